@@ -180,6 +180,11 @@ typedef enum {
 	
 	/** int[OHMD_CONTROL_COUNT] (get, ohmd_geti()): Get whether controls are digital or analog. */
 	OHMD_CONTROLS_TYPES                   =  6,
+
+	/** int[2] (get, ohmd_geti()): Get the number of IMU samples waiting to be fused and the number of samples
+	    dropped because the queue was full, for devices with a pipelined update (see OHMD_ICS_PIPELINED_UPDATE).
+	    Both are 0 for other devices. */
+	OHMD_SAMPLE_QUEUE_STATS               =  7,
 } ohmd_int_value;
 
 /** A collection of data information types used for setting information with ohmd_set_data(). */
@@ -199,8 +204,103 @@ typedef enum {
 	/** int[1] (set, default: 1): Set this to 0 to prevent OpenHMD from creating background threads to do automatic device ticking.
 	    Call ohmd_update(); must be called frequently, at least 10 times per second, if the background threads are disabled. */
 	OHMD_IDS_AUTOMATIC_UPDATE = 0,
+	/** int[1] (set, default: OHMD_FUSION_ENGINE_DEFAULT): The sensor fusion the device's orientation is
+	    computed with, see ohmd_fusion_engine. Ignored by devices that don't do their own sensor fusion. */
+	OHMD_IDS_FUSION_ENGINE = 1,
+	/** int[1] (set, default: 0): Set this to 1 to correct the yaw drift with the magnetometer, on devices that have
+	    one. It's calibrated while in use, which takes turning the device every which way for a while, until then
+	    the yaw drifts as it would without. */
+	OHMD_IDS_MAGNETOMETER = 2,
 } ohmd_int_settings;
 
+/** Sensor fusion engines, used with OHMD_IDS_FUSION_ENGINE. */
+typedef enum {
+	/** Gyro integration with a slow gravity tilt correction. */
+	OHMD_FUSION_ENGINE_DEFAULT = 0,
+	/** Error-state Kalman filter that also estimates the gyro and accelerometer biases while in use. */
+	OHMD_FUSION_ENGINE_ESKF = 1,
+	/** Mahony filter, the cheapest, for low-power trackers. Estimates the gyro bias but corrects the tilt less smoothly. */
+	OHMD_FUSION_ENGINE_MAHONY = 2,
+} ohmd_fusion_engine;
+
+/** A collection of int value settings for a context, used with ohmd_ctx_seti() and ohmd_ctx_geti(). */
+typedef enum {
+	/** int[1] (get, set, default: 1): Set this to 0 to make the automatic update thread poll all devices at a fixed
+	    1000 Hz rate. When set, the update thread blocks until a device has new data and only updates that device.
+	    This needs a descriptor to wait on, which only the built-in hidraw backend on Linux provides (OPENHMD_HIDRAW
+	    in CMake, --enable-hidraw or -Dhidraw=true). hidapi hides its descriptor, so with the default build every
+	    device is still polled at 1000 Hz. */
+	OHMD_ICS_EVENT_DRIVEN_UPDATE = 0,
+	/** int[1] (get, set, default: 1): Number of background threads that update devices. Each device opened with
+	    automatic updates is assigned to one of them, so that devices on different threads don't wait for each
+	    other. Limited to 1 to 8, changing it restarts the threads and reassigns all devices. */
+	OHMD_ICS_UPDATE_WORKERS = 1,
+	/** int[1] (get, set, default: OHMD_SCHED_NORMAL): Scheduling policy of the update threads and the reader
+	    thread (see OHMD_ICS_PIPELINED_UPDATE), see ohmd_sched_policy. The threads opening and reconnecting
+	    devices aren't affected by any of the thread settings. Real-time policies need privileges (e.g.
+	    CAP_SYS_NICE), threads fall back to normal scheduling when they can't be obtained. Changing any of the
+	    thread settings restarts the threads. */
+	OHMD_ICS_THREAD_SCHED_POLICY = 2,
+	/** int[1] (get, set, default: 0): Real-time priority of the update and reader threads, clamped to the range
+	    of the policy (1 to 99 on Linux). */
+	OHMD_ICS_THREAD_SCHED_PRIORITY = 3,
+	/** int[1] (get, set, default: 0): Mask of the CPUs the update and reader threads may run on, bit n being CPU n.
+	    0 doesn't pin the threads. */
+	OHMD_ICS_THREAD_CPU_AFFINITY = 4,
+	/** int[1] (get, set, default: 0): Set to 1 to lock the memory of the process into RAM (mlockall) when an
+	    update or reader thread is started, so that the threads don't stall on page faults. */
+	OHMD_ICS_THREAD_LOCK_MEMORY = 5,
+	/** int[4] (get): The thread settings in effect for the last update or reader thread started, in the order
+	    policy, priority, CPU affinity and memory lock. Differs from the requested settings when privileges
+	    were missing. */
+	OHMD_ICS_THREAD_SETTINGS_IN_EFFECT = 6,
+	/** int[1] (get, set, default: 0): Set to 1 to split the automatic update of drivers that support it in two
+	    stages. A reader thread drains the device and queues the raw IMU samples, the update threads fuse them.
+	    This way a stalled update thread doesn't make the device drop reports. Restarts the background threads. */
+	OHMD_ICS_PIPELINED_UPDATE = 7,
+	/** int[1] (get, set, default: 0): Mask of the device classes ohmd_ctx_probe() lists, bit n being the
+	    ohmd_device_class n. 0 lists all of them. */
+	OHMD_ICS_PROBE_DEVICE_CLASSES = 8,
+	/** int[OHMD_MAX_PROBE_VENDORS] (get, set, default: all 0): USB vendor IDs of the HID devices ohmd_ctx_probe()
+	    looks at, unused entries set to 0. When all are 0 every vendor is probed. Drivers whose devices
+	    aren't HID devices (e.g. the null devices) are not affected. */
+	OHMD_ICS_PROBE_VENDOR_IDS = 9,
+	/** int[1] (get, set, default: OHMD_DEVICE_CACHE_ON): How drivers use the device cache, an ohmd_device_cache_mode.
+	    Drivers that support it keep the calibration and properties they read from a device in a file per device,
+	    keyed by serial number and firmware revision, so that opening it again skips reading them.
+	    The files are kept in the directory set by the OHMD_CACHE_DIR environment variable, or in the user's cache
+	    directory. */
+	OHMD_ICS_DEVICE_CACHE = 10,
+	/** int[1] (get, set, default: 0): Set to 1 to watch for devices being plugged in and out. The device list
+	    is then kept up to date by ohmd_ctx_poll_hotplug() and ohmd_ctx_wait_hotplug(), which report the
+	    changes, so that there is no need to call ohmd_ctx_probe() again. Uses udev's netlink events on Linux.
+	    Setting it returns OHMD_S_UNSUPPORTED where devices can't be watched. */
+	OHMD_ICS_HOTPLUG_MONITOR = 11,
+} ohmd_int_context_settings;
+
+/** Number of vendor IDs in OHMD_ICS_PROBE_VENDOR_IDS. */
+#define OHMD_MAX_PROBE_VENDORS 8
+
+/** Scheduling policies for OHMD_ICS_THREAD_SCHED_POLICY. */
+typedef enum {
+	/** The default time sharing scheduler. */
+	OHMD_SCHED_NORMAL = 0,
+	/** Real-time, first in first out (SCHED_FIFO). */
+	OHMD_SCHED_FIFO = 1,
+	/** Real-time, round robin (SCHED_RR). */
+	OHMD_SCHED_RR = 2,
+} ohmd_sched_policy;
+
+/** Device cache modes for OHMD_ICS_DEVICE_CACHE. */
+typedef enum {
+	/** Always read from the device, don't read or write the cache. */
+	OHMD_DEVICE_CACHE_OFF = 0,
+	/** Use the cached data when it's valid, read from the device and cache it otherwise. */
+	OHMD_DEVICE_CACHE_ON = 1,
+	/** Always read from the device and rewrite the cache, e.g. after recalibrating a device. */
+	OHMD_DEVICE_CACHE_REFRESH = 2,
+} ohmd_device_cache_mode;
+
 /** Device classes. */
 typedef enum 
 {
@@ -232,6 +332,49 @@ typedef struct ohmd_device ohmd_device;
 /** An opaque pointer to a structure representing arguments for a device. */
 typedef struct ohmd_device_settings ohmd_device_settings;
 
+/** An opaque pointer to a device being opened in the background, see ohmd_list_open_device_async(). */
+typedef struct ohmd_open_request ohmd_open_request;
+
+/** Called on the background thread when an ohmd_open_request finishes, device is NULL if the device couldn't be opened. */
+typedef void (OHMD_APIENTRY *ohmd_open_callback)(ohmd_device* device, void* user_data);
+
+/** Hotplug event types, see ohmd_hotplug_event. */
+typedef enum {
+	/** A device was added to the end of the device list. */
+	OHMD_HOTPLUG_ADDED = 0,
+	/** A device was removed from the device list, the ones after it moved down by one. */
+	OHMD_HOTPLUG_REMOVED = 1,
+} ohmd_hotplug_event_type;
+
+/** A change of the device list as returned by ohmd_ctx_poll_hotplug. */
+typedef struct {
+	ohmd_hotplug_event_type type;
+	/** The index of the device in the device list, before it was removed for OHMD_HOTPLUG_REMOVED. */
+	int index;
+	/** See OHMD_DEVICE_CLASS. */
+	ohmd_device_class device_class;
+	/** See OHMD_VENDOR, OHMD_PRODUCT and OHMD_PATH. */
+	char vendor[OHMD_STR_SIZE];
+	char product[OHMD_STR_SIZE];
+	char path[OHMD_STR_SIZE];
+} ohmd_hotplug_event;
+
+/** The pose of a device as returned by ohmd_ctx_get_poses. */
+typedef struct {
+	/** The device this pose belongs to. */
+	ohmd_device* device;
+	/** Rotation quaternion (x, y, z, w), see OHMD_ROTATION_QUAT. */
+	float rotation[4];
+	/** Position vector, see OHMD_POSITION_VECTOR. */
+	float position[3];
+	/** See OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX. */
+	float left_eye_modelview[16];
+	/** See OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX. */
+	float right_eye_modelview[16];
+	/** Time of the last sensor sample in the pose, see ohmd_ctx_get_time(). */
+	double time;
+} ohmd_device_pose;
+
 /**
  * Create an OpenHMD context.
  *
@@ -275,6 +418,26 @@ OHMD_APIENTRYDLL const char* OHMD_APIENTRY ohmd_ctx_get_error(ohmd_context* ctx)
  **/
 OHMD_APIENTRYDLL void OHMD_APIENTRY ohmd_ctx_update(ohmd_context* ctx);
 
+/**
+ * Set an integer setting for a context.
+ *
+ * @param ctx The context to change the setting for.
+ * @param key The specific setting you wish to set, see ohmd_int_context_settings.
+ * @param val A pointer to an int or int array (containing the expected number of elements) with the value(s) you wish to set.
+ * @return 0 on success, <0 on failure.
+ **/
+OHMD_APIENTRYDLL ohmd_status OHMD_APIENTRY ohmd_ctx_seti(ohmd_context* ctx, ohmd_int_context_settings key, const int* val);
+
+/**
+ * Get an integer setting from a context.
+ *
+ * @param ctx The context to retrieve the setting from.
+ * @param key The specific setting you wish to get, see ohmd_int_context_settings.
+ * @param[out] out A pointer to an int or int array where the retrieved value(s) should be written.
+ * @return 0 on success, <0 on failure.
+ **/
+OHMD_APIENTRYDLL ohmd_status OHMD_APIENTRY ohmd_ctx_geti(ohmd_context* ctx, ohmd_int_context_settings key, int* out);
+
 /**
  * Probe for devices.
  *
@@ -285,6 +448,33 @@ OHMD_APIENTRYDLL void OHMD_APIENTRY ohmd_ctx_update(ohmd_context* ctx);
  **/
 OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_ctx_probe(ohmd_context* ctx);
 
+/**
+ * Get the next change of the device list.
+ *
+ * With OHMD_ICS_HOTPLUG_MONITOR set, brings the device list up to date with the devices
+ * plugged in and out since the last call and returns the changes one at a time, in the
+ * order they were made to the list. Devices that stay keep their entry, only the indices
+ * after a removed device change. Never blocks. Call it from the thread using the device
+ * list; ohmd_ctx_probe drops the changes not returned yet.
+ *
+ * @param ctx A context with OHMD_ICS_HOTPLUG_MONITOR set.
+ * @param event The change, filled in when 1 is returned.
+ * @return 1 if a change was returned, 0 if there is none or the monitor is off.
+ **/
+OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_ctx_poll_hotplug(ohmd_context* ctx, ohmd_hotplug_event* event);
+
+/**
+ * Wait for the next change of the device list.
+ *
+ * Like ohmd_ctx_poll_hotplug, but waits up to timeout seconds for a change.
+ *
+ * @param ctx A context with OHMD_ICS_HOTPLUG_MONITOR set.
+ * @param timeout How long to wait in seconds, a negative timeout waits until there is a change.
+ * @param event The change, filled in when 1 is returned.
+ * @return 1 if a change was returned, 0 on timeout or if the monitor is off.
+ **/
+OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_ctx_wait_hotplug(ohmd_context* ctx, double timeout, ohmd_hotplug_event* event);
+
 /**
  * Get string from openhmd.
  *
@@ -361,6 +551,50 @@ OHMD_APIENTRYDLL ohmd_device* OHMD_APIENTRY ohmd_list_open_device(ohmd_context*
  **/
 OHMD_APIENTRYDLL ohmd_device* OHMD_APIENTRY ohmd_list_open_device_s(ohmd_context* ctx, int index, ohmd_device_settings* settings);
 
+/**
+ * Open a device in the background.
+ *
+ * Like ohmd_list_open_device_s, but returns right away while the driver talks to the
+ * device on a thread of its own, so that several devices can be opened at the same
+ * time. The device is added to the context once it's open, as if it was opened with
+ * ohmd_list_open_device_s.
+ *
+ * ohmd_ctx_probe waits for the devices still being opened, don't call it from the callback.
+ *
+ * @param ctx A (probed) context.
+ * @param index An index, between 0 and the value returned from ohmd_ctx_probe.
+ * @param settings A pointer to a device settings struct, NULL for the defaults of ohmd_list_open_device.
+ * @param callback Called when the device is open or has failed to open, can be NULL.
+ * @param user_data Passed to the callback.
+ * @return a request to query and wait on, NULL if the index is invalid or the thread couldn't be started.
+ **/
+OHMD_APIENTRYDLL ohmd_open_request* OHMD_APIENTRY ohmd_list_open_device_async(ohmd_context* ctx, int index,
+	ohmd_device_settings* settings, ohmd_open_callback callback, void* user_data);
+
+/**
+ * Check if an open request has finished.
+ *
+ * @param request An open request.
+ * @return 1 if the device is open or failed to open, 0 if it's still being opened.
+ **/
+OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_open_request_is_done(ohmd_open_request* request);
+
+/**
+ * Wait for an open request to finish.
+ *
+ * @param request An open request.
+ * @return the opened device, or NULL if it couldn't be opened (see ohmd_ctx_get_error).
+ **/
+OHMD_APIENTRYDLL ohmd_device* OHMD_APIENTRY ohmd_open_request_wait(ohmd_open_request* request);
+
+/**
+ * Destroy an open request, waiting for it to finish. An opened device stays open.
+ * Requests not destroyed yet are destroyed with their context.
+ *
+ * @param request The open request to destroy.
+ **/
+OHMD_APIENTRYDLL void OHMD_APIENTRY ohmd_open_request_destroy(ohmd_open_request* request);
+
 /**
  * Specify int settings in a device settings struct.
  *
@@ -447,6 +681,61 @@ OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_device_seti(ohmd_device* device, ohmd_in
  **/
 OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_device_set_data(ohmd_device* device, ohmd_data_value type, const void* in);
 
+/**
+ * Get the poses of all open devices in one call.
+ *
+ * All poses are taken from the same update, so the poses of e.g. a HMD and
+ * its controllers are consistent with each other. With more than one update
+ * thread (see OHMD_ICS_UPDATE_WORKERS) this holds for the devices of each
+ * thread, the time of each pose tells how they relate. The poses come in
+ * no particular order, closing a device can change it.
+ *
+ * @param ctx A (valid) OpenHMD context.
+ * @param[out] poses An array of poses to write to, one per open device.
+ * @param max_poses The number of elements in poses.
+ * @return The number of poses written.
+ **/
+OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_ctx_get_poses(ohmd_context* ctx, ohmd_device_pose* poses, int max_poses);
+
+/**
+ * Get the current time of the clock used for pose timestamps.
+ *
+ * @param ctx A (valid) OpenHMD context.
+ * @return The current time in seconds, on a monotonic clock with an arbitrary epoch.
+ **/
+OHMD_APIENTRYDLL double OHMD_APIENTRY ohmd_ctx_get_time(ohmd_context* ctx);
+
+/**
+ * Get the rotation of a device extrapolated to a future point in time.
+ *
+ * The rotation is extrapolated from the last pose using the angular velocity
+ * reported by the device, devices without a gyro return the last rotation.
+ * Horizons beyond 100 ms are clamped.
+ *
+ * @param device An open device to retrieve the rotation from.
+ * @param horizon How far ahead to predict, in seconds.
+ * @param[out] out A quaternion (float[4]) where the rotation should be written.
+ * @return 0 on success, <0 on failure.
+ **/
+OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_device_get_predicted_rotation(ohmd_device* device, float horizon, float* out);
+
+/**
+ * Get the rotation of a device at an absolute point in time.
+ *
+ * Like ohmd_device_get_predicted_rotation(), but the time is given on the
+ * clock of ohmd_ctx_get_time(), e.g. the time the next frame is displayed.
+ *
+ * Times in the past are interpolated from a history of the last 512 sensor
+ * samples (about half a second at 1000 Hz), older times are clamped to the
+ * oldest sample. Devices without sensor fusion return the last rotation.
+ *
+ * @param device An open device to retrieve the rotation from.
+ * @param time The time to get the rotation for, see ohmd_ctx_get_time().
+ * @param[out] out A quaternion (float[4]) where the rotation should be written.
+ * @return 0 on success, <0 on failure.
+ **/
+OHMD_APIENTRYDLL int OHMD_APIENTRY ohmd_device_get_rotation_at(ohmd_device* device, double time, float* out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,189 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Device Cache */
+
+#include <ctype.h>
+#include <string.h>
+#include "openhmdi.h"
+
+#define CACHE_MAGIC 0x43444d4f // "OMDC"
+#define CACHE_VERSION 1
+#define CACHE_MAX_PAYLOAD (1 << 20)
+#define CACHE_PATH_SIZE 1024
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version; // of this header
+	uint32_t format; // of the payload
+	uint32_t revision;
+	uint32_t size;
+	uint32_t crc; // of the payload
+	char driver[32];
+	char serial[64];
+} cache_header;
+
+uint32_t ohmd_crc32(const void* data, size_t size)
+{
+	const unsigned char* bytes = data;
+	uint32_t crc = 0xffffffff;
+
+	for(size_t i = 0; i < size; i++){
+		crc ^= bytes[i];
+		for(int b = 0; b < 8; b++)
+			crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+bool ohmd_cache_key_init(ohmd_cache_key* key, const char* driver, uint32_t format,
+	ohmd_hid_device* dev, const ohmd_hid_device_info* info)
+{
+	wchar_t serial[64] = { 0 };
+	memset(key, 0, sizeof(*key));
+
+	key->driver = driver;
+	key->format = format;
+	key->revision = info ? info->release_number : 0;
+
+	if(ohmd_hid_get_serial_number_string(dev, serial, 64) != 0 || serial[0] == L'\0'){
+		if(!info || !info->serial_number)
+			return false;
+
+		wcsncpy(serial, info->serial_number, 63);
+	}
+
+	// serial numbers are ASCII in practice, anything else can't be told apart anyway
+	for(int i = 0; i < 63 && serial[i]; i++)
+		key->serial[i] = (serial[i] > 0x20 && serial[i] < 0x7f) ? (char)serial[i] : '_';
+
+	return key->serial[0] != '\0';
+}
+
+static void append_name(char* out, size_t size, const char* name)
+{
+	size_t len = strlen(out);
+
+	for(; *name && len + 1 < size; name++)
+		out[len++] = (isalnum((unsigned char)*name) || *name == '-' || *name == '_') ? *name : '_';
+
+	out[len] = '\0';
+}
+
+static bool get_path(const ohmd_cache_key* key, char* path, size_t size)
+{
+	char revision[16];
+
+	if(!ohmd_get_cache_dir(path, size))
+		return false;
+
+#ifdef _WIN32
+	strncat(path, "\\", size - strlen(path) - 1);
+#else
+	strncat(path, "/", size - strlen(path) - 1);
+#endif
+
+	snprintf(revision, sizeof(revision), "-%04x.cache", key->revision);
+
+	append_name(path, size, key->driver);
+	strncat(path, "-", size - strlen(path) - 1);
+	append_name(path, size, key->serial);
+	strncat(path, revision, size - strlen(path) - 1);
+
+	// a cut off name could be another device's
+	return strlen(path) + 1 < size;
+}
+
+void* ohmd_cache_load(ohmd_context* ctx, const ohmd_cache_key* key, size_t* size)
+{
+	char path[CACHE_PATH_SIZE];
+
+	if(ctx->device_cache != OHMD_DEVICE_CACHE_ON || !get_path(key, path, sizeof(path)))
+		return NULL;
+
+	FILE* file = fopen(path, "rb");
+	if(!file)
+		return NULL;
+
+	cache_header header;
+	void* payload = NULL;
+
+	if(fread(&header, sizeof(header), 1, file) != 1 ||
+	   header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.size > CACHE_MAX_PAYLOAD){
+		LOGW("ignoring invalid cache file %s", path);
+		goto done;
+	}
+
+	// a different format or revision is outdated, not broken
+	if(header.format != key->format || header.revision != key->revision ||
+	   strncmp(header.driver, key->driver, sizeof(header.driver)) != 0 ||
+	   strncmp(header.serial, key->serial, sizeof(header.serial)) != 0){
+		LOGI("cache file %s is outdated", path);
+		goto done;
+	}
+
+	payload = malloc(header.size ? header.size : 1);
+	if(!payload)
+		goto done;
+
+	if(fread(payload, 1, header.size, file) != header.size || ohmd_crc32(payload, header.size) != header.crc){
+		LOGW("ignoring corrupt cache file %s", path);
+		free(payload);
+		payload = NULL;
+		goto done;
+	}
+
+	LOGD("using cache file %s", path);
+	*size = header.size;
+
+done:
+	fclose(file);
+	return payload;
+}
+
+bool ohmd_cache_store(ohmd_context* ctx, const ohmd_cache_key* key, const void* payload, size_t size)
+{
+	char path[CACHE_PATH_SIZE];
+	char tmp_path[CACHE_PATH_SIZE + 4];
+
+	if(ctx->device_cache == OHMD_DEVICE_CACHE_OFF || size > CACHE_MAX_PAYLOAD || !get_path(key, path, sizeof(path)))
+		return false;
+
+	cache_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.format = key->format;
+	header.revision = key->revision;
+	header.size = (uint32_t)size;
+	header.crc = ohmd_crc32(payload, size);
+	snprintf(header.driver, sizeof(header.driver), "%s", key->driver);
+	snprintf(header.serial, sizeof(header.serial), "%s", key->serial);
+
+	// write it next to the old one and swap them, so that a crash or a
+	// concurrent load never sees a torn file
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE* file = fopen(tmp_path, "wb");
+	if(!file){
+		LOGW("could not create cache file %s", tmp_path);
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	          fwrite(payload, 1, size, file) == size;
+	ok = fclose(file) == 0 && ok;
+
+	if(!ok || !ohmd_rename_file(tmp_path, path)){
+		LOGW("could not write cache file %s", path);
+		remove(tmp_path);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,56 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Device Cache */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "openhmd.h"
+#include "hid.h"
+
+// Drivers keep what they read from a device once and for all, calibration,
+// display info, LED positions and the like, in a file per device, so that
+// opening it again doesn't wait on dozens of feature reports. An entry is
+// keyed by driver, serial number and firmware revision, and holds a payload
+// in the driver's own layout (host byte order, it doesn't leave the machine)
+// behind a header with the key, the size and a CRC32 of the payload. A file
+// that doesn't check out is ignored and rewritten on the next open.
+//
+// The files live in the directory of ohmd_get_cache_dir, named
+// <driver>-<serial>-<revision>.cache. OHMD_ICS_DEVICE_CACHE turns the cache
+// off, or makes the drivers read from the device and rewrite their entries.
+
+typedef struct {
+	const char* driver; // short name, e.g. "rift"
+	char serial[64];
+	uint32_t revision; // firmware revision, e.g. the USB release number
+	uint32_t format; // version of the payload layout, bump it when it changes
+} ohmd_cache_key;
+
+// Fills in the key for dev, the serial number read from the device and the
+// revision from its enumeration entry (none if info is NULL). Returns false
+// if the device has no serial number, it can't be cached then.
+bool ohmd_cache_key_init(ohmd_cache_key* key, const char* driver, uint32_t format,
+	ohmd_hid_device* dev, const ohmd_hid_device_info* info);
+
+// Returns a copy of the payload cached for key, to be freed by the caller,
+// and its size in size. NULL if there is no valid entry, or the context
+// doesn't read the cache.
+void* ohmd_cache_load(ohmd_context* ctx, const ohmd_cache_key* key, size_t* size);
+
+// Writes the entry for key, unless the cache is off. The file is replaced as
+// a whole, a reader never sees half of it.
+bool ohmd_cache_store(ohmd_context* ctx, const ohmd_cache_key* key, const void* payload, size_t size);
+
+uint32_t ohmd_crc32(const void* data, size_t size);
+
+#endif
@@ -0,0 +1,672 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* HID Capture Files - Implementation */
+
+#if defined(__unix__) || defined(__unix) || defined(__APPLE__) || defined(__MACH__)
+#define _POSIX_C_SOURCE 200809L
+#define CAPTURE_MMAP
+#endif
+
+#include <string.h>
+#include "openhmdi.h"
+#include "capture.h"
+
+#ifdef CAPTURE_MMAP
+#include <sys/mman.h>
+#endif
+
+#define PADDED(_size) (((uint64_t)(_size) + 7) & ~(uint64_t)7)
+
+struct ohmd_capture_writer {
+	FILE* file;
+	uint64_t offset;
+	uint64_t last_time;
+
+	ohmd_capture_index info;
+	ohmd_capture_index_entry* entries;
+	uint32_t max_entries;
+};
+
+struct ohmd_capture_reader {
+	const unsigned char* data;
+	uint64_t size;
+	uint64_t end;
+	bool mapped;
+
+	ohmd_capture_index info;
+	ohmd_capture_index_entry* entries;
+};
+
+static bool add_index_entry(ohmd_capture_index* info, ohmd_capture_index_entry** entries, uint32_t* max_entries,
+	uint64_t time, uint64_t offset)
+{
+	if(info->num_entries == *max_entries){
+		uint32_t max = *max_entries ? *max_entries * 2 : 64;
+		ohmd_capture_index_entry* grown = realloc(*entries, max * sizeof(ohmd_capture_index_entry));
+		if(!grown)
+			return false;
+
+		*entries = grown;
+		*max_entries = max;
+	}
+
+	(*entries)[info->num_entries].time = time;
+	(*entries)[info->num_entries].offset = offset;
+	info->num_entries++;
+
+	return true;
+}
+
+static const ohmd_capture_record* record_at(ohmd_capture_reader* reader, uint64_t offset, uint64_t limit)
+{
+	if(offset + sizeof(ohmd_capture_record) > limit)
+		return NULL;
+
+	const ohmd_capture_record* record = (const ohmd_capture_record*)(reader->data + offset);
+	if(offset + sizeof(ohmd_capture_record) + PADDED(record->size) > limit)
+		return NULL;
+
+	return record;
+}
+
+static bool load_index(ohmd_capture_reader* reader)
+{
+	// a closed file ends with a trailer record pointing at its index
+	if(reader->size < sizeof(ohmd_capture_file_header) + sizeof(ohmd_capture_record) + sizeof(uint64_t))
+		return false;
+
+	uint64_t trailer_offset = reader->size - sizeof(ohmd_capture_record) - sizeof(uint64_t);
+
+	const ohmd_capture_record* trailer = record_at(reader, trailer_offset, reader->size);
+	if(!trailer || trailer->type != OHMD_CAPTURE_TRAILER || trailer->size != sizeof(uint64_t))
+		return false;
+
+	uint64_t index_offset;
+	memcpy(&index_offset, trailer + 1, sizeof(uint64_t));
+
+	const ohmd_capture_record* index = record_at(reader, index_offset, trailer_offset);
+	if(!index || index->type != OHMD_CAPTURE_INDEX || index->size < sizeof(ohmd_capture_index))
+		return false;
+
+	memcpy(&reader->info, index + 1, sizeof(ohmd_capture_index));
+	if(index->size != sizeof(ohmd_capture_index) + reader->info.num_entries * sizeof(ohmd_capture_index_entry))
+		return false;
+
+	reader->entries = malloc(reader->info.num_entries * sizeof(ohmd_capture_index_entry) + 1);
+	if(!reader->entries)
+		return false;
+
+	memcpy(reader->entries, (const unsigned char*)(index + 1) + sizeof(ohmd_capture_index),
+		reader->info.num_entries * sizeof(ohmd_capture_index_entry));
+	reader->end = reader->size;
+
+	return true;
+}
+
+static bool build_index(ohmd_capture_reader* reader)
+{
+	uint32_t max_entries = 0;
+	uint64_t offset = sizeof(ohmd_capture_file_header);
+	const ohmd_capture_record* record;
+
+	memset(&reader->info, 0, sizeof(ohmd_capture_index));
+
+	while((record = record_at(reader, offset, reader->size))){
+		if(record->type != OHMD_CAPTURE_INDEX && record->type != OHMD_CAPTURE_TRAILER){
+			if(reader->info.num_records % OHMD_CAPTURE_INDEX_INTERVAL == 0
+			  && !add_index_entry(&reader->info, &reader->entries, &max_entries, record->time, offset))
+				return false;
+
+			reader->info.num_records++;
+			reader->info.num_devices = OHMD_MAX(reader->info.num_devices, (uint32_t)record->device + 1);
+		}
+
+		offset += sizeof(ohmd_capture_record) + PADDED(record->size);
+	}
+
+	reader->end = offset;
+
+	return true;
+}
+
+ohmd_capture_reader* ohmd_capture_reader_open(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if(!file)
+		return NULL;
+
+	ohmd_capture_reader* reader = calloc(1, sizeof(ohmd_capture_reader));
+	if(!reader)
+		goto cleanup;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	if(size < (long)sizeof(ohmd_capture_file_header)){
+		LOGE("%s is not a capture file", path);
+		goto cleanup;
+	}
+
+	reader->size = (uint64_t)size;
+
+#ifdef CAPTURE_MMAP
+	void* data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if(data != MAP_FAILED){
+		reader->data = data;
+		reader->mapped = true;
+	}
+#endif
+
+	if(!reader->data){
+		unsigned char* data = malloc(reader->size);
+		if(!data || fread(data, 1, reader->size, file) != reader->size){
+			LOGE("could not read %s", path);
+			free(data);
+			goto cleanup;
+		}
+
+		reader->data = data;
+	}
+
+	fclose(file);
+	file = NULL;
+
+	const ohmd_capture_file_header* header = (const ohmd_capture_file_header*)reader->data;
+	if(memcmp(header->magic, OHMD_CAPTURE_MAGIC, sizeof(header->magic)) != 0 || header->version != OHMD_CAPTURE_VERSION){
+		LOGE("%s is not a version %d capture file", path, OHMD_CAPTURE_VERSION);
+		goto cleanup;
+	}
+
+	if(!load_index(reader)){
+		LOGW("%s has no index, it wasn't closed properly", path);
+
+		free(reader->entries);
+		reader->entries = NULL;
+
+		if(!build_index(reader))
+			goto cleanup;
+	}
+
+	return reader;
+
+cleanup:
+	if(file)
+		fclose(file);
+
+	if(reader && reader->data)
+		ohmd_capture_reader_close(reader);
+	else
+		free(reader);
+
+	return NULL;
+}
+
+void ohmd_capture_reader_close(ohmd_capture_reader* reader)
+{
+#ifdef CAPTURE_MMAP
+	if(reader->mapped)
+		munmap((void*)reader->data, reader->size);
+#endif
+
+	if(!reader->mapped)
+		free((void*)reader->data);
+
+	free(reader->entries);
+	free(reader);
+}
+
+uint64_t ohmd_capture_reader_begin(ohmd_capture_reader* reader)
+{
+	return sizeof(ohmd_capture_file_header);
+}
+
+uint64_t ohmd_capture_reader_end(ohmd_capture_reader* reader)
+{
+	return reader->end;
+}
+
+const ohmd_capture_record* ohmd_capture_reader_next(ohmd_capture_reader* reader, uint64_t* offset, const unsigned char** payload)
+{
+	const ohmd_capture_record* record = record_at(reader, *offset, reader->end);
+	if(!record)
+		return NULL;
+
+	*payload = (const unsigned char*)(record + 1);
+	*offset += sizeof(ohmd_capture_record) + PADDED(record->size);
+
+	return record;
+}
+
+uint64_t ohmd_capture_reader_seek(ohmd_capture_reader* reader, uint64_t time)
+{
+	uint64_t offset = sizeof(ohmd_capture_file_header);
+
+	// appended sessions may start earlier than the ones before them, seeking
+	// stays within the first run of increasing timestamps
+	for(uint32_t i = 0; i < reader->info.num_entries; i++){
+		if(reader->entries[i].time > time || (i > 0 && reader->entries[i].time < reader->entries[i - 1].time))
+			break;
+
+		offset = reader->entries[i].offset;
+	}
+
+	return offset;
+}
+
+const ohmd_capture_index_entry* ohmd_capture_reader_get_index(ohmd_capture_reader* reader, ohmd_capture_index* index)
+{
+	*index = reader->info;
+	return reader->entries;
+}
+
+static bool write_record(ohmd_capture_writer* writer, uint64_t time, uint16_t device,
+	ohmd_capture_record_type type, uint8_t flags, const void* payload, uint32_t size)
+{
+	static const unsigned char padding[8] = { 0 };
+	ohmd_capture_record record = { time, size, device, (uint8_t)type, flags };
+	uint64_t padded = PADDED(size);
+
+	if(fwrite(&record, sizeof(record), 1, writer->file) != 1
+	  || (size > 0 && fwrite(payload, size, 1, writer->file) != 1)
+	  || (padded > size && fwrite(padding, padded - size, 1, writer->file) != 1))
+		return false;
+
+	writer->offset += sizeof(record) + padded;
+
+	return true;
+}
+
+ohmd_capture_writer* ohmd_capture_writer_open(const char* path)
+{
+	ohmd_capture_writer* writer = calloc(1, sizeof(ohmd_capture_writer));
+	if(!writer)
+		return NULL;
+
+	// carry the index of the sessions already in the file over
+	FILE* existing = fopen(path, "rb");
+	if(existing){
+		fclose(existing);
+
+		ohmd_capture_reader* reader = ohmd_capture_reader_open(path);
+		if(!reader)
+			goto cleanup;
+
+		if(reader->end != reader->size){
+			LOGE("%s ends with an incomplete record, not appending to it", path);
+			ohmd_capture_reader_close(reader);
+			goto cleanup;
+		}
+
+		writer->info = reader->info;
+		writer->offset = reader->size;
+		writer->max_entries = reader->info.num_entries;
+		writer->entries = reader->entries;
+		reader->entries = NULL;
+
+		ohmd_capture_reader_close(reader);
+	}
+
+	writer->file = fopen(path, "ab");
+	if(!writer->file){
+		LOGE("could not open %s for writing", path);
+		goto cleanup;
+	}
+
+	if(writer->offset == 0){
+		ohmd_capture_file_header header = { OHMD_CAPTURE_MAGIC, OHMD_CAPTURE_VERSION, 0 };
+		if(fwrite(&header, sizeof(header), 1, writer->file) != 1)
+			goto cleanup;
+
+		writer->offset = sizeof(header);
+	}
+
+	return writer;
+
+cleanup:
+	if(writer->file)
+		fclose(writer->file);
+
+	free(writer->entries);
+	free(writer);
+
+	return NULL;
+}
+
+void ohmd_capture_writer_close(ohmd_capture_writer* writer)
+{
+	uint32_t index_size = sizeof(ohmd_capture_index) + writer->info.num_entries * sizeof(ohmd_capture_index_entry);
+	unsigned char* index = malloc(index_size);
+
+	if(index){
+		uint64_t index_offset = writer->offset;
+
+		memcpy(index, &writer->info, sizeof(ohmd_capture_index));
+		if(writer->info.num_entries > 0)
+			memcpy(index + sizeof(ohmd_capture_index), writer->entries, writer->info.num_entries * sizeof(ohmd_capture_index_entry));
+
+		if(!write_record(writer, writer->last_time, 0, OHMD_CAPTURE_INDEX, 0, index, index_size)
+		  || !write_record(writer, writer->last_time, 0, OHMD_CAPTURE_TRAILER, 0, &index_offset, sizeof(index_offset)))
+			LOGE("could not write the capture index");
+
+		free(index);
+	}
+
+	fclose(writer->file);
+	free(writer->entries);
+	free(writer);
+}
+
+uint16_t ohmd_capture_writer_new_device(ohmd_capture_writer* writer)
+{
+	return (uint16_t)writer->info.num_devices++;
+}
+
+bool ohmd_capture_writer_add(ohmd_capture_writer* writer, uint64_t time, uint16_t device,
+	ohmd_capture_record_type type, uint8_t flags, const void* payload, uint32_t size)
+{
+	if(writer->info.num_records % OHMD_CAPTURE_INDEX_INTERVAL == 0){
+		if(!add_index_entry(&writer->info, &writer->entries, &writer->max_entries, time, writer->offset))
+			return false;
+
+		// don't lose more than an interval if the process goes down
+		fflush(writer->file);
+	}
+
+	if(!write_record(writer, time, device, type, flags, payload, size))
+		return false;
+
+	writer->info.num_records++;
+	writer->last_time = time;
+
+	return true;
+}
+
+/* Capturing */
+
+struct ohmd_hid_capture {
+	ohmd_hid_transport base;
+	ohmd_hid_transport* inner;
+	ohmd_context* ctx;
+
+	ohmd_mutex* lock;
+	ohmd_capture_writer* writer;
+
+	// what the last enumeration said about each path, for the device records
+	ohmd_capture_device* known;
+	int num_known, max_known;
+};
+
+typedef struct {
+	ohmd_hid_device base;
+	ohmd_hid_device* inner;
+	ohmd_hid_capture* capture;
+	uint16_t device;
+	bool got_report;
+} capture_handle;
+
+static void narrow(const wchar_t* in, char* out, size_t size)
+{
+	size_t i = 0;
+
+	for(; in && in[i] && i < size - 1; i++)
+		out[i] = in[i] < 128 ? (char)in[i] : '?';
+
+	out[i] = '\0';
+}
+
+static void add_record(ohmd_hid_capture* capture, uint16_t device, ohmd_capture_record_type type, uint8_t flags,
+	const void* payload, uint32_t size)
+{
+	uint64_t time = ohmd_monotonic_conv(ohmd_monotonic_get(capture->ctx), ohmd_monotonic_per_sec(capture->ctx), 1000000000);
+
+	ohmd_lock_mutex(capture->lock);
+	if(!ohmd_capture_writer_add(capture->writer, time, device, type, flags, payload, size))
+		LOGE("could not write capture record");
+	ohmd_unlock_mutex(capture->lock);
+}
+
+static ohmd_hid_device_info* capture_enumerate(ohmd_hid_transport* transport, unsigned short vendor_id, unsigned short product_id)
+{
+	ohmd_hid_capture* capture = (ohmd_hid_capture*)transport;
+	if(!capture->inner)
+		return NULL;
+
+	ohmd_hid_device_info* devs = capture->inner->enumerate(capture->inner, vendor_id, product_id);
+
+	ohmd_lock_mutex(capture->lock);
+	for(ohmd_hid_device_info* cur = devs; cur; cur = cur->next){
+		ohmd_capture_device* known = NULL;
+		for(int i = 0; i < capture->num_known; i++){
+			if(strcmp(capture->known[i].path, cur->path) == 0)
+				known = &capture->known[i];
+		}
+
+		if(!known){
+			if(capture->num_known == capture->max_known){
+				int max = capture->max_known ? capture->max_known * 2 : 16;
+				ohmd_capture_device* grown = realloc(capture->known, max * sizeof(ohmd_capture_device));
+				if(!grown)
+					break;
+
+				capture->known = grown;
+				capture->max_known = max;
+			}
+
+			known = &capture->known[capture->num_known++];
+		}
+
+		memset(known, 0, sizeof(ohmd_capture_device));
+		known->vendor_id = cur->vendor_id;
+		known->product_id = cur->product_id;
+		known->release_number = cur->release_number;
+		known->usage_page = cur->usage_page;
+		known->usage = cur->usage;
+		known->interface_number = cur->interface_number;
+		snprintf(known->path, sizeof(known->path), "%s", cur->path);
+		narrow(cur->manufacturer_string, known->manufacturer, sizeof(known->manufacturer));
+		narrow(cur->product_string, known->product, sizeof(known->product));
+		narrow(cur->serial_number, known->serial_number, sizeof(known->serial_number));
+	}
+	ohmd_unlock_mutex(capture->lock);
+
+	return devs;
+}
+
+static void capture_free_enumeration(ohmd_hid_transport* transport, ohmd_hid_device_info* devs)
+{
+	ohmd_hid_capture* capture = (ohmd_hid_capture*)transport;
+	capture->inner->free_enumeration(capture->inner, devs);
+}
+
+static ohmd_hid_device* capture_open_path(ohmd_hid_transport* transport, const char* path)
+{
+	ohmd_hid_capture* capture = (ohmd_hid_capture*)transport;
+	if(!capture->inner)
+		return NULL;
+
+	capture_handle* handle = calloc(1, sizeof(capture_handle));
+	if(!handle)
+		return NULL;
+
+	handle->inner = capture->inner->open_path(capture->inner, path);
+	if(!handle->inner){
+		free(handle);
+		return NULL;
+	}
+
+	handle->base.transport = transport;
+	handle->capture = capture;
+
+	ohmd_capture_device info;
+	memset(&info, 0, sizeof(info));
+	info.interface_number = -1;
+
+	ohmd_lock_mutex(capture->lock);
+	for(int i = 0; i < capture->num_known; i++){
+		if(strcmp(capture->known[i].path, path) == 0)
+			info = capture->known[i];
+	}
+	handle->device = ohmd_capture_writer_new_device(capture->writer);
+	ohmd_unlock_mutex(capture->lock);
+
+	snprintf(info.path, sizeof(info.path), "%s", path);
+	add_record(capture, handle->device, OHMD_CAPTURE_DEVICE, 0, &info, sizeof(info));
+
+	return &handle->base;
+}
+
+static void capture_init(ohmd_hid_transport* transport)
+{
+	ohmd_hid_capture* capture = (ohmd_hid_capture*)transport;
+	if(capture->inner && capture->inner->init)
+		capture->inner->init(capture->inner);
+}
+
+static void capture_exit(ohmd_hid_transport* transport)
+{
+	ohmd_hid_capture* capture = (ohmd_hid_capture*)transport;
+	if(capture->inner && capture->inner->exit)
+		capture->inner->exit(capture->inner);
+}
+
+static void capture_close(ohmd_hid_device* dev)
+{
+	capture_handle* handle = (capture_handle*)dev;
+	ohmd_hid_close(handle->inner);
+	free(handle);
+}
+
+static int capture_set_nonblocking(ohmd_hid_device* dev, int nonblock)
+{
+	return ohmd_hid_set_nonblocking(((capture_handle*)dev)->inner, nonblock);
+}
+
+static int capture_read(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	capture_handle* handle = (capture_handle*)dev;
+	int ret = ohmd_hid_read(handle->inner, data, length);
+
+	if(ret > 0){
+		add_record(handle->capture, handle->device, OHMD_CAPTURE_INPUT, 0, data, ret);
+		handle->got_report = true;
+	}else if(ret == 0 && handle->got_report){
+		// the end of a batch of reports, the next ones came in a later update
+		add_record(handle->capture, handle->device, OHMD_CAPTURE_READ_EMPTY, 0, NULL, 0);
+		handle->got_report = false;
+	}
+
+	return ret;
+}
+
+static int capture_write(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	capture_handle* handle = (capture_handle*)dev;
+	int ret = ohmd_hid_write(handle->inner, data, length);
+
+	add_record(handle->capture, handle->device, OHMD_CAPTURE_WRITE, ret < 0 ? OHMD_CAPTURE_FLAG_FAILED : 0, data, length);
+
+	return ret;
+}
+
+static int capture_send_feature_report(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	capture_handle* handle = (capture_handle*)dev;
+	int ret = ohmd_hid_send_feature_report(handle->inner, data, length);
+
+	add_record(handle->capture, handle->device, OHMD_CAPTURE_FEATURE_SEND, ret < 0 ? OHMD_CAPTURE_FLAG_FAILED : 0, data, length);
+
+	return ret;
+}
+
+static int capture_get_feature_report(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	capture_handle* handle = (capture_handle*)dev;
+	unsigned char id = data[0];
+	int ret = ohmd_hid_get_feature_report(handle->inner, data, length);
+
+	if(ret < 0)
+		add_record(handle->capture, handle->device, OHMD_CAPTURE_FEATURE_GET, OHMD_CAPTURE_FLAG_FAILED, &id, 1);
+	else
+		add_record(handle->capture, handle->device, OHMD_CAPTURE_FEATURE_GET, 0, data, ret);
+
+	return ret;
+}
+
+static int capture_get_string(ohmd_hid_device* dev, ohmd_hid_string string, wchar_t* out, size_t maxlen)
+{
+	ohmd_hid_device* inner = ((capture_handle*)dev)->inner;
+	return inner->transport->get_string(inner, string, out, maxlen);
+}
+
+static int capture_get_fd(ohmd_hid_device* dev)
+{
+	return ohmd_hid_get_fd(((capture_handle*)dev)->inner);
+}
+
+static uint32_t capture_get_generation(ohmd_hid_transport* transport)
+{
+	ohmd_hid_transport* inner = ((ohmd_hid_capture*)transport)->inner;
+	return inner->get_generation(inner);
+}
+
+ohmd_hid_capture* ohmd_hid_capture_create(ohmd_context* ctx, ohmd_hid_transport* inner, const char* path)
+{
+	ohmd_hid_capture* capture = ohmd_alloc(ctx, sizeof(ohmd_hid_capture));
+	if(!capture)
+		return NULL;
+
+	capture->writer = ohmd_capture_writer_open(path);
+	if(!capture->writer){
+		ohmd_set_error(ctx, "could not open capture file %s", path);
+		free(capture);
+		return NULL;
+	}
+
+	capture->ctx = ctx;
+	capture->inner = inner;
+	capture->lock = ohmd_create_mutex(ctx);
+
+	capture->base.enumerate = capture_enumerate;
+	capture->base.free_enumeration = capture_free_enumeration;
+	capture->base.open_path = capture_open_path;
+	capture->base.init = capture_init;
+	capture->base.exit = capture_exit;
+	capture->base.close = capture_close;
+	capture->base.set_nonblocking = capture_set_nonblocking;
+	capture->base.read = capture_read;
+	capture->base.write = capture_write;
+	capture->base.send_feature_report = capture_send_feature_report;
+	capture->base.get_feature_report = capture_get_feature_report;
+	capture->base.get_string = capture_get_string;
+	capture->base.get_fd = capture_get_fd;
+	if(inner->get_generation)
+		capture->base.get_generation = capture_get_generation;
+
+	LOGI("capturing HID traffic to %s", path);
+
+	return capture;
+}
+
+void ohmd_hid_capture_destroy(ohmd_hid_capture* capture)
+{
+	ohmd_capture_writer_close(capture->writer);
+	ohmd_destroy_mutex(capture->lock);
+	free(capture->known);
+	free(capture);
+}
+
+ohmd_hid_transport* ohmd_hid_capture_get_transport(ohmd_hid_capture* capture)
+{
+	return &capture->base;
+}
+
+void ohmd_hid_capture_set_inner(ohmd_hid_capture* capture, ohmd_hid_transport* inner)
+{
+	capture->inner = inner;
+}
@@ -0,0 +1,142 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* HID Capture Files */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hid.h"
+
+// A capture file holds the HID traffic of one or more sessions: a 16 byte
+// file header followed by records, each a 16 byte record header and its
+// payload padded to 8 bytes, so a mapped file can be walked in place.
+// Values are stored in host byte order.
+//
+// Sessions are appended to the end of the file. When a writer is closed it
+// appends an index record, which holds the time and offset of every
+// OHMD_CAPTURE_INDEX_INTERVAL-th record of the whole file, and a trailer
+// record pointing at it. Earlier index and trailer records are left in place
+// and skipped by readers. A file without a trailer (e.g. the capturing
+// process crashed) is indexed by walking it when it's opened.
+
+#define OHMD_CAPTURE_MAGIC "OHMDCAP"
+#define OHMD_CAPTURE_VERSION 1
+#define OHMD_CAPTURE_INDEX_INTERVAL 1024
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+} ohmd_capture_file_header;
+
+typedef enum {
+	OHMD_CAPTURE_DEVICE = 1,       // a device was opened, payload is ohmd_capture_device
+	OHMD_CAPTURE_INPUT = 2,        // an input report was read
+	OHMD_CAPTURE_READ_EMPTY = 3,   // a read found no report after returning some
+	OHMD_CAPTURE_FEATURE_GET = 4,  // the feature report returned by the device
+	OHMD_CAPTURE_FEATURE_SEND = 5, // a feature report sent to the device
+	OHMD_CAPTURE_WRITE = 6,        // an output report written to the device
+	OHMD_CAPTURE_INDEX = 7,        // payload is ohmd_capture_index followed by its entries
+	OHMD_CAPTURE_TRAILER = 8,      // payload is the uint64_t offset of the index record
+} ohmd_capture_record_type;
+
+// the request failed, the payload only holds the report id asked for
+#define OHMD_CAPTURE_FLAG_FAILED 1
+
+typedef struct {
+	uint64_t time;   // host monotonic time in nanoseconds
+	uint32_t size;   // payload size without padding
+	uint16_t device; // the OHMD_CAPTURE_DEVICE record's device, unique within the file
+	uint8_t type;
+	uint8_t flags;
+} ohmd_capture_record;
+
+typedef struct {
+	uint16_t vendor_id;
+	uint16_t product_id;
+	uint16_t release_number;
+	uint16_t usage_page;
+	uint16_t usage;
+	uint16_t reserved;
+	int32_t interface_number;
+	char path[256];
+	char manufacturer[128];
+	char product[128];
+	char serial_number[128];
+} ohmd_capture_device;
+
+typedef struct {
+	uint64_t num_records; // in the whole file, not counting index and trailer records
+	uint32_t num_devices; // device ids used in the file
+	uint32_t num_entries;
+} ohmd_capture_index;
+
+typedef struct {
+	uint64_t time;
+	uint64_t offset;
+} ohmd_capture_index_entry;
+
+/* Writing */
+
+typedef struct ohmd_capture_writer ohmd_capture_writer;
+
+// Opens path for appending, creating it if needed. Returns NULL if the file
+// can't be opened or isn't a complete capture file.
+ohmd_capture_writer* ohmd_capture_writer_open(const char* path);
+void ohmd_capture_writer_close(ohmd_capture_writer* writer);
+
+// Returns a device id for OHMD_CAPTURE_DEVICE records not used in the file yet.
+uint16_t ohmd_capture_writer_new_device(ohmd_capture_writer* writer);
+
+// Not synchronized, writers shared by threads need a lock around this.
+bool ohmd_capture_writer_add(ohmd_capture_writer* writer, uint64_t time, uint16_t device,
+	ohmd_capture_record_type type, uint8_t flags, const void* payload, uint32_t size);
+
+/* Reading */
+
+typedef struct ohmd_capture_reader ohmd_capture_reader;
+
+ohmd_capture_reader* ohmd_capture_reader_open(const char* path);
+void ohmd_capture_reader_close(ohmd_capture_reader* reader);
+
+// Offsets of the first record and one past the last complete one.
+uint64_t ohmd_capture_reader_begin(ohmd_capture_reader* reader);
+uint64_t ohmd_capture_reader_end(ohmd_capture_reader* reader);
+
+// Returns the record at offset and its payload, NULL at the end. offset is
+// advanced to the next record.
+const ohmd_capture_record* ohmd_capture_reader_next(ohmd_capture_reader* reader, uint64_t* offset, const unsigned char** payload);
+
+// Returns the offset of a record at or shortly before the first record of
+// the file timestamped at or after time, found through the index.
+uint64_t ohmd_capture_reader_seek(ohmd_capture_reader* reader, uint64_t time);
+
+// Fills in the totals of the file and returns its index entries.
+const ohmd_capture_index_entry* ohmd_capture_reader_get_index(ohmd_capture_reader* reader, ohmd_capture_index* index);
+
+/* Capturing */
+
+// A transport passing everything through to another one while writing the
+// traffic of the devices opened through it to a capture file. Set up by
+// ohmd_ctx_create when OHMD_CAPTURE names a file.
+
+typedef struct ohmd_hid_capture ohmd_hid_capture;
+
+ohmd_hid_capture* ohmd_hid_capture_create(ohmd_context* ctx, ohmd_hid_transport* inner, const char* path);
+void ohmd_hid_capture_destroy(ohmd_hid_capture* capture);
+
+ohmd_hid_transport* ohmd_hid_capture_get_transport(ohmd_hid_capture* capture);
+
+// Devices already open keep using the transport they were opened with.
+void ohmd_hid_capture_set_inner(ohmd_hid_capture* capture, ohmd_hid_transport* inner);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Clocks */
+
+#include "openhmdi.h"
+
+typedef struct {
+	ohmd_clock base;
+	double speed;
+	ohmd_mutex* lock;
+
+	double time; // when simulated
+	double start; // system time at 0 when running
+} virtual_clock;
+
+double ohmd_clock_get_tick(ohmd_clock* clock)
+{
+	return clock ? clock->get_tick(clock) : ohmd_get_tick();
+}
+
+void ohmd_clock_sleep(ohmd_clock* clock, double seconds)
+{
+	if(clock)
+		clock->sleep(clock, seconds);
+	else
+		ohmd_sleep(seconds);
+}
+
+static double virtual_get_tick(ohmd_clock* clock)
+{
+	virtual_clock* me = (virtual_clock*)clock;
+
+	ohmd_lock_mutex(me->lock);
+	double time = me->speed > 0 ? (ohmd_get_tick() - me->start) * me->speed + me->time : me->time;
+	ohmd_unlock_mutex(me->lock);
+
+	return time;
+}
+
+static void virtual_sleep(ohmd_clock* clock, double seconds)
+{
+	virtual_clock* me = (virtual_clock*)clock;
+
+	if(me->speed > 0)
+		ohmd_sleep(seconds / me->speed);
+	else
+		ohmd_virtual_clock_advance(clock, seconds);
+}
+
+ohmd_clock* ohmd_create_virtual_clock(ohmd_context* ctx, double speed)
+{
+	virtual_clock* me = ohmd_alloc(ctx, sizeof(virtual_clock));
+	if(!me)
+		return NULL;
+
+	me->lock = ohmd_create_mutex(ctx);
+	if(!me->lock){
+		free(me);
+		return NULL;
+	}
+
+	me->base.get_tick = virtual_get_tick;
+	me->base.sleep = virtual_sleep;
+	me->speed = OHMD_MAX(speed, 0.0);
+	me->start = ohmd_get_tick();
+
+	return &me->base;
+}
+
+void ohmd_destroy_virtual_clock(ohmd_clock* clock)
+{
+	virtual_clock* me = (virtual_clock*)clock;
+
+	ohmd_destroy_mutex(me->lock);
+	free(me);
+}
+
+void ohmd_virtual_clock_advance(ohmd_clock* clock, double seconds)
+{
+	virtual_clock* me = (virtual_clock*)clock;
+
+	ohmd_lock_mutex(me->lock);
+	me->time += OHMD_MAX(seconds, 0.0);
+	ohmd_unlock_mutex(me->lock);
+}
@@ -26,6 +26,7 @@ typedef struct {
     ASensorEventQueue* sensorEventQueue;
 	AAssetManager* assetMgr;
 	short firstRun;
+	float timestamp; // of the last sensor event, for the time delta
     #endif
 } android_priv;
 
@@ -34,10 +35,6 @@ static void set_android_properties(ohmd_device* device, ohmd_device_properties*
 static void nofusion_init(fusion* me);
 static void nofusion_update(fusion* me, float dt, const vec3f* accel);
 
-
-//Static variable for timeDelta;
-static float timestamp;
-
 //Android callback for the sensor event queue
 static int android_sensor_callback(int fd, int events, void* data)
 {
@@ -73,8 +70,8 @@ static int android_sensor_callback(int fd, int events, void* data)
         }
             //apply data to the fusion
             float dT = 0.0f;
-            if (timestamp != 0)
-                dT= (lastevent_timestamp - timestamp) * (1.0f / 1000000000.0f);
+            if (priv->timestamp != 0)
+                dT= (lastevent_timestamp - priv->timestamp) * (1.0f / 1000000000.0f);
 
             //Check if accelerometer only fallback is required
             if (!priv->gyroscopeSensor)
@@ -82,7 +79,7 @@ static int android_sensor_callback(int fd, int events, void* data)
             else
                 ofusion_update(&priv->sensor_fusion, dT, &gyro, &accel, &mag); //default
 
-            timestamp = lastevent_timestamp;
+            priv->timestamp = lastevent_timestamp;
     }
     return 1;
 }
@@ -223,6 +220,7 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
     else {
         ofusion_init(&priv->sensor_fusion); //Default when all sensors are available
         priv->sensor_fusion.flags = 0; // Disable the gravity
+        priv->base.sensor_fusion = &priv->sensor_fusion;
     }
 
 	return (ohmd_device*)priv;
@@ -230,7 +228,9 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 
 static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 {
-	ohmd_device_desc* desc = &list->devices[list->num_devices++];
+	ohmd_device_desc* desc = ohmd_device_list_add(list);
+	if(!desc)
+		return;
 
 	strcpy(desc->driver, "OpenHMD Generic Android Driver");
 	strcpy(desc->vendor, "OpenHMD");
@@ -8,7 +8,6 @@
 /* Deepoon Driver - HID/USB Driver Implementation */
 
 #include <stdlib.h>
-#include <hidapi.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
@@ -27,7 +26,7 @@
 typedef struct {
 	ohmd_device base;
 
-	hid_device* handle;
+	ohmd_hid_device* handle;
 	pkt_sensor_range sensor_range;
 	pkt_sensor_display_info display_info;
 	rift_coordinate_frame coordinate_frame, hw_coordinate_frame;
@@ -35,7 +34,7 @@ typedef struct {
 	pkt_tracker_sensor sensor;
 	double last_keep_alive;
 	fusion sensor_fusion;
-	vec3f raw_mag, raw_accel, raw_gyro;
+	sample_queue samples;
 } rift_priv;
 
 static rift_priv* rift_priv_get(ohmd_device* device)
@@ -47,12 +46,12 @@ static int get_feature_report(rift_priv* priv, rift_sensor_feature_cmd cmd, unsi
 {
 	memset(buf, 0, FEATURE_BUFFER_SIZE);
 	buf[0] = (unsigned char)cmd;
-	return hid_get_feature_report(priv->handle, buf, FEATURE_BUFFER_SIZE);
+	return ohmd_hid_get_feature_report(priv->handle, buf, FEATURE_BUFFER_SIZE);
 }
 
 static int send_feature_report(rift_priv* priv, const unsigned char *data, size_t length)
 {
-	return hid_send_feature_report(priv->handle, data, length);
+	return ohmd_hid_send_feature_report(priv->handle, data, length);
 }
 
 static void set_coordinate_frame(rift_priv* priv, rift_coordinate_frame coordframe)
@@ -102,40 +101,30 @@ static void handle_tracker_sensor_msg(rift_priv* priv, unsigned char* buffer, in
 	if(last_sample_tick > 0) //startup correction
 		tick_delta = s->tick - last_sample_tick;
 
-	float dt = tick_delta * TICK_LEN;
-	vec3f mag = {{0.0f, 0.0f, 0.0f}};
+	imu_sample sample;
+	sample.time = ohmd_ctx_get_time(priv->base.ctx);
+	sample.dt = tick_delta * TICK_LEN;
+	sample.mag = (vec3f){{0.0f, 0.0f, 0.0f}};
 
 	for(int i = 0; i < 1; i++){ //just use 1 sample since we don't have sample order for this frame
-		vec3f_from_dp_vec(s->samples[i].accel, &priv->raw_accel);
-		vec3f_from_dp_vec(s->samples[i].gyro, &priv->raw_gyro);
+		vec3f_from_dp_vec(s->samples[i].accel, &sample.accel);
+		vec3f_from_dp_vec(s->samples[i].gyro, &sample.ang_vel);
 
-		ofusion_update(&priv->sensor_fusion, dt, &priv->raw_gyro, &priv->raw_accel, &mag);
+		osq_push(&priv->samples, &sample);
 
 		// reset dt to tick_len for the last samples if there were more than one sample
-		dt = TICK_LEN;
+		sample.dt = TICK_LEN;
 	}
 }
 
-static void update_device(ohmd_device* device)
+static void read_device(ohmd_device* device)
 {
 	rift_priv* priv = rift_priv_get(device);
 	unsigned char buffer[FEATURE_BUFFER_SIZE];
 
-	// Handle keep alive messages
-	double t = ohmd_get_tick();
-	if(t - priv->last_keep_alive >= (double)priv->sensor_config.keep_alive_interval / 1000.0 - .2){
-		// send keep alive message
-		pkt_keep_alive keep_alive = { 0, priv->sensor_config.keep_alive_interval };
-		int ka_size = dp_encode_keep_alive(buffer, &keep_alive);
-		send_feature_report(priv, buffer, ka_size);
-
-		// Update the time of the last keep alive we have sent.
-		priv->last_keep_alive = t;
-	}
-
 	// Read all the messages from the device.
 	while(true){
-		int size = hid_read(priv->handle, buffer, FEATURE_BUFFER_SIZE);
+		int size = ohmd_hid_read(priv->handle, buffer, FEATURE_BUFFER_SIZE);
 		if(size < 0){
 			LOGE("error reading from device");
 			return;
@@ -152,6 +141,41 @@ static void update_device(ohmd_device* device)
 	}
 }
 
+static void update_device(ohmd_device* device)
+{
+	rift_priv* priv = rift_priv_get(device);
+	unsigned char buffer[FEATURE_BUFFER_SIZE];
+	imu_sample sample;
+
+	// Handle keep alive messages
+	double t = ohmd_ctx_get_time(priv->base.ctx);
+	if(t - priv->last_keep_alive >= (double)priv->sensor_config.keep_alive_interval / 1000.0 - .2){
+		// send keep alive message
+		pkt_keep_alive keep_alive = { 0, priv->sensor_config.keep_alive_interval };
+		int ka_size = dp_encode_keep_alive(buffer, &keep_alive);
+		send_feature_report(priv, buffer, ka_size);
+
+		// Update the time of the last keep alive we have sent.
+		priv->last_keep_alive = t;
+	}
+
+	// Fuse the samples queued by read_device, a batch at a time.
+	ofusion_sample batch[FUSION_BATCH_SIZE];
+	int count = 0;
+
+	while(osq_pop(&priv->samples, &sample)){
+		ofusion_sample fusion_sample = { sample.dt, sample.ang_vel, sample.accel, sample.mag };
+		batch[count++] = fusion_sample;
+
+		if(count == FUSION_BATCH_SIZE){
+			ofusion_update_batch(&priv->sensor_fusion, batch, count);
+			count = 0;
+		}
+	}
+
+	ofusion_update_batch(&priv->sensor_fusion, batch, count);
+}
+
 static int getf(ohmd_device* device, ohmd_float_value type, float* out)
 {
 	rift_priv* priv = rift_priv_get(device);
@@ -182,11 +206,17 @@ static int getf(ohmd_device* device, ohmd_float_value type, float* out)
 	return 0;
 }
 
+static int get_fd(ohmd_device* device)
+{
+	rift_priv* priv = rift_priv_get(device);
+	return ohmd_hid_get_fd(priv->handle);
+}
+
 static void close_device(ohmd_device* device)
 {
 	LOGD("closing device");
 	rift_priv* priv = rift_priv_get(device);
-	hid_close(priv->handle);
+	ohmd_hid_close(priv->handle);
 	free(priv);
 }
 
@@ -199,7 +229,7 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	priv->base.ctx = driver->ctx;
 
 	// Open the HID device
-	priv->handle = hid_open_path(desc->path);
+	priv->handle = ohmd_hid_open_path(driver->ctx, desc->path);
 
 	if(!priv->handle) {
 		char* path = _hid_to_unix_path(desc->path);
@@ -209,7 +239,7 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 		goto cleanup;
 	}
 
-	if(hid_set_nonblocking(priv->handle, 1) == -1){
+	if(ohmd_hid_set_nonblocking(priv->handle, 1) == -1){
 		ohmd_set_error(driver->ctx, "failed to set non-blocking on device");
 		goto cleanup;
 	}
@@ -234,7 +264,7 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	send_feature_report(priv, buf, size);
 
 	// Update the time of the last keep alive we have sent.
-	priv->last_keep_alive = ohmd_get_tick();
+	priv->last_keep_alive = ohmd_ctx_get_time(priv->base.ctx);
 
 	// Set default device properties
 	ohmd_set_default_device_properties(&priv->base.properties);
@@ -254,12 +284,17 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	ohmd_calc_default_proj_matrices(&priv->base.properties);
 
 	// set up device callbacks
+	priv->base.read = read_device;
 	priv->base.update = update_device;
 	priv->base.close = close_device;
+	priv->base.get_fd = get_fd;
 	priv->base.getf = getf;
 
 	// initialize sensor fusion
 	ofusion_init(&priv->sensor_fusion);
+	osq_init(&priv->samples);
+	priv->base.samples = &priv->samples;
+	priv->base.sensor_fusion = &priv->sensor_fusion;
 
 	return &priv->base;
 
@@ -270,17 +305,23 @@ cleanup:
 	return NULL;
 }
 
+static const ohmd_hid_match deepoon_matches[] = {
+	{ DEEPOON_ID, DEEPOON_HMD },
+	{ 0, 0 }
+};
+
 static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 {
-	struct hid_device_info* devs = hid_enumerate(DEEPOON_ID, DEEPOON_HMD);
-	struct hid_device_info* cur_dev = devs;
+	ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(driver->ctx, NULL, DEEPOON_ID, DEEPOON_HMD);
 
 	while (cur_dev) {
 		// This is needed because DeePoon share USB IDs with the Nolo.
 		if (wcscmp(cur_dev->manufacturer_string, L"DeePoon VR, Inc.")==0 &&
 			wcscmp(cur_dev->product_string, L"DeePoon Tracker Device")==0) {
 
-			ohmd_device_desc* desc = &list->devices[list->num_devices++];
+			ohmd_device_desc* desc = ohmd_device_list_add(list);
+			if(!desc)
+				return;
 
 			strcpy(desc->driver, "Deepoon Driver");
 			strcpy(desc->vendor, "Deepoon");
@@ -293,16 +334,13 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 			strcpy(desc->path, cur_dev->path);
 			desc->driver_ptr = driver;
 		}
-		cur_dev = cur_dev->next;
+		cur_dev = ohmd_hid_next_device(driver->ctx, cur_dev, DEEPOON_ID, DEEPOON_HMD);
 	}
-
-	hid_free_enumeration(devs);
 }
 
 static void destroy_driver(ohmd_driver* drv)
 {
 	LOGD("shutting down driver");
-	hid_exit();
 	free(drv);
 }
 
@@ -318,6 +356,7 @@ ohmd_driver* ohmd_create_deepoon_drv(ohmd_context* ctx)
 	drv->get_device_list = get_device_list;
 	drv->open_device = open_device;
 	drv->destroy = destroy_driver;
+	drv->hid_matches = deepoon_matches;
 
 	return drv;
 }
@@ -119,7 +119,9 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 
 	// HMD
 
-	desc = &list->devices[list->num_devices++];
+	desc = ohmd_device_list_add(list);
+	if(!desc)
+		return;
 
 	strcpy(desc->driver, "OpenHMD Null Driver");
 	strcpy(desc->vendor, "OpenHMD");
@@ -136,7 +138,9 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 
 	// Left Controller
 	
-	desc = &list->devices[list->num_devices++];
+	desc = ohmd_device_list_add(list);
+	if(!desc)
+		return;
 
 	strcpy(desc->driver, "OpenHMD Null Driver");
 	strcpy(desc->vendor, "OpenHMD");
@@ -157,7 +161,9 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 	
 	// Right Controller
 	
-	desc = &list->devices[list->num_devices++];
+	desc = ohmd_device_list_add(list);
+	if(!desc)
+		return;
 
 	strcpy(desc->driver, "OpenHMD Null Driver");
 	strcpy(desc->vendor, "OpenHMD");
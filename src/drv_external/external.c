@@ -99,13 +99,16 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	priv->base.setf = setf;
 	
 	ofusion_init(&priv->sensor_fusion);
+	priv->base.sensor_fusion = &priv->sensor_fusion;
 
 	return (ohmd_device*)priv;
 }
 
 static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 {
-	ohmd_device_desc* desc = &list->devices[list->num_devices++];
+	ohmd_device_desc* desc = ohmd_device_list_add(list);
+	if(!desc)
+		return;
 
 	strcpy(desc->driver, "OpenHMD Generic External Driver");
 	strcpy(desc->vendor, "OpenHMD");
@@ -20,19 +20,19 @@
 
 #include <string.h>
 #include <wchar.h>
-#include <hidapi.h>
 #include <assert.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "vive.h"
+#include "../hid.h"
 
 typedef struct {
 	ohmd_device base;
 
-	hid_device* hmd_handle;
-	hid_device* imu_handle;
+	ohmd_hid_device* hmd_handle;
+	ohmd_hid_device* imu_handle;
 	fusion sensor_fusion;
 	vec3f raw_accel, raw_gyro;
 	uint32_t last_ticks;
@@ -45,6 +45,9 @@ typedef struct {
 
 } vive_priv;
 
+// version of the vive_imu_config kept in the device cache
+#define VIVE_CACHE_FORMAT 1
+
 void vec3f_from_vive_vec_accel(const vive_imu_config* config,
                                const int16_t* smp,
                                vec3f* out)
@@ -123,13 +126,17 @@ static void update_device(ohmd_device* device)
 	int size = 0;
 	unsigned char buffer[FEATURE_BUFFER_SIZE];
 
-	while((size = hid_read(priv->imu_handle, buffer, FEATURE_BUFFER_SIZE)) > 0){
+	while((size = ohmd_hid_read(priv->imu_handle, buffer, FEATURE_BUFFER_SIZE)) > 0){
 		if(buffer[0] == VIVE_IRQ_SENSORS){
 			vive_headset_imu_packet pkt;
 			vive_decode_sensor_packet(&pkt, buffer, size);
 
 			vive_headset_imu_sample* smp = NULL;
 
+			// the packet's new samples are fused together
+			ofusion_sample samples[3];
+			int count = 0;
+
 			while((smp = get_next_sample(&pkt, priv->last_seq)) != NULL)
 			{
 				if(priv->last_ticks == 0)
@@ -146,16 +153,17 @@ static void update_device(ohmd_device* device)
 				vec3f_from_vive_vec_accel(&priv->imu_config, smp->acc, &priv->raw_accel);
 				vec3f_from_vive_vec_gyro(&priv->imu_config, smp->rot, &priv->raw_gyro);
 
-				if(process_error(priv)){
-					vec3f mag = {{0.0f, 0.0f, 0.0f}};
-					vec3f gyro;
-					ovec3f_subtract(&priv->raw_gyro, &priv->gyro_error, &gyro);
-
-					ofusion_update(&priv->sensor_fusion, dt, &gyro, &priv->raw_accel, &mag);
+				// no need to measure the gyro bias at rest if the engine estimates it
+				if(priv->sensor_fusion.engine->get_gyro_bias || process_error(priv)){
+					ofusion_sample sample = { dt, {{0.0f, 0.0f, 0.0f}}, priv->raw_accel, {{0.0f, 0.0f, 0.0f}} };
+					ovec3f_subtract(&priv->raw_gyro, &priv->gyro_error, &sample.ang_vel);
+					samples[count++] = sample;
 				}
 
 				priv->last_seq = smp->seq;
 			}
+
+			ofusion_update_batch(&priv->sensor_fusion, samples, count);
 		}else{
 			LOGE("unknown message type: %u", buffer[0]);
 		}
@@ -193,6 +201,12 @@ static int getf(ohmd_device* device, ohmd_float_value type, float* out)
 	return 0;
 }
 
+static int get_fd(ohmd_device* device)
+{
+	vive_priv* priv = (vive_priv*)device;
+	return ohmd_hid_get_fd(priv->imu_handle);
+}
+
 static void close_device(ohmd_device* device)
 {
 	int hret = 0;
@@ -201,25 +215,25 @@ static void close_device(ohmd_device* device)
 	LOGD("closing HTC Vive device");
 
 	// turn the display off
-	hret = hid_send_feature_report(priv->hmd_handle, vive_magic_power_off1, sizeof(vive_magic_power_off1));
+	hret = ohmd_hid_send_feature_report(priv->hmd_handle, vive_magic_power_off1, sizeof(vive_magic_power_off1));
 	LOGI("power off magic 1: %d\n", hret);
 
-	hret = hid_send_feature_report(priv->hmd_handle, vive_magic_power_off2, sizeof(vive_magic_power_off2));
+	hret = ohmd_hid_send_feature_report(priv->hmd_handle, vive_magic_power_off2, sizeof(vive_magic_power_off2));
 	LOGI("power off magic 2: %d\n", hret);
 
-	hid_close(priv->hmd_handle);
-	hid_close(priv->imu_handle);
+	ohmd_hid_close(priv->hmd_handle);
+	ohmd_hid_close(priv->imu_handle);
 
 	free(device);
 }
 
 #if 0
-static void dump_indexed_string(hid_device* device, int index)
+static void dump_indexed_string(ohmd_hid_device* device, int index)
 {
 	wchar_t wbuffer[512] = {0};
 	char buffer[1024] = {0};
 
-	int hret = hid_get_indexed_string(device, index, wbuffer, 511);
+	int hret = ohmd_hid_get_indexed_string(device, index, wbuffer, 511);
 
 	if(hret == 0){
 		wcstombs(buffer, wbuffer, sizeof(buffer));
@@ -228,7 +242,7 @@ static void dump_indexed_string(hid_device* device, int index)
 }
 #endif
 
-static void dump_info_string(int (*fun)(hid_device*, wchar_t*, size_t), const char* what, hid_device* device)
+static void dump_info_string(int (*fun)(ohmd_hid_device*, wchar_t*, size_t), const char* what, ohmd_hid_device* device)
 {
 	wchar_t wbuffer[512] = {0};
 	char buffer[1024] = {0};
@@ -254,24 +268,26 @@ static void dumpbin(const char* label, const unsigned char* data, int length)
 }
 #endif
 
-static hid_device* open_device_idx(int manufacturer, int product, int iface, int iface_tot, int device_index)
+static ohmd_hid_device* open_device_idx(ohmd_context* ctx, int manufacturer, int product, int iface, int iface_tot, int device_index,
+	ohmd_hid_device_info** info)
 {
-	struct hid_device_info* devs = hid_enumerate(manufacturer, product);
-	struct hid_device_info* cur_dev = devs;
+	ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(ctx, NULL, manufacturer, product);
 
 	int idx = 0;
 	int iface_cur = 0;
-	hid_device* ret = NULL;
+	ohmd_hid_device* ret = NULL;
 
 	while (cur_dev) {
 		LOGI("%04x:%04x %s\n", manufacturer, product, cur_dev->path);
 
 		if(idx == device_index && iface == iface_cur){
-			ret = hid_open_path(cur_dev->path);
+			ret = ohmd_hid_open_path(ctx, cur_dev->path);
+			if(info)
+				*info = cur_dev;
 			LOGI("opening\n");
 		}
 
-		cur_dev = cur_dev->next;
+		cur_dev = ohmd_hid_next_device(ctx, cur_dev, manufacturer, product);
 
 		iface_cur++;
 
@@ -281,19 +297,17 @@ static hid_device* open_device_idx(int manufacturer, int product, int iface, int
 		}
 	}
 
-	hid_free_enumeration(devs);
-
 	return ret;
 }
 
-void vive_read_config(vive_priv* priv)
+bool vive_read_config(vive_priv* priv)
 {
 	unsigned char buffer[128];
 	int bytes;
 
 	LOGI("Getting feature report 16 to 39\n");
 	buffer[0] = VIVE_CONFIG_START_PACKET_ID;
-	bytes = hid_get_feature_report(priv->imu_handle, buffer, sizeof(buffer));
+	bytes = ohmd_hid_get_feature_report(priv->imu_handle, buffer, sizeof(buffer));
 	printf("got %i bytes\n", bytes);
 	for (int i = 0; i < bytes; i++) {
 		printf("%02x ", buffer[i]);
@@ -305,16 +319,18 @@ void vive_read_config(vive_priv* priv)
 	int offset = 0;
 	while (buffer[1] != 0) {
 		buffer[0] = VIVE_CONFIG_READ_PACKET_ID;
-		bytes = hid_get_feature_report(priv->imu_handle, buffer, sizeof(buffer));
+		bytes = ohmd_hid_get_feature_report(priv->imu_handle, buffer, sizeof(buffer));
 
     memcpy((uint8_t*)packet_buffer + offset, buffer+2, buffer[1]);
     offset += buffer[1];
   }
   packet_buffer[offset] = '\0';
   //LOGD("Result: %s\n", packet_buffer);
-  vive_decode_config_packet(&priv->imu_config, packet_buffer, offset);
+  bool ret = vive_decode_config_packet(&priv->imu_config, packet_buffer, offset);
 
   free(packet_buffer);
+
+  return ret;
 }
 
 #define OHMD_GRAVITY_EARTH 9.80665 // m/s²
@@ -328,12 +344,12 @@ int vive_get_range_packet(vive_priv* priv)
 
   buffer[0] = VIVE_IMU_RANGE_MODES_PACKET_ID;
 
-  ret = hid_get_feature_report(priv->imu_handle, buffer, sizeof(buffer));
+  ret = ohmd_hid_get_feature_report(priv->imu_handle, buffer, sizeof(buffer));
   if (ret < 0)
     return ret;
 
   if (!buffer[1] || !buffer[2]) {
-    ret = hid_get_feature_report(priv->imu_handle, buffer, sizeof(buffer));
+    ret = ohmd_hid_get_feature_report(priv->imu_handle, buffer, sizeof(buffer));
     if (ret < 0)
       return ret;
 
@@ -379,40 +395,57 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	int idx = atoi(desc->path);
 
 	// Open the HMD device
-	priv->hmd_handle = open_device_idx(HTC_ID, VIVE_HMD, 0, 1, idx);
+	priv->hmd_handle = open_device_idx(driver->ctx, HTC_ID, VIVE_HMD, 0, 1, idx, NULL);
 
 	if(!priv->hmd_handle)
 		goto cleanup;
 
-	if(hid_set_nonblocking(priv->hmd_handle, 1) == -1){
+	if(ohmd_hid_set_nonblocking(priv->hmd_handle, 1) == -1){
 		ohmd_set_error(driver->ctx, "failed to set non-blocking on device");
 		goto cleanup;
 	}
 
 	// Open the lighthouse device
-	priv->imu_handle = open_device_idx(VALVE_ID, VIVE_LIGHTHOUSE_FPGA_RX, 0, 2, idx);
+	ohmd_hid_device_info* imu_info = NULL;
+	priv->imu_handle = open_device_idx(driver->ctx, VALVE_ID, VIVE_LIGHTHOUSE_FPGA_RX, 0, 2, idx, &imu_info);
 
 	if(!priv->imu_handle)
 		goto cleanup;
 
-	if(hid_set_nonblocking(priv->imu_handle, 1) == -1){
+	if(ohmd_hid_set_nonblocking(priv->imu_handle, 1) == -1){
 		ohmd_set_error(driver->ctx, "failed to set non-blocking on device");
 		goto cleanup;
 	}
 
-	dump_info_string(hid_get_manufacturer_string, "manufacturer", priv->hmd_handle);
-	dump_info_string(hid_get_product_string , "product", priv->hmd_handle);
-	dump_info_string(hid_get_serial_number_string, "serial number", priv->hmd_handle);
+	dump_info_string(ohmd_hid_get_manufacturer_string, "manufacturer", priv->hmd_handle);
+	dump_info_string(ohmd_hid_get_product_string , "product", priv->hmd_handle);
+	dump_info_string(ohmd_hid_get_serial_number_string, "serial number", priv->hmd_handle);
 
 	// turn the display on
-	hret = hid_send_feature_report(priv->hmd_handle, vive_magic_power_on, sizeof(vive_magic_power_on));
+	hret = ohmd_hid_send_feature_report(priv->hmd_handle, vive_magic_power_on, sizeof(vive_magic_power_on));
 	LOGI("power on magic: %d\n", hret);
 
 	// enable lighthouse
-	//hret = hid_send_feature_report(priv->hmd_handle, vive_magic_enable_lighthouse, sizeof(vive_magic_enable_lighthouse));
+	//hret = ohmd_hid_send_feature_report(priv->hmd_handle, vive_magic_enable_lighthouse, sizeof(vive_magic_enable_lighthouse));
 	//LOGD("enable lighthouse magic: %d\n", hret);
 
-	vive_read_config(priv);
+	// The IMU calibration is a compressed JSON file downloaded in dozens of
+	// feature reports, keep it in the device cache
+	ohmd_cache_key cache_key;
+	bool cacheable = ohmd_cache_key_init(&cache_key, "vive", VIVE_CACHE_FORMAT, priv->imu_handle, imu_info);
+	vive_imu_config* cached = NULL;
+	size_t cached_size = 0;
+
+	if(cacheable)
+		cached = ohmd_cache_load(driver->ctx, &cache_key, &cached_size);
+
+	if(cached && cached_size == sizeof(vive_imu_config)){
+		priv->imu_config = *cached;
+	}else if(vive_read_config(priv) && cacheable){
+		ohmd_cache_store(driver->ctx, &cache_key, &priv->imu_config, sizeof(vive_imu_config));
+	}
+
+	free(cached);
 
 	if (vive_get_range_packet(priv) != 0)
 	{
@@ -438,9 +471,11 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	// set up device callbacks
 	priv->base.update = update_device;
 	priv->base.close = close_device;
+	priv->base.get_fd = get_fd;
 	priv->base.getf = getf;
 
 	ofusion_init(&priv->sensor_fusion);
+	priv->base.sensor_fusion = &priv->sensor_fusion;
 
 	ofq_init(&priv->gyro_q, 128);
 
@@ -453,14 +488,20 @@ cleanup:
 	return NULL;
 }
 
+static const ohmd_hid_match vive_matches[] = {
+	{ HTC_ID, VIVE_HMD },
+	{ 0, 0 }
+};
+
 static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 {
-	struct hid_device_info* devs = hid_enumerate(HTC_ID, VIVE_HMD);
-	struct hid_device_info* cur_dev = devs;
+	ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(driver->ctx, NULL, HTC_ID, VIVE_HMD);
 
 	int idx = 0;
 	while (cur_dev) {
-		ohmd_device_desc* desc = &list->devices[list->num_devices++];
+		ohmd_device_desc* desc = ohmd_device_list_add(list);
+		if(!desc)
+			return;
 
 		strcpy(desc->driver, "OpenHMD HTC Vive Driver");
 		strcpy(desc->vendor, "HTC/Valve");
@@ -474,11 +515,9 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 		desc->device_class = OHMD_DEVICE_CLASS_HMD;
 		desc->device_flags = OHMD_DEVICE_FLAGS_ROTATIONAL_TRACKING;
 
-		cur_dev = cur_dev->next;
+		cur_dev = ohmd_hid_next_device(driver->ctx, cur_dev, HTC_ID, VIVE_HMD);
 		idx++;
 	}
-
-	hid_free_enumeration(devs);
 }
 
 static void destroy_driver(ohmd_driver* drv)
@@ -498,6 +537,7 @@ ohmd_driver* ohmd_create_htc_vive_drv(ohmd_context* ctx)
 	drv->open_device = open_device;
 	drv->destroy = destroy_driver;
 	drv->ctx = ctx;
+	drv->hid_matches = vive_matches;
 
 	return drv;
 }
@@ -22,7 +22,16 @@
 #define NOLO_HMD				0x5750
 
 static const int controllerLength = 3 + (3+4)*2 + 2 + 2 + 1;
-static devices_t* nolo_devices;
+
+typedef struct {
+	ohmd_driver base;
+
+	// The groups of the devices opened, the controllers are updated with
+	// the HMD as they come through its device. The mutex guards them, their
+	// members and the controllers' state, which is read by other threads.
+	ohmd_mutex* mutex;
+	devices_t* nolo_devices;
+} nolo_driver;
 
 static drv_priv* drv_priv_get(ohmd_device* device)
 {
@@ -38,31 +47,21 @@ static void update_device(ohmd_device* device)
 	if (priv->id != 0)
 		return;
 
-	devices_t* current = nolo_devices;
-	drv_priv* controller0 = NULL;
-	drv_priv* controller1 = NULL;
-
-	//Check if controllers exist
-	while (current != NULL) {
-		if (current->drv->hmd_tracker == priv)
-		{
-			if (current->drv->controller0)
-				controller0 = current->drv->controller0;
-			if (current->drv->controller1)
-				controller1 = current->drv->controller1;
-			break;
-		}
-		current = current->next;
-	}
+	// the controllers can't be closed meanwhile
+	nolo_driver* driver = (nolo_driver*)priv->driver;
+	ohmd_lock_mutex(driver->mutex);
+
+	drv_priv* controller0 = priv->group->controller0;
+	drv_priv* controller1 = priv->group->controller1;
 
 	// Read all the messages from the device.
 	while(true){
-		int size = hid_read(priv->handle, buffer, FEATURE_BUFFER_SIZE);
+		int size = ohmd_hid_read(priv->handle, buffer, FEATURE_BUFFER_SIZE);
 		if(size < 0){
 			LOGE("error reading from device");
-			return;
+			break;
 		} else if(size == 0) {
-			return; // No more messages, return.
+			break; // No more messages, return.
 		}
 
 		nolo_decrypt_data(buffer);
@@ -86,14 +85,11 @@ static void update_device(ohmd_device* device)
 		}
 	}
 
-
-	return;
+	ohmd_unlock_mutex(driver->mutex);
 }
 
-static int getf(ohmd_device* device, ohmd_float_value type, float* out)
+static int read_value(drv_priv* priv, ohmd_float_value type, float* out)
 {
-	drv_priv* priv = drv_priv_get(device);
-
 	switch(type){
 
 	case OHMD_ROTATION_QUAT: {
@@ -133,33 +129,87 @@ static int getf(ohmd_device* device, ohmd_float_value type, float* out)
 	return 0;
 }
 
+static int getf(ohmd_device* device, ohmd_float_value type, float* out)
+{
+	drv_priv* priv = drv_priv_get(device);
+
+	// the HMD's update writes the controllers, under the driver's mutex
+	if (priv->id == 0)
+		return read_value(priv, type, out);
+
+	nolo_driver* driver = (nolo_driver*)priv->driver;
+	ohmd_lock_mutex(driver->mutex);
+	int ret = read_value(priv, type, out);
+	ohmd_unlock_mutex(driver->mutex);
+
+	return ret;
+}
+
+static int get_fd(ohmd_device* device)
+{
+	drv_priv* priv = drv_priv_get(device);
+	return ohmd_hid_get_fd(priv->handle);
+}
+
 static void close_device(ohmd_device* device)
 {
 	LOGD("closing device");
 	drv_priv* priv = drv_priv_get(device);
-	hid_close(priv->handle);
+	nolo_driver* driver = (nolo_driver*)priv->driver;
+
+	// take it out of its group, and the group out of the driver once it's empty
+	ohmd_lock_mutex(driver->mutex);
+
+	drv_nolo* group = priv->group;
+	if (group->hmd_tracker == priv)
+		group->hmd_tracker = NULL;
+	if (group->controller0 == priv)
+		group->controller0 = NULL;
+	if (group->controller1 == priv)
+		group->controller1 = NULL;
+
+	if (!group->hmd_tracker && !group->controller0 && !group->controller1) {
+		for (devices_t** cur = &driver->nolo_devices; *cur; cur = &(*cur)->next) {
+			if ((*cur)->drv == group) {
+				devices_t* found = *cur;
+				*cur = found->next;
+				free(found);
+				break;
+			}
+		}
+
+		free(group);
+	}
+
+	ohmd_unlock_mutex(driver->mutex);
+
+	ohmd_hid_close(priv->handle);
 	free(priv);
 }
 
-void push_device(devices_t * head, drv_nolo* val) {
-	devices_t* current = head;
-
-	if (!nolo_devices)
-	{
-		nolo_devices = calloc(1, sizeof(devices_t));
-		nolo_devices->drv = val;
-		nolo_devices->next = NULL;
-		return;
+// the group of the devices at path, created if there is none yet
+static drv_nolo* get_group(nolo_driver* driver, const char* path)
+{
+	for (devices_t* current = driver->nolo_devices; current; current = current->next) {
+		if (strcmp(current->drv->path, path) == 0)
+			return current->drv;
 	}
 
-	while (current->next != NULL) {
-		current = current->next;
+	drv_nolo* group = calloc(1, sizeof(drv_nolo));
+	devices_t* entry = calloc(1, sizeof(devices_t));
+	if (!group || !entry) {
+		free(group);
+		free(entry);
+		return NULL;
 	}
 
-	/* now we can add a new variable */
-	current->next = calloc(1, sizeof(devices_t));
-	current->next->drv = val;
-	current->next->next = NULL;
+	strcpy(group->path, path);
+
+	entry->drv = group;
+	entry->next = driver->nolo_devices;
+	driver->nolo_devices = entry;
+
+	return group;
 }
 
 static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
@@ -174,7 +224,7 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	// Open the HID device when physical device
 	if (priv->id == 0)
 	{
-		priv->handle = hid_open_path(desc->path);
+		priv->handle = ohmd_hid_open_path(driver->ctx, desc->path);
 
 		if(!priv->handle) {
 			char* path = _hid_to_unix_path(desc->path);
@@ -184,33 +234,26 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 			goto cleanup;
 		}
 
-		if(hid_set_nonblocking(priv->handle, 1) == -1){
+		if(ohmd_hid_set_nonblocking(priv->handle, 1) == -1){
 			ohmd_set_error(driver->ctx, "failed to set non-blocking on device");
 			goto cleanup;
 		}
 
 	}
 
-	devices_t* current = nolo_devices;
-	drv_nolo* mNOLO = NULL;
+	// Devices of the driver can be opened in parallel
+	nolo_driver* nolo = (nolo_driver*)driver;
+	ohmd_lock_mutex(nolo->mutex);
 
-	//Check if the opened device is part of a group
-	while (current != NULL) {
-		if (strcmp(current->drv->path, desc->path)==0)
-			mNOLO = current->drv;
-		current = current->next;
+	drv_nolo* mNOLO = get_group(nolo, desc->path);
+	if (!mNOLO) {
+		ohmd_unlock_mutex(nolo->mutex);
+		ohmd_set_error(driver->ctx, "could not allocate RAM for device");
+		goto cleanup;
 	}
 
-	if (!mNOLO)
-	{
-		//Create new group
-		mNOLO = calloc(1, sizeof(drv_nolo));
-		mNOLO->hmd_tracker = NULL;
-		mNOLO->controller0 = NULL;
-		mNOLO->controller1 = NULL;
-		strcpy(mNOLO->path, desc->path);
-		push_device(nolo_devices, mNOLO);
-	}
+	priv->driver = driver;
+	priv->group = mNOLO;
 
 	if (priv->id == 0) {
 		mNOLO->hmd_tracker = priv;
@@ -256,33 +299,44 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 		priv->base.properties.controls_types[7] = OHMD_ANALOG;
 	}
 
+	ohmd_unlock_mutex(nolo->mutex);
+
 	// Set default device properties
 	ohmd_set_default_device_properties(&priv->base.properties);
 
 	// set up device callbacks
 	priv->base.update = update_device;
 	priv->base.close = close_device;
+	priv->base.get_fd = get_fd;
 	priv->base.getf = getf;
 
 	return &priv->base;
 
 cleanup:
-	if(priv)
+	if(priv){
+		ohmd_hid_close(priv->handle);
 		free(priv);
+	}
 
 	return NULL;
 }
 
+static const ohmd_hid_match nolo_matches[] = {
+	{ NOLO_ID, NOLO_HMD },
+	{ 0, 0 }
+};
+
 static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 {
-	struct hid_device_info* devs = hid_enumerate(NOLO_ID, NOLO_HMD);
-	struct hid_device_info* cur_dev = devs;
+	ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(driver->ctx, NULL, NOLO_ID, NOLO_HMD);
 
 	int id = 0;
 	while (cur_dev) {
 		if (wcscmp(cur_dev->manufacturer_string, L"LYRobotix")==0 &&
 			wcscmp(cur_dev->product_string, L"NOLO")==0) {
-			ohmd_device_desc* desc = &list->devices[list->num_devices++];
+			ohmd_device_desc* desc = ohmd_device_list_add(list);
+			if(!desc)
+				return;
 
 			strcpy(desc->driver, "OpenHMD NOLO VR CV1 driver");
 			strcpy(desc->vendor, "LYRobotix");
@@ -299,7 +353,9 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 			desc->id = id++;
 
 			//Controller 0
-			desc = &list->devices[list->num_devices++];
+			desc = ohmd_device_list_add(list);
+			if(!desc)
+				return;
 
 			strcpy(desc->driver, "OpenHMD NOLO VR CV1 driver");
 			strcpy(desc->vendor, "LYRobotix");
@@ -318,7 +374,9 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 			desc->id = id++;
 
 			// Controller 1
-			desc = &list->devices[list->num_devices++];
+			desc = ohmd_device_list_add(list);
+			if(!desc)
+				return;
 
 			strcpy(desc->driver, "OpenHMD NOLO VR CV1 driver");
 			strcpy(desc->vendor, "LYRobotix");
@@ -336,28 +394,34 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 			desc->driver_ptr = driver;
 			desc->id = id++;
 		}
-		cur_dev = cur_dev->next;
+		cur_dev = ohmd_hid_next_device(driver->ctx, cur_dev, NOLO_ID, NOLO_HMD);
 	}
-	hid_free_enumeration(devs);
 }
 
 static void destroy_driver(ohmd_driver* drv)
 {
 	LOGD("shutting down NOLO CV1 driver");
-	hid_exit();
-	free(drv);
+	nolo_driver* nolo = (nolo_driver*)drv;
+
+	// the devices are all closed, and their groups with them
+	ohmd_destroy_mutex(nolo->mutex);
+	free(nolo);
 }
 
 ohmd_driver* ohmd_create_nolo_drv(ohmd_context* ctx)
 {
-	ohmd_driver* drv = ohmd_alloc(ctx, sizeof(ohmd_driver));
-	if(drv == NULL)
+	nolo_driver* nolo = ohmd_alloc(ctx, sizeof(nolo_driver));
+	if(nolo == NULL)
 		return NULL;
 
+	nolo->mutex = ohmd_create_mutex(ctx);
+
+	ohmd_driver* drv = &nolo->base;
 	drv->get_device_list = get_device_list;
 	drv->open_device = open_device;
 	drv->destroy = destroy_driver;
 	drv->ctx = ctx;
+	drv->hid_matches = nolo_matches;
 
 	return drv;
 }
@@ -10,24 +10,28 @@
 #define NOLODRIVER_H
 
 #include "../openhmdi.h"
-#include <hidapi.h>
+#include "../hid.h"
 
 #define FEATURE_BUFFER_SIZE 64
 
+typedef struct drv_nolo drv_nolo;
+
 typedef struct {
 	ohmd_device base;
 
-	hid_device* handle;
+	ohmd_hid_device* handle;
 	int id;
 	float controller_values[8];
+	ohmd_driver* driver;
+	drv_nolo* group; // the HMD and controllers sharing its device
 } drv_priv;
 
-typedef struct{
+struct drv_nolo {
 	char path[OHMD_STR_SIZE];
 	drv_priv* hmd_tracker;
 	drv_priv* controller0;
 	drv_priv* controller1;
-} drv_nolo;
+};
 
 typedef struct devices{
 	drv_nolo* drv;
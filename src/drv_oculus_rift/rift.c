@@ -8,7 +8,6 @@
 /* Oculus Rift Driver - HID/USB Driver Implementation */
 
 #include <stdlib.h>
-#include <hidapi.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
@@ -21,10 +20,20 @@
 #define KEEP_ALIVE_VALUE (10 * 1000)
 #define SETFLAG(_s, _flag, _val) (_s) = ((_s) & ~(_flag)) | ((_val) ? (_flag) : 0)
 
+typedef enum {
+	REV_DK1,
+	REV_DK2,
+	REV_CV1,
+
+	REV_GEARVR_GEN1
+} rift_revision;
+
 typedef struct {
 	ohmd_device base;
 
-	hid_device* handle;
+	ohmd_hid_device* handle;
+	ohmd_hid_identity identity; // to find the device again after a reset
+	rift_revision revision;
 	pkt_sensor_range sensor_range;
 	pkt_sensor_display_info display_info;
 	rift_coordinate_frame coordinate_frame, hw_coordinate_frame;
@@ -33,22 +42,27 @@ typedef struct {
 	uint32_t last_imu_timestamp;
 	double last_keep_alive;
 	fusion sensor_fusion;
-	vec3f raw_mag, raw_accel, raw_gyro;
+	sample_queue samples;
 
 	struct {
 		vec3f pos;
 	} imu;
 
 	rift_led *leds;
+	int num_leds;
 } rift_priv;
 
-typedef enum {
-	REV_DK1,
-	REV_DK2,
-	REV_CV1,
+// What open_device reads from the device once and for all, as it's kept in
+// the device cache, followed by num_leds rift_leds. Bump RIFT_CACHE_FORMAT
+// when it changes.
+typedef struct {
+	pkt_sensor_range sensor_range;
+	pkt_sensor_display_info display_info;
+	vec3f imu_pos;
+	uint32_t num_leds;
+} rift_cache_data;
 
-	REV_GEARVR_GEN1
-} rift_revision;
+#define RIFT_CACHE_FORMAT 1
 
 typedef struct {
 	const char* name;
@@ -67,12 +81,12 @@ static int get_feature_report(rift_priv* priv, rift_sensor_feature_cmd cmd, unsi
 {
 	memset(buf, 0, FEATURE_BUFFER_SIZE);
 	buf[0] = (unsigned char)cmd;
-	return hid_get_feature_report(priv->handle, buf, FEATURE_BUFFER_SIZE);
+	return ohmd_hid_get_feature_report(priv->handle, buf, FEATURE_BUFFER_SIZE);
 }
 
 static int send_feature_report(rift_priv* priv, const unsigned char *data, size_t length)
 {
-	return hid_send_feature_report(priv->handle, data, length);
+	return ohmd_hid_send_feature_report(priv->handle, data, length);
 }
 
 static void set_coordinate_frame(rift_priv* priv, rift_coordinate_frame coordframe)
@@ -123,51 +137,42 @@ static void handle_tracker_sensor_msg(rift_priv* priv, unsigned char* buffer, in
 
 	dump_packet_tracker_sensor(s);
 
+	imu_sample sample;
+	sample.time = ohmd_ctx_get_time(priv->base.ctx);
+
 	int32_t mag32[] = { s->mag[0], s->mag[1], s->mag[2] };
-	vec3f_from_rift_vec(mag32, &priv->raw_mag);
+	vec3f_from_rift_vec(mag32, &sample.mag);
 
 	// TODO: handle overflows in a nicer way
-	float dt = TICK_LEN; // TODO: query the Rift for the sample rate
+	sample.dt = TICK_LEN; // TODO: query the Rift for the sample rate
 	if (s->timestamp > priv->last_imu_timestamp)
 	{
-		dt = (s->timestamp - priv->last_imu_timestamp) / 1000000.0f;
-		dt -= (s->num_samples - 1) * TICK_LEN; // TODO: query the Rift for the sample rate
+		sample.dt = (s->timestamp - priv->last_imu_timestamp) / 1000000.0f;
+		sample.dt -= (s->num_samples - 1) * TICK_LEN; // TODO: query the Rift for the sample rate
 	}
 
 	for(int i = 0; i < s->num_samples; i++){
-		vec3f_from_rift_vec(s->samples[i].accel, &priv->raw_accel);
-		vec3f_from_rift_vec(s->samples[i].gyro, &priv->raw_gyro);
+		vec3f_from_rift_vec(s->samples[i].accel, &sample.accel);
+		vec3f_from_rift_vec(s->samples[i].gyro, &sample.ang_vel);
 
-		ofusion_update(&priv->sensor_fusion, dt, &priv->raw_gyro, &priv->raw_accel, &priv->raw_mag);
-		dt = TICK_LEN; // TODO: query the Rift for the sample rate
+		osq_push(&priv->samples, &sample);
+		sample.dt = TICK_LEN; // TODO: query the Rift for the sample rate
 	}
 
 	priv->last_imu_timestamp = s->timestamp;
 }
 
-static void update_device(ohmd_device* device)
+static void read_device(ohmd_device* device)
 {
 	rift_priv* priv = rift_priv_get(device);
 	unsigned char buffer[FEATURE_BUFFER_SIZE];
 
-	// Handle keep alive messages
-	double t = ohmd_get_tick();
-	if(t - priv->last_keep_alive >= (double)priv->sensor_config.keep_alive_interval / 1000.0 - .2){
-		// send keep alive message
-		pkt_keep_alive keep_alive = { 0, priv->sensor_config.keep_alive_interval };
-		int ka_size = encode_keep_alive(buffer, &keep_alive);
-		if (send_feature_report(priv, buffer, ka_size) == -1)
-			LOGE("error sending keepalive");
-
-		// Update the time of the last keep alive we have sent.
-		priv->last_keep_alive = t;
-	}
-
 	// Read all the messages from the device.
 	while(true){
-		int size = hid_read(priv->handle, buffer, FEATURE_BUFFER_SIZE);
+		int size = ohmd_hid_read(priv->handle, buffer, FEATURE_BUFFER_SIZE);
 		if(size < 0){
 			LOGE("error reading from device");
+			ohmd_device_lost(device);
 			return;
 		} else if(size == 0) {
 			return; // No more messages, return.
@@ -182,6 +187,42 @@ static void update_device(ohmd_device* device)
 	}
 }
 
+static void update_device(ohmd_device* device)
+{
+	rift_priv* priv = rift_priv_get(device);
+	unsigned char buffer[FEATURE_BUFFER_SIZE];
+	imu_sample sample;
+
+	// Handle keep alive messages
+	double t = ohmd_ctx_get_time(priv->base.ctx);
+	if(t - priv->last_keep_alive >= (double)priv->sensor_config.keep_alive_interval / 1000.0 - .2){
+		// send keep alive message
+		pkt_keep_alive keep_alive = { 0, priv->sensor_config.keep_alive_interval };
+		int ka_size = encode_keep_alive(buffer, &keep_alive);
+		if (send_feature_report(priv, buffer, ka_size) == -1)
+			LOGE("error sending keepalive");
+
+		// Update the time of the last keep alive we have sent.
+		priv->last_keep_alive = t;
+	}
+
+	// Fuse the samples queued by read_device, a batch at a time.
+	ofusion_sample batch[FUSION_BATCH_SIZE];
+	int count = 0;
+
+	while(osq_pop(&priv->samples, &sample)){
+		ofusion_sample fusion_sample = { sample.dt, sample.ang_vel, sample.accel, sample.mag };
+		batch[count++] = fusion_sample;
+
+		if(count == FUSION_BATCH_SIZE){
+			ofusion_update_batch(&priv->sensor_fusion, batch, count);
+			count = 0;
+		}
+	}
+
+	ofusion_update_batch(&priv->sensor_fusion, batch, count);
+}
+
 static int getf(ohmd_device* device, ohmd_float_value type, float* out)
 {
 	rift_priv* priv = rift_priv_get(device);
@@ -212,14 +253,137 @@ static int getf(ohmd_device* device, ohmd_float_value type, float* out)
 	return 0;
 }
 
+static int get_fd(ohmd_device* device)
+{
+	rift_priv* priv = rift_priv_get(device);
+	return ohmd_hid_get_fd(priv->handle);
+}
+
+// turns the screens and the tracking LEDs on
+static void enable_components(rift_priv* priv)
+{
+	unsigned char buf[FEATURE_BUFFER_SIZE];
+
+	if (priv->revision == REV_CV1)
+	{
+		int size = encode_enable_components(buf, true, true, true);
+		if (send_feature_report(priv, buf, size) == -1)
+			LOGE("error turning the screens on");
+
+		ohmd_hid_write(priv->handle, rift_enable_leds_cv1, sizeof(rift_enable_leds_cv1));
+	}
+	else if (priv->revision == REV_DK2)
+	{
+		ohmd_hid_write(priv->handle, rift_enable_leds_dk2, sizeof(rift_enable_leds_dk2));
+	}
+}
+
+static void start_keep_alive(rift_priv* priv)
+{
+	unsigned char buf[FEATURE_BUFFER_SIZE];
+
+	// set keep alive interval to n seconds
+	pkt_keep_alive keep_alive = { 0, KEEP_ALIVE_VALUE };
+	int size = encode_keep_alive(buf, &keep_alive);
+	if (send_feature_report(priv, buf, size) == -1)
+		LOGE("error setting up keepalive");
+
+	// Update the time of the last keep alive we have sent.
+	priv->last_keep_alive = ohmd_ctx_get_time(priv->base.ctx);
+
+	// update sensor settings with new keep alive value
+	// (which will have been ignored in favor of the default 1000 ms one)
+	size = get_feature_report(priv, RIFT_CMD_SENSOR_CONFIG, buf);
+	decode_sensor_config(&priv->sensor_config, buf, size);
+	dump_packet_sensor_config(&priv->sensor_config);
+}
+
+static void* reopen_device(ohmd_device* device)
+{
+	rift_priv* priv = rift_priv_get(device);
+	return ohmd_hid_reopen(&priv->identity);
+}
+
+// The Rift came back from a reset with its defaults, set it up again. The
+// calibration and the fusion state are still good.
+static void resume_device(ohmd_device* device, void* link)
+{
+	rift_priv* priv = rift_priv_get(device);
+
+	ohmd_hid_close(priv->handle);
+	priv->handle = link;
+
+	if(ohmd_hid_set_nonblocking(priv->handle, 1) == -1)
+		LOGE("failed to set non-blocking on device");
+
+	// the sensor counts time from its reset
+	priv->last_imu_timestamp = -1;
+
+	set_coordinate_frame(priv, priv->coordinate_frame);
+	enable_components(priv);
+	start_keep_alive(priv);
+}
+
 static void close_device(ohmd_device* device)
 {
 	LOGD("closing device");
 	rift_priv* priv = rift_priv_get(device);
-	hid_close(priv->handle);
+	ohmd_hid_close(priv->handle);
+	free(priv->leds);
 	free(priv);
 }
 
+static bool load_cache(rift_priv* priv, const ohmd_cache_key* key)
+{
+	size_t size;
+	rift_cache_data* data = ohmd_cache_load(priv->base.ctx, key, &size);
+	if(!data)
+		return false;
+
+	size_t leds_size = size >= sizeof(rift_cache_data) ? size - sizeof(rift_cache_data) : 1;
+	if(leds_size % sizeof(rift_led) != 0 || data->num_leds != leds_size / sizeof(rift_led)){
+		LOGW("ignoring cached data of unexpected size %u", (unsigned)size);
+		free(data);
+		return false;
+	}
+
+	if(data->num_leds > 0){
+		priv->leds = malloc(leds_size);
+		if(!priv->leds){
+			free(data);
+			return false;
+		}
+
+		memcpy(priv->leds, (unsigned char*)data + sizeof(rift_cache_data), leds_size);
+	}
+
+	priv->sensor_range = data->sensor_range;
+	priv->display_info = data->display_info;
+	priv->imu.pos = data->imu_pos;
+	priv->num_leds = (int)data->num_leds;
+
+	free(data);
+	return true;
+}
+
+static void store_cache(rift_priv* priv, const ohmd_cache_key* key)
+{
+	size_t leds_size = priv->num_leds * sizeof(rift_led);
+	rift_cache_data* data = calloc(1, sizeof(rift_cache_data) + leds_size);
+	if(!data)
+		return;
+
+	data->sensor_range = priv->sensor_range;
+	data->display_info = priv->display_info;
+	data->imu_pos = priv->imu.pos;
+	data->num_leds = (uint32_t)priv->num_leds;
+	if(leds_size > 0)
+		memcpy((unsigned char*)data + sizeof(rift_cache_data), priv->leds, leds_size);
+
+	ohmd_cache_store(priv->base.ctx, key, data, sizeof(rift_cache_data) + leds_size);
+	free(data);
+}
+
 #define UDEV_WIKI_URL "https://github.com/OpenHMD/OpenHMD/wiki/Udev-rules-list"
 
 static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
@@ -229,11 +393,12 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 		goto cleanup;
 
 	priv->last_imu_timestamp = -1;
+	priv->revision = desc->revision;
 
 	priv->base.ctx = driver->ctx;
 
 	// Open the HID device
-	priv->handle = hid_open_path(desc->path);
+	priv->handle = ohmd_hid_open_path(driver->ctx, desc->path);
 
 	if(!priv->handle) {
 		char* path = _hid_to_unix_path(desc->path);
@@ -244,7 +409,7 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 		goto cleanup;
 	}
 
-	if(hid_set_nonblocking(priv->handle, 1) == -1){
+	if(ohmd_hid_set_nonblocking(priv->handle, 1) == -1){
 		ohmd_set_error(driver->ctx, "failed to set non-blocking on device");
 		goto cleanup;
 	}
@@ -253,15 +418,25 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 
 	int size;
 
-	// Read and decode the sensor range
-	size = get_feature_report(priv, RIFT_CMD_RANGE, buf);
-	decode_sensor_range(&priv->sensor_range, buf, size);
-	dump_packet_sensor_range(&priv->sensor_range);
-
-	// Read and decode display information
-	size = get_feature_report(priv, RIFT_CMD_DISPLAY_INFO, buf);
-	decode_sensor_display_info(&priv->display_info, buf, size);
-	dump_packet_sensor_display_info(&priv->display_info);
+	// The range, display information and LED positions never change, take
+	// them from the device cache when they are there
+	ohmd_cache_key cache_key;
+	bool cacheable = ohmd_cache_key_init(&cache_key, "rift", RIFT_CACHE_FORMAT, priv->handle,
+		ohmd_hid_find_device(driver->ctx, desc->path));
+	bool cached = cacheable && load_cache(priv, &cache_key);
+	bool read_ok = true;
+
+	if(!cached){
+		// Read and decode the sensor range
+		size = get_feature_report(priv, RIFT_CMD_RANGE, buf);
+		read_ok = decode_sensor_range(&priv->sensor_range, buf, size) && read_ok;
+		dump_packet_sensor_range(&priv->sensor_range);
+
+		// Read and decode display information
+		size = get_feature_report(priv, RIFT_CMD_DISPLAY_INFO, buf);
+		read_ok = decode_sensor_display_info(&priv->display_info, buf, size) && read_ok;
+		dump_packet_sensor_display_info(&priv->display_info);
+	}
 
 	// Read and decode the sensor config
 	size = get_feature_report(priv, RIFT_CMD_SENSOR_CONFIG, buf);
@@ -278,25 +453,13 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	// apply sensor config
 	set_coordinate_frame(priv, priv->coordinate_frame);
 
-	// Turn the screens on
-	if (desc->revision == REV_CV1)
-	{
-		size = encode_enable_components(buf, true, true, true);
-		if (send_feature_report(priv, buf, size) == -1)
-			LOGE("error turning the screens on");
-
-		hid_write(priv->handle, rift_enable_leds_cv1, sizeof(rift_enable_leds_cv1));
-	}
-	else if (desc->revision == REV_DK2)
-	{
-		hid_write(priv->handle, rift_enable_leds_dk2, sizeof(rift_enable_leds_dk2));
-	}
+	enable_components(priv);
 
 	pkt_position_info pos;
 	int first_index = -1;
 
 	//Get LED positions
-	while (true) {
+	while (!cached) {
 		size = get_feature_report(priv, RIFT_CMD_POSITION_INFO, buf);
 		if (size <= 0 || !decode_position_info(&pos, buf, size) ||
 		    first_index == pos.index) {
@@ -306,13 +469,14 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 		if (first_index < 0) {
 			first_index = pos.index;
 			priv->leds = calloc(pos.num, sizeof(rift_led));
+			priv->num_leds = priv->leds ? pos.num : 0;
 		}
 
 		if (pos.flags == 1) { //reports 0's
 			priv->imu.pos.x = (float)pos.pos_x;
 			priv->imu.pos.y = (float)pos.pos_y;
 			priv->imu.pos.z = (float)pos.pos_z;
-		} else if (pos.flags == 2) {
+		} else if (pos.flags == 2 && pos.index < priv->num_leds) {
 			rift_led *led = &priv->leds[pos.index];
 			led->pos.x = (float)pos.pos_x;
 			led->pos.y = (float)pos.pos_y;
@@ -324,20 +488,11 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 		}
 	}
 
-	// set keep alive interval to n seconds
-	pkt_keep_alive keep_alive = { 0, KEEP_ALIVE_VALUE };
-	size = encode_keep_alive(buf, &keep_alive);
-	if (send_feature_report(priv, buf, size) == -1)
-		LOGE("error setting up keepalive");
+	// don't cache what a flaky read got wrong
+	if (!cached && cacheable && read_ok)
+		store_cache(priv, &cache_key);
 
-	// Update the time of the last keep alive we have sent.
-	priv->last_keep_alive = ohmd_get_tick();
-
-	// update sensor settings with new keep alive value
-	// (which will have been ignored in favor of the default 1000 ms one)
-	size = get_feature_report(priv, RIFT_CMD_SENSOR_CONFIG, buf);
-	decode_sensor_config(&priv->sensor_config, buf, size);
-	dump_packet_sensor_config(&priv->sensor_config);
+	start_keep_alive(priv);
 
 	// Set default device properties
 	ohmd_set_default_device_properties(&priv->base.properties);
@@ -397,13 +552,22 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 			priv->display_info.h_screen_size/2 - priv->display_info.lens_separation/2,
 			priv->display_info.eye_to_screen_distance[0]);
 
+	ohmd_hid_get_identity(driver->ctx, priv->handle, desc->path, &priv->identity);
+
 	// set up device callbacks
+	priv->base.read = read_device;
 	priv->base.update = update_device;
 	priv->base.close = close_device;
+	priv->base.get_fd = get_fd;
 	priv->base.getf = getf;
+	priv->base.reopen = reopen_device;
+	priv->base.resume = resume_device;
 
 	// initialize sensor fusion
 	ofusion_init(&priv->sensor_fusion);
+	osq_init(&priv->samples);
+	priv->base.samples = &priv->samples;
+	priv->base.sensor_fusion = &priv->sensor_fusion;
 
 	return &priv->base;
 
@@ -418,6 +582,15 @@ cleanup:
 #define SAMSUNG_ELECTRONICS_CO_ID 0x04e8
 #define RIFT_ID_COUNT 5
 
+static const ohmd_hid_match rift_matches[] = {
+	{ OCULUS_VR_INC_ID, 0x0001 },
+	{ OCULUS_VR_INC_ID, 0x0021 },
+	{ OCULUS_VR_INC_ID, 0x2021 },
+	{ OCULUS_VR_INC_ID, 0x0031 },
+	{ SAMSUNG_ELECTRONICS_CO_ID, 0xa500 },
+	{ 0, 0 }
+};
+
 static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 {
 	// enumerate HID devices and add any Rifts found to the device list
@@ -432,15 +605,13 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 	};
 
 	for(int i = 0; i < RIFT_ID_COUNT; i++){
-		struct hid_device_info* devs = hid_enumerate(rd[i].company, rd[i].id);
-		struct hid_device_info* cur_dev = devs;
-
-		if(devs == NULL)
-			continue;
+		ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(driver->ctx, NULL, rd[i].company, rd[i].id);
 
 		while (cur_dev) {
 			if(rd[i].iface == -1 || cur_dev->interface_number == rd[i].iface){
-				ohmd_device_desc* desc = &list->devices[list->num_devices++];
+				ohmd_device_desc* desc = ohmd_device_list_add(list);
+				if(!desc)
+					return;
 
 				strcpy(desc->driver, "OpenHMD Rift Driver");
 				strcpy(desc->vendor, "Oculus VR, Inc.");
@@ -456,17 +627,14 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 				desc->driver_ptr = driver;
 			}
 
-			cur_dev = cur_dev->next;
+			cur_dev = ohmd_hid_next_device(driver->ctx, cur_dev, rd[i].company, rd[i].id);
 		}
-
-		hid_free_enumeration(devs);
 	}
 }
 
 static void destroy_driver(ohmd_driver* drv)
 {
 	LOGD("shutting down driver");
-	hid_exit();
 	free(drv);
 
 	ohmd_toggle_ovr_service(1); //re-enable OVRService if previously running
@@ -484,6 +652,7 @@ ohmd_driver* ohmd_create_oculus_rift_drv(ohmd_context* ctx)
 	drv->open_device = open_device;
 	drv->destroy = destroy_driver;
 	drv->ctx = ctx;
+	drv->hid_matches = rift_matches;
 
 	return drv;
 }
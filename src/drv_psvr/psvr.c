@@ -16,19 +16,19 @@
 
 #include <string.h>
 #include <wchar.h>
-#include <hidapi.h>
 #include <assert.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "psvr.h"
+#include "../hid.h"
 
 typedef struct {
 	ohmd_device base;
 
-	hid_device* hmd_handle;
-	hid_device* hmd_control;
+	ohmd_hid_device* hmd_handle;
+	ohmd_hid_device* hmd_control;
 	fusion sensor_fusion;
 	vec3f raw_accel, raw_gyro;
 	uint32_t last_ticks;
@@ -80,7 +80,7 @@ static void update_device(ohmd_device* device)
 	unsigned char buffer[FEATURE_BUFFER_SIZE];
 
 	while(true){
-		int size = hid_read(priv->hmd_handle, buffer, FEATURE_BUFFER_SIZE);
+		int size = ohmd_hid_read(priv->hmd_handle, buffer, FEATURE_BUFFER_SIZE);
 		if(size < 0){
 			LOGE("error reading from device");
 			return;
@@ -134,32 +134,37 @@ static int getf(ohmd_device* device, ohmd_float_value type, float* out)
 	return 0;
 }
 
+static int get_fd(ohmd_device* device)
+{
+	psvr_priv* priv = (psvr_priv*)device;
+	return ohmd_hid_get_fd(priv->hmd_handle);
+}
+
 static void close_device(ohmd_device* device)
 {
 	psvr_priv* priv = (psvr_priv*)device;
 
 	LOGD("closing HTC PSVR device");
 
-	hid_close(priv->hmd_handle);
-	hid_close(priv->hmd_control);
+	ohmd_hid_close(priv->hmd_handle);
+	ohmd_hid_close(priv->hmd_control);
 
 	free(device);
 }
 
-static hid_device* open_device_idx(int manufacturer, int product, int iface, int device_index)
+static ohmd_hid_device* open_device_idx(ohmd_context* ctx, int manufacturer, int product, int iface, int device_index)
 {
-	struct hid_device_info* devs = hid_enumerate(manufacturer, product);
-	struct hid_device_info* cur_dev = devs;
+	ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(ctx, NULL, manufacturer, product);
 
 	int idx = 0;
-	hid_device* ret = NULL;
+	ohmd_hid_device* ret = NULL;
 
 	while (cur_dev) {
 		LOGI("%04x:%04x %s\n", manufacturer, product, cur_dev->path);
 
 		if (cur_dev->interface_number == iface) {
 			if(idx == device_index){
-				ret = hid_open_path(cur_dev->path);
+				ret = ohmd_hid_open_path(ctx, cur_dev->path);
 				LOGI("opening\n");
 				break;
 			}
@@ -167,11 +172,9 @@ static hid_device* open_device_idx(int manufacturer, int product, int iface, int
 			idx++;
 		}
 
-		cur_dev = cur_dev->next;
+		cur_dev = ohmd_hid_next_device(ctx, cur_dev, manufacturer, product);
 	}
 
-	hid_free_enumeration(devs);
-
 	return ret;
 }
 
@@ -187,32 +190,32 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	int idx = atoi(desc->path);
 
 	// Open the HMD device
-	priv->hmd_handle = open_device_idx(SONY_ID, PSVR_HMD, 4, idx);
+	priv->hmd_handle = open_device_idx(driver->ctx, SONY_ID, PSVR_HMD, 4, idx);
 
 	if(!priv->hmd_handle)
 		goto cleanup;
 
-	if(hid_set_nonblocking(priv->hmd_handle, 1) == -1){
+	if(ohmd_hid_set_nonblocking(priv->hmd_handle, 1) == -1){
 		ohmd_set_error(driver->ctx, "failed to set non-blocking on device");
 		goto cleanup;
 	}
 
 	// Open the HMD Control device
-	priv->hmd_control = open_device_idx(SONY_ID, PSVR_HMD, 5, idx);
+	priv->hmd_control = open_device_idx(driver->ctx, SONY_ID, PSVR_HMD, 5, idx);
 
 	if(!priv->hmd_control)
 		goto cleanup;
 
-	if(hid_set_nonblocking(priv->hmd_control, 1) == -1){
+	if(ohmd_hid_set_nonblocking(priv->hmd_control, 1) == -1){
 		ohmd_set_error(driver->ctx, "failed to set non-blocking on device");
 		goto cleanup;
 	}
 
 	// turn the display on
-	hid_write(priv->hmd_control, psvr_power_on, sizeof(psvr_power_on));
+	ohmd_hid_write(priv->hmd_control, psvr_power_on, sizeof(psvr_power_on));
 	
 	// set VR mode for the hmd
-	hid_write(priv->hmd_control, psvr_vrmode_on, sizeof(psvr_vrmode_on));
+	ohmd_hid_write(priv->hmd_control, psvr_vrmode_on, sizeof(psvr_vrmode_on));
 
 	// Set default device properties
 	ohmd_set_default_device_properties(&priv->base.properties);
@@ -237,9 +240,11 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	// set up device callbacks
 	priv->base.update = update_device;
 	priv->base.close = close_device;
+	priv->base.get_fd = get_fd;
 	priv->base.getf = getf;
 
 	ofusion_init(&priv->sensor_fusion);
+	priv->base.sensor_fusion = &priv->sensor_fusion;
 
 	return (ohmd_device*)priv;
 
@@ -250,10 +255,14 @@ cleanup:
 	return NULL;
 }
 
+static const ohmd_hid_match psvr_matches[] = {
+	{ SONY_ID, PSVR_HMD },
+	{ 0, 0 }
+};
+
 static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 {
-	struct hid_device_info* devs = hid_enumerate(SONY_ID, PSVR_HMD);
-	struct hid_device_info* cur_dev = devs;
+	ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(driver->ctx, NULL, SONY_ID, PSVR_HMD);
 
 	int idx = 0;
 	while (cur_dev) {
@@ -270,7 +279,9 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 
 		// Register one device for each IMU sensor interface
 		if (cur_dev->interface_number == 4) {
-			desc = &list->devices[list->num_devices++];
+			desc = ohmd_device_list_add(list);
+			if(!desc)
+				return;
 
 			strcpy(desc->driver, "OpenHMD Sony PSVR Driver");
 			strcpy(desc->vendor, "Sony");
@@ -288,10 +299,8 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 			idx++;
 		}
 
-		cur_dev = cur_dev->next;
+		cur_dev = ohmd_hid_next_device(driver->ctx, cur_dev, SONY_ID, PSVR_HMD);
 	}
-
-	hid_free_enumeration(devs);
 }
 
 static void destroy_driver(ohmd_driver* drv)
@@ -311,6 +320,7 @@ ohmd_driver* ohmd_create_psvr_drv(ohmd_context* ctx)
 	drv->open_device = open_device;
 	drv->destroy = destroy_driver;
 	drv->ctx = ctx;
+	drv->hid_matches = psvr_matches;
 
 	return drv;
 }
@@ -0,0 +1,515 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Replay Driver - plays HID capture files back through the other drivers */
+
+#include <string.h>
+#include "../openhmdi.h"
+#include "../capture.h"
+
+// The capture file is named by OHMD_REPLAY. Its devices are listed the way
+// the driver they were captured with lists them, and opened by that driver
+// on a transport serving the captured traffic, so the reports go through
+// the original decoders.
+//
+// OHMD_REPLAY_SPEED scales the playback, 0 plays it as fast as it's read:
+// a read then returns the reports in the batches they were read in when
+// capturing. The speed is relative to the context clock, so a replay on a
+// virtual clock runs at that clock's pace. OHMD_REPLAY_START skips that many
+// seconds of the capture.
+
+#define NS_PER_SEC 1000000000.0
+
+typedef struct {
+	uint16_t id;
+	uint64_t offset; // just past the device record
+	uint64_t time;
+	const ohmd_capture_device* info;
+	bool opened;
+} replay_device;
+
+typedef struct {
+	ohmd_hid_transport base;
+	ohmd_context* ctx;
+	ohmd_capture_reader* reader;
+	double speed;
+	uint64_t start_time;
+
+	replay_device* devices;
+	int num_devices;
+} replay_transport;
+
+typedef struct {
+	ohmd_hid_device base;
+	replay_transport* transport;
+	replay_device* device;
+	bool nonblocking;
+	bool finished;
+
+	uint64_t input_offset;
+	uint64_t feature_offset;
+
+	uint64_t capture_start; // capture time played back at host_start
+	double host_start;
+} replay_handle;
+
+typedef struct {
+	ohmd_driver base;
+	replay_transport transport;
+	ohmd_hid_device_info* hid_devices; // the captured devices, for the other drivers to find
+
+	// the descriptions of the other drivers, by ohmd_device_desc.id
+	ohmd_device_list originals;
+} replay_driver;
+
+static wchar_t* to_wide(const char* str)
+{
+	size_t len = strlen(str);
+	wchar_t* ret = calloc(len + 1, sizeof(wchar_t));
+
+	for(size_t i = 0; ret && i <= len; i++)
+		ret[i] = (unsigned char)str[i];
+
+	return ret;
+}
+
+static ohmd_hid_device_info* replay_enumerate(ohmd_hid_transport* transport, unsigned short vendor_id, unsigned short product_id)
+{
+	replay_transport* replay = (replay_transport*)transport;
+	ohmd_hid_device_info* first = NULL;
+	ohmd_hid_device_info** next = &first;
+
+	for(int i = 0; i < replay->num_devices; i++){
+		const ohmd_capture_device* dev = replay->devices[i].info;
+
+		if((vendor_id != 0 && dev->vendor_id != vendor_id) || (product_id != 0 && dev->product_id != product_id))
+			continue;
+
+		// a device opened more than once in the capture is listed once
+		bool listed = false;
+		for(int j = 0; j < i; j++)
+			listed = listed || strcmp(replay->devices[j].info->path, dev->path) == 0;
+
+		if(listed)
+			continue;
+
+		ohmd_hid_device_info* info = calloc(1, sizeof(ohmd_hid_device_info));
+		if(!info)
+			break;
+
+		info->path = malloc(strlen(dev->path) + 1);
+		strcpy(info->path, dev->path);
+		info->vendor_id = dev->vendor_id;
+		info->product_id = dev->product_id;
+		info->release_number = dev->release_number;
+		info->usage_page = dev->usage_page;
+		info->usage = dev->usage;
+		info->interface_number = dev->interface_number;
+		info->manufacturer_string = to_wide(dev->manufacturer);
+		info->product_string = to_wide(dev->product);
+		info->serial_number = to_wide(dev->serial_number);
+
+		*next = info;
+		next = &info->next;
+	}
+
+	return first;
+}
+
+static void replay_free_enumeration(ohmd_hid_transport* transport, ohmd_hid_device_info* devs)
+{
+	while(devs){
+		ohmd_hid_device_info* next = devs->next;
+		free(devs->path);
+		free(devs->manufacturer_string);
+		free(devs->product_string);
+		free(devs->serial_number);
+		free(devs);
+		devs = next;
+	}
+}
+
+static ohmd_hid_device* replay_open_path(ohmd_hid_transport* transport, const char* path)
+{
+	replay_transport* replay = (replay_transport*)transport;
+	replay_device* device = NULL;
+
+	// a device opened again plays its next session in the capture, the last one repeats
+	for(int i = 0; i < replay->num_devices; i++){
+		if(strcmp(replay->devices[i].info->path, path) != 0)
+			continue;
+
+		device = &replay->devices[i];
+		if(!device->opened)
+			break;
+	}
+
+	if(!device)
+		return NULL;
+
+	replay_handle* handle = calloc(1, sizeof(replay_handle));
+	if(!handle)
+		return NULL;
+
+	device->opened = true;
+
+	handle->base.transport = transport;
+	handle->transport = replay;
+	handle->device = device;
+	handle->input_offset = device->offset;
+	handle->feature_offset = device->offset;
+	handle->capture_start = device->time;
+	handle->host_start = ohmd_ctx_get_time(replay->ctx);
+
+	if(replay->start_time > device->time){
+		uint64_t offset = OHMD_MAX(ohmd_capture_reader_seek(replay->reader, replay->start_time), device->offset);
+		const ohmd_capture_record* record;
+		const unsigned char* payload;
+
+		// the index points at or before the record, find it
+		while(true){
+			handle->input_offset = offset;
+			record = ohmd_capture_reader_next(replay->reader, &offset, &payload);
+			if(!record || record->time >= replay->start_time)
+				break;
+		}
+
+		handle->capture_start = replay->start_time;
+	}
+
+	return &handle->base;
+}
+
+static void replay_exit(ohmd_hid_transport* transport)
+{
+}
+
+static void replay_close(ohmd_hid_device* dev)
+{
+	free(dev);
+}
+
+static int replay_set_nonblocking(ohmd_hid_device* dev, int nonblock)
+{
+	((replay_handle*)dev)->nonblocking = nonblock;
+	return 0;
+}
+
+// the next record of the handle's device at or after offset
+static const ohmd_capture_record* next_record(replay_handle* handle, uint64_t* offset, const unsigned char** payload)
+{
+	const ohmd_capture_record* record;
+
+	while((record = ohmd_capture_reader_next(handle->transport->reader, offset, payload))){
+		if(record->device == handle->device->id)
+			return record;
+	}
+
+	return NULL;
+}
+
+static int replay_read(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	replay_handle* handle = (replay_handle*)dev;
+	double speed = handle->transport->speed;
+
+	while(true){
+		uint64_t offset = handle->input_offset;
+		const unsigned char* payload;
+		const ohmd_capture_record* record = next_record(handle, &offset, &payload);
+
+		if(!record){
+			if(!handle->finished)
+				LOGI("replay of %s finished", handle->device->info->path);
+
+			handle->finished = true;
+			return 0;
+		}
+
+		if(record->type == OHMD_CAPTURE_READ_EMPTY){
+			handle->input_offset = offset;
+
+			// as fast as possible the reports come in the batches they were captured in
+			if(speed == 0 && handle->nonblocking)
+				return 0;
+
+			continue;
+		}
+
+		if(record->type != OHMD_CAPTURE_INPUT){
+			handle->input_offset = offset;
+			continue;
+		}
+
+		if(speed > 0){
+			double due = handle->host_start + ((double)record->time - (double)handle->capture_start) / NS_PER_SEC / speed;
+			double now = ohmd_ctx_get_time(handle->transport->ctx);
+
+			if(now < due){
+				if(handle->nonblocking)
+					return 0;
+
+				ohmd_ctx_sleep(handle->transport->ctx, due - now);
+			}
+		}
+
+		handle->input_offset = offset;
+
+		size_t size = OHMD_MIN(length, record->size);
+		memcpy(data, payload, size);
+
+		return (int)size;
+	}
+}
+
+static int replay_write(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	return (int)length;
+}
+
+static int replay_send_feature_report(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	return (int)length;
+}
+
+static const ohmd_capture_record* find_feature_report(replay_handle* handle, uint64_t* offset, unsigned char id,
+	const unsigned char** payload)
+{
+	const ohmd_capture_record* record;
+
+	while((record = next_record(handle, offset, payload))){
+		if(record->type == OHMD_CAPTURE_FEATURE_GET && record->size > 0 && (*payload)[0] == id)
+			return record;
+	}
+
+	return NULL;
+}
+
+static int replay_get_feature_report(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	replay_handle* handle = (replay_handle*)dev;
+	const unsigned char* payload;
+
+	// the reports are answered in the order they were asked for when
+	// capturing, a report asked for again starts over from the beginning
+	uint64_t offset = handle->feature_offset;
+	const ohmd_capture_record* record = find_feature_report(handle, &offset, data[0], &payload);
+
+	if(!record){
+		offset = handle->device->offset;
+		record = find_feature_report(handle, &offset, data[0], &payload);
+	}
+
+	if(!record || (record->flags & OHMD_CAPTURE_FLAG_FAILED))
+		return -1;
+
+	handle->feature_offset = offset;
+
+	size_t size = OHMD_MIN(length, record->size);
+	memcpy(data, payload, size);
+
+	return (int)size;
+}
+
+static int replay_get_string(ohmd_hid_device* dev, ohmd_hid_string string, wchar_t* out, size_t maxlen)
+{
+	const ohmd_capture_device* info = ((replay_handle*)dev)->device->info;
+	const char* str = NULL;
+
+	switch(string){
+	case OHMD_HID_MANUFACTURER_STRING: str = info->manufacturer; break;
+	case OHMD_HID_PRODUCT_STRING: str = info->product; break;
+	case OHMD_HID_SERIAL_NUMBER_STRING: str = info->serial_number; break;
+	}
+
+	if(!str || maxlen == 0)
+		return -1;
+
+	size_t i;
+	for(i = 0; i < maxlen - 1 && str[i]; i++)
+		out[i] = (unsigned char)str[i];
+	out[i] = L'\0';
+
+	return 0;
+}
+
+static bool load_capture(replay_driver* priv, const char* path)
+{
+	replay_transport* replay = &priv->transport;
+	ohmd_capture_index index;
+
+	replay->reader = ohmd_capture_reader_open(path);
+	if(!replay->reader){
+		ohmd_set_error(priv->base.ctx, "could not open capture file %s", path);
+		return false;
+	}
+
+	ohmd_capture_reader_get_index(replay->reader, &index);
+	replay->devices = calloc(index.num_devices + 1, sizeof(replay_device));
+	if(!replay->devices)
+		return false;
+
+	uint64_t offset = ohmd_capture_reader_begin(replay->reader);
+	uint64_t first_time = 0;
+	const ohmd_capture_record* record;
+	const unsigned char* payload;
+
+	while((record = ohmd_capture_reader_next(replay->reader, &offset, &payload))){
+		if(first_time == 0)
+			first_time = record->time;
+
+		if(record->type != OHMD_CAPTURE_DEVICE || record->size != sizeof(ohmd_capture_device)
+		  || replay->num_devices == (int)index.num_devices)
+			continue;
+
+		replay_device* device = &replay->devices[replay->num_devices++];
+		device->id = record->device;
+		device->offset = offset;
+		device->time = record->time;
+		device->info = (const ohmd_capture_device*)payload;
+	}
+
+	const char* speed = getenv("OHMD_REPLAY_SPEED");
+	replay->speed = speed ? OHMD_MAX(strtod(speed, NULL), 0.0) : 1.0;
+
+	const char* start = getenv("OHMD_REPLAY_START");
+	if(start)
+		replay->start_time = first_time + (uint64_t)(OHMD_MAX(strtod(start, NULL), 0.0) * NS_PER_SEC);
+
+	LOGI("replaying %d devices from %s", replay->num_devices, path);
+
+	return true;
+}
+
+static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
+{
+	replay_driver* priv = (replay_driver*)driver;
+	ohmd_context* ctx = driver->ctx;
+
+	if(desc->id < 0 || desc->id >= priv->originals.num_devices){
+		ohmd_set_error(ctx, "unknown replayed device %d", desc->id);
+		return NULL;
+	}
+
+	ohmd_device_desc* original = &priv->originals.devices[desc->id];
+
+	// the driver opens the device on the replay transport, the device keeps
+	// it, nothing else is opened meanwhile (see open_exclusive)
+	ohmd_hid_transport* transport = ctx->hid_transport;
+	ohmd_hid_device_info* hid_devices = ctx->hid_devices;
+	ctx->hid_transport = &priv->transport.base;
+	ctx->hid_devices = priv->hid_devices;
+
+	ohmd_device* device = original->driver_ptr->open_device(original->driver_ptr, original);
+
+	ctx->hid_transport = transport;
+	ctx->hid_devices = hid_devices;
+
+	return device;
+}
+
+static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
+{
+	replay_driver* priv = (replay_driver*)driver;
+	ohmd_context* ctx = driver->ctx;
+
+	const char* path = getenv("OHMD_REPLAY");
+	if(!path || !*path)
+		return;
+
+	if(!priv->transport.reader){
+		if(!load_capture(priv, path))
+			return;
+
+		priv->hid_devices = replay_enumerate(&priv->transport.base, 0, 0);
+	}
+
+	ohmd_device_list* captured = &priv->originals;
+	captured->num_devices = 0;
+
+	// let the other drivers find their devices in the capture
+	ohmd_hid_transport* transport = ctx->hid_transport;
+	ohmd_hid_device_info* hid_devices = ctx->hid_devices;
+	ctx->hid_transport = &priv->transport.base;
+	ctx->hid_devices = priv->hid_devices;
+
+	for(int i = 0; i < ctx->num_drivers; i++){
+		ohmd_driver* other = ctx->drivers[i];
+		if(other != driver && (!other->hid_matches || ohmd_hid_probe_matches(ctx, other->hid_matches)))
+			other->get_device_list(other, captured);
+	}
+
+	ctx->hid_transport = transport;
+	ctx->hid_devices = hid_devices;
+
+	for(int i = 0; i < captured->num_devices; i++){
+		ohmd_device_desc* original = &captured->devices[i];
+
+		// skip the devices that don't come from the capture, like the null devices
+		bool replayed = false;
+		for(int j = 0; j < priv->transport.num_devices; j++)
+			replayed = replayed || strcmp(priv->transport.devices[j].info->path, original->path) == 0;
+
+		if(!replayed)
+			continue;
+
+		ohmd_device_desc* desc = ohmd_device_list_add(list);
+		if(!desc)
+			return;
+
+		*desc = *original;
+
+		strcpy(desc->driver, "OpenHMD Replay Driver");
+		desc->driver_ptr = driver;
+		desc->id = i;
+	}
+}
+
+static void destroy_driver(ohmd_driver* drv)
+{
+	replay_driver* priv = (replay_driver*)drv;
+
+	LOGD("shutting down replay driver");
+
+	replay_free_enumeration(&priv->transport.base, priv->hid_devices);
+
+	if(priv->transport.reader)
+		ohmd_capture_reader_close(priv->transport.reader);
+
+	free(priv->transport.devices);
+	ohmd_device_list_free(&priv->originals);
+	free(priv);
+}
+
+ohmd_driver* ohmd_create_replay_drv(ohmd_context* ctx)
+{
+	replay_driver* priv = ohmd_alloc(ctx, sizeof(replay_driver));
+	if(!priv)
+		return NULL;
+
+	priv->base.get_device_list = get_device_list;
+	priv->base.open_device = open_device;
+	priv->base.destroy = destroy_driver;
+	priv->base.ctx = ctx;
+	priv->base.open_exclusive = true;
+
+	replay_transport* replay = &priv->transport;
+	replay->ctx = ctx;
+	replay->base.enumerate = replay_enumerate;
+	replay->base.free_enumeration = replay_free_enumeration;
+	replay->base.open_path = replay_open_path;
+	replay->base.exit = replay_exit;
+	replay->base.close = replay_close;
+	replay->base.set_nonblocking = replay_set_nonblocking;
+	replay->base.read = replay_read;
+	replay->base.write = replay_write;
+	replay->base.send_feature_report = replay_send_feature_report;
+	replay->base.get_feature_report = replay_get_feature_report;
+	replay->base.get_string = replay_get_string;
+
+	return &priv->base;
+}
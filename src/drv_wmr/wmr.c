@@ -15,18 +15,18 @@
 
 #include <string.h>
 #include <wchar.h>
-#include <hidapi.h>
 #include <assert.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "wmr.h"
+#include "../hid.h"
 
 typedef struct {
 	ohmd_device base;
 
-	hid_device* hmd_imu;
+	ohmd_hid_device* hmd_imu;
 	fusion sensor_fusion;
 	vec3f raw_accel, raw_gyro;
 	uint32_t last_ticks;
@@ -81,7 +81,7 @@ static void handle_tracker_sensor_msg(wmr_priv* priv, unsigned char* buffer, int
 	hololens_sensors_packet* s = &priv->sensor;
 
 
-	vec3f mag = {{0.0f, 0.0f, 0.0f}};
+	ofusion_sample samples[4];
 
 	for(int i = 0; i < 4; i++){
 		uint64_t tick_delta = 1000;
@@ -93,10 +93,13 @@ static void handle_tracker_sensor_msg(wmr_priv* priv, unsigned char* buffer, int
 		vec3f_from_hololens_gyro(s->gyro, i, &priv->raw_gyro);
 		vec3f_from_hololens_accel(s->accel, i, &priv->raw_accel);
 
-		ofusion_update(&priv->sensor_fusion, dt, &priv->raw_gyro, &priv->raw_accel, &mag);
+		ofusion_sample sample = { dt, priv->raw_gyro, priv->raw_accel, {{0.0f, 0.0f, 0.0f}} };
+		samples[i] = sample;
 
 		last_sample_tick = s->gyro_timestamp[i];
 	}
+
+	ofusion_update_batch(&priv->sensor_fusion, samples, 4);
 }
 
 static void update_device(ohmd_device* device)
@@ -107,7 +110,7 @@ static void update_device(ohmd_device* device)
 	unsigned char buffer[FEATURE_BUFFER_SIZE];
 
 	while(true){
-		int size = hid_read(priv->hmd_imu, buffer, FEATURE_BUFFER_SIZE);
+		int size = ohmd_hid_read(priv->hmd_imu, buffer, FEATURE_BUFFER_SIZE);
 		if(size < 0){
 			LOGE("error reading from device");
 			return;
@@ -155,35 +158,40 @@ static int getf(ohmd_device* device, ohmd_float_value type, float* out)
 	return 0;
 }
 
+static int get_fd(ohmd_device* device)
+{
+	wmr_priv* priv = (wmr_priv*)device;
+	return ohmd_hid_get_fd(priv->hmd_imu);
+}
+
 static void close_device(ohmd_device* device)
 {
 	wmr_priv* priv = (wmr_priv*)device;
 
 	LOGD("closing Microsoft HoloLens Sensors device");
 
-	hid_close(priv->hmd_imu);
+	ohmd_hid_close(priv->hmd_imu);
 
 	free(device);
 }
 
-static hid_device* open_device_idx(int manufacturer, int product, int iface, int iface_tot, int device_index)
+static ohmd_hid_device* open_device_idx(ohmd_context* ctx, int manufacturer, int product, int iface, int iface_tot, int device_index)
 {
-	struct hid_device_info* devs = hid_enumerate(manufacturer, product);
-	struct hid_device_info* cur_dev = devs;
+	ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(ctx, NULL, manufacturer, product);
 
 	int idx = 0;
 	int iface_cur = 0;
-	hid_device* ret = NULL;
+	ohmd_hid_device* ret = NULL;
 
 	while (cur_dev) {
 		LOGI("%04x:%04x %s\n", manufacturer, product, cur_dev->path);
 
 		if(idx == device_index && iface == iface_cur){
-			ret = hid_open_path(cur_dev->path);
+			ret = ohmd_hid_open_path(ctx, cur_dev->path);
 			LOGI("opening\n");
 		}
 
-		cur_dev = cur_dev->next;
+		cur_dev = ohmd_hid_next_device(ctx, cur_dev, manufacturer, product);
 
 		iface_cur++;
 
@@ -193,19 +201,17 @@ static hid_device* open_device_idx(int manufacturer, int product, int iface, int
 		}
 	}
 
-	hid_free_enumeration(devs);
-
 	return ret;
 }
 
-static int config_command_sync(hid_device* hmd_imu, unsigned char type,
+static int config_command_sync(ohmd_hid_device* hmd_imu, unsigned char type,
 			       unsigned char* buf, int len)
 {
 	unsigned char cmd[64] = { 0x02, type };
 
-	hid_write(hmd_imu, cmd, sizeof(cmd));
+	ohmd_hid_write(hmd_imu, cmd, sizeof(cmd));
 	do {
-		int size = hid_read(hmd_imu, buf, len);
+		int size = ohmd_hid_read(hmd_imu, buf, len);
 		if (size == -1)
 			return -1;
 		if (buf[0] == 0x02)
@@ -297,7 +303,7 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	int idx = atoi(desc->path);
 
 	// Open the HMD device
-	priv->hmd_imu = open_device_idx(MICROSOFT_VID, HOLOLENS_SENSORS_PID, 0, 1, idx);
+	priv->hmd_imu = open_device_idx(driver->ctx, MICROSOFT_VID, HOLOLENS_SENSORS_PID, 0, 1, idx);
 
 	if(!priv->hmd_imu)
 		goto cleanup;
@@ -312,13 +318,13 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 		free(config);
 	}
 
-	if(hid_set_nonblocking(priv->hmd_imu, 1) == -1){
+	if(ohmd_hid_set_nonblocking(priv->hmd_imu, 1) == -1){
 		ohmd_set_error(driver->ctx, "failed to set non-blocking on device");
 		goto cleanup;
 	}
 
 	// turn the IMU on
-	hid_write(priv->hmd_imu, hololens_sensors_imu_on, sizeof(hololens_sensors_imu_on));
+	ohmd_hid_write(priv->hmd_imu, hololens_sensors_imu_on, sizeof(hololens_sensors_imu_on));
 
 	// Set default device properties
 	ohmd_set_default_device_properties(&priv->base.properties);
@@ -352,9 +358,11 @@ static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
 	// set up device callbacks
 	priv->base.update = update_device;
 	priv->base.close = close_device;
+	priv->base.get_fd = get_fd;
 	priv->base.getf = getf;
 
 	ofusion_init(&priv->sensor_fusion);
+	priv->base.sensor_fusion = &priv->sensor_fusion;
 
 	return (ohmd_device*)priv;
 
@@ -365,14 +373,20 @@ cleanup:
 	return NULL;
 }
 
+static const ohmd_hid_match wmr_matches[] = {
+	{ MICROSOFT_VID, HOLOLENS_SENSORS_PID },
+	{ 0, 0 }
+};
+
 static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 {
-	struct hid_device_info* devs = hid_enumerate(MICROSOFT_VID, HOLOLENS_SENSORS_PID);
-	struct hid_device_info* cur_dev = devs;
+	ohmd_hid_device_info* cur_dev = ohmd_hid_next_device(driver->ctx, NULL, MICROSOFT_VID, HOLOLENS_SENSORS_PID);
 
 	int idx = 0;
 	while (cur_dev) {
-		ohmd_device_desc* desc = &list->devices[list->num_devices++];
+		ohmd_device_desc* desc = ohmd_device_list_add(list);
+		if(!desc)
+			return;
 
 		strcpy(desc->driver, "OpenHMD Windows Mixed Reality Driver");
 		strcpy(desc->vendor, "Microsoft");
@@ -387,11 +401,9 @@ static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
 		desc->device_class = OHMD_DEVICE_CLASS_HMD;
 		desc->device_flags = OHMD_DEVICE_FLAGS_ROTATIONAL_TRACKING;
 
-		cur_dev = cur_dev->next;
+		cur_dev = ohmd_hid_next_device(driver->ctx, cur_dev, MICROSOFT_VID, HOLOLENS_SENSORS_PID);
 		idx++;
 	}
-
-	hid_free_enumeration(devs);
 }
 
 static void destroy_driver(ohmd_driver* drv)
@@ -411,6 +423,7 @@ ohmd_driver* ohmd_create_wmr_drv(ohmd_context* ctx)
 	drv->open_device = open_device;
 	drv->destroy = destroy_driver;
 	drv->ctx = ctx;
+	drv->hid_matches = wmr_matches;
 
 	return drv;
 }
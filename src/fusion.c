@@ -21,11 +21,90 @@ void ofusion_init(fusion* me)
 
 	me->flags = FF_USE_GRAVITY;
 	me->grav_gain = 0.05f;
+
+	ofusion_mag_init(&me->mag_cal);
+
+	me->engine = &ofusion_engine_default;
 }
 
-void ofusion_update(fusion* me, float dt, const vec3f* ang_vel, const vec3f* accel, const vec3f* mag)
+bool ofusion_set_engine(fusion* me, const ofusion_engine* engine)
+{
+	if(engine->state_size > sizeof(me->engine_state))
+		return false;
+
+	me->engine = engine;
+	memset(&me->engine_state, 0, sizeof(me->engine_state));
+
+	if(engine->init)
+		engine->init(me, me->engine_state.data);
+
+	return true;
+}
+
+void ofusion_get_gyro_bias(const fusion* me, vec3f* out)
+{
+	if(me->engine->get_gyro_bias)
+		me->engine->get_gyro_bias(me->engine_state.data, out);
+	else
+		memset(out, 0, sizeof(*out));
+}
+
+void ofusion_level(quatf* orient, const vec3f* accel)
 {
-	me->ang_vel = *ang_vel;
+	vec3f up;
+	oquatf_get_rotated(orient, accel, &up);
+	ovec3f_normalize_me(&up);
+
+	// up x (0, 1, 0)
+	vec3f axis = {{ -up.z, 0, up.x }};
+	float angle = acosf(OHMD_MAX(OHMD_MIN(up.y, 1.0f), -1.0f));
+
+	if(ovec3f_get_length(&axis) > 1e-6f){
+		quatf corr_quat, old_orient = *orient;
+		oquatf_init_axis(&corr_quat, &axis, angle);
+		oquatf_mult(&corr_quat, &old_orient, orient);
+	}
+}
+
+// Maps the sensor clock onto the host clock. The smallest offset seen is the
+// sample with the least transfer latency, a slowly leaking average follows
+// the drift between the two clocks.
+static double ofusion_get_host_time(fusion* me)
+{
+	double offset = ohmd_clock_get_tick(me->clock) - me->time;
+
+	if(me->history_head == 0 || offset < me->host_time_offset)
+		me->host_time_offset = offset;
+	else
+		me->host_time_offset += (offset - me->host_time_offset) * 0.0001;
+
+	return me->time + me->host_time_offset;
+}
+
+static void ofusion_add_history(fusion* me)
+{
+	uint32_t head = me->history_head;
+	fusion_history_entry* entry = &me->history[head & (FUSION_HISTORY_SIZE - 1)];
+
+	// lookups rely on the stamps being in order, which the offset alone only
+	// guarantees as long as the host clock and the sample times never go back
+	double time = ofusion_get_host_time(me);
+	if(head > 0)
+		time = OHMD_MAX(time, me->history[(head - 1) & (FUSION_HISTORY_SIZE - 1)].time);
+
+	entry->time = time;
+	entry->orient = me->orient;
+
+	// publish the entry after it's been written
+	ohmd_atomic_store(&me->history_head, head + 1);
+}
+
+// The bookkeeping shared by all engines, done before the engine sees the sample.
+// Everything but the engine sees the gyro with its estimated bias taken out.
+static void ofusion_add_sample(fusion* me, const vec3f* gyro_bias, float dt, const vec3f* ang_vel, const vec3f* accel, const vec3f* mag)
+{
+	ovec3f_subtract(ang_vel, gyro_bias, &me->ang_vel);
+
 	me->accel = *accel;
 	me->raw_mag = *mag;
 
@@ -39,8 +118,131 @@ void ofusion_update(fusion* me, float dt, const vec3f* ang_vel, const vec3f* acc
 
 	ofq_add(&me->mag_fq, mag);
 	ofq_add(&me->accel_fq, &world_accel);
-	ofq_add(&me->ang_vel_fq, ang_vel);
+	ofq_add(&me->ang_vel_fq, &me->ang_vel);
+}
+
+void ofusion_update(fusion* me, float dt, const vec3f* ang_vel, const vec3f* accel, const vec3f* mag)
+{
+	vec3f gyro_bias;
+	ofusion_get_gyro_bias(me, &gyro_bias);
+
+	ofusion_add_sample(me, &gyro_bias, dt, ang_vel, accel, mag);
+	me->engine->update(me, me->engine_state.data, dt, ang_vel, accel);
+
+	if(me->flags & FF_USE_MAG)
+		ofusion_mag_update(&me->mag_cal, &me->orient, dt, mag, &me->mag);
+
+	// mitigate drift due to floating point
+	// inprecision with quat multiplication.
+	oquatf_normalize_me(&me->orient);
+
+	ofusion_add_history(me);
+}
+
+void ofusion_update_batch(fusion* me, const ofusion_sample* samples, int count)
+{
+	if(!me->engine->update_batch){
+		for(int i = 0; i < count; i++)
+			ofusion_update(me, samples[i].dt, &samples[i].ang_vel, &samples[i].accel, &samples[i].mag);
+		return;
+	}
+
+	if(count <= 0)
+		return;
+
+	// the engine only moves its bias in update_batch
+	vec3f gyro_bias;
+	ofusion_get_gyro_bias(me, &gyro_bias);
+
+	for(int i = 0; i < count; i++)
+		ofusion_add_sample(me, &gyro_bias, samples[i].dt, &samples[i].ang_vel, &samples[i].accel, &samples[i].mag);
+
+	me->engine->update_batch(me, me->engine_state.data, samples, count);
+
+	// the yaw is corrected once, with the last reading
+	if(me->flags & FF_USE_MAG){
+		float dt = 0;
+		for(int i = 0; i < count; i++)
+			dt += samples[i].dt;
+
+		ofusion_mag_update(&me->mag_cal, &me->orient, dt, &samples[count - 1].mag, &me->mag);
+	}
+
+	oquatf_normalize_me(&me->orient);
+	ofusion_add_history(me);
+}
+
+#define GRAVITY_TOLERANCE .4f
+#define ANG_VEL_TOLERANCE .1f
+
+// Gravity tilt correction for count samples, level tells whether they were
+// all within tolerance levels. Corrects for all of them at once.
+static void default_correct_gravity(fusion* me, bool level, float ang_vel_length, int count)
+{
+	const float gravity_tolerance = GRAVITY_TOLERANCE;
+	const float min_tilt_error = 0.05f, max_tilt_error = 0.01f;
+
+	// if the device is within tolerance levels, count this as the device is level and add to the counter
+	// otherwise reset the counter and start over
+
+	me->device_level_count = level ? me->device_level_count + count : 0;
+
+	// device has been level for long enough, grab mean from the accelerometer filter queue (last n values)
+	// and use for correction
+
+	if(me->device_level_count > 50){
+		me->device_level_count = 0;
 
+		vec3f accel_mean;
+		ofq_get_mean(&me->accel_fq, &accel_mean);
+		if (ovec3f_get_length(&accel_mean) - 9.82f < gravity_tolerance)
+		{
+			// Calculate a cross product between what the device
+			// thinks is up and what gravity indicates is down.
+			// The values are optimized of what we would get out
+			// from the cross product.
+			vec3f tilt = {{accel_mean.z, 0, -accel_mean.x}};
+
+			ovec3f_normalize_me(&tilt);
+			ovec3f_normalize_me(&accel_mean);
+
+			vec3f up = {{0, 1.0f, 0}};
+			float tilt_angle = ovec3f_get_angle(&up, &accel_mean);
+
+			if(tilt_angle > max_tilt_error){
+				me->grav_error_angle = tilt_angle;
+				me->grav_error_axis = tilt;
+			}
+		}
+	}
+
+	// perform gravity tilt correction
+	if(me->grav_error_angle > min_tilt_error){
+		float use_angle;
+		// if less than 2000 iterations have passed, set the up axis to the correction value outright
+		if(me->iterations < 2000){
+			use_angle = -me->grav_error_angle;
+			me->grav_error_angle = 0;
+		}
+
+		// otherwise try to correct, never past the error
+		else {
+			use_angle = -me->grav_gain * me->grav_error_angle * 0.005f * (5.0f * ang_vel_length + 1.0f) * count;
+			use_angle = OHMD_MAX(use_angle, -me->grav_error_angle);
+			me->grav_error_angle += use_angle;
+		}
+
+		// perform the correction
+		quatf corr_quat, old_orient;
+		oquatf_init_axis(&corr_quat, &me->grav_error_axis, use_angle);
+		old_orient = me->orient;
+
+		oquatf_mult(&corr_quat, &old_orient, &me->orient);
+	}
+}
+
+static void default_update(fusion* me, void* state, float dt, const vec3f* ang_vel, const vec3f* accel)
+{
 	float ang_vel_length = ovec3f_get_length(ang_vel);
 
 	if(ang_vel_length > 0.0001f){
@@ -55,72 +257,147 @@ void ofusion_update(fusion* me, float dt, const vec3f* ang_vel, const vec3f* acc
 		oquatf_mult_me(&me->orient, &delta_orient);
 	}
 
-	// gravity correction
 	if(me->flags & FF_USE_GRAVITY){
-		const float gravity_tolerance = .4f, ang_vel_tolerance = .1f;
-		const float min_tilt_error = 0.05f, max_tilt_error = 0.01f;
-
-		// if the device is within tolerance levels, count this as the device is level and add to the counter
-		// otherwise reset the counter and start over
-
-		me->device_level_count =
-			fabsf(ovec3f_get_length(accel) - 9.82f) < gravity_tolerance * 2.0f && ang_vel_length < ang_vel_tolerance
-			? me->device_level_count + 1 : 0;
-
-		// device has been level for long enough, grab mean from the accelerometer filter queue (last n values)
-		// and use for correction
-
-		if(me->device_level_count > 50){
-			me->device_level_count = 0;
-
-			vec3f accel_mean;
-			ofq_get_mean(&me->accel_fq, &accel_mean);
-			if (ovec3f_get_length(&accel_mean) - 9.82f < gravity_tolerance)
-			{
-				// Calculate a cross product between what the device
-				// thinks is up and what gravity indicates is down.
-				// The values are optimized of what we would get out
-				// from the cross product.
-				vec3f tilt = {{accel_mean.z, 0, -accel_mean.x}};
-
-				ovec3f_normalize_me(&tilt);
-				ovec3f_normalize_me(&accel_mean);
-
-				vec3f up = {{0, 1.0f, 0}};
-				float tilt_angle = ovec3f_get_angle(&up, &accel_mean);
-
-				if(tilt_angle > max_tilt_error){
-					me->grav_error_angle = tilt_angle;
-					me->grav_error_axis = tilt;
-				}
-			}
-		}
+		bool level = fabsf(ovec3f_get_length(accel) - 9.82f) < GRAVITY_TOLERANCE * 2.0f && ang_vel_length < ANG_VEL_TOLERANCE;
+		default_correct_gravity(me, level, ang_vel_length, 1);
+	}
+}
 
-		// perform gravity tilt correction
-		if(me->grav_error_angle > min_tilt_error){
-			float use_angle;
-			// if less than 2000 iterations have passed, set the up axis to the correction value outright
-			if(me->iterations < 2000){
-				use_angle = -me->grav_error_angle;
-				me->grav_error_angle = 0;
-			}
+// Integrates the samples one by one and does the gravity correction once,
+// with the mean acceleration and rate of the batch. Level means every sample
+// was level.
+static void default_update_batch(fusion* me, void* state, const ofusion_sample* samples, int count)
+{
+	vec3f ang_vel_sum = {{0, 0, 0}};
+	bool level = true;
 
-			// otherwise try to correct
-			else {
-				use_angle = -me->grav_gain * me->grav_error_angle * 0.005f * (5.0f * ang_vel_length + 1.0f);
-				me->grav_error_angle += use_angle;
+	for(int i = 0; i < count; i++){
+		const vec3f* ang_vel = &samples[i].ang_vel;
+		float ang_vel_length = ovec3f_get_length(ang_vel);
+
+		if(ang_vel_length > 0.0001f){
+			// sin and cos of half the angle, by their Taylor series while
+			// that's exact in single precision
+			float half_angle = ang_vel_length * samples[i].dt * 0.5f, s, c;
+			if(half_angle < 0.01f){
+				float sq = half_angle * half_angle;
+				s = half_angle * (1.0f - sq * (1.0f / 6.0f));
+				c = 1.0f - sq * 0.5f * (1.0f - sq * (1.0f / 12.0f));
+			}else{
+				s = sinf(half_angle);
+				c = cosf(half_angle);
 			}
 
-			// perform the correction
-			quatf corr_quat, old_orient;
-			oquatf_init_axis(&corr_quat, &me->grav_error_axis, use_angle);
-			old_orient = me->orient;
+			s /= ang_vel_length;
+			quatf delta_orient = {{ ang_vel->x * s, ang_vel->y * s, ang_vel->z * s, c }};
+			oquatf_mult_me(&me->orient, &delta_orient);
+		}
 
-			oquatf_mult(&corr_quat, &old_orient, &me->orient);
+		if(me->flags & FF_USE_GRAVITY){
+			float accel_length_sq = ovec3f_get_dot(&samples[i].accel, &samples[i].accel);
+			const float min_length = 9.82f - GRAVITY_TOLERANCE * 2.0f, max_length = 9.82f + GRAVITY_TOLERANCE * 2.0f;
+
+			level = level && ang_vel_length < ANG_VEL_TOLERANCE &&
+				accel_length_sq > min_length * min_length && accel_length_sq < max_length * max_length;
 		}
+
+		ang_vel_sum.x += ang_vel->x;
+		ang_vel_sum.y += ang_vel->y;
+		ang_vel_sum.z += ang_vel->z;
 	}
 
-	// mitigate drift due to floating point
-	// inprecision with quat multiplication.
-	oquatf_normalize_me(&me->orient);
+	if(me->flags & FF_USE_GRAVITY)
+		default_correct_gravity(me, level, ovec3f_get_length(&ang_vel_sum) / count, count);
+}
+
+const ofusion_engine ofusion_engine_default = {
+	"default",
+	0, // the gravity correction is kept in the fusion struct
+	NULL,
+	default_update,
+	default_update_batch,
+	NULL,
+};
+
+// Angular velocity to extrapolate the orientation with. Below the gyro noise
+// floor the filtered rate is used, so that a resting device doesn't jitter.
+void ofusion_get_prediction_rate(const fusion* me, vec3f* ang_vel)
+{
+	const float ang_vel_tolerance = .1f;
+
+	if(ovec3f_get_length(&me->ang_vel) < ang_vel_tolerance && me->iterations >= me->ang_vel_fq.size)
+		ofq_get_mean(&me->ang_vel_fq, ang_vel);
+	else
+		*ang_vel = me->ang_vel;
+}
+
+// Rotates orient by the body frame angular velocity ang_vel for dt seconds
+void ofusion_predict(const quatf* orient, const vec3f* ang_vel, float dt, quatf* out)
+{
+	float ang_vel_length = ovec3f_get_length(ang_vel);
+
+	*out = *orient;
+
+	if(ang_vel_length > 0.0001f){
+		quatf delta_orient;
+		oquatf_init_axis(&delta_orient, ang_vel, ang_vel_length * dt);
+		oquatf_mult_me(out, &delta_orient);
+	}
+}
+
+double ofusion_get_last_time(const fusion* me)
+{
+	uint32_t head = me->history_head;
+	return head ? me->history[(head - 1) & (FUSION_HISTORY_SIZE - 1)].time : 0;
+}
+
+// Interpolates the orientation at the given host time from the history. Safe to
+// call while another thread runs ofusion_update, the newest entries are kept
+// clear of the writer and the lookup is retried if it caught up anyway. Times
+// outside of the history are clamped to the oldest or newest entry.
+int ofusion_get_orient_at(fusion* me, double time, quatf* out)
+{
+	// entries the writer may add during a lookup without forcing a retry
+	const uint32_t slack = 16;
+
+	for(;;){
+		uint32_t head = ohmd_atomic_load(&me->history_head);
+		if(head == 0)
+			return -1;
+
+		uint32_t count = OHMD_MIN(head, FUSION_HISTORY_SIZE - slack);
+		uint32_t first = head - count;
+		uint32_t lo = 0, hi = count - 1;
+		fusion_history_entry a, b;
+
+		#define ENTRY(_i) me->history[(first + (_i)) & (FUSION_HISTORY_SIZE - 1)]
+
+		// find the last entry at or before time, entries are ordered by time
+		while(lo < hi){
+			uint32_t mid = lo + (hi - lo + 1) / 2;
+			if(ENTRY(mid).time <= time)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+
+		a = ENTRY(lo);
+		b = ENTRY(OHMD_MIN(lo + 1, count - 1));
+
+		#undef ENTRY
+
+		// retry if the writer caught up with the entries we've read
+		ohmd_memory_barrier();
+		if(ohmd_atomic_load(&me->history_head) - first >= FUSION_HISTORY_SIZE)
+			continue;
+
+		if(b.time > a.time && time > a.time){
+			float t = (float)OHMD_MIN((time - a.time) / (b.time - a.time), 1.0);
+			oquatf_slerp(t, &a.orient, &b.orient, true, out);
+		}else{
+			*out = a.orient;
+		}
+
+		return 0;
+	}
 }
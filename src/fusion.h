@@ -10,9 +10,60 @@
 #ifndef FUSION_H
 #define FUSION_H
 
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include "omath.h"
+#include "platform.h"
 
 #define FF_USE_GRAVITY 1
+#define FF_USE_MAG 2 // correct the yaw with the magnetometer, see fusion_mag.c
+
+// Bytes kept in every fusion struct for the state of its engine
+#define FUSION_ENGINE_STATE_SIZE 512
+
+// Number of fused orientations kept for ofusion_get_orient_at, must be a power of two
+#define FUSION_HISTORY_SIZE 512
+
+// The most samples drivers put in a batch, and how close batches stay to
+// single updates, see ofusion_update_batch
+#define FUSION_BATCH_SIZE 32
+#define FUSION_BATCH_TOLERANCE 0.005f
+
+typedef struct {
+	double time; // host time, see ohmd_get_tick()
+	quatf orient;
+} fusion_history_entry;
+
+typedef struct ofusion_engine ofusion_engine;
+
+typedef struct {
+	float dt;
+	vec3f ang_vel, accel, mag;
+} ofusion_sample;
+
+// Magnetometer calibration and the heading the yaw is held to, see fusion_mag.c
+typedef struct {
+	// ellipsoid fit to the readings, which are divided by scale first
+	double scale;
+	double fit[9];
+	double fit_cov[9][9];
+	float fit_error; // mean square error of the fit on new readings
+	vec3f last_fed;
+	int fed; // readings fit
+
+	// the calibrated field, soft_iron * (raw - hard_iron), is of unit length
+	bool calibrated;
+	vec3f hard_iron;
+	float soft_iron[3][3];
+
+	// the field in the world frame when the yaw was first held, x and z
+	// of its horizontal direction and its vertical part
+	bool has_reference;
+	float reference[2];
+	float reference_dip;
+	float quiet_time; // s since the field last looked disturbed
+} fusion_mag;
 
 typedef struct {
 	int state;
@@ -24,7 +75,7 @@ typedef struct {
 	vec3f raw_mag;  // raw magnetometer values
 
 	int iterations;
-	float time;
+	double time; // sensor time, the sum of all dt
 
 	int flags;
 
@@ -36,9 +87,84 @@ typedef struct {
 	float grav_error_angle;
 	vec3f grav_error_axis;
 	float grav_gain; // amount of correction
+
+	// magnetometer yaw correction, with FF_USE_MAG
+	fusion_mag mag_cal;
+
+	// turns the samples into the orientation, the default one does the gravity correction above
+	const ofusion_engine* engine;
+	union {
+		double align;
+		unsigned char data[FUSION_ENGINE_STATE_SIZE];
+	} engine_state;
+
+	// orientation history, written by ofusion_update, readable from any thread
+	fusion_history_entry history[FUSION_HISTORY_SIZE];
+	volatile uint32_t history_head; // number of entries ever written
+	double host_time_offset; // host time minus sensor time
+	ohmd_clock* clock; // the host clock, set when the device is opened
 } fusion;
 
+// A way of fusing the sensors. ofusion_update keeps the filter queues,
+// history and timing of every fusion struct, the engine updates orient from
+// the raw samples and keeps whatever else it needs in the engine_state.
+struct ofusion_engine {
+	const char* name;
+	size_t state_size; // bytes of engine_state used, at most FUSION_ENGINE_STATE_SIZE
+
+	// engine_state is zeroed before, the orientation is left as it is
+	void (*init)(fusion* me, void* state);
+	void (*update)(fusion* me, void* state, float dt, const vec3f* ang_vel, const vec3f* accel);
+
+	// Optional: updates with count samples at once, in order. Without it
+	// ofusion_update_batch goes over them one by one.
+	void (*update_batch)(fusion* me, void* state, const ofusion_sample* samples, int count);
+
+	// Optional: the gyro bias the engine takes out of ang_vel
+	void (*get_gyro_bias)(const void* state, vec3f* out);
+};
+
+// gyro integration with a slow gravity correction, see fusion.c
+extern const ofusion_engine ofusion_engine_default;
+// error-state Kalman filter estimating the gyro and accelerometer biases, see fusion_eskf.c
+extern const ofusion_engine ofusion_engine_eskf;
+// Mahony filter, cheap, see fusion_mahony.c
+extern const ofusion_engine ofusion_engine_mahony;
+
 void ofusion_init(fusion* me);
 void ofusion_update(fusion* me, float dt, const vec3f* ang_vel, const vec3f* accel, const vec3f* mag_field);
 
+// Updates with count samples in one go, for drivers that get several per
+// report. The filter queues and the timing still see every sample, the
+// engine may integrate them in one pass and correct for gravity once, and
+// there is one entry in the history per batch. With the default engine the
+// orientation stays within FUSION_BATCH_TOLERANCE radians (0.3 degrees) of
+// updating sample by sample, for batches of up to FUSION_BATCH_SIZE samples
+// at 1 kHz once the tilt has first been set: gravity is looked at once per
+// batch, so the difference grows with how far the device turns during one
+// while it's level.
+void ofusion_update_batch(fusion* me, const ofusion_sample* samples, int count);
+
+// switches to engine, starting from the current orientation, false if its state doesn't fit
+bool ofusion_set_engine(fusion* me, const ofusion_engine* engine);
+void ofusion_get_gyro_bias(const fusion* me, vec3f* out);
+
+void ofusion_mag_init(fusion_mag* me);
+
+// Calibrates with a raw magnetometer reading and, once calibrated, pulls the
+// yaw of orient towards the reference heading over dt. calibrated is left
+// as it is until there is a calibration.
+void ofusion_mag_update(fusion_mag* me, quatf* orient, float dt, const vec3f* raw, vec3f* calibrated);
+
+// rotates orient so that the measured acceleration points up, keeping its yaw
+void ofusion_level(quatf* orient, const vec3f* accel);
+
+// prediction
+void ofusion_get_prediction_rate(const fusion* me, vec3f* ang_vel);
+void ofusion_predict(const quatf* orient, const vec3f* ang_vel, float dt, quatf* out);
+
+// history
+double ofusion_get_last_time(const fusion* me);
+int ofusion_get_orient_at(fusion* me, double time, quatf* out);
+
 #endif
@@ -0,0 +1,354 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Sensor Fusion - Error-State Kalman Filter */
+
+// The orientation is integrated from the bias corrected gyro as usual, the
+// filter estimates the small error of that integration along with the
+// errors of the gyro and accelerometer biases: [dtheta, dgyro_bias,
+// daccel_bias], all in the body frame. The only measurement is gravity as
+// seen by the accelerometer, averaged over a few samples, so yaw and the gyro
+// bias around the up axis are left as they are. The accelerometer bias can
+// only be told from a tilt error once the device has been held in a few
+// orientations.
+
+#include <string.h>
+#include "openhmdi.h"
+
+#define GRAVITY 9.82f
+
+// seconds of samples averaged into one measurement, the covariance is
+// propagated once per measurement too
+#define UPDATE_INTERVAL 0.005f
+
+// accelerations further than this from gravity are motion, not gravity
+#define GRAVITY_TOLERANCE 2.0f
+
+// chi-square with 3 degrees of freedom, 99.9%
+#define INNOVATION_GATE 16.3f
+
+// noise densities, per sqrt(s), and the noise of an averaged accelerometer
+// reading, which is mostly linear acceleration from moving the device
+#define GYRO_NOISE 0.003f         // rad/s
+#define GYRO_BIAS_WALK 0.0002f    // rad/s^2
+#define ACCEL_BIAS_WALK 0.002f    // m/s^3
+#define ACCEL_NOISE 5.0f          // m/s^2
+
+// initial standard deviations and the largest ones the estimate may drift to
+#define INITIAL_ANGLE 0.05f       // rad
+#define INITIAL_GYRO_BIAS 0.02f   // rad/s
+#define INITIAL_ACCEL_BIAS 0.1f   // m/s^2
+#define MAX_ANGLE 0.5f
+#define MAX_GYRO_BIAS 0.05f
+#define MAX_ACCEL_BIAS 0.5f
+
+typedef struct {
+	bool initialized;
+	vec3f gyro_bias, accel_bias; // rad/s, m/s^2
+	float P[9][9]; // error covariance of [orientation, gyro bias, accel bias]
+
+	// accumulated since the last measurement
+	vec3f theta; // rotation
+	vec3f accel_sum; // in the world frame
+	int accel_count;
+	float elapsed;
+} eskf_state;
+
+typedef float mat3[3][3];
+
+static void skew(const vec3f* v, mat3 out)
+{
+	out[0][0] = 0;      out[0][1] = -v->z; out[0][2] = v->y;
+	out[1][0] = v->z;   out[1][1] = 0;     out[1][2] = -v->x;
+	out[2][0] = -v->y;  out[2][1] = v->x;  out[2][2] = 0;
+}
+
+static void mat3_mult(const mat3 a, const mat3 b, mat3 out)
+{
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)
+			out[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+}
+
+// a * b^T
+static void mat3_mult_t(const mat3 a, const mat3 b, mat3 out)
+{
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)
+			out[i][j] = a[i][0] * b[j][0] + a[i][1] * b[j][1] + a[i][2] * b[j][2];
+}
+
+static bool mat3_inverse(const mat3 m, mat3 out)
+{
+	out[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+	out[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+	out[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+	out[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+	out[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+	out[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+	out[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+	out[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+	out[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+	float det = m[0][0] * out[0][0] + m[0][1] * out[1][0] + m[0][2] * out[2][0];
+	if(fabsf(det) < 1e-12f)
+		return false;
+
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)
+			out[i][j] /= det;
+
+	return true;
+}
+
+static void get_block(float P[9][9], int row, int col, mat3 out)
+{
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)
+			out[i][j] = P[row * 3 + i][col * 3 + j];
+}
+
+// also sets the transposed block, P stays symmetric
+static void set_block(float P[9][9], int row, int col, mat3 m)
+{
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++){
+			P[row * 3 + i][col * 3 + j] = m[i][j];
+			P[col * 3 + j][row * 3 + i] = m[i][j];
+		}
+}
+
+// Scales the rows and columns of variances past their limit back down,
+// which keeps P positive definite
+static void clamp_covariance(float P[9][9])
+{
+	static const float max_std[3] = { MAX_ANGLE, MAX_GYRO_BIAS, MAX_ACCEL_BIAS };
+
+	for(int i = 0; i < 9; i++){
+		float max = max_std[i / 3] * max_std[i / 3];
+
+		if(P[i][i] > max){
+			float scale = sqrtf(max / P[i][i]);
+			for(int j = 0; j < 9; j++){
+				P[i][j] *= scale;
+				P[j][i] *= scale;
+			}
+		}else if(P[i][i] < 1e-12f){
+			P[i][i] = 1e-12f;
+		}
+	}
+}
+
+static void eskf_init(fusion* f, void* state)
+{
+	eskf_state* me = state;
+
+	for(int i = 0; i < 3; i++){
+		me->P[i][i] = INITIAL_ANGLE * INITIAL_ANGLE;
+		me->P[3 + i][3 + i] = INITIAL_GYRO_BIAS * INITIAL_GYRO_BIAS;
+		me->P[6 + i][6 + i] = INITIAL_ACCEL_BIAS * INITIAL_ACCEL_BIAS;
+	}
+}
+
+// F = [[I - [theta]x, -dt I, 0], [0, I, 0], [0, 0, I]], P = F P F^T + Q
+static void predict(eskf_state* me, const vec3f* theta, float dt)
+{
+	mat3 A, P00, P01, P02, P11, P12, AP01, t0, t1;
+
+	skew(theta, A);
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)
+			A[i][j] = (i == j ? 1.0f : 0) - A[i][j];
+
+	get_block(me->P, 0, 0, P00);
+	get_block(me->P, 0, 1, P01);
+	get_block(me->P, 0, 2, P02);
+	get_block(me->P, 1, 1, P11);
+	get_block(me->P, 1, 2, P12);
+
+	mat3_mult(A, P01, AP01);
+
+	// A P00 A^T - dt (A P01 + (A P01)^T) + dt^2 P11
+	mat3_mult(A, P00, t0);
+	mat3_mult_t(t0, A, t1);
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++)
+			P00[i][j] = t1[i][j] - dt * (AP01[i][j] + AP01[j][i]) + dt * dt * P11[i][j];
+
+	// A P01 - dt P11, A P02 - dt P12
+	mat3_mult(A, P02, t0);
+	for(int i = 0; i < 3; i++)
+		for(int j = 0; j < 3; j++){
+			P01[i][j] = AP01[i][j] - dt * P11[i][j];
+			P02[i][j] = t0[i][j] - dt * P12[i][j];
+		}
+
+	for(int i = 0; i < 3; i++){
+		P00[i][i] += GYRO_NOISE * GYRO_NOISE * dt;
+		me->P[3 + i][3 + i] += GYRO_BIAS_WALK * GYRO_BIAS_WALK * dt;
+		me->P[6 + i][6 + i] += ACCEL_BIAS_WALK * ACCEL_BIAS_WALK * dt;
+	}
+
+	set_block(me->P, 0, 0, P00);
+	set_block(me->P, 0, 1, P01);
+	set_block(me->P, 0, 2, P02);
+}
+
+// h = R^T g + accel_bias, H = [[R^T g]x, 0, I]
+static void correct(eskf_state* me, quatf* orient, const vec3f* accel, float deviation)
+{
+	float PHt[9][3], K[9][3];
+	mat3 hx, S, S_inv;
+	vec3f h0, gravity = {{ 0, GRAVITY, 0 }};
+
+	quatf inv_orient = *orient;
+	oquatf_inverse(&inv_orient);
+	oquatf_get_rotated(&inv_orient, &gravity, &h0);
+	skew(&h0, hx);
+
+	// P H^T
+	for(int r = 0; r < 9; r++)
+		for(int c = 0; c < 3; c++)
+			PHt[r][c] = me->P[r][0] * hx[c][0] + me->P[r][1] * hx[c][1] + me->P[r][2] * hx[c][2] + me->P[r][6 + c];
+
+	// H P H^T + R, the noise grows with how far off gravity the reading is
+	float noise = ACCEL_NOISE + deviation;
+	for(int a = 0; a < 3; a++)
+		for(int b = 0; b < 3; b++)
+			S[a][b] = hx[a][0] * PHt[0][b] + hx[a][1] * PHt[1][b] + hx[a][2] * PHt[2][b] + PHt[6 + a][b]
+				+ (a == b ? noise * noise : 0);
+
+	if(!mat3_inverse(S, S_inv))
+		return;
+
+	vec3f y = {{ accel->x - h0.x - me->accel_bias.x,
+	             accel->y - h0.y - me->accel_bias.y,
+	             accel->z - h0.z - me->accel_bias.z }};
+
+	// readings the filter can't explain are mostly linear acceleration, they
+	// would pull the biases away, y^T S^-1 y is chi-square distributed
+	float distance = 0;
+	for(int a = 0; a < 3; a++)
+		for(int b = 0; b < 3; b++)
+			distance += y.arr[a] * S_inv[a][b] * y.arr[b];
+
+	if(distance > INNOVATION_GATE)
+		return;
+
+	for(int r = 0; r < 9; r++)
+		for(int c = 0; c < 3; c++)
+			K[r][c] = PHt[r][0] * S_inv[0][c] + PHt[r][1] * S_inv[1][c] + PHt[r][2] * S_inv[2][c];
+
+	float dx[9];
+	for(int r = 0; r < 9; r++)
+		dx[r] = K[r][0] * y.x + K[r][1] * y.y + K[r][2] * y.z;
+
+	// P - K H P, H P = (P H^T)^T, averaged with its transpose against rounding
+	for(int r = 0; r < 9; r++)
+		for(int c = r; c < 9; c++){
+			float v = me->P[r][c] - 0.5f * (K[r][0] * PHt[c][0] + K[r][1] * PHt[c][1] + K[r][2] * PHt[c][2]
+			                              + K[c][0] * PHt[r][0] + K[c][1] * PHt[r][1] + K[c][2] * PHt[r][2]);
+			me->P[r][c] = v;
+			me->P[c][r] = v;
+		}
+
+	// inject the error into the nominal state, the error is reset to zero
+	vec3f dtheta = {{ dx[0], dx[1], dx[2] }};
+	float angle = ovec3f_get_length(&dtheta);
+	if(angle > 0){
+		quatf delta_orient;
+		oquatf_init_axis(&delta_orient, &dtheta, angle);
+		oquatf_mult_me(orient, &delta_orient);
+	}
+
+	for(int i = 0; i < 3; i++){
+		me->gyro_bias.arr[i] += dx[3 + i];
+		me->accel_bias.arr[i] += dx[6 + i];
+	}
+}
+
+static void eskf_update(fusion* f, void* state, float dt, const vec3f* raw_ang_vel, const vec3f* accel)
+{
+	eskf_state* me = state;
+	quatf* orient = &f->orient;
+
+	vec3f ang_vel;
+	ovec3f_subtract(raw_ang_vel, &me->gyro_bias, &ang_vel);
+	float ang_vel_length = ovec3f_get_length(&ang_vel);
+
+	if(ang_vel_length > 0.0001f){
+		quatf delta_orient;
+		oquatf_init_axis(&delta_orient, &ang_vel, ang_vel_length * dt);
+		oquatf_mult_me(orient, &delta_orient);
+	}
+
+	// the readings are summed up in the world frame and turned back into the
+	// latest body frame, the mean of the body frame readings would lag behind
+	// the orientation by half the interval, which looks a lot like gyro bias
+	vec3f world_accel;
+	oquatf_get_rotated(orient, accel, &world_accel);
+
+	for(int i = 0; i < 3; i++){
+		me->theta.arr[i] += ang_vel.arr[i] * dt;
+		me->accel_sum.arr[i] += world_accel.arr[i];
+	}
+
+	me->accel_count++;
+	me->elapsed += dt;
+
+	if(me->elapsed < UPDATE_INTERVAL)
+		return;
+
+	vec3f world_mean = {{ me->accel_sum.x / me->accel_count,
+	                      me->accel_sum.y / me->accel_count,
+	                      me->accel_sum.z / me->accel_count }};
+
+	vec3f accel_mean;
+	quatf inv_orient = *orient;
+	oquatf_inverse(&inv_orient);
+	oquatf_get_rotated(&inv_orient, &world_mean, &accel_mean);
+
+	vec3f corrected;
+	ovec3f_subtract(&accel_mean, &me->accel_bias, &corrected);
+	float deviation = fabsf(ovec3f_get_length(&corrected) - GRAVITY);
+
+	bool use_gravity = (f->flags & FF_USE_GRAVITY) != 0;
+
+	if(!me->initialized && use_gravity){
+		// start from the tilt the first still reading shows
+		if(deviation < GRAVITY_TOLERANCE * 0.25f){
+			ofusion_level(orient, &corrected);
+			me->initialized = true;
+		}
+	}else{
+		predict(me, &me->theta, me->elapsed);
+
+		if(use_gravity && deviation < GRAVITY_TOLERANCE)
+			correct(me, orient, &accel_mean, deviation);
+
+		clamp_covariance(me->P);
+	}
+
+	memset(&me->theta, 0, sizeof(me->theta));
+	memset(&me->accel_sum, 0, sizeof(me->accel_sum));
+	me->accel_count = 0;
+	me->elapsed = 0;
+}
+
+static void eskf_get_gyro_bias(const void* state, vec3f* out)
+{
+	*out = ((const eskf_state*)state)->gyro_bias;
+}
+
+const ofusion_engine ofusion_engine_eskf = {
+	"eskf",
+	sizeof(eskf_state),
+	eskf_init,
+	eskf_update,
+	NULL,
+	eskf_get_gyro_bias,
+};
@@ -0,0 +1,352 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Sensor Fusion - Device Groups, Implementation */
+
+#include <string.h>
+#include "openhmdi.h"
+#include "fusion_group.h"
+
+// The vector operations the update needs, a vfloat holds a value of WIDTH
+// devices and a vmask a condition of each
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define WIDTH 8
+typedef __m256 vfloat;
+typedef __m256 vmask;
+
+#define vf_load(p) _mm256_loadu_ps(p)
+#define vf_store(p, a) _mm256_storeu_ps(p, a)
+#define vf_set(f) _mm256_set1_ps(f)
+#define vf_add(a, b) _mm256_add_ps(a, b)
+#define vf_sub(a, b) _mm256_sub_ps(a, b)
+#define vf_mul(a, b) _mm256_mul_ps(a, b)
+#define vf_div(a, b) _mm256_div_ps(a, b)
+#define vf_max(a, b) _mm256_max_ps(a, b)
+#define vf_sqrt(a) _mm256_sqrt_ps(a)
+#define vf_lt(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vm_and(a, b) _mm256_and_ps(a, b)
+#define vm_select(m, a, b) _mm256_blendv_ps(b, a, m)
+#define vm_bits(m) _mm256_movemask_ps(m)
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#define WIDTH 4
+typedef __m128 vfloat;
+typedef __m128 vmask;
+
+#define vf_load(p) _mm_loadu_ps(p)
+#define vf_store(p, a) _mm_storeu_ps(p, a)
+#define vf_set(f) _mm_set1_ps(f)
+#define vf_add(a, b) _mm_add_ps(a, b)
+#define vf_sub(a, b) _mm_sub_ps(a, b)
+#define vf_mul(a, b) _mm_mul_ps(a, b)
+#define vf_div(a, b) _mm_div_ps(a, b)
+#define vf_max(a, b) _mm_max_ps(a, b)
+#define vf_sqrt(a) _mm_sqrt_ps(a)
+#define vf_lt(a, b) _mm_cmplt_ps(a, b)
+#define vm_and(a, b) _mm_and_ps(a, b)
+#define vm_select(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define vm_bits(m) _mm_movemask_ps(m)
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+#include <arm_neon.h>
+
+#define WIDTH 4
+typedef float32x4_t vfloat;
+typedef uint32x4_t vmask;
+
+#define vf_load(p) vld1q_f32(p)
+#define vf_store(p, a) vst1q_f32(p, a)
+#define vf_set(f) vdupq_n_f32(f)
+#define vf_add(a, b) vaddq_f32(a, b)
+#define vf_sub(a, b) vsubq_f32(a, b)
+#define vf_mul(a, b) vmulq_f32(a, b)
+#define vf_div(a, b) vdivq_f32(a, b)
+#define vf_max(a, b) vmaxq_f32(a, b)
+#define vf_sqrt(a) vsqrtq_f32(a)
+#define vf_lt(a, b) vcltq_f32(a, b)
+#define vm_and(a, b) vandq_u32(a, b)
+#define vm_select(m, a, b) vbslq_f32(m, a, b)
+
+static inline int vm_bits(vmask m)
+{
+	const uint32_t lane_bits[4] = { 1, 2, 4, 8 };
+	return (int)vaddvq_u32(vandq_u32(m, vld1q_u32(lane_bits)));
+}
+
+#else
+
+#define WIDTH 1
+typedef float vfloat;
+typedef int vmask;
+
+#define vf_load(p) (*(p))
+#define vf_store(p, a) (*(p) = (a))
+#define vf_set(f) (f)
+#define vf_add(a, b) ((a) + (b))
+#define vf_sub(a, b) ((a) - (b))
+#define vf_mul(a, b) ((a) * (b))
+#define vf_div(a, b) ((a) / (b))
+#define vf_max(a, b) OHMD_MAX(a, b)
+#define vf_sqrt(a) sqrtf(a)
+#define vf_lt(a, b) ((a) < (b))
+#define vm_and(a, b) ((a) && (b))
+#define vm_select(m, a, b) ((m) ? (a) : (b))
+#define vm_bits(m) (m)
+
+#endif
+
+// the default engine's gravity correction, see fusion.c
+#define GRAVITY 9.82f
+#define GRAVITY_TOLERANCE .4f
+#define ANG_VEL_TOLERANCE .1f
+#define MIN_TILT_ERROR 0.05f
+#define MAX_TILT_ERROR 0.01f
+#define LEVEL_SAMPLES 50
+#define SETTLE_ITERATIONS 2000
+
+// arrays in data before the acceleration windows, in the order they're
+// pointed to from fusion_group
+#define NUM_ARRAYS 15
+
+bool ofusion_group_init(fusion_group* me, int count)
+{
+	memset(me, 0, sizeof(fusion_group));
+
+	me->count = count;
+	me->stride = (count + WIDTH - 1) / WIDTH * WIDTH;
+	me->grav_gain = 0.05f;
+
+	me->data = calloc((size_t)me->stride * (NUM_ARRAYS + 3 * FUSION_GROUP_WINDOW), sizeof(float));
+	if(!me->data)
+		return false;
+
+	float* array = me->data;
+	float** arrays[NUM_ARRAYS] = {
+		&me->dt,
+		&me->ang_vel[0], &me->ang_vel[1], &me->ang_vel[2],
+		&me->accel[0], &me->accel[1], &me->accel[2],
+		&me->orient[0], &me->orient[1], &me->orient[2], &me->orient[3],
+		&me->level_count,
+		&me->grav_error_angle,
+		&me->grav_error_axis[0], &me->grav_error_axis[1],
+	};
+
+	for(int i = 0; i < NUM_ARRAYS; i++){
+		*arrays[i] = array;
+		array += me->stride;
+	}
+
+	for(int i = 0; i < 3; i++){
+		me->accel_window[i] = array;
+		array += me->stride * FUSION_GROUP_WINDOW;
+	}
+
+	// the padding too, so that it stays a unit quaternion
+	for(int i = 0; i < me->stride; i++)
+		me->orient[3][i] = 1.0f;
+
+	return true;
+}
+
+void ofusion_group_free(fusion_group* me)
+{
+	free(me->data);
+	me->data = NULL;
+}
+
+void ofusion_group_set_sample(fusion_group* me, int device, float dt, const vec3f* ang_vel, const vec3f* accel)
+{
+	me->dt[device] = dt;
+
+	for(int i = 0; i < 3; i++){
+		me->ang_vel[i][device] = ang_vel->arr[i];
+		me->accel[i][device] = accel->arr[i];
+	}
+}
+
+void ofusion_group_get_orient(const fusion_group* me, int device, quatf* orient)
+{
+	for(int i = 0; i < 4; i++)
+		orient->arr[i] = me->orient[i][device];
+}
+
+// Measures the tilt of a device that has been level for long enough, and
+// sets it outright while the filter is settling
+static void measure_tilt(fusion_group* me, int device)
+{
+	vec3f accel_mean = {{0, 0, 0}};
+
+	for(int i = 0; i < 3; i++){
+		for(int j = 0; j < FUSION_GROUP_WINDOW; j++)
+			accel_mean.arr[i] += me->accel_window[i][j * me->stride + device];
+
+		accel_mean.arr[i] /= (float)FUSION_GROUP_WINDOW;
+	}
+
+	me->level_count[device] = 0;
+
+	if(ovec3f_get_length(&accel_mean) - GRAVITY < GRAVITY_TOLERANCE){
+		vec3f tilt = {{accel_mean.z, 0, -accel_mean.x}};
+
+		ovec3f_normalize_me(&tilt);
+		ovec3f_normalize_me(&accel_mean);
+
+		vec3f up = {{0, 1.0f, 0}};
+		float tilt_angle = ovec3f_get_angle(&up, &accel_mean);
+
+		if(tilt_angle > MAX_TILT_ERROR){
+			me->grav_error_angle[device] = tilt_angle;
+			me->grav_error_axis[0][device] = tilt.x;
+			me->grav_error_axis[1][device] = tilt.z;
+		}
+	}
+
+	if(me->grav_error_angle[device] > MIN_TILT_ERROR && me->iterations < SETTLE_ITERATIONS){
+		vec3f axis = {{me->grav_error_axis[0][device], 0, me->grav_error_axis[1][device]}};
+		quatf corr_quat, old_orient, orient;
+
+		oquatf_init_axis(&corr_quat, &axis, -me->grav_error_angle[device]);
+		ofusion_group_get_orient(me, device, &old_orient);
+		oquatf_mult(&corr_quat, &old_orient, &orient);
+
+		for(int i = 0; i < 4; i++)
+			me->orient[i][device] = orient.arr[i];
+
+		me->grav_error_angle[device] = 0;
+	}
+}
+
+void ofusion_group_update(fusion_group* me)
+{
+	const vfloat zero = vf_set(0), one = vf_set(1.0f), half = vf_set(0.5f), two = vf_set(2.0f);
+	const float min_accel = GRAVITY - GRAVITY_TOLERANCE * 2.0f, max_accel = GRAVITY + GRAVITY_TOLERANCE * 2.0f;
+
+	// the window slots are taken in turn
+	int slot = me->iterations % FUSION_GROUP_WINDOW * me->stride;
+	me->iterations++;
+
+	for(int i = 0; i < me->stride; i += WIDTH){
+		vfloat dt = vf_load(me->dt + i);
+		vfloat wx = vf_load(me->ang_vel[0] + i), wy = vf_load(me->ang_vel[1] + i), wz = vf_load(me->ang_vel[2] + i);
+		vfloat ax = vf_load(me->accel[0] + i), ay = vf_load(me->accel[1] + i), az = vf_load(me->accel[2] + i);
+		vfloat qx = vf_load(me->orient[0] + i), qy = vf_load(me->orient[1] + i);
+		vfloat qz = vf_load(me->orient[2] + i), qw = vf_load(me->orient[3] + i);
+
+		// the acceleration in the world frame, rotated by the orientation
+		// before the sample: a + w * t + q x t with t = 2 * (q x a)
+		vfloat tx = vf_mul(two, vf_sub(vf_mul(qy, az), vf_mul(qz, ay)));
+		vfloat ty = vf_mul(two, vf_sub(vf_mul(qz, ax), vf_mul(qx, az)));
+		vfloat tz = vf_mul(two, vf_sub(vf_mul(qx, ay), vf_mul(qy, ax)));
+		vfloat world_x = vf_add(vf_add(ax, vf_mul(qw, tx)), vf_sub(vf_mul(qy, tz), vf_mul(qz, ty)));
+		vfloat world_y = vf_add(vf_add(ay, vf_mul(qw, ty)), vf_sub(vf_mul(qz, tx), vf_mul(qx, tz)));
+		vfloat world_z = vf_add(vf_add(az, vf_mul(qw, tz)), vf_sub(vf_mul(qx, ty), vf_mul(qy, tx)));
+
+		// the rotation over dt as a quaternion, (ang_vel * sin(h) / |ang_vel|, cos(h))
+		// with h = |ang_vel| * dt / 2, from their series in h^2 which also
+		// holds when not turning
+		vfloat ang_vel_sq = vf_add(vf_add(vf_mul(wx, wx), vf_mul(wy, wy)), vf_mul(wz, wz));
+		vfloat half_dt = vf_mul(dt, half);
+		vfloat h2 = vf_mul(ang_vel_sq, vf_mul(half_dt, half_dt));
+
+		vfloat s = vf_sub(one, vf_mul(h2, vf_set(1.0f / 42.0f)));
+		s = vf_sub(one, vf_mul(vf_mul(h2, vf_set(1.0f / 20.0f)), s));
+		s = vf_sub(one, vf_mul(vf_mul(h2, vf_set(1.0f / 6.0f)), s));
+		s = vf_mul(half_dt, s);
+
+		vfloat dw = vf_sub(one, vf_mul(h2, vf_set(1.0f / 56.0f)));
+		dw = vf_sub(one, vf_mul(vf_mul(h2, vf_set(1.0f / 30.0f)), dw));
+		dw = vf_sub(one, vf_mul(vf_mul(h2, vf_set(1.0f / 12.0f)), dw));
+		dw = vf_sub(one, vf_mul(vf_mul(h2, half), dw));
+
+		vfloat dx = vf_mul(wx, s), dy = vf_mul(wy, s), dz = vf_mul(wz, s);
+
+		// orient = orient * delta
+		vfloat nx = vf_add(vf_add(vf_mul(qw, dx), vf_mul(qx, dw)), vf_sub(vf_mul(qy, dz), vf_mul(qz, dy)));
+		vfloat ny = vf_add(vf_sub(vf_mul(qw, dy), vf_mul(qx, dz)), vf_add(vf_mul(qy, dw), vf_mul(qz, dx)));
+		vfloat nz = vf_add(vf_add(vf_mul(qw, dz), vf_mul(qx, dy)), vf_sub(vf_mul(qz, dw), vf_mul(qy, dx)));
+		vfloat nw = vf_sub(vf_sub(vf_mul(qw, dw), vf_mul(qx, dx)), vf_add(vf_mul(qy, dy), vf_mul(qz, dz)));
+		qx = nx; qy = ny; qz = nz; qw = nw;
+
+		vf_store(me->accel_window[0] + slot + i, world_x);
+		vf_store(me->accel_window[1] + slot + i, world_y);
+		vf_store(me->accel_window[2] + slot + i, world_z);
+
+		// count the samples the device has been level for, starting over
+		// when it isn't
+		vfloat accel_sq = vf_add(vf_add(vf_mul(ax, ax), vf_mul(ay, ay)), vf_mul(az, az));
+		vmask level = vm_and(vf_lt(ang_vel_sq, vf_set(ANG_VEL_TOLERANCE * ANG_VEL_TOLERANCE)),
+			vm_and(vf_lt(vf_set(min_accel * min_accel), accel_sq), vf_lt(accel_sq, vf_set(max_accel * max_accel))));
+
+		vfloat level_count = vm_select(level, vf_add(vf_load(me->level_count + i), one), zero);
+		vf_store(me->level_count + i, level_count);
+
+		// measuring the tilt is rare, it's done one device at a time
+		int measure = vm_bits(vf_lt(vf_set(LEVEL_SAMPLES), level_count));
+		if(measure){
+			vf_store(me->orient[0] + i, qx);
+			vf_store(me->orient[1] + i, qy);
+			vf_store(me->orient[2] + i, qz);
+			vf_store(me->orient[3] + i, qw);
+
+			for(int j = 0; j < WIDTH; j++){
+				if(measure & (1 << j))
+					measure_tilt(me, i + j);
+			}
+
+			qx = vf_load(me->orient[0] + i);
+			qy = vf_load(me->orient[1] + i);
+			qz = vf_load(me->orient[2] + i);
+			qw = vf_load(me->orient[3] + i);
+		}
+
+		// correct a part of the tilt error, faster while turning
+		vfloat error = vf_load(me->grav_error_angle + i);
+		vmask correct = vf_lt(vf_set(MIN_TILT_ERROR), error);
+		if(vm_bits(correct)){
+			vfloat ang_vel = vf_sqrt(ang_vel_sq);
+			vfloat use_angle = vf_mul(vf_mul(vf_set(-me->grav_gain * 0.005f), error),
+				vf_add(vf_mul(vf_set(5.0f), ang_vel), one));
+			use_angle = vf_max(use_angle, vf_sub(zero, error));
+			vf_store(me->grav_error_angle + i, vm_select(correct, vf_add(error, use_angle), error));
+
+			// a small angle, the first terms of sin and cos are enough
+			vfloat ch = vf_mul(use_angle, half);
+			vfloat ch2 = vf_mul(ch, ch);
+			vfloat sin_ch = vf_mul(ch, vf_sub(one, vf_mul(ch2, vf_set(1.0f / 6.0f))));
+			vfloat cw = vf_sub(one, vf_mul(vf_mul(ch2, half), vf_sub(one, vf_mul(ch2, vf_set(1.0f / 12.0f)))));
+			vfloat cx = vf_mul(vf_load(me->grav_error_axis[0] + i), sin_ch);
+			vfloat cz = vf_mul(vf_load(me->grav_error_axis[1] + i), sin_ch);
+
+			// orient = corr * orient, the axis has no y
+			nx = vf_add(vf_mul(cw, qx), vf_sub(vf_mul(cx, qw), vf_mul(cz, qy)));
+			ny = vf_add(vf_mul(cw, qy), vf_sub(vf_mul(cz, qx), vf_mul(cx, qz)));
+			nz = vf_add(vf_mul(cw, qz), vf_add(vf_mul(cx, qy), vf_mul(cz, qw)));
+			nw = vf_sub(vf_mul(cw, qw), vf_add(vf_mul(cx, qx), vf_mul(cz, qz)));
+
+			qx = vm_select(correct, nx, qx);
+			qy = vm_select(correct, ny, qy);
+			qz = vm_select(correct, nz, qz);
+			qw = vm_select(correct, nw, qw);
+		}
+
+		// mitigate drift due to floating point imprecision
+		vfloat length = vf_sqrt(vf_add(vf_add(vf_mul(qx, qx), vf_mul(qy, qy)), vf_add(vf_mul(qz, qz), vf_mul(qw, qw))));
+		vfloat inv_length = vf_div(one, length);
+
+		vf_store(me->orient[0] + i, vf_mul(qx, inv_length));
+		vf_store(me->orient[1] + i, vf_mul(qy, inv_length));
+		vf_store(me->orient[2] + i, vf_mul(qz, inv_length));
+		vf_store(me->orient[3] + i, vf_mul(qw, inv_length));
+	}
+}
@@ -0,0 +1,69 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Sensor Fusion - Device Groups */
+
+#ifndef FUSION_GROUP_H
+#define FUSION_GROUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "omath.h"
+
+// The default engine's gyro integration and gravity correction for many
+// identical devices at once, for rigs with dozens of trackers. The state is
+// kept as a structure of arrays, one array per value with an element per
+// device, so that several devices are updated with each SIMD instruction:
+// eight with AVX2, four with SSE2 or NEON on AArch64, one at a time
+// elsewhere. Which one is decided when building, AVX2 needs -mavx2 (or a
+// -march that has it).
+//
+// The orientations follow what a fusion struct with the default engine
+// would give within FUSION_GROUP_TOLERANCE radians, the rotation of a sample
+// is taken from a polynomial though, which is exact in single precision for
+// turns of up to 1 rad per sample.
+
+#define FUSION_GROUP_TOLERANCE 0.001f
+
+// samples the tilt is measured over, as the fusion struct's accel_fq
+#define FUSION_GROUP_WINDOW 20
+
+typedef struct {
+	int count;  // devices
+	int stride; // elements per array, count rounded up to a whole SIMD vector
+	uint32_t iterations;
+	float grav_gain;
+
+	// the next sample of every device, written by the caller before each
+	// ofusion_group_update, see ofusion_group_set_sample
+	float* dt;
+	float* ang_vel[3];
+	float* accel[3];
+
+	// the orientation
+	float* orient[4]; // x, y, z, w
+
+	// gravity correction, as in the fusion struct
+	float* level_count;
+	float* accel_window[3]; // world acceleration, FUSION_GROUP_WINDOW samples a stride apart
+	float* grav_error_angle;
+	float* grav_error_axis[2]; // x and z, the axis is level
+
+	float* data;
+} fusion_group;
+
+// false if out of memory
+bool ofusion_group_init(fusion_group* me, int count);
+void ofusion_group_free(fusion_group* me);
+
+void ofusion_group_set_sample(fusion_group* me, int device, float dt, const vec3f* ang_vel, const vec3f* accel);
+void ofusion_group_get_orient(const fusion_group* me, int device, quatf* orient);
+
+// Fuses the sample of every device
+void ofusion_group_update(fusion_group* me);
+
+#endif
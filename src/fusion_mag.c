@@ -0,0 +1,318 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Sensor Fusion - Magnetometer Yaw Correction */
+
+// Gravity keeps the tilt from drifting but can't tell about the yaw, the
+// magnetic field can once the magnetometer is calibrated. Readings of a
+// device turned every which way lie on an ellipsoid, off center by the hard
+// iron (magnetized parts of the device) and squashed by the soft iron (parts
+// that bend the field). The readings are fit to one as they come, by
+// recursive least squares on its nine parameters, and the calibration maps
+// them back onto the unit sphere. Rotated into the world frame the field
+// then keeps pointing the same way unless the yaw drifts, and the yaw is
+// slowly pulled back to where the field pointed when the correction began.
+//
+// A reading is fit only when it points FEED_ANGLE away from the last one,
+// so that a device held still doesn't outweigh the rest, for a 9x9
+// covariance update. Readings that don't look like the calibrated field,
+// near metal or a speaker, are left out of both, as are the readings for
+// QUIET_TIME after them.
+
+#include <string.h>
+#include "openhmdi.h"
+
+#define FEED_ANGLE 0.1f // rad between readings fit
+#define MIN_FED 100 // readings fit before there's a calibration
+#define REFIT_INTERVAL 10 // readings fit between refreshing the calibration
+#define MAX_FIT_ERROR 0.005f // mean square error of the fit on new readings
+#define MAX_AXIS_RATIO 3.0 // soft iron squashing the field more than this is a bad fit
+#define INITIAL_COVARIANCE 1000.0
+
+#define FIELD_TOLERANCE 0.08f // of the calibrated field's length
+#define DIP_TOLERANCE 0.05f // of its vertical part
+#define QUIET_TIME 1.0f // s the field has to look right for after a disturbance
+#define MIN_HORIZONTAL 0.2f // too close to a magnetic pole to tell the heading below this
+#define YAW_GAIN 0.2f // 1/s, how fast the yaw is pulled in
+
+void ofusion_mag_init(fusion_mag* me)
+{
+	memset(me, 0, sizeof(fusion_mag));
+
+	for(int i = 0; i < 9; i++)
+		me->fit_cov[i][i] = INITIAL_COVARIANCE;
+
+	me->fit_error = 1.0f;
+
+	for(int i = 0; i < 3; i++)
+		me->soft_iron[i][i] = 1.0f;
+}
+
+// Fits the ellipsoid x^T M x + 2 v^T x = 1 to one more reading, the
+// parameters are M's diagonal, its upper triangle and v
+static void feed(fusion_mag* me, const vec3f* raw)
+{
+	if(me->scale == 0)
+		me->scale = ovec3f_get_length(raw);
+
+	double x = raw->x / me->scale, y = raw->y / me->scale, z = raw->z / me->scale;
+	double h[9] = { x * x, y * y, z * z, 2 * x * y, 2 * x * z, 2 * y * z, 2 * x, 2 * y, 2 * z };
+	double ph[9], hph = 0, error = 1.0;
+
+	for(int i = 0; i < 9; i++){
+		ph[i] = 0;
+		for(int j = 0; j < 9; j++)
+			ph[i] += me->fit_cov[i][j] * h[j];
+
+		hph += h[i] * ph[i];
+		error -= h[i] * me->fit[i];
+	}
+
+	// the error before taking the reading in tells how well the fit predicts
+	me->fit_error += ((float)(error * error) - me->fit_error) * 0.05f;
+
+	double denom = 1.0 + hph;
+	for(int i = 0; i < 9; i++){
+		me->fit[i] += ph[i] * error / denom;
+
+		for(int j = 0; j < 9; j++)
+			me->fit_cov[i][j] -= ph[i] * ph[j] / denom;
+	}
+
+	me->last_fed = *raw;
+	me->fed++;
+}
+
+static bool invert(const double m[3][3], double out[3][3])
+{
+	double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+	           - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+	           + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+
+	if(fabs(det) < 1e-12)
+		return false;
+
+	for(int i = 0; i < 3; i++){
+		for(int j = 0; j < 3; j++){
+			// cofactor of m[j][i]
+			int r0 = (j + 1) % 3, r1 = (j + 2) % 3, c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+			out[i][j] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) / det;
+		}
+	}
+
+	return true;
+}
+
+// Square root of a symmetric matrix from its eigenvectors, found by Jacobi
+// rotations. False unless it's positive definite and its eigenvalues are
+// within MAX_AXIS_RATIO squared of each other.
+static bool sqrt_symmetric(const double a[3][3], double out[3][3])
+{
+	double d[3][3], v[3][3] = {{ 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }};
+	memcpy(d, a, sizeof(d));
+
+	for(int sweep = 0; sweep < 10; sweep++){
+		for(int p = 0; p < 2; p++){
+			for(int q = p + 1; q < 3; q++){
+				if(fabs(d[p][q]) < 1e-15)
+					continue;
+
+				double theta = (d[q][q] - d[p][p]) / (2.0 * d[p][q]);
+				double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+				double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+
+				for(int k = 0; k < 3; k++){
+					double dkp = d[k][p], dkq = d[k][q];
+					d[k][p] = c * dkp - s * dkq;
+					d[k][q] = s * dkp + c * dkq;
+
+					double vkp = v[k][p], vkq = v[k][q];
+					v[k][p] = c * vkp - s * vkq;
+					v[k][q] = s * vkp + c * vkq;
+				}
+
+				for(int k = 0; k < 3; k++){
+					double dpk = d[p][k], dqk = d[q][k];
+					d[p][k] = c * dpk - s * dqk;
+					d[q][k] = s * dpk + c * dqk;
+				}
+			}
+		}
+	}
+
+	double min = OHMD_MIN(d[0][0], OHMD_MIN(d[1][1], d[2][2]));
+	double max = OHMD_MAX(d[0][0], OHMD_MAX(d[1][1], d[2][2]));
+	if(min <= 0 || max > min * MAX_AXIS_RATIO * MAX_AXIS_RATIO)
+		return false;
+
+	for(int i = 0; i < 3; i++){
+		for(int j = 0; j < 3; j++){
+			out[i][j] = 0;
+			for(int k = 0; k < 3; k++)
+				out[i][j] += v[i][k] * sqrt(d[k][k]) * v[j][k];
+		}
+	}
+
+	return true;
+}
+
+// The calibration from the fit: with c = -M^-1 v the ellipsoid is
+// (x - c)^T M (x - c) = 1 + c^T M c, the square root of M over the right
+// side takes it onto the unit sphere
+static bool solve(const fusion_mag* me, vec3f* hard_iron, float soft_iron[3][3])
+{
+	const double* p = me->fit;
+	double m[3][3] = {{ p[0], p[3], p[4] }, { p[3], p[1], p[5] }, { p[4], p[5], p[2] }};
+	double inv[3][3], w[3][3], c[3], g = 1.0;
+
+	if(!invert(m, inv))
+		return false;
+
+	for(int i = 0; i < 3; i++)
+		c[i] = -(inv[i][0] * p[6] + inv[i][1] * p[7] + inv[i][2] * p[8]);
+
+	for(int i = 0; i < 3; i++){
+		for(int j = 0; j < 3; j++)
+			g += c[i] * m[i][j] * c[j];
+	}
+
+	if(g <= 0)
+		return false;
+
+	for(int i = 0; i < 3; i++){
+		for(int j = 0; j < 3; j++)
+			m[i][j] /= g;
+	}
+
+	if(!sqrt_symmetric(m, w))
+		return false;
+
+	// the fit was of readings divided by scale
+	for(int i = 0; i < 3; i++){
+		hard_iron->arr[i] = (float)(c[i] * me->scale);
+
+		for(int j = 0; j < 3; j++)
+			soft_iron[i][j] = (float)(w[i][j] / me->scale);
+	}
+
+	return true;
+}
+
+static void calibrate(const vec3f* hard_iron, float soft_iron[3][3], const vec3f* raw, vec3f* out)
+{
+	vec3f centered;
+	ovec3f_subtract(raw, hard_iron, &centered);
+
+	for(int i = 0; i < 3; i++)
+		out->arr[i] = soft_iron[i][0] * centered.x + soft_iron[i][1] * centered.y + soft_iron[i][2] * centered.z;
+}
+
+// angle around up from the horizontal direction (x, z) to world's
+static float heading_error(const float reference[2], const vec3f* world)
+{
+	return atan2f(reference[1] * world->x - reference[0] * world->z, reference[0] * world->x + reference[1] * world->z);
+}
+
+// Takes the new calibration, turning the reference along with how it
+// changes where the current reading points
+static void recalibrate(fusion_mag* me, const quatf* orient, const vec3f* raw)
+{
+	vec3f hard_iron;
+	float soft_iron[3][3];
+
+	if(!solve(me, &hard_iron, soft_iron))
+		return;
+
+	if(me->has_reference){
+		vec3f old_field, new_field, old_world, new_world;
+		calibrate(&me->hard_iron, me->soft_iron, raw, &old_field);
+		calibrate(&hard_iron, soft_iron, raw, &new_field);
+		oquatf_get_rotated(orient, &old_field, &old_world);
+		oquatf_get_rotated(orient, &new_field, &new_world);
+
+		float old_direction[2] = { old_world.x, old_world.z };
+		float turn = heading_error(old_direction, &new_world);
+		float c = cosf(turn), s = sinf(turn);
+		float x = me->reference[0], z = me->reference[1];
+
+		me->reference[0] = c * x + s * z;
+		me->reference[1] = c * z - s * x;
+		me->reference_dip += new_world.y - old_world.y;
+	}
+
+	me->hard_iron = hard_iron;
+	memcpy(me->soft_iron, soft_iron, sizeof(soft_iron));
+	me->calibrated = true;
+}
+
+// world is the calibrated field in the world frame
+static void correct_yaw(fusion_mag* me, quatf* orient, float dt, const vec3f* world)
+{
+	float horizontal = sqrtf(world->x * world->x + world->z * world->z);
+	if(horizontal < MIN_HORIZONTAL)
+		return;
+
+	if(!me->has_reference){
+		me->reference[0] = world->x / horizontal;
+		me->reference[1] = world->z / horizontal;
+		me->reference_dip = world->y;
+		me->has_reference = true;
+		return;
+	}
+
+	// the field turning around up by an angle means the yaw drifted by as much
+	float angle = -heading_error(me->reference, world) * OHMD_MIN(YAW_GAIN * dt, 1.0f);
+
+	vec3f up = {{ 0, 1.0f, 0 }};
+	quatf corr_quat, old_orient = *orient;
+	oquatf_init_axis(&corr_quat, &up, angle);
+	oquatf_mult(&corr_quat, &old_orient, orient);
+}
+
+void ofusion_mag_update(fusion_mag* me, quatf* orient, float dt, const vec3f* raw, vec3f* calibrated)
+{
+	// no magnetometer
+	float length = ovec3f_get_length(raw);
+	if(length < 1e-6f)
+		return;
+
+	// a disturbed field is of another strength or dips differently, the
+	// latter also when the tilt is off
+	vec3f field, world;
+	bool plausible = true;
+	if(me->calibrated){
+		calibrate(&me->hard_iron, me->soft_iron, raw, &field);
+		oquatf_get_rotated(orient, &field, &world);
+
+		plausible = fabsf(ovec3f_get_length(&field) - 1.0f) < FIELD_TOLERANCE &&
+			(!me->has_reference || fabsf(world.y - me->reference_dip) < DIP_TOLERANCE);
+	}
+
+	me->quiet_time = plausible ? me->quiet_time + dt : 0;
+	plausible = plausible && me->quiet_time >= QUIET_TIME;
+
+	float last_length = ovec3f_get_length(&me->last_fed);
+	bool turned = me->fed == 0 || ovec3f_get_dot(raw, &me->last_fed) < cosf(FEED_ANGLE) * length * last_length;
+
+	if(plausible && turned){
+		feed(me, raw);
+
+		if(me->fed >= MIN_FED && me->fed % REFIT_INTERVAL == 0 && me->fit_error < MAX_FIT_ERROR)
+			recalibrate(me, orient, raw);
+	}
+
+	if(!me->calibrated)
+		return;
+
+	calibrate(&me->hard_iron, me->soft_iron, raw, &field);
+	*calibrated = field;
+
+	if(plausible){
+		oquatf_get_rotated(orient, &field, &world);
+		correct_yaw(me, orient, dt, &world);
+	}
+}
@@ -0,0 +1,146 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Sensor Fusion - Mahony Filter */
+
+// Feeds the angle between the measured and the expected gravity back into
+// the gyro rate, proportionally to pull the tilt in and through an integral
+// that ends up as the gyro bias (R. Mahony et al., "Nonlinear Complementary
+// Filters on the Special Orthogonal Group"). A sample costs a couple of cross
+// products and a first order quaternion integration without any trig, for
+// trackers where that matters more than the accuracy of the other engines.
+
+#include <string.h>
+#include "openhmdi.h"
+
+#define GRAVITY 9.82f
+
+// accelerations further than this from gravity are motion, not gravity
+#define GRAVITY_TOLERANCE 2.0f
+
+#define KP 0.5f // 1/s, how fast the tilt follows gravity
+#define KI 0.1f  // 1/s^2, how fast the bias follows the tilt error
+
+typedef struct {
+	bool initialized;
+	vec3f gyro_bias;
+} mahony_state;
+
+// The tilt error as an angular rate, zero if accel isn't gravity
+static bool get_error(const fusion* f, const vec3f* accel, vec3f* error)
+{
+	float length = ovec3f_get_length(accel);
+
+	if(!(f->flags & FF_USE_GRAVITY) || fabsf(length - GRAVITY) > GRAVITY_TOLERANCE)
+		return false;
+
+	// up as the orientation expects the accelerometer to see it, the second
+	// row of its rotation matrix
+	const quatf* q = &f->orient;
+	vec3f expected = {{ 2.0f * (q->x * q->y + q->w * q->z),
+	                    1.0f - 2.0f * (q->x * q->x + q->z * q->z),
+	                    2.0f * (q->y * q->z - q->w * q->x) }};
+
+	vec3f measured = {{ accel->x / length, accel->y / length, accel->z / length }};
+
+	// measured x expected
+	error->x = measured.y * expected.z - measured.z * expected.y;
+	error->y = measured.z * expected.x - measured.x * expected.z;
+	error->z = measured.x * expected.y - measured.y * expected.x;
+
+	return true;
+}
+
+// q += q * (0, ang_vel) * dt / 2, ofusion_update normalizes after
+static void integrate(quatf* q, const vec3f* ang_vel, float dt)
+{
+	float hx = ang_vel->x * dt * 0.5f, hy = ang_vel->y * dt * 0.5f, hz = ang_vel->z * dt * 0.5f;
+	quatf p = *q;
+
+	q->x += p.w * hx + p.y * hz - p.z * hy;
+	q->y += p.w * hy - p.x * hz + p.z * hx;
+	q->z += p.w * hz + p.x * hy - p.y * hx;
+	q->w -= p.x * hx + p.y * hy + p.z * hz;
+}
+
+// Applies the feedback for error over dt seconds to the rate and the bias
+static void feed_back(mahony_state* me, const vec3f* error, float dt, vec3f* ang_vel)
+{
+	for(int i = 0; i < 3; i++){
+		me->gyro_bias.arr[i] -= KI * error->arr[i] * dt;
+		ang_vel->arr[i] += KP * error->arr[i];
+	}
+}
+
+// Starts from the tilt the first reading of gravity shows
+static void start(fusion* f, mahony_state* me, const vec3f* accel)
+{
+	vec3f error;
+
+	if(me->initialized || !get_error(f, accel, &error))
+		return;
+
+	ofusion_level(&f->orient, accel);
+	me->initialized = true;
+}
+
+static void mahony_update(fusion* f, void* state, float dt, const vec3f* raw_ang_vel, const vec3f* accel)
+{
+	mahony_state* me = state;
+	vec3f ang_vel, error;
+
+	start(f, me, accel);
+	ovec3f_subtract(raw_ang_vel, &me->gyro_bias, &ang_vel);
+
+	if(me->initialized && get_error(f, accel, &error))
+		feed_back(me, &error, dt, &ang_vel);
+
+	integrate(&f->orient, &ang_vel, dt);
+}
+
+// The error is taken once from the mean acceleration of the batch
+static void mahony_update_batch(fusion* f, void* state, const ofusion_sample* samples, int count)
+{
+	mahony_state* me = state;
+	vec3f accel = {{ 0, 0, 0 }}, error, feedback = {{ 0, 0, 0 }};
+	float dt = 0;
+
+	for(int i = 0; i < count; i++){
+		for(int j = 0; j < 3; j++)
+			accel.arr[j] += samples[i].accel.arr[j] / count;
+		dt += samples[i].dt;
+	}
+
+	start(f, me, &accel);
+
+	// the rate correction is the same for every sample, the bias moves once
+	vec3f bias = me->gyro_bias;
+	if(me->initialized && get_error(f, &accel, &error))
+		feed_back(me, &error, dt, &feedback);
+
+	for(int i = 0; i < count; i++){
+		vec3f ang_vel;
+		for(int j = 0; j < 3; j++)
+			ang_vel.arr[j] = samples[i].ang_vel.arr[j] - bias.arr[j] + feedback.arr[j];
+
+		integrate(&f->orient, &ang_vel, samples[i].dt);
+	}
+}
+
+static void mahony_get_gyro_bias(const void* state, vec3f* out)
+{
+	*out = ((const mahony_state*)state)->gyro_bias;
+}
+
+const ofusion_engine ofusion_engine_mahony = {
+	"mahony",
+	sizeof(mahony_state),
+	NULL,
+	mahony_update,
+	mahony_update_batch,
+	mahony_get_gyro_bias,
+};
@@ -0,0 +1,439 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* HID Transport Interface - Implementation */
+
+#include "openhmdi.h"
+#include "hid.h"
+
+#ifdef OHMD_HIDRAW
+#include "hidraw.h"
+#endif
+
+#ifdef OHMD_HIDAPI
+
+#include <hidapi.h>
+
+// hidapi transport
+
+typedef struct {
+	ohmd_hid_device base;
+	hid_device* handle;
+} hidapi_device;
+
+static wchar_t* copy_wide(const wchar_t* str)
+{
+	if(!str)
+		return NULL;
+
+	size_t size = (wcslen(str) + 1) * sizeof(wchar_t);
+	wchar_t* copy = malloc(size);
+	if(copy)
+		memcpy(copy, str, size);
+
+	return copy;
+}
+
+static void hidapi_free_enumeration(ohmd_hid_transport* transport, ohmd_hid_device_info* devs)
+{
+	while(devs){
+		ohmd_hid_device_info* next = devs->next;
+		free(devs->path);
+		free(devs->serial_number);
+		free(devs->manufacturer_string);
+		free(devs->product_string);
+		free(devs);
+		devs = next;
+	}
+}
+
+static ohmd_hid_device_info* hidapi_enumerate(ohmd_hid_transport* transport, unsigned short vendor_id, unsigned short product_id)
+{
+	// copied field by field, hidapi's struct differs between versions
+	struct hid_device_info* devs = hid_enumerate(vendor_id, product_id);
+	ohmd_hid_device_info* first = NULL;
+	ohmd_hid_device_info** next = &first;
+
+	for(struct hid_device_info* cur = devs; cur; cur = cur->next){
+		ohmd_hid_device_info* info = calloc(1, sizeof(ohmd_hid_device_info));
+		char* path = malloc(strlen(cur->path) + 1);
+		if(!info || !path){
+			free(info);
+			free(path);
+			break;
+		}
+
+		strcpy(path, cur->path);
+		info->path = path;
+		info->vendor_id = cur->vendor_id;
+		info->product_id = cur->product_id;
+		info->serial_number = copy_wide(cur->serial_number);
+		info->release_number = cur->release_number;
+		info->manufacturer_string = copy_wide(cur->manufacturer_string);
+		info->product_string = copy_wide(cur->product_string);
+		info->usage_page = cur->usage_page;
+		info->usage = cur->usage;
+		info->interface_number = cur->interface_number;
+
+		*next = info;
+		next = &info->next;
+	}
+
+	hid_free_enumeration(devs);
+
+	return first;
+}
+
+static ohmd_hid_device* hidapi_open_path(ohmd_hid_transport* transport, const char* path)
+{
+	hid_device* handle = hid_open_path(path);
+	if(!handle)
+		return NULL;
+
+	hidapi_device* dev = calloc(1, sizeof(hidapi_device));
+	if(!dev){
+		hid_close(handle);
+		return NULL;
+	}
+
+	dev->base.transport = transport;
+	dev->handle = handle;
+
+	return &dev->base;
+}
+
+// hidapi is set up once for the whole process, the contexts using it are
+// counted so that the last one to go shuts it down
+static volatile uint32_t hidapi_users;
+static volatile uint32_t hidapi_lock;
+
+static void lock_hidapi(void)
+{
+	// whoever takes the count from 0 to 1 holds it
+	while(ohmd_atomic_add(&hidapi_lock, 1) != 1){
+		ohmd_atomic_add(&hidapi_lock, (uint32_t)-1);
+		ohmd_sleep(0.0001);
+	}
+}
+
+static void unlock_hidapi(void)
+{
+	ohmd_atomic_add(&hidapi_lock, (uint32_t)-1);
+}
+
+static void hidapi_init(ohmd_hid_transport* transport)
+{
+	lock_hidapi();
+	if(hidapi_users++ == 0)
+		hid_init();
+	unlock_hidapi();
+}
+
+static void hidapi_exit(ohmd_hid_transport* transport)
+{
+	lock_hidapi();
+	if(hidapi_users > 0 && --hidapi_users == 0)
+		hid_exit();
+	unlock_hidapi();
+}
+
+static void hidapi_close(ohmd_hid_device* dev)
+{
+	hid_close(((hidapi_device*)dev)->handle);
+	free(dev);
+}
+
+static int hidapi_set_nonblocking(ohmd_hid_device* dev, int nonblock)
+{
+	return hid_set_nonblocking(((hidapi_device*)dev)->handle, nonblock);
+}
+
+static int hidapi_read(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	return hid_read(((hidapi_device*)dev)->handle, data, length);
+}
+
+static int hidapi_write(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	return hid_write(((hidapi_device*)dev)->handle, data, length);
+}
+
+static int hidapi_send_feature_report(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	return hid_send_feature_report(((hidapi_device*)dev)->handle, data, length);
+}
+
+static int hidapi_get_feature_report(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	return hid_get_feature_report(((hidapi_device*)dev)->handle, data, length);
+}
+
+static int hidapi_get_string(ohmd_hid_device* dev, ohmd_hid_string string, wchar_t* out, size_t maxlen)
+{
+	hid_device* handle = ((hidapi_device*)dev)->handle;
+
+	switch(string){
+	case OHMD_HID_MANUFACTURER_STRING: return hid_get_manufacturer_string(handle, out, maxlen);
+	case OHMD_HID_PRODUCT_STRING: return hid_get_product_string(handle, out, maxlen);
+	case OHMD_HID_SERIAL_NUMBER_STRING: return hid_get_serial_number_string(handle, out, maxlen);
+	}
+
+	return -1;
+}
+
+static ohmd_hid_transport hidapi_transport = {
+	hidapi_enumerate,
+	hidapi_free_enumeration,
+	hidapi_open_path,
+	hidapi_init,
+	hidapi_exit,
+	hidapi_close,
+	hidapi_set_nonblocking,
+	hidapi_read,
+	hidapi_write,
+	hidapi_send_feature_report,
+	hidapi_get_feature_report,
+	hidapi_get_string,
+	NULL, // hidapi hides its descriptor (and with libusb there is none to wait on)
+};
+
+#endif
+
+ohmd_hid_transport* ohmd_hid_get_default_transport(void)
+{
+#if defined(OHMD_HIDRAW)
+	return ohmd_hidraw_get_transport();
+#elif defined(OHMD_HIDAPI)
+	return &hidapi_transport;
+#else
+	return NULL;
+#endif
+}
+
+void ohmd_ctx_set_hid_transport(ohmd_context* ctx, ohmd_hid_transport* transport)
+{
+	// the devices found belong to the old transport
+	ohmd_hid_free_probe(ctx);
+
+	// keep capturing, on top of the new transport
+	if(ctx->hid_capture)
+		ohmd_hid_capture_set_inner(ctx->hid_capture, transport);
+	else
+		ctx->hid_transport = transport;
+}
+
+ohmd_hid_device_info* ohmd_hid_enumerate(ohmd_context* ctx, unsigned short vendor_id, unsigned short product_id)
+{
+	if(!ctx->hid_transport)
+		return NULL;
+
+	return ctx->hid_transport->enumerate(ctx->hid_transport, vendor_id, product_id);
+}
+
+void ohmd_hid_free_enumeration(ohmd_context* ctx, ohmd_hid_device_info* devs)
+{
+	if(ctx->hid_transport && devs)
+		ctx->hid_transport->free_enumeration(ctx->hid_transport, devs);
+}
+
+ohmd_hid_device* ohmd_hid_open_path(ohmd_context* ctx, const char* path)
+{
+	if(!ctx->hid_transport)
+		return NULL;
+
+	return ctx->hid_transport->open_path(ctx->hid_transport, path);
+}
+
+void ohmd_hid_init(ohmd_context* ctx)
+{
+	ohmd_hid_transport* transport = ohmd_hid_get_default_transport();
+
+	ctx->hid_transport = ctx->hid_default_transport = transport;
+	if(transport && transport->init)
+		transport->init(transport);
+}
+
+void ohmd_hid_exit(ohmd_context* ctx)
+{
+	// the transport set with ohmd_ctx_set_hid_transport belongs to the caller
+	ohmd_hid_transport* transport = ctx->hid_default_transport;
+
+	if(transport && transport->exit)
+		transport->exit(transport);
+
+	ctx->hid_default_transport = NULL;
+}
+
+void ohmd_hid_probe(ohmd_context* ctx)
+{
+	ohmd_hid_free_probe(ctx);
+
+	ctx->hid_devices = ohmd_hid_enumerate(ctx, 0, 0);
+	ctx->hid_devices_transport = ctx->hid_transport;
+}
+
+void ohmd_hid_free_probe(ohmd_context* ctx)
+{
+	if(ctx->hid_devices)
+		ctx->hid_devices_transport->free_enumeration(ctx->hid_devices_transport, ctx->hid_devices);
+
+	ctx->hid_devices = NULL;
+	ctx->hid_devices_transport = NULL;
+}
+
+static bool vendor_selected(ohmd_context* ctx, unsigned short vendor_id)
+{
+	if(!ctx->probing || ctx->probe_vendor_ids[0] == 0)
+		return true;
+
+	for(int i = 0; i < OHMD_MAX_PROBE_VENDORS && ctx->probe_vendor_ids[i]; i++){
+		if(ctx->probe_vendor_ids[i] == vendor_id)
+			return true;
+	}
+
+	return false;
+}
+
+ohmd_hid_device_info* ohmd_hid_next_device(ohmd_context* ctx, ohmd_hid_device_info* prev,
+	unsigned short vendor_id, unsigned short product_id)
+{
+	for(ohmd_hid_device_info* cur = prev ? prev->next : ctx->hid_devices; cur; cur = cur->next){
+		if((vendor_id == 0 || cur->vendor_id == vendor_id) && (product_id == 0 || cur->product_id == product_id)
+		  && vendor_selected(ctx, cur->vendor_id))
+			return cur;
+	}
+
+	return NULL;
+}
+
+ohmd_hid_device_info* ohmd_hid_find_device(ohmd_context* ctx, const char* path)
+{
+	for(ohmd_hid_device_info* cur = ctx->hid_devices; cur; cur = cur->next){
+		if(strcmp(cur->path, path) == 0)
+			return cur;
+	}
+
+	return NULL;
+}
+
+void ohmd_hid_get_identity(ohmd_context* ctx, ohmd_hid_device* dev, const char* path, ohmd_hid_identity* identity)
+{
+	memset(identity, 0, sizeof(*identity));
+
+	identity->transport = dev->transport;
+	identity->interface_number = -1;
+	strncpy(identity->path, path, OHMD_STR_SIZE - 1);
+
+	ohmd_hid_device_info* info = ohmd_hid_find_device(ctx, path);
+	if(info){
+		identity->vendor_id = info->vendor_id;
+		identity->product_id = info->product_id;
+		identity->interface_number = info->interface_number;
+	}
+
+	if(ohmd_hid_get_serial_number_string(dev, identity->serial, 64) != 0 || identity->serial[0] == L'\0'){
+		identity->serial[0] = L'\0';
+		if(info && info->serial_number)
+			wcsncpy(identity->serial, info->serial_number, 63);
+	}
+
+	identity->serial[63] = L'\0';
+}
+
+static bool same_device(const ohmd_hid_identity* identity, const ohmd_hid_device_info* info)
+{
+	if(info->interface_number != identity->interface_number)
+		return false;
+
+	// devices without a serial number can only be told apart by where they are
+	if(identity->serial[0] == L'\0')
+		return strcmp(info->path, identity->path) == 0;
+
+	return info->serial_number && wcscmp(info->serial_number, identity->serial) == 0;
+}
+
+ohmd_hid_device* ohmd_hid_reopen(const ohmd_hid_identity* identity)
+{
+	ohmd_hid_transport* transport = identity->transport;
+	ohmd_hid_device* dev = NULL;
+
+	ohmd_hid_device_info* devs = transport->enumerate(transport, identity->vendor_id, identity->product_id);
+
+	for(ohmd_hid_device_info* cur = devs; cur && !dev; cur = cur->next){
+		if(same_device(identity, cur))
+			dev = transport->open_path(transport, cur->path);
+	}
+
+	if(devs)
+		transport->free_enumeration(transport, devs);
+
+	return dev;
+}
+
+bool ohmd_hid_probe_matches(ohmd_context* ctx, const ohmd_hid_match* matches)
+{
+	for(; matches->vendor_id; matches++){
+		if(ohmd_hid_next_device(ctx, NULL, matches->vendor_id, matches->product_id))
+			return true;
+	}
+
+	return false;
+}
+
+void ohmd_hid_close(ohmd_hid_device* dev)
+{
+	if(dev)
+		dev->transport->close(dev);
+}
+
+int ohmd_hid_set_nonblocking(ohmd_hid_device* dev, int nonblock)
+{
+	return dev->transport->set_nonblocking(dev, nonblock);
+}
+
+int ohmd_hid_read(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	return dev->transport->read(dev, data, length);
+}
+
+int ohmd_hid_write(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	return dev->transport->write(dev, data, length);
+}
+
+int ohmd_hid_send_feature_report(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	return dev->transport->send_feature_report(dev, data, length);
+}
+
+int ohmd_hid_get_feature_report(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	return dev->transport->get_feature_report(dev, data, length);
+}
+
+int ohmd_hid_get_manufacturer_string(ohmd_hid_device* dev, wchar_t* string, size_t maxlen)
+{
+	return dev->transport->get_string(dev, OHMD_HID_MANUFACTURER_STRING, string, maxlen);
+}
+
+int ohmd_hid_get_product_string(ohmd_hid_device* dev, wchar_t* string, size_t maxlen)
+{
+	return dev->transport->get_string(dev, OHMD_HID_PRODUCT_STRING, string, maxlen);
+}
+
+int ohmd_hid_get_serial_number_string(ohmd_hid_device* dev, wchar_t* string, size_t maxlen)
+{
+	return dev->transport->get_string(dev, OHMD_HID_SERIAL_NUMBER_STRING, string, maxlen);
+}
+
+int ohmd_hid_get_fd(ohmd_hid_device* dev)
+{
+	if(!dev || !dev->transport->get_fd)
+		return -1;
+
+	return dev->transport->get_fd(dev);
+}
@@ -1,5 +1,164 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* HID Transport Interface */
+
+#ifndef HID_H
+#define HID_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "openhmd.h"
+
+// The drivers talk to their devices through a transport, which is hidapi,
+// the Linux hidraw backend (see hidraw.h) or the in-memory mock (see
+// hid_mock.h). The calls mirror hidapi. Each context has one transport,
+// the built-in one unless another is set with ohmd_ctx_set_hid_transport.
+
+typedef struct ohmd_hid_transport ohmd_hid_transport;
+
+typedef struct ohmd_hid_device_info {
+	char* path;
+	unsigned short vendor_id;
+	unsigned short product_id;
+	wchar_t* serial_number;
+	unsigned short release_number;
+	wchar_t* manufacturer_string;
+	wchar_t* product_string;
+	unsigned short usage_page;
+	unsigned short usage;
+	int interface_number;
+	struct ohmd_hid_device_info* next;
+} ohmd_hid_device_info;
+
+// Transports embed this as the first member of their device handles.
+typedef struct {
+	ohmd_hid_transport* transport;
+} ohmd_hid_device;
+
+typedef enum {
+	OHMD_HID_MANUFACTURER_STRING,
+	OHMD_HID_PRODUCT_STRING,
+	OHMD_HID_SERIAL_NUMBER_STRING,
+} ohmd_hid_string;
+
+struct ohmd_hid_transport {
+	ohmd_hid_device_info* (*enumerate)(ohmd_hid_transport* transport, unsigned short vendor_id, unsigned short product_id);
+	void (*free_enumeration)(ohmd_hid_transport* transport, ohmd_hid_device_info* devs);
+	ohmd_hid_device* (*open_path)(ohmd_hid_transport* transport, const char* path);
+
+	// Optional, called once by each context using the transport when it's
+	// created and when it's destroyed. Contexts come and go independently,
+	// a transport with global state (like hidapi's) has to count them.
+	void (*init)(ohmd_hid_transport* transport);
+	void (*exit)(ohmd_hid_transport* transport);
+
+	void (*close)(ohmd_hid_device* dev);
+	int (*set_nonblocking)(ohmd_hid_device* dev, int nonblock);
+	int (*read)(ohmd_hid_device* dev, unsigned char* data, size_t length);
+	int (*write)(ohmd_hid_device* dev, const unsigned char* data, size_t length);
+	int (*send_feature_report)(ohmd_hid_device* dev, const unsigned char* data, size_t length);
+	int (*get_feature_report)(ohmd_hid_device* dev, unsigned char* data, size_t length);
+	int (*get_string)(ohmd_hid_device* dev, ohmd_hid_string string, wchar_t* out, size_t maxlen);
+
+	// optional, the descriptor reports arrive on, for the automatic update loop
+	int (*get_fd)(ohmd_hid_device* dev);
+
+	// optional, a count that changes whenever a device is added or removed,
+	// for transports the hotplug monitor can't watch otherwise (see hotplug.h)
+	uint32_t (*get_generation)(ohmd_hid_transport* transport);
+};
+
+// A device a driver handles, a product_id of 0 matching all products of the
+// vendor. Drivers declare a table of them ended by a zeroed entry, see
+// ohmd_driver.
+typedef struct {
+	unsigned short vendor_id;
+	unsigned short product_id;
+} ohmd_hid_match;
+
+// the transport the library was built with, NULL if there is none
+ohmd_hid_transport* ohmd_hid_get_default_transport(void);
+
+// The transport is not owned by the context, it has to outlive it.
+void ohmd_ctx_set_hid_transport(ohmd_context* ctx, ohmd_hid_transport* transport);
+
+// Sets the context up with the default transport, and lets go of it when
+// the context is destroyed. Drivers don't call these.
+void ohmd_hid_init(ohmd_context* ctx);
+
+ohmd_hid_device_info* ohmd_hid_enumerate(ohmd_context* ctx, unsigned short vendor_id, unsigned short product_id);
+void ohmd_hid_free_enumeration(ohmd_context* ctx, ohmd_hid_device_info* devs);
+ohmd_hid_device* ohmd_hid_open_path(ohmd_context* ctx, const char* path);
+void ohmd_hid_exit(ohmd_context* ctx);
+
+// ohmd_ctx_probe enumerates the transport once and keeps the devices found
+// until the next probe, for the drivers to list and open their devices from
+// instead of enumerating again. ohmd_hid_next_device walks them: it returns
+// the first device after prev (NULL to start) matching vendor_id and
+// product_id, 0 matching any. While probing it skips the vendors not
+// selected with OHMD_ICS_PROBE_VENDOR_IDS.
+void ohmd_hid_probe(ohmd_context* ctx);
+void ohmd_hid_free_probe(ohmd_context* ctx);
+ohmd_hid_device_info* ohmd_hid_next_device(ohmd_context* ctx, ohmd_hid_device_info* prev,
+	unsigned short vendor_id, unsigned short product_id);
+
+// the device the probe found at path, NULL if there is none
+ohmd_hid_device_info* ohmd_hid_find_device(ohmd_context* ctx, const char* path);
+
+// What tells a physical device apart, to find it again once it was
+// unplugged and came back, likely under another path.
+typedef struct {
+	ohmd_hid_transport* transport;
+	unsigned short vendor_id;
+	unsigned short product_id;
+	int interface_number;
+	wchar_t serial[64];
+	char path[OHMD_STR_SIZE];
+} ohmd_hid_identity;
+
+// the identity of dev, opened from path
+void ohmd_hid_get_identity(ohmd_context* ctx, ohmd_hid_device* dev, const char* path, ohmd_hid_identity* identity);
+
+// Enumerates the transport again and opens the device with the identity:
+// the one with the same serial number, or the same path when the device
+// has none. NULL if it's not there (yet). Safe to call from any thread.
+ohmd_hid_device* ohmd_hid_reopen(const ohmd_hid_identity* identity);
+
+// whether the probe found a device in the match table
+bool ohmd_hid_probe_matches(ohmd_context* ctx, const ohmd_hid_match* matches);
+
+void ohmd_hid_close(ohmd_hid_device* dev);
+int ohmd_hid_set_nonblocking(ohmd_hid_device* dev, int nonblock);
+int ohmd_hid_read(ohmd_hid_device* dev, unsigned char* data, size_t length);
+int ohmd_hid_write(ohmd_hid_device* dev, const unsigned char* data, size_t length);
+int ohmd_hid_send_feature_report(ohmd_hid_device* dev, const unsigned char* data, size_t length);
+int ohmd_hid_get_feature_report(ohmd_hid_device* dev, unsigned char* data, size_t length);
+int ohmd_hid_get_manufacturer_string(ohmd_hid_device* dev, wchar_t* string, size_t maxlen);
+int ohmd_hid_get_product_string(ohmd_hid_device* dev, wchar_t* string, size_t maxlen);
+int ohmd_hid_get_serial_number_string(ohmd_hid_device* dev, wchar_t* string, size_t maxlen);
+
+// -1 if the device is closed or the transport has no descriptor to wait on
+int ohmd_hid_get_fd(ohmd_hid_device* dev);
+
 static inline char* _hid_to_unix_path(char* path)
 {
+	// hidraw paths are device nodes already
+	if(strncmp(path, "/dev/", 5) == 0){
+		char* result = malloc(strlen(path) + 1);
+		strcpy(result, path);
+		return result;
+	}
+
 	char bus [5];
 	char dev [5];
 	char *result = malloc( sizeof(char) * ( 20 + 1 ) );
@@ -13,3 +172,4 @@ static inline char* _hid_to_unix_path(char* path)
 	return result;
 }
 
+#endif
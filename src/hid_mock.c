@@ -0,0 +1,444 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* In-Memory Mock HID Transport - Implementation */
+
+#include <string.h>
+#include "openhmdi.h"
+#include "hid_mock.h"
+
+#define MAX_MOCK_DEVICES 512
+#define MAX_FEATURE_REPORTS 32
+#define MAX_FEATURE_REPORT_SIZE 256
+
+typedef struct {
+	unsigned char data[MAX_FEATURE_REPORT_SIZE];
+	size_t length;
+} feature_report;
+
+struct ohmd_hid_mock_device {
+	ohmd_hid_mock* mock;
+	char path[OHMD_STR_SIZE];
+	unsigned short vendor_id, product_id;
+	int interface_number;
+	char manufacturer[OHMD_STR_SIZE], product[OHMD_STR_SIZE], serial[OHMD_STR_SIZE];
+
+	feature_report feature_reports[MAX_FEATURE_REPORTS];
+	int num_feature_reports;
+	double feature_report_latency;
+
+	unsigned char* reports;
+	size_t report_size;
+	int num_reports;
+	double rate;
+	int64_t total;
+	ohmd_hid_mock_report_callback callback;
+	void* user_data;
+
+	double start;
+	uint64_t next_index;
+	int burst_left;
+	ohmd_hid_mock_stats stats;
+	bool unplugged;
+};
+
+struct ohmd_hid_mock {
+	ohmd_hid_transport base;
+	ohmd_hid_mock_device* devices[MAX_MOCK_DEVICES];
+	int num_devices;
+	ohmd_clock* clock;
+
+	double enumerate_cost;
+	int num_enumerations;
+	uint32_t generation; // bumped by every device added or removed
+};
+
+typedef struct {
+	ohmd_hid_device base;
+	ohmd_hid_mock_device* dev;
+} mock_handle;
+
+static wchar_t* to_wide(const char* str)
+{
+	size_t len = strlen(str);
+	wchar_t* ret = calloc(len + 1, sizeof(wchar_t));
+
+	for(size_t i = 0; ret && i <= len; i++)
+		ret[i] = (unsigned char)str[i];
+
+	return ret;
+}
+
+static ohmd_hid_device_info* mock_enumerate(ohmd_hid_transport* transport, unsigned short vendor_id, unsigned short product_id)
+{
+	ohmd_hid_mock* mock = (ohmd_hid_mock*)transport;
+	ohmd_hid_device_info* first = NULL;
+	ohmd_hid_device_info** next = &first;
+
+	mock->num_enumerations++;
+
+	for(int i = 0; i < mock->num_devices; i++){
+		ohmd_hid_mock_device* dev = mock->devices[i];
+		if(dev->unplugged)
+			continue;
+
+		// every device on the bus is looked at, whatever the filter
+		if(mock->enumerate_cost > 0){
+			double until = ohmd_get_tick() + mock->enumerate_cost;
+			while(ohmd_get_tick() < until);
+		}
+
+		if((vendor_id != 0 && dev->vendor_id != vendor_id) || (product_id != 0 && dev->product_id != product_id))
+			continue;
+
+		ohmd_hid_device_info* info = calloc(1, sizeof(ohmd_hid_device_info));
+		if(!info)
+			break;
+
+		info->path = malloc(strlen(dev->path) + 1);
+		strcpy(info->path, dev->path);
+		info->vendor_id = dev->vendor_id;
+		info->product_id = dev->product_id;
+		info->interface_number = dev->interface_number;
+		info->manufacturer_string = to_wide(dev->manufacturer);
+		info->product_string = to_wide(dev->product);
+		info->serial_number = to_wide(dev->serial);
+
+		*next = info;
+		next = &info->next;
+	}
+
+	return first;
+}
+
+static void mock_free_enumeration(ohmd_hid_transport* transport, ohmd_hid_device_info* devs)
+{
+	while(devs){
+		ohmd_hid_device_info* next = devs->next;
+		free(devs->path);
+		free(devs->manufacturer_string);
+		free(devs->product_string);
+		free(devs->serial_number);
+		free(devs);
+		devs = next;
+	}
+}
+
+static ohmd_hid_device* mock_open_path(ohmd_hid_transport* transport, const char* path)
+{
+	ohmd_hid_mock* mock = (ohmd_hid_mock*)transport;
+
+	for(int i = 0; i < mock->num_devices; i++){
+		ohmd_hid_mock_device* dev = mock->devices[i];
+		if(dev->unplugged || strcmp(dev->path, path) != 0)
+			continue;
+
+		mock_handle* handle = calloc(1, sizeof(mock_handle));
+		if(!handle)
+			return NULL;
+
+		handle->base.transport = transport;
+		handle->dev = dev;
+
+		// the device starts streaming once it's opened
+		if(dev->stats.open_count++ == 0)
+			dev->start = ohmd_clock_get_tick(dev->mock->clock);
+
+		return &handle->base;
+	}
+
+	return NULL;
+}
+
+static void mock_exit(ohmd_hid_transport* transport)
+{
+}
+
+static void mock_close(ohmd_hid_device* handle)
+{
+	((mock_handle*)handle)->dev->stats.open_count--;
+	free(handle);
+}
+
+static int mock_set_nonblocking(ohmd_hid_device* handle, int nonblock)
+{
+	// reads never block
+	return 0;
+}
+
+static int mock_read(ohmd_hid_device* handle, unsigned char* data, size_t length)
+{
+	ohmd_hid_mock_device* dev = ((mock_handle*)handle)->dev;
+
+	if(dev->unplugged)
+		return -1;
+
+	if(dev->num_reports == 0)
+		return 0;
+
+	if(dev->rate == 0){
+		if(dev->burst_left == 0){
+			dev->burst_left = OHMD_HID_MOCK_BUFFER_REPORTS;
+			return 0;
+		}
+
+		dev->burst_left--;
+	}else{
+		uint64_t due = (uint64_t)((ohmd_clock_get_tick(dev->mock->clock) - dev->start) * dev->rate);
+		if(due <= dev->next_index)
+			return 0;
+
+		// the reports the device buffer couldn't hold are lost
+		if(due - dev->next_index > OHMD_HID_MOCK_BUFFER_REPORTS){
+			uint64_t dropped = due - dev->next_index - OHMD_HID_MOCK_BUFFER_REPORTS;
+			dev->stats.reports_dropped += dropped;
+			dev->next_index += dropped;
+		}
+	}
+
+	if(dev->total >= 0 && dev->next_index >= (uint64_t)dev->total)
+		return 0;
+
+	size_t size = OHMD_MIN(length, dev->report_size);
+	memcpy(data, dev->reports + (dev->next_index % dev->num_reports) * dev->report_size, size);
+
+	if(dev->callback)
+		dev->callback(data, size, dev->next_index, dev->user_data);
+
+	dev->next_index++;
+	dev->stats.reports_read++;
+
+	return (int)size;
+}
+
+static int mock_write(ohmd_hid_device* handle, const unsigned char* data, size_t length)
+{
+	ohmd_hid_mock_device* dev = ((mock_handle*)handle)->dev;
+
+	if(dev->unplugged)
+		return -1;
+
+	dev->stats.writes++;
+	return (int)length;
+}
+
+static int mock_send_feature_report(ohmd_hid_device* handle, const unsigned char* data, size_t length)
+{
+	ohmd_hid_mock_device* dev = ((mock_handle*)handle)->dev;
+
+	if(dev->feature_report_latency > 0)
+		ohmd_clock_sleep(dev->mock->clock, dev->feature_report_latency);
+
+	if(dev->unplugged || length == 0 || length > MAX_FEATURE_REPORT_SIZE)
+		return -1;
+
+	ohmd_hid_mock_set_feature_report(dev, data, length);
+	dev->stats.feature_reports_sent++;
+
+	return (int)length;
+}
+
+static int mock_get_feature_report(ohmd_hid_device* handle, unsigned char* data, size_t length)
+{
+	ohmd_hid_mock_device* dev = ((mock_handle*)handle)->dev;
+	dev->stats.feature_reports_read++;
+
+	if(dev->feature_report_latency > 0)
+		ohmd_clock_sleep(dev->mock->clock, dev->feature_report_latency);
+
+	if(dev->unplugged)
+		return -1;
+
+	for(int i = 0; i < dev->num_feature_reports; i++){
+		feature_report* report = &dev->feature_reports[i];
+		if(report->data[0] != data[0])
+			continue;
+
+		size_t size = OHMD_MIN(length, report->length);
+		memcpy(data, report->data, size);
+		return (int)size;
+	}
+
+	return -1;
+}
+
+static int mock_get_string(ohmd_hid_device* handle, ohmd_hid_string string, wchar_t* out, size_t maxlen)
+{
+	ohmd_hid_mock_device* dev = ((mock_handle*)handle)->dev;
+	const char* str = NULL;
+
+	switch(string){
+	case OHMD_HID_MANUFACTURER_STRING: str = dev->manufacturer; break;
+	case OHMD_HID_PRODUCT_STRING: str = dev->product; break;
+	case OHMD_HID_SERIAL_NUMBER_STRING: str = dev->serial; break;
+	}
+
+	if(!str || maxlen == 0)
+		return -1;
+
+	size_t i;
+	for(i = 0; i < maxlen - 1 && str[i]; i++)
+		out[i] = (unsigned char)str[i];
+	out[i] = L'\0';
+
+	return 0;
+}
+
+static uint32_t mock_get_generation(ohmd_hid_transport* transport)
+{
+	return ((ohmd_hid_mock*)transport)->generation;
+}
+
+ohmd_hid_mock* ohmd_hid_mock_create(void)
+{
+	ohmd_hid_mock* mock = calloc(1, sizeof(ohmd_hid_mock));
+	if(!mock)
+		return NULL;
+
+	mock->base.enumerate = mock_enumerate;
+	mock->base.free_enumeration = mock_free_enumeration;
+	mock->base.open_path = mock_open_path;
+	mock->base.exit = mock_exit;
+	mock->base.close = mock_close;
+	mock->base.set_nonblocking = mock_set_nonblocking;
+	mock->base.read = mock_read;
+	mock->base.write = mock_write;
+	mock->base.send_feature_report = mock_send_feature_report;
+	mock->base.get_feature_report = mock_get_feature_report;
+	mock->base.get_string = mock_get_string;
+	mock->base.get_generation = mock_get_generation;
+
+	return mock;
+}
+
+void ohmd_hid_mock_destroy(ohmd_hid_mock* mock)
+{
+	for(int i = 0; i < mock->num_devices; i++){
+		free(mock->devices[i]->reports);
+		free(mock->devices[i]);
+	}
+
+	free(mock);
+}
+
+ohmd_hid_transport* ohmd_hid_mock_get_transport(ohmd_hid_mock* mock)
+{
+	return &mock->base;
+}
+
+void ohmd_hid_mock_set_clock(ohmd_hid_mock* mock, ohmd_clock* clock)
+{
+	mock->clock = clock;
+}
+
+void ohmd_hid_mock_set_enumerate_cost(ohmd_hid_mock* mock, double seconds)
+{
+	mock->enumerate_cost = seconds;
+}
+
+int ohmd_hid_mock_get_num_enumerations(ohmd_hid_mock* mock)
+{
+	return mock->num_enumerations;
+}
+
+ohmd_hid_mock_device* ohmd_hid_mock_add_device(ohmd_hid_mock* mock, const char* path,
+	unsigned short vendor_id, unsigned short product_id, int interface_number,
+	const char* manufacturer, const char* product, const char* serial)
+{
+	if(mock->num_devices == MAX_MOCK_DEVICES)
+		return NULL;
+
+	ohmd_hid_mock_device* dev = calloc(1, sizeof(ohmd_hid_mock_device));
+	if(!dev)
+		return NULL;
+
+	snprintf(dev->path, OHMD_STR_SIZE, "%s", path);
+	snprintf(dev->manufacturer, OHMD_STR_SIZE, "%s", manufacturer);
+	snprintf(dev->product, OHMD_STR_SIZE, "%s", product);
+	snprintf(dev->serial, OHMD_STR_SIZE, "%s", serial);
+	dev->vendor_id = vendor_id;
+	dev->product_id = product_id;
+	dev->interface_number = interface_number;
+	dev->total = -1;
+	dev->mock = mock;
+
+	mock->devices[mock->num_devices++] = dev;
+	mock->generation++;
+
+	return dev;
+}
+
+void ohmd_hid_mock_set_plugged(ohmd_hid_mock_device* dev, bool plugged)
+{
+	if(dev->unplugged == !plugged)
+		return;
+
+	dev->unplugged = !plugged;
+	dev->mock->generation++;
+}
+
+void ohmd_hid_mock_set_feature_report(ohmd_hid_mock_device* dev, const unsigned char* data, size_t length)
+{
+	length = OHMD_MIN(length, MAX_FEATURE_REPORT_SIZE);
+
+	feature_report* report = NULL;
+	for(int i = 0; i < dev->num_feature_reports; i++){
+		if(dev->feature_reports[i].data[0] == data[0])
+			report = &dev->feature_reports[i];
+	}
+
+	if(!report){
+		if(dev->num_feature_reports == MAX_FEATURE_REPORTS){
+			LOGW("mock device %s has no room for feature report %d", dev->path, data[0]);
+			return;
+		}
+
+		report = &dev->feature_reports[dev->num_feature_reports++];
+	}
+
+	memcpy(report->data, data, length);
+	report->length = length;
+}
+
+void ohmd_hid_mock_set_reports(ohmd_hid_mock_device* dev, const unsigned char* reports, size_t report_size,
+	int num_reports, double rate, int64_t total)
+{
+	free(dev->reports);
+	dev->reports = malloc(report_size * num_reports);
+	if(!dev->reports){
+		dev->num_reports = 0;
+		return;
+	}
+
+	memcpy(dev->reports, reports, report_size * num_reports);
+	dev->report_size = report_size;
+	dev->num_reports = num_reports;
+	dev->rate = rate;
+	dev->total = total;
+	dev->next_index = 0;
+	dev->burst_left = OHMD_HID_MOCK_BUFFER_REPORTS;
+
+	// a new stream on an open device starts now
+	if(dev->stats.open_count > 0)
+		dev->start = ohmd_clock_get_tick(dev->mock->clock);
+}
+
+void ohmd_hid_mock_set_feature_report_latency(ohmd_hid_mock_device* dev, double seconds)
+{
+	dev->feature_report_latency = seconds;
+}
+
+void ohmd_hid_mock_set_report_callback(ohmd_hid_mock_device* dev, ohmd_hid_mock_report_callback callback, void* user_data)
+{
+	dev->callback = callback;
+	dev->user_data = user_data;
+}
+
+void ohmd_hid_mock_get_stats(ohmd_hid_mock_device* dev, ohmd_hid_mock_stats* stats)
+{
+	*stats = dev->stats;
+}
@@ -0,0 +1,97 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* In-Memory Mock HID Transport */
+
+#ifndef HID_MOCK_H
+#define HID_MOCK_H
+
+#include <stdint.h>
+#include "hid.h"
+#include "platform.h"
+
+// A transport with scripted devices, so that drivers can be run without
+// hardware. Set it on a context before probing:
+//
+//   ohmd_hid_mock* mock = ohmd_hid_mock_create();
+//   ohmd_hid_mock_device* dev = ohmd_hid_mock_add_device(mock, "mock0", vid, pid, 0, "Vendor", "Product", "1234");
+//   ohmd_hid_mock_set_feature_report(dev, config, sizeof(config));
+//   ohmd_hid_mock_set_reports(dev, reports, 62, 1, 1000.0, -1);
+//   ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+//
+// Reads never block, they return 0 while no report is due. The mock isn't
+// synchronized, script the devices before they are opened and read the
+// stats once the update loop is done with them.
+
+typedef struct ohmd_hid_mock ohmd_hid_mock;
+typedef struct ohmd_hid_mock_device ohmd_hid_mock_device;
+
+// Called on every report before it's handed out, e.g. to advance timestamps.
+// index counts the reports of the stream, including dropped ones.
+typedef void (*ohmd_hid_mock_report_callback)(unsigned char* report, size_t size, uint64_t index, void* user_data);
+
+typedef struct {
+	uint64_t reports_read;
+	uint64_t reports_dropped; // not read before the device buffer overflowed
+	int feature_reports_sent;
+	int feature_reports_read;
+	int writes;
+	int open_count;
+} ohmd_hid_mock_stats;
+
+// reports buffered before the mock starts dropping them, like the kernel does
+#define OHMD_HID_MOCK_BUFFER_REPORTS 64
+
+ohmd_hid_mock* ohmd_hid_mock_create(void);
+void ohmd_hid_mock_destroy(ohmd_hid_mock* mock);
+ohmd_hid_transport* ohmd_hid_mock_get_transport(ohmd_hid_mock* mock);
+
+// The clock report rates are timed by, the system clock by default. Set it
+// to the clock of the context the mock is used with.
+void ohmd_hid_mock_set_clock(ohmd_hid_mock* mock, ohmd_clock* clock);
+
+// Makes enumerating spin for seconds per device added, whatever devices are
+// asked for, like a platform reading the attributes of every device on the
+// bus. Free by default.
+void ohmd_hid_mock_set_enumerate_cost(ohmd_hid_mock* mock, double seconds);
+
+// how often the mock was enumerated
+int ohmd_hid_mock_get_num_enumerations(ohmd_hid_mock* mock);
+
+// Adds a device to the enumeration, returns NULL if there's no room.
+ohmd_hid_mock_device* ohmd_hid_mock_add_device(ohmd_hid_mock* mock, const char* path,
+	unsigned short vendor_id, unsigned short product_id, int interface_number,
+	const char* manufacturer, const char* product, const char* serial);
+
+// Unplugging a device takes it out of the enumeration and makes the calls
+// on its open handles fail, plugging it back in restores it. Devices are
+// plugged in when added. Both count as a change for the hotplug monitor.
+void ohmd_hid_mock_set_plugged(ohmd_hid_mock_device* dev, bool plugged);
+
+// Answers get_feature_report for the report id in data[0]. Sending a feature
+// report replaces the answer, like a device storing its configuration.
+void ohmd_hid_mock_set_feature_report(ohmd_hid_mock_device* dev, const unsigned char* data, size_t length);
+
+// Makes every feature report request take that long on the mock's clock,
+// like a control transfer round trip to the device.
+void ohmd_hid_mock_set_feature_report_latency(ohmd_hid_mock_device* dev, double seconds);
+
+// The report stream read returns: num_reports reports of report_size bytes,
+// repeated until total reports have been handed out (-1 for no end). With a
+// rate they become available at that many per second from the time the
+// device is opened, or from now if it's already open. With a rate of 0 they
+// come as fast as they are read, in bursts of OHMD_HID_MOCK_BUFFER_REPORTS:
+// a read finding the burst used up returns 0 and refills it, so a driver
+// draining the device gets a full buffer on every update.
+void ohmd_hid_mock_set_reports(ohmd_hid_mock_device* dev, const unsigned char* reports, size_t report_size,
+	int num_reports, double rate, int64_t total);
+
+void ohmd_hid_mock_set_report_callback(ohmd_hid_mock_device* dev, ohmd_hid_mock_report_callback callback, void* user_data);
+
+void ohmd_hid_mock_get_stats(ohmd_hid_mock_device* dev, ohmd_hid_mock_stats* stats);
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Linux hidraw HID Backend - Implementation */
+
+#ifdef __linux__
+
+// realpath, strdup
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+#include <linux/input.h>
+
+#include "hidraw.h"
+
+#define SYSFS_HIDRAW "/sys/class/hidraw"
+
+struct ohmd_hidraw_device {
+	ohmd_hid_device base;
+	int fd;
+	bool nonblocking;
+
+	wchar_t* manufacturer_string;
+	wchar_t* product_string;
+	wchar_t* serial_number;
+};
+
+static wchar_t* to_wide(const char* str)
+{
+	size_t len = strlen(str);
+	wchar_t* ret = calloc(len + 1, sizeof(wchar_t));
+	if(!ret)
+		return NULL;
+
+	// sysfs strings are UTF-8, fall back to a plain copy outside of UTF-8 locales
+	if(mbstowcs(ret, str, len + 1) == (size_t)-1){
+		for(size_t i = 0; i <= len; i++)
+			ret[i] = (unsigned char)str[i];
+	}
+
+	return ret;
+}
+
+static bool read_sysfs_string(const char* dir, const char* file, char* out, size_t size)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+	FILE* f = fopen(path, "r");
+	if(!f)
+		return false;
+
+	bool ret = fgets(out, (int)size, f) != NULL;
+	fclose(f);
+
+	if(ret)
+		out[strcspn(out, "\n")] = '\0';
+
+	return ret;
+}
+
+static void strip_last_component(char* path)
+{
+	char* slash = strrchr(path, '/');
+	if(slash)
+		*slash = '\0';
+}
+
+// Fills info for /dev/<name> from sysfs, the strings are always allocated.
+static bool get_device_info(const char* name, ohmd_hid_device_info* info)
+{
+	// link has room for dir with /uevent appended
+	char link[PATH_MAX + sizeof("/uevent")], dir[PATH_MAX], line[256];
+	char hid_name[256] = "", hid_uniq[256] = "";
+	char manufacturer[256] = "", product[256] = "", serial[256] = "";
+	unsigned int bus = 0, vendor_id = 0, product_id = 0;
+
+	memset(info, 0, sizeof(*info));
+	info->interface_number = -1;
+
+	// .../<usb device>/<usb interface>/<hid device>
+	snprintf(link, sizeof(link), SYSFS_HIDRAW "/%s/device", name);
+	if(!realpath(link, dir))
+		return false;
+
+	snprintf(link, sizeof(link), "%s/uevent", dir);
+	FILE* f = fopen(link, "r");
+	if(!f)
+		return false;
+
+	while(fgets(line, sizeof(line), f)){
+		line[strcspn(line, "\n")] = '\0';
+
+		if(strncmp(line, "HID_ID=", 7) == 0)
+			sscanf(line + 7, "%x:%x:%x", &bus, &vendor_id, &product_id);
+		else if(strncmp(line, "HID_NAME=", 9) == 0)
+			snprintf(hid_name, sizeof(hid_name), "%s", line + 9);
+		else if(strncmp(line, "HID_UNIQ=", 9) == 0)
+			snprintf(hid_uniq, sizeof(hid_uniq), "%s", line + 9);
+	}
+
+	fclose(f);
+
+	info->vendor_id = vendor_id;
+	info->product_id = product_id;
+
+	if(bus == BUS_USB){
+		char value[32];
+
+		strip_last_component(dir);
+		if(read_sysfs_string(dir, "bInterfaceNumber", value, sizeof(value)))
+			info->interface_number = (int)strtol(value, NULL, 16);
+
+		strip_last_component(dir);
+		read_sysfs_string(dir, "manufacturer", manufacturer, sizeof(manufacturer));
+		read_sysfs_string(dir, "product", product, sizeof(product));
+		read_sysfs_string(dir, "serial", serial, sizeof(serial));
+
+		if(read_sysfs_string(dir, "bcdDevice", value, sizeof(value)))
+			info->release_number = (unsigned short)strtol(value, NULL, 16);
+	}else{
+		snprintf(product, sizeof(product), "%s", hid_name);
+		snprintf(serial, sizeof(serial), "%s", hid_uniq);
+	}
+
+	snprintf(link, sizeof(link), "/dev/%s", name);
+	info->path = strdup(link);
+	info->manufacturer_string = to_wide(manufacturer);
+	info->product_string = to_wide(product);
+	info->serial_number = to_wide(serial);
+
+	return true;
+}
+
+static void free_device_info(ohmd_hid_device_info* info)
+{
+	free(info->path);
+	free(info->manufacturer_string);
+	free(info->product_string);
+	free(info->serial_number);
+}
+
+ohmd_hid_device_info* ohmd_hidraw_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	ohmd_hid_device_info* first = NULL;
+	ohmd_hid_device_info** next = &first;
+
+	DIR* dir = opendir(SYSFS_HIDRAW);
+	if(!dir)
+		return NULL;
+
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL){
+		ohmd_hid_device_info info;
+
+		if(strncmp(entry->d_name, "hidraw", 6) != 0 || !get_device_info(entry->d_name, &info))
+			continue;
+
+		if((vendor_id != 0 && info.vendor_id != vendor_id) || (product_id != 0 && info.product_id != product_id)){
+			free_device_info(&info);
+			continue;
+		}
+
+		ohmd_hid_device_info* node = malloc(sizeof(info));
+		if(!node){
+			free_device_info(&info);
+			break;
+		}
+
+		*node = info;
+		*next = node;
+		next = &node->next;
+	}
+
+	closedir(dir);
+
+	return first;
+}
+
+void ohmd_hidraw_free_enumeration(ohmd_hid_device_info* devs)
+{
+	while(devs){
+		ohmd_hid_device_info* next = devs->next;
+		free_device_info(devs);
+		free(devs);
+		devs = next;
+	}
+}
+
+ohmd_hidraw_device* ohmd_hidraw_open_fd(int fd)
+{
+	ohmd_hidraw_device* dev = calloc(1, sizeof(ohmd_hidraw_device));
+	if(!dev)
+		return NULL;
+
+	dev->base.transport = ohmd_hidraw_get_transport();
+	dev->fd = fd;
+	dev->nonblocking = (fcntl(fd, F_GETFL) & O_NONBLOCK) != 0;
+
+	return dev;
+}
+
+ohmd_hidraw_device* ohmd_hidraw_open_path(const char* path)
+{
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if(fd < 0)
+		return NULL;
+
+	ohmd_hidraw_device* dev = ohmd_hidraw_open_fd(fd);
+	if(!dev){
+		close(fd);
+		return NULL;
+	}
+
+	// keep the strings around for ohmd_hidraw_get_string
+	ohmd_hid_device_info info;
+	const char* name = strrchr(path, '/');
+	if(name && get_device_info(name + 1, &info)){
+		dev->manufacturer_string = info.manufacturer_string;
+		dev->product_string = info.product_string;
+		dev->serial_number = info.serial_number;
+		free(info.path);
+	}
+
+	return dev;
+}
+
+void ohmd_hidraw_close(ohmd_hidraw_device* dev)
+{
+	if(!dev)
+		return;
+
+	close(dev->fd);
+	free(dev->manufacturer_string);
+	free(dev->product_string);
+	free(dev->serial_number);
+	free(dev);
+}
+
+int ohmd_hidraw_get_fd(ohmd_hidraw_device* dev)
+{
+	return dev->fd;
+}
+
+int ohmd_hidraw_set_nonblocking(ohmd_hidraw_device* dev, int nonblock)
+{
+	int flags = fcntl(dev->fd, F_GETFL);
+	if(flags < 0)
+		return -1;
+
+	flags = nonblock ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	if(fcntl(dev->fd, F_SETFL, flags) < 0)
+		return -1;
+
+	dev->nonblocking = nonblock != 0;
+	return 0;
+}
+
+int ohmd_hidraw_read_timeout(ohmd_hidraw_device* dev, unsigned char* data, size_t length, int milliseconds)
+{
+	// A non-blocking read with no timeout goes straight to read(2), the
+	// drivers drain the device this way so it's the path that matters.
+	if(milliseconds != 0 || !dev->nonblocking){
+		struct pollfd pfd = { dev->fd, POLLIN, 0 };
+
+		int ret = poll(&pfd, 1, milliseconds);
+		if(ret == 0 || (ret < 0 && errno == EINTR))
+			return 0;
+
+		if(ret < 0 || (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+			return -1;
+	}
+
+	ssize_t bytes = read(dev->fd, data, length);
+	if(bytes < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+
+	return (int)bytes;
+}
+
+int ohmd_hidraw_read(ohmd_hidraw_device* dev, unsigned char* data, size_t length)
+{
+	return ohmd_hidraw_read_timeout(dev, data, length, dev->nonblocking ? 0 : -1);
+}
+
+int ohmd_hidraw_write(ohmd_hidraw_device* dev, const unsigned char* data, size_t length)
+{
+	return (int)write(dev->fd, data, length);
+}
+
+int ohmd_hidraw_send_feature_report(ohmd_hidraw_device* dev, const unsigned char* data, size_t length)
+{
+	return ioctl(dev->fd, HIDIOCSFEATURE(length), data);
+}
+
+int ohmd_hidraw_get_feature_report(ohmd_hidraw_device* dev, unsigned char* data, size_t length)
+{
+	return ioctl(dev->fd, HIDIOCGFEATURE(length), data);
+}
+
+int ohmd_hidraw_get_string(ohmd_hidraw_device* dev, ohmd_hid_string string, wchar_t* out, size_t maxlen)
+{
+	const wchar_t* str = NULL;
+
+	switch(string){
+	case OHMD_HID_MANUFACTURER_STRING: str = dev->manufacturer_string; break;
+	case OHMD_HID_PRODUCT_STRING: str = dev->product_string; break;
+	case OHMD_HID_SERIAL_NUMBER_STRING: str = dev->serial_number; break;
+	}
+
+	if(!str || maxlen == 0)
+		return -1;
+
+	wcsncpy(out, str, maxlen);
+	out[maxlen - 1] = L'\0';
+
+	return 0;
+}
+
+// transport glue
+
+static ohmd_hid_device_info* transport_enumerate(ohmd_hid_transport* transport, unsigned short vendor_id, unsigned short product_id)
+{
+	return ohmd_hidraw_enumerate(vendor_id, product_id);
+}
+
+static void transport_free_enumeration(ohmd_hid_transport* transport, ohmd_hid_device_info* devs)
+{
+	ohmd_hidraw_free_enumeration(devs);
+}
+
+static ohmd_hid_device* transport_open_path(ohmd_hid_transport* transport, const char* path)
+{
+	return (ohmd_hid_device*)ohmd_hidraw_open_path(path);
+}
+
+static void transport_exit(ohmd_hid_transport* transport)
+{
+}
+
+static void transport_close(ohmd_hid_device* dev)
+{
+	ohmd_hidraw_close((ohmd_hidraw_device*)dev);
+}
+
+static int transport_set_nonblocking(ohmd_hid_device* dev, int nonblock)
+{
+	return ohmd_hidraw_set_nonblocking((ohmd_hidraw_device*)dev, nonblock);
+}
+
+static int transport_read(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	return ohmd_hidraw_read((ohmd_hidraw_device*)dev, data, length);
+}
+
+static int transport_write(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	return ohmd_hidraw_write((ohmd_hidraw_device*)dev, data, length);
+}
+
+static int transport_send_feature_report(ohmd_hid_device* dev, const unsigned char* data, size_t length)
+{
+	return ohmd_hidraw_send_feature_report((ohmd_hidraw_device*)dev, data, length);
+}
+
+static int transport_get_feature_report(ohmd_hid_device* dev, unsigned char* data, size_t length)
+{
+	return ohmd_hidraw_get_feature_report((ohmd_hidraw_device*)dev, data, length);
+}
+
+static int transport_get_string(ohmd_hid_device* dev, ohmd_hid_string string, wchar_t* out, size_t maxlen)
+{
+	return ohmd_hidraw_get_string((ohmd_hidraw_device*)dev, string, out, maxlen);
+}
+
+static int transport_get_fd(ohmd_hid_device* dev)
+{
+	return ohmd_hidraw_get_fd((ohmd_hidraw_device*)dev);
+}
+
+static ohmd_hid_transport hidraw_transport = {
+	transport_enumerate,
+	transport_free_enumeration,
+	transport_open_path,
+	NULL, // nothing to set up
+	transport_exit,
+	transport_close,
+	transport_set_nonblocking,
+	transport_read,
+	transport_write,
+	transport_send_feature_report,
+	transport_get_feature_report,
+	transport_get_string,
+	transport_get_fd,
+};
+
+ohmd_hid_transport* ohmd_hidraw_get_transport(void)
+{
+	return &hidraw_transport;
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Linux hidraw HID Backend */
+
+#ifndef HIDRAW_H
+#define HIDRAW_H
+
+#include <stddef.h>
+#include <wchar.h>
+
+#include "hid.h"
+
+// A HID transport talking to /dev/hidrawN directly. Unlike hidapi there's no
+// reader thread or report list in between, a read is a single read(2) on the
+// device node. The node can also be handed to poll/epoll through
+// ohmd_hidraw_get_fd.
+
+typedef struct ohmd_hidraw_device ohmd_hidraw_device;
+
+ohmd_hid_transport* ohmd_hidraw_get_transport(void);
+
+ohmd_hid_device_info* ohmd_hidraw_enumerate(unsigned short vendor_id, unsigned short product_id);
+void ohmd_hidraw_free_enumeration(ohmd_hid_device_info* devs);
+
+ohmd_hidraw_device* ohmd_hidraw_open_path(const char* path);
+void ohmd_hidraw_close(ohmd_hidraw_device* dev);
+
+// Wraps an already opened descriptor that delivers one report per read, e.g.
+// one end of a SOCK_SEQPACKET socketpair standing in for a device. The
+// descriptor is closed by ohmd_hidraw_close.
+ohmd_hidraw_device* ohmd_hidraw_open_fd(int fd);
+
+int ohmd_hidraw_get_fd(ohmd_hidraw_device* dev);
+int ohmd_hidraw_set_nonblocking(ohmd_hidraw_device* dev, int nonblock);
+
+int ohmd_hidraw_read(ohmd_hidraw_device* dev, unsigned char* data, size_t length);
+int ohmd_hidraw_read_timeout(ohmd_hidraw_device* dev, unsigned char* data, size_t length, int milliseconds);
+int ohmd_hidraw_write(ohmd_hidraw_device* dev, const unsigned char* data, size_t length);
+
+int ohmd_hidraw_send_feature_report(ohmd_hidraw_device* dev, const unsigned char* data, size_t length);
+int ohmd_hidraw_get_feature_report(ohmd_hidraw_device* dev, unsigned char* data, size_t length);
+
+int ohmd_hidraw_get_string(ohmd_hidraw_device* dev, ohmd_hid_string string, wchar_t* out, size_t maxlen);
+
+#endif
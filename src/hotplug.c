@@ -0,0 +1,199 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Hotplug Monitor - Implementation */
+
+#ifdef __linux__
+// SOCK_CLOEXEC, SOCK_NONBLOCK
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#endif
+
+#include <string.h>
+
+#include "openhmdi.h"
+#include "hotplug.h"
+
+// how often the generation of the transport is looked at while waiting
+#define GENERATION_POLL_INTERVAL 0.01
+#define UEVENT_BUFFER_SIZE 8192
+
+struct ohmd_hotplug_monitor {
+	ohmd_context* ctx;
+	ohmd_poller* poller;
+	int fd; // netlink socket, -1 if there is none
+
+	// the transport last looked at and its generation
+	ohmd_hid_transport* transport;
+	uint32_t generation;
+};
+
+#ifdef __linux__
+
+#define KERNEL_GROUP 1
+#define UDEV_GROUP 2
+
+static int open_netlink(void)
+{
+	// udev's events come once its rules ran, so that the device can be
+	// opened when they arrive, the kernel's have to do without it
+	unsigned int group = access("/run/udev/control", F_OK) == 0 ? UDEV_GROUP : KERNEL_GROUP;
+
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+	if(fd < 0)
+		return -1;
+
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = group;
+
+	if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// event is a list of null terminated strings: a header ("action@devpath"
+// from the kernel, a binary one from udev) followed by KEY=value properties
+static bool is_hidraw_event(const char* event, size_t size)
+{
+	size_t offset = strlen(event) + 1;
+
+	if(size >= 24 && memcmp(event, "libudev", 8) == 0){
+		uint32_t properties_offset;
+		memcpy(&properties_offset, event + 16, sizeof(properties_offset));
+		offset = properties_offset;
+	}
+
+	for(; offset < size; offset += strlen(event + offset) + 1){
+		if(strcmp(event + offset, "SUBSYSTEM=hidraw") == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool read_netlink(int fd)
+{
+	char event[UEVENT_BUFFER_SIZE];
+	bool changed = false;
+	ssize_t size;
+
+	while((size = recv(fd, event, sizeof(event) - 1, 0)) > 0){
+		event[size] = '\0';
+		if(is_hidraw_event(event, (size_t)size))
+			changed = true;
+	}
+
+	// the socket overflowed and events were lost, anything may have changed
+	if(size < 0 && errno == ENOBUFS)
+		changed = true;
+
+	return changed;
+}
+
+#else
+
+static int open_netlink(void)
+{
+	return -1;
+}
+
+static bool read_netlink(int fd)
+{
+	return false;
+}
+
+#endif
+
+ohmd_hotplug_monitor* ohmd_hotplug_monitor_create(ohmd_context* ctx)
+{
+	int fd = open_netlink();
+
+	if(fd < 0 && !ctx->hid_transport->get_generation)
+		return NULL;
+
+	ohmd_hotplug_monitor* monitor = ohmd_alloc(ctx, sizeof(ohmd_hotplug_monitor));
+	if(!monitor)
+		goto fail;
+
+	monitor->poller = ohmd_create_poller(ctx);
+	if(!monitor->poller)
+		goto fail;
+
+	monitor->ctx = ctx;
+	monitor->fd = fd;
+
+	// start from the devices as they are now
+	monitor->transport = ctx->hid_transport;
+	if(monitor->transport->get_generation)
+		monitor->generation = monitor->transport->get_generation(monitor->transport);
+
+	return monitor;
+
+fail:
+	free(monitor);
+#ifdef __linux__
+	if(fd >= 0)
+		close(fd);
+#endif
+	return NULL;
+}
+
+void ohmd_hotplug_monitor_destroy(ohmd_hotplug_monitor* monitor)
+{
+#ifdef __linux__
+	if(monitor->fd >= 0)
+		close(monitor->fd);
+#endif
+	ohmd_destroy_poller(monitor->poller);
+	free(monitor);
+}
+
+bool ohmd_hotplug_monitor_changed(ohmd_hotplug_monitor* monitor)
+{
+	bool changed = monitor->fd >= 0 && read_netlink(monitor->fd);
+
+	// a new transport has other devices
+	ohmd_hid_transport* transport = monitor->ctx->hid_transport;
+	if(transport != monitor->transport)
+		changed = true;
+
+	if(transport->get_generation){
+		uint32_t generation = transport->get_generation(transport);
+		if(generation != monitor->generation)
+			changed = true;
+
+		monitor->generation = generation;
+	}
+
+	monitor->transport = transport;
+
+	return changed;
+}
+
+void ohmd_hotplug_monitor_wait(ohmd_hotplug_monitor* monitor, double timeout)
+{
+	// the generation can only be polled
+	if(monitor->ctx->hid_transport->get_generation)
+		timeout = OHMD_MIN(timeout, GENERATION_POLL_INTERVAL);
+
+	if(monitor->fd >= 0){
+		bool ready;
+		if(ohmd_poller_wait(monitor->poller, &monitor->fd, &ready, 1, timeout) >= 0)
+			return;
+	}
+
+	ohmd_sleep(OHMD_MIN(timeout, GENERATION_POLL_INTERVAL));
+}
@@ -0,0 +1,37 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Hotplug Monitor */
+
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+#include <stdbool.h>
+
+#include "openhmd.h"
+
+// Tells the context when HID devices may have been plugged in or out, so
+// that it only goes over the devices again then. On Linux it listens to the
+// device events on a netlink socket: the ones udev sends once it's done
+// setting a device up (its permissions in particular) when udev is running,
+// the kernel's otherwise. Transports with devices of their own (the mock)
+// report changes through get_generation instead.
+
+typedef struct ohmd_hotplug_monitor ohmd_hotplug_monitor;
+
+// NULL if neither the platform nor the transport can tell about changes
+ohmd_hotplug_monitor* ohmd_hotplug_monitor_create(ohmd_context* ctx);
+void ohmd_hotplug_monitor_destroy(ohmd_hotplug_monitor* monitor);
+
+// Whether a HID device was added or removed since the last call, reading
+// all the events pending. Never blocks.
+bool ohmd_hotplug_monitor_changed(ohmd_hotplug_monitor* monitor);
+
+// Waits until there may be a change or timeout seconds have passed.
+void ohmd_hotplug_monitor_wait(ohmd_hotplug_monitor* monitor, double timeout);
+
+#endif
@@ -137,8 +137,8 @@ void oquatf_slerp (float fT, const quatf* rkP, const quatf* rkQ, bool shortestPa
 	if (fCos < 0.0f && shortestPath)
 	{
 		fCos = -fCos;
-		rkT = *rkQ;
-		oquatf_inverse(&rkT);
+		for(int i = 0; i < 4; i++)
+			rkT.arr[i] = -rkQ->arr[i];
 	}
 	else
 	{
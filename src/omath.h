@@ -11,6 +11,7 @@
 #define OMATH_H
 
 #include <math.h>
+#include <stdbool.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -56,6 +57,7 @@ void oquatf_normalize_me(quatf* me);
 float oquatf_get_length(const quatf* me);
 float oquatf_get_dot(const quatf* me, const quatf* q);
 void oquatf_inverse(quatf* me);
+void oquatf_slerp(float fT, const quatf* rkP, const quatf* rkQ, bool shortestPath, quatf* out_q);
 
 void oquatf_get_mat4x4(const quatf* me, const vec3f* point, float mat[4][4]);
 
@@ -16,6 +16,33 @@
 // Running automatic updates at 1000 Hz
 #define AUTOMATIC_UPDATE_SLEEP (1.0 / 1000.0)
 
+// Upper bound for waiting on device file descriptors, so that drivers still
+// get to run periodic tasks like keep alive messages when no data arrives
+#define AUTOMATIC_UPDATE_MAX_WAIT (100.0 / 1000.0)
+
+// Maximum number of file descriptors the update thread waits on
+#define AUTOMATIC_UPDATE_MAX_FDS 64
+
+// how often to check whether the devices being opened are done
+#define OPEN_WAIT_SLEEP (1.0 / 1000.0)
+
+// indexed by ohmd_fusion_engine
+static const ofusion_engine* const fusion_engines[] = {
+	&ofusion_engine_default,
+	&ofusion_engine_eskf,
+	&ofusion_engine_mahony,
+};
+
+#define NUM_FUSION_ENGINES (int)(sizeof(fusion_engines) / sizeof(fusion_engines[0]))
+
+static void ohmd_get_eye_matrix(ohmd_device* device, const ohmd_pose* pose, ohmd_eye_matrix matrix, float* out);
+static void ohmd_wake_update_workers(ohmd_context* ctx);
+static void ohmd_stop_reconnect(ohmd_device* device);
+static void ohmd_start_update_workers(ohmd_context* ctx);
+static void ohmd_stop_update_workers(ohmd_context* ctx);
+static void ohmd_restart_update_workers(ohmd_context* ctx, int worker_count);
+static void ohmd_update_device(ohmd_context* ctx, ohmd_device* dev);
+
 ohmd_context* OHMD_APIENTRY ohmd_ctx_create(void)
 {
 	ohmd_context* ctx = calloc(1, sizeof(ohmd_context));
@@ -24,282 +51,1482 @@ ohmd_context* OHMD_APIENTRY ohmd_ctx_create(void)
 		return NULL;
 	}
 
-	ohmd_monotonic_init(ctx);
+	ohmd_monotonic_init(ctx);
+	ohmd_hid_init(ctx);
+
+	// capture the HID traffic, e.g. to replay a tracking issue with the replay driver
+	const char* capture_path = getenv("OHMD_CAPTURE");
+	if(capture_path && *capture_path){
+		ctx->hid_capture = ohmd_hid_capture_create(ctx, ctx->hid_transport, capture_path);
+		if(ctx->hid_capture)
+			ctx->hid_transport = ohmd_hid_capture_get_transport(ctx->hid_capture);
+	}
+
+#if DRIVER_OCULUS_RIFT
+	ohmd_add_driver(ctx, ohmd_create_oculus_rift_drv(ctx));
+#endif
+
+#if DRIVER_DEEPOON
+	ohmd_add_driver(ctx, ohmd_create_deepoon_drv(ctx));
+#endif
+
+#if DRIVER_HTC_VIVE
+	ohmd_add_driver(ctx, ohmd_create_htc_vive_drv(ctx));
+#endif
+
+#if DRIVER_WMR
+	ohmd_add_driver(ctx, ohmd_create_wmr_drv(ctx));
+#endif
+
+#if DRIVER_PSVR
+	ohmd_add_driver(ctx, ohmd_create_psvr_drv(ctx));
+#endif
+
+#if DRIVER_NOLO
+	ohmd_add_driver(ctx, ohmd_create_nolo_drv(ctx));
+#endif
+
+#if DRIVER_REPLAY
+	ohmd_add_driver(ctx, ohmd_create_replay_drv(ctx));
+#endif
+
+#if DRIVER_EXTERNAL
+	ohmd_add_driver(ctx, ohmd_create_external_drv(ctx));
+#endif
+
+#if DRIVER_ANDROID
+	ohmd_add_driver(ctx, ohmd_create_android_drv(ctx));
+#endif
+	// add dummy driver last to make it the lowest priority
+	ohmd_add_driver(ctx, ohmd_create_dummy_drv(ctx));
+
+	ctx->update_request_quit = false;
+	ctx->update_event_driven = true;
+	ctx->update_worker_count = 1;
+	ctx->device_cache = OHMD_DEVICE_CACHE_ON;
+
+	ctx->open_mutex = ohmd_create_mutex(ctx);
+
+	return ctx;
+}
+
+void OHMD_APIENTRY ohmd_ctx_destroy(ohmd_context* ctx)
+{
+	// let the devices being opened finish, they are closed below
+	while(ctx->open_requests)
+		ohmd_open_request_destroy(ctx->open_requests);
+
+	// stop the update threads before the devices they update go away
+	ohmd_stop_update_workers(ctx);
+
+	for(int i = 0; i < ctx->num_active_devices; i++){
+		ohmd_stop_reconnect(ctx->active_devices[i]);
+
+		ohmd_mutex* mutex = ctx->active_devices[i]->mutex;
+		ohmd_mutex* read_mutex = ctx->active_devices[i]->read_mutex;
+		ctx->active_devices[i]->close(ctx->active_devices[i]);
+		ohmd_destroy_mutex(mutex);
+		ohmd_destroy_mutex(read_mutex);
+	}
+
+	if(ctx->hotplug)
+		ohmd_hotplug_monitor_destroy(ctx->hotplug);
+
+	ohmd_hid_free_probe(ctx);
+
+	for(int i = 0; i < ctx->num_drivers; i++){
+		ctx->drivers[i]->destroy(ctx->drivers[i]);
+	}
+
+	ohmd_hid_exit(ctx);
+
+	free(ctx->drivers);
+	free(ctx->active_devices);
+	free(ctx->manual_devices);
+	free(ctx->reader_devices);
+	free(ctx->reader_heads);
+	free(ctx->hotplug_events);
+	ohmd_device_list_free(&ctx->list);
+
+	if(ctx->hid_capture)
+		ohmd_hid_capture_destroy(ctx->hid_capture);
+
+	if(ctx->update_mutex)
+		ohmd_destroy_mutex(ctx->update_mutex);
+
+	ohmd_destroy_mutex(ctx->open_mutex);
+
+	free(ctx);
+}
+
+void OHMD_APIENTRY ohmd_ctx_update(ohmd_context* ctx)
+{
+	int num_devices = 0;
+
+	// same as a round of the update threads, for the devices without automatic updates
+	ohmd_lock_mutex(ctx->update_mutex);
+
+	ohmd_reserve(&ctx->manual_devices, &ctx->manual_devices_capacity, ctx->num_active_devices, sizeof(ohmd_device*));
+	ohmd_device** devices = ctx->manual_devices;
+
+	for(int i = 0; i < ctx->num_active_devices && num_devices < ctx->manual_devices_capacity; i++){
+		ohmd_device* dev = ctx->active_devices[i];
+		if(!dev->settings.automatic_update && dev->update){
+			ohmd_lock_mutex(dev->mutex);
+			devices[num_devices++] = dev;
+		}
+	}
+
+	ohmd_unlock_mutex(ctx->update_mutex);
+
+	for(int i = 0; i < num_devices; i++)
+		ohmd_update_device(ctx, devices[i]);
+
+	// publish all poses at once, so that ohmd_ctx_get_poses sees them together
+	ohmd_lock_mutex(ctx->update_mutex);
+
+	for(int i = 0; i < num_devices; i++){
+		ohmd_publish_pose(devices[i]);
+		ohmd_unlock_mutex(devices[i]->mutex);
+	}
+
+	ohmd_unlock_mutex(ctx->update_mutex);
+}
+
+int OHMD_APIENTRY ohmd_ctx_get_poses(ohmd_context* ctx, ohmd_device_pose* poses, int max_poses)
+{
+	// Poses are published with the update mutex held, holding it here keeps
+	// the devices open and all poses from the same update round.
+	ohmd_lock_mutex(ctx->update_mutex);
+
+	int num_poses = OHMD_MIN(ctx->num_active_devices, max_poses);
+
+	for(int i = 0; i < num_poses; i++){
+		ohmd_device* device = ctx->active_devices[i];
+		ohmd_device_pose* out = &poses[i];
+		ohmd_pose pose;
+
+		ohmd_read_pose(device, &pose);
+
+		out->device = device;
+		out->time = pose.time;
+
+		quatf rot = pose.rotation;
+		oquatf_mult_me(&rot, &pose.rotation_correction);
+		memcpy(out->rotation, rot.arr, sizeof(out->rotation));
+
+		for(int j = 0; j < 3; j++)
+			out->position[j] = pose.position.arr[j] + pose.position_correction.arr[j];
+
+		ohmd_get_eye_matrix(device, &pose, OHMD_EYE_MATRIX_LEFT_MODELVIEW, out->left_eye_modelview);
+		ohmd_get_eye_matrix(device, &pose, OHMD_EYE_MATRIX_RIGHT_MODELVIEW, out->right_eye_modelview);
+	}
+
+	ohmd_unlock_mutex(ctx->update_mutex);
+
+	return num_poses;
+}
+
+const char* OHMD_APIENTRY ohmd_ctx_get_error(ohmd_context* ctx)
+{
+	return ctx->error_msg;
+}
+
+ohmd_status OHMD_APIENTRY ohmd_ctx_seti(ohmd_context* ctx, ohmd_int_context_settings key, const int* val)
+{
+	switch(key){
+	case OHMD_ICS_EVENT_DRIVEN_UPDATE:
+		ctx->update_event_driven = val[0] == 0 ? false : true;
+
+		// let the update threads pick up the new mode
+		ohmd_wake_update_workers(ctx);
+
+		return OHMD_S_OK;
+
+	case OHMD_ICS_UPDATE_WORKERS: {
+		if(val[0] < 1 || val[0] > OHMD_MAX_UPDATE_WORKERS){
+			ohmd_set_error(ctx, "invalid number of update workers (%d)", val[0]);
+			return OHMD_S_INVALID_PARAMETER;
+		}
+
+		ohmd_restart_update_workers(ctx, val[0]);
+
+		return OHMD_S_OK;
+	}
+
+	case OHMD_ICS_THREAD_SCHED_POLICY:
+		if(val[0] != OHMD_SCHED_NORMAL && val[0] != OHMD_SCHED_FIFO && val[0] != OHMD_SCHED_RR){
+			ohmd_set_error(ctx, "invalid scheduling policy (%d)", val[0]);
+			return OHMD_S_INVALID_PARAMETER;
+		}
+
+		ctx->thread_settings.sched_policy = (ohmd_sched_policy)val[0];
+		ohmd_restart_update_workers(ctx, ctx->update_worker_count);
+		return OHMD_S_OK;
+
+	case OHMD_ICS_THREAD_SCHED_PRIORITY:
+		ctx->thread_settings.sched_priority = val[0];
+		ohmd_restart_update_workers(ctx, ctx->update_worker_count);
+		return OHMD_S_OK;
+
+	case OHMD_ICS_THREAD_CPU_AFFINITY:
+		ctx->thread_settings.cpu_affinity = (uint32_t)val[0];
+		ohmd_restart_update_workers(ctx, ctx->update_worker_count);
+		return OHMD_S_OK;
+
+	case OHMD_ICS_THREAD_LOCK_MEMORY:
+		ctx->thread_settings.lock_memory = val[0] == 0 ? false : true;
+		ohmd_restart_update_workers(ctx, ctx->update_worker_count);
+		return OHMD_S_OK;
+
+	case OHMD_ICS_PIPELINED_UPDATE:
+		ctx->update_pipelined = val[0] == 0 ? false : true;
+		ohmd_restart_update_workers(ctx, ctx->update_worker_count);
+		return OHMD_S_OK;
+
+	case OHMD_ICS_PROBE_DEVICE_CLASSES:
+		ctx->probe_device_classes = (uint32_t)val[0];
+		return OHMD_S_OK;
+
+	case OHMD_ICS_PROBE_VENDOR_IDS:
+		for(int i = 0; i < OHMD_MAX_PROBE_VENDORS; i++){
+			if(val[i] < 0 || val[i] > 0xffff)
+				return OHMD_S_INVALID_PARAMETER;
+		}
+
+		for(int i = 0; i < OHMD_MAX_PROBE_VENDORS; i++)
+			ctx->probe_vendor_ids[i] = (unsigned short)val[i];
+
+		return OHMD_S_OK;
+
+	case OHMD_ICS_DEVICE_CACHE:
+		if(val[0] != OHMD_DEVICE_CACHE_OFF && val[0] != OHMD_DEVICE_CACHE_ON && val[0] != OHMD_DEVICE_CACHE_REFRESH){
+			ohmd_set_error(ctx, "invalid device cache mode (%d)", val[0]);
+			return OHMD_S_INVALID_PARAMETER;
+		}
+
+		ctx->device_cache = (ohmd_device_cache_mode)val[0];
+		return OHMD_S_OK;
+
+	case OHMD_ICS_HOTPLUG_MONITOR:
+		if(val[0] != 0 && !ctx->hotplug){
+			ctx->hotplug = ohmd_hotplug_monitor_create(ctx);
+			if(!ctx->hotplug){
+				ohmd_set_error(ctx, "can't watch for devices being plugged in and out");
+				return OHMD_S_UNSUPPORTED;
+			}
+
+			// catch up with what changed since the last probe
+			ctx->hotplug_pending = true;
+		}else if(val[0] == 0 && ctx->hotplug){
+			ohmd_hotplug_monitor_destroy(ctx->hotplug);
+			ctx->hotplug = NULL;
+			ctx->num_hotplug_events = ctx->next_hotplug_event = 0;
+		}
+
+		return OHMD_S_OK;
+
+	default:
+		return OHMD_S_INVALID_PARAMETER;
+	}
+}
+
+ohmd_status OHMD_APIENTRY ohmd_ctx_geti(ohmd_context* ctx, ohmd_int_context_settings key, int* out)
+{
+	switch(key){
+	case OHMD_ICS_EVENT_DRIVEN_UPDATE:
+		*out = ctx->update_event_driven ? 1 : 0;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_UPDATE_WORKERS:
+		*out = ctx->update_worker_count;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_THREAD_SCHED_POLICY:
+		*out = ctx->thread_settings.sched_policy;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_THREAD_SCHED_PRIORITY:
+		*out = ctx->thread_settings.sched_priority;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_THREAD_CPU_AFFINITY:
+		*out = (int)ctx->thread_settings.cpu_affinity;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_THREAD_LOCK_MEMORY:
+		*out = ctx->thread_settings.lock_memory ? 1 : 0;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_PIPELINED_UPDATE:
+		*out = ctx->update_pipelined ? 1 : 0;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_PROBE_DEVICE_CLASSES:
+		*out = (int)ctx->probe_device_classes;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_PROBE_VENDOR_IDS:
+		for(int i = 0; i < OHMD_MAX_PROBE_VENDORS; i++)
+			out[i] = ctx->probe_vendor_ids[i];
+
+		return OHMD_S_OK;
+
+	case OHMD_ICS_DEVICE_CACHE:
+		*out = ctx->device_cache;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_HOTPLUG_MONITOR:
+		*out = ctx->hotplug ? 1 : 0;
+		return OHMD_S_OK;
+
+	case OHMD_ICS_THREAD_SETTINGS_IN_EFFECT:
+		out[0] = ctx->thread_settings_in_effect.sched_policy;
+		out[1] = ctx->thread_settings_in_effect.sched_priority;
+		out[2] = (int)ctx->thread_settings_in_effect.cpu_affinity;
+		out[3] = ctx->thread_settings_in_effect.lock_memory ? 1 : 0;
+		return OHMD_S_OK;
+
+	default:
+		return OHMD_S_INVALID_PARAMETER;
+	}
+}
+
+static void list_devices(ohmd_context* ctx, ohmd_device_list* list)
+{
+	// the drivers still opening devices use the devices found by the last probe
+	ohmd_lock_mutex(ctx->open_mutex);
+	while(ctx->num_pending_opens > 0){
+		ohmd_unlock_mutex(ctx->open_mutex);
+		ohmd_sleep(OPEN_WAIT_SLEEP);
+		ohmd_lock_mutex(ctx->open_mutex);
+	}
+	ohmd_unlock_mutex(ctx->open_mutex);
+
+	list->num_devices = 0;
+
+	// one enumeration of the HID devices for all the drivers
+	ohmd_hid_probe(ctx);
+	ctx->probing = true;
+
+	for(int i = 0; i < ctx->num_drivers; i++){
+		ohmd_driver* driver = ctx->drivers[i];
+		if(driver->hid_matches && !ohmd_hid_probe_matches(ctx, driver->hid_matches))
+			continue;
+
+		driver->get_device_list(driver, list);
+	}
+
+	ctx->probing = false;
+
+	if(ctx->probe_device_classes){
+		int num_devices = 0;
+		for(int i = 0; i < list->num_devices; i++){
+			if(ctx->probe_device_classes & (1u << list->devices[i].device_class))
+				list->devices[num_devices++] = list->devices[i];
+		}
+
+		list->num_devices = num_devices;
+	}
+}
+
+int OHMD_APIENTRY ohmd_ctx_probe(ohmd_context* ctx)
+{
+	// the list starts over, the changes up to now don't apply to it
+	ctx->num_hotplug_events = ctx->next_hotplug_event = 0;
+	ctx->hotplug_pending = false;
+	if(ctx->hotplug)
+		ohmd_hotplug_monitor_changed(ctx->hotplug);
+
+	list_devices(ctx, &ctx->list);
+
+	return ctx->list.num_devices;
+}
+
+static int find_device_desc(const ohmd_device_list* list, const ohmd_device_desc* desc)
+{
+	for(int i = 0; i < list->num_devices; i++){
+		const ohmd_device_desc* cur = &list->devices[i];
+		if(cur->driver_ptr == desc->driver_ptr && cur->id == desc->id && cur->revision == desc->revision &&
+		   strcmp(cur->path, desc->path) == 0 && strcmp(cur->product, desc->product) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static void push_hotplug_event(ohmd_context* ctx, ohmd_hotplug_event_type type, int index, const ohmd_device_desc* desc)
+{
+	ohmd_hotplug_event* event = &ctx->hotplug_events[ctx->num_hotplug_events++];
+
+	event->type = type;
+	event->index = index;
+	event->device_class = desc->device_class;
+	strcpy(event->vendor, desc->vendor);
+	strcpy(event->product, desc->product);
+	strcpy(event->path, desc->path);
+}
+
+// Lists the devices again and applies the difference to the device list:
+// the devices gone are taken out, the new ones added to the end.
+static void update_device_list(ohmd_context* ctx)
+{
+	ohmd_device_list found_list = { 0 };
+	ohmd_device_list* found = &found_list;
+	ohmd_device_list* list = &ctx->list;
+
+	list_devices(ctx, found);
+
+	// at most every device is removed and every one found is added
+	ctx->num_hotplug_events = ctx->next_hotplug_event = 0;
+	if(!ohmd_reserve(&ctx->hotplug_events, &ctx->hotplug_events_capacity,
+	                 list->num_devices + found->num_devices, sizeof(ohmd_hotplug_event)) ||
+	   !ohmd_reserve(&list->devices, &list->capacity, list->num_devices + found->num_devices, sizeof(ohmd_device_desc))){
+		LOGE("could not allocate RAM for the device list");
+		ohmd_device_list_free(found);
+		return;
+	}
+
+	for(int i = 0; i < list->num_devices;){
+		if(find_device_desc(found, &list->devices[i]) != -1){
+			i++;
+			continue;
+		}
+
+		push_hotplug_event(ctx, OHMD_HOTPLUG_REMOVED, i, &list->devices[i]);
+
+		memmove(&list->devices[i], &list->devices[i + 1], (list->num_devices - i - 1) * sizeof(ohmd_device_desc));
+		list->num_devices--;
+	}
+
+	for(int i = 0; i < found->num_devices; i++){
+		if(find_device_desc(list, &found->devices[i]) != -1)
+			continue;
+
+		list->devices[list->num_devices] = found->devices[i];
+		push_hotplug_event(ctx, OHMD_HOTPLUG_ADDED, list->num_devices, &found->devices[i]);
+		list->num_devices++;
+	}
+
+	ohmd_device_list_free(found);
+}
+
+int OHMD_APIENTRY ohmd_ctx_poll_hotplug(ohmd_context* ctx, ohmd_hotplug_event* event)
+{
+	if(!ctx->hotplug)
+		return 0;
+
+	if(ctx->next_hotplug_event == ctx->num_hotplug_events &&
+	   (ohmd_hotplug_monitor_changed(ctx->hotplug) || ctx->hotplug_pending)){
+		ctx->hotplug_pending = false;
+		update_device_list(ctx);
+	}
+
+	if(ctx->next_hotplug_event == ctx->num_hotplug_events)
+		return 0;
+
+	*event = ctx->hotplug_events[ctx->next_hotplug_event++];
+	return 1;
+}
+
+int OHMD_APIENTRY ohmd_ctx_wait_hotplug(ohmd_context* ctx, double timeout, ohmd_hotplug_event* event)
+{
+	double end = ohmd_get_tick() + timeout;
+
+	while(ctx->hotplug){
+		if(ohmd_ctx_poll_hotplug(ctx, event))
+			return 1;
+
+		double left = timeout < 0 ? 1.0 : end - ohmd_get_tick();
+		if(left <= 0)
+			break;
+
+		ohmd_hotplug_monitor_wait(ctx->hotplug, left);
+	}
+
+	return 0;
+}
+
+int OHMD_APIENTRY ohmd_gets(ohmd_string_description type, const char ** out)
+{
+	switch(type){
+	case OHMD_GLSL_DISTORTION_VERT_SRC:
+		*out = distortion_vert;
+		return OHMD_S_OK;
+	case OHMD_GLSL_DISTORTION_FRAG_SRC:
+		*out = distortion_frag;
+		return OHMD_S_OK;
+	case OHMD_GLSL_330_DISTORTION_VERT_SRC:
+		*out = distortion_vert_330;
+		return OHMD_S_OK;
+	case OHMD_GLSL_330_DISTORTION_FRAG_SRC:
+		*out = distortion_frag_330;
+		return OHMD_S_OK;
+	default:
+		return OHMD_S_UNSUPPORTED;
+	}
+}
+
+const char* OHMD_APIENTRY ohmd_list_gets(ohmd_context* ctx, int index, ohmd_string_value type)
+{
+	if(index >= ctx->list.num_devices)
+		return NULL;
+
+	switch(type){
+	case OHMD_VENDOR:
+		return ctx->list.devices[index].vendor;
+	case OHMD_PRODUCT:
+		return ctx->list.devices[index].product;
+	case OHMD_PATH:
+		return ctx->list.devices[index].path;
+	default:
+		return NULL;
+	}
+}
+
+int OHMD_APIENTRY ohmd_list_geti(ohmd_context* ctx, int index, ohmd_int_value type, int* out)
+{
+	if(index >= ctx->list.num_devices)
+		return OHMD_S_INVALID_PARAMETER;
+
+	switch(type){
+	case OHMD_DEVICE_CLASS:
+		*out = ctx->list.devices[index].device_class;
+		return OHMD_S_OK;
+
+	case OHMD_DEVICE_FLAGS:
+		*out = ctx->list.devices[index].device_flags;
+		return OHMD_S_OK;
+
+	default:
+		return OHMD_S_INVALID_PARAMETER;
+	}
+}
+
+static bool ohmd_fd_is_ready(int fd, const int* fds, const bool* ready, int num_fds)
+{
+	for(int i = 0; i < num_fds; i++){
+		if(fds[i] == fd)
+			return ready[i];
+	}
+
+	return false;
+}
+
+static bool ohmd_is_worker_device(ohmd_update_worker* worker, ohmd_device* dev)
+{
+	return dev->settings.automatic_update && dev->update && dev->update_worker == worker->index;
+}
+
+// the read stage of these devices runs on the reader thread
+static bool ohmd_is_pipelined(ohmd_context* ctx, ohmd_device* dev)
+{
+	return ctx->update_pipelined && dev->settings.automatic_update && dev->read;
+}
+
+static bool ohmd_is_lost(ohmd_device* dev)
+{
+	return ohmd_atomic_load(&dev->lost) != 0;
+}
+
+// lost devices are polled, so that they're picked up again right when they're back
+static int ohmd_get_device_fd(ohmd_device* dev)
+{
+	return dev->get_fd && !ohmd_is_lost(dev) ? dev->get_fd(dev) : -1;
+}
+
+static void ohmd_update_device(ohmd_context* ctx, ohmd_device* dev)
+{
+	// keeps its last pose until it's reconnected
+	if(ohmd_is_lost(dev))
+		return;
+
+	if(dev->read && !ohmd_is_pipelined(ctx, dev))
+		dev->read(dev);
+
+	dev->update(dev);
+}
+
+static unsigned int ohmd_update_thread(void* arg)
+{
+	ohmd_update_worker* worker = (ohmd_update_worker*)arg;
+	ohmd_context* ctx = worker->ctx;
+
+	int num_devices = 0;
+
+	int fds[AUTOMATIC_UPDATE_MAX_FDS];
+	bool ready[AUTOMATIC_UPDATE_MAX_FDS];
+	int num_fds = 0;
+	int num_ready = 0;
+
+	while(!ctx->update_request_quit)
+	{
+		bool event_driven = ctx->update_event_driven && worker->poller;
+		bool polled = false;
+		bool pipelined = false;
+
+		// Pick the devices that have data, or all of them when polling. Devices
+		// are looked up again after waiting as they might have been closed in
+		// the mean time, holding their mutex keeps them open until we're done.
+		ohmd_lock_mutex(ctx->update_mutex);
+
+		ohmd_reserve(&worker->devices, &worker->devices_capacity, ctx->num_active_devices, sizeof(ohmd_device*));
+		ohmd_device** devices = worker->devices;
+
+		num_devices = 0;
+		for(int i = 0; i < ctx->num_active_devices && num_devices < worker->devices_capacity; i++){
+			ohmd_device* dev = ctx->active_devices[i];
+			if(!ohmd_is_worker_device(worker, dev))
+				continue;
+
+			// pipelined devices have their samples queued by the reader thread
+			int fd = event_driven && !ohmd_is_pipelined(ctx, dev) ? ohmd_get_device_fd(dev) : -1;
+			if(fd < 0 || num_ready <= 0 || ohmd_fd_is_ready(fd, fds, ready, num_fds)){
+				ohmd_lock_mutex(dev->mutex);
+				devices[num_devices++] = dev;
+			}
+		}
+
+		ohmd_unlock_mutex(ctx->update_mutex);
+
+		// the slow part, other workers and the application can carry on meanwhile
+		for(int i = 0; i < num_devices; i++)
+			ohmd_update_device(ctx, devices[i]);
+
+		ohmd_lock_mutex(ctx->update_mutex);
+
+		for(int i = 0; i < num_devices; i++){
+			ohmd_publish_pose(devices[i]);
+			ohmd_unlock_mutex(devices[i]->mutex);
+		}
+
+		// Collect the file descriptors to wait on for the next round. Fall back to
+		// polling at a fixed rate if any device can't be waited on.
+		num_fds = 0;
+		for(int i = 0; i < ctx->num_active_devices && event_driven; i++){
+			ohmd_device* dev = ctx->active_devices[i];
+			if(!ohmd_is_worker_device(worker, dev))
+				continue;
+
+			// the reader thread wakes us up for these
+			if(ohmd_is_pipelined(ctx, dev)){
+				pipelined = true;
+				continue;
+			}
+
+			int fd = ohmd_get_device_fd(dev);
+			if(fd < 0 || num_fds == AUTOMATIC_UPDATE_MAX_FDS){
+				polled = true;
+				break;
+			}
+
+			fds[num_fds++] = fd;
+		}
+
+		ohmd_unlock_mutex(ctx->update_mutex);
+
+		if(!event_driven || polled)
+			num_fds = 0;
+
+		// the poller waits in system time, with another clock poll on that instead
+		if(!worker->poller || ctx->clock){
+			ohmd_ctx_sleep(ctx, AUTOMATIC_UPDATE_SLEEP);
+			num_ready = 0;
+			continue;
+		}
+
+		num_ready = ohmd_poller_wait(worker->poller, fds, ready, num_fds,
+			num_fds > 0 || (pipelined && !polled) ? AUTOMATIC_UPDATE_MAX_WAIT : AUTOMATIC_UPDATE_SLEEP);
+
+		if(num_ready < 0){
+			// the platform can't wait on the devices
+			ohmd_ctx_sleep(ctx, AUTOMATIC_UPDATE_SLEEP);
+			num_ready = 0;
+		}
+	}
+
+	return 0;
+}
+
+// The read stage of pipelined devices. Only drains the devices into their
+// sample queues, so that it keeps up even if an update thread stalls.
+static unsigned int ohmd_reader_thread(void* arg)
+{
+	ohmd_context* ctx = (ohmd_context*)arg;
+
+	int num_devices = 0;
+
+	int fds[AUTOMATIC_UPDATE_MAX_FDS];
+	bool ready[AUTOMATIC_UPDATE_MAX_FDS];
+	int num_fds = 0;
+	int num_ready = 0;
+
+	while(!ctx->update_request_quit)
+	{
+		bool polled = !ctx->update_event_driven;
+
+		// The read mutex keeps the devices open, it's never held while taking
+		// the update mutex so there's no lock order to worry about.
+		ohmd_lock_mutex(ctx->update_mutex);
+
+		ohmd_reserve(&ctx->reader_devices, &ctx->reader_devices_capacity, ctx->num_active_devices, sizeof(ohmd_device*));
+		ohmd_reserve(&ctx->reader_heads, &ctx->reader_heads_capacity, ctx->num_active_devices, sizeof(uint32_t));
+		ohmd_device** devices = ctx->reader_devices;
+		uint32_t* heads = ctx->reader_heads;
+		int max_devices = OHMD_MIN(ctx->reader_devices_capacity, ctx->reader_heads_capacity);
+
+		num_devices = 0;
+		for(int i = 0; i < ctx->num_active_devices && num_devices < max_devices; i++){
+			ohmd_device* dev = ctx->active_devices[i];
+			if(!ohmd_is_pipelined(ctx, dev))
+				continue;
+
+			int fd = ohmd_get_device_fd(dev);
+			if(fd < 0 || num_ready <= 0 || ohmd_fd_is_ready(fd, fds, ready, num_fds)){
+				ohmd_lock_mutex(dev->read_mutex);
+				devices[num_devices++] = dev;
+			}
+		}
+
+		num_fds = 0;
+		for(int i = 0; i < ctx->num_active_devices && !polled; i++){
+			ohmd_device* dev = ctx->active_devices[i];
+			if(!ohmd_is_pipelined(ctx, dev))
+				continue;
+
+			int fd = ohmd_get_device_fd(dev);
+			if(fd < 0 || num_fds == AUTOMATIC_UPDATE_MAX_FDS){
+				polled = true;
+				break;
+			}
+
+			fds[num_fds++] = fd;
+		}
+
+		ohmd_unlock_mutex(ctx->update_mutex);
+
+		for(int i = 0; i < num_devices; i++){
+			ohmd_device* dev = devices[i];
+			heads[i] = dev->samples->head;
+			if(!ohmd_is_lost(dev))
+				dev->read(dev);
+		}
+
+		for(int i = 0; i < num_devices; i++){
+			ohmd_device* dev = devices[i];
+
+			// hand new samples to the fusion stage
+			ohmd_poller* poller = ctx->update_workers[dev->update_worker].poller;
+			if(dev->samples->head != heads[i] && poller)
+				ohmd_poller_wake(poller);
+
+			ohmd_unlock_mutex(dev->read_mutex);
+		}
+
+		if(polled)
+			num_fds = 0;
+
+		if(!ctx->reader_poller || ctx->clock){
+			ohmd_ctx_sleep(ctx, AUTOMATIC_UPDATE_SLEEP);
+			num_ready = 0;
+			continue;
+		}
+
+		num_ready = ohmd_poller_wait(ctx->reader_poller, fds, ready, num_fds,
+			num_fds > 0 ? AUTOMATIC_UPDATE_MAX_WAIT : AUTOMATIC_UPDATE_SLEEP);
+
+		if(num_ready < 0){
+			ohmd_ctx_sleep(ctx, AUTOMATIC_UPDATE_SLEEP);
+			num_ready = 0;
+		}
+	}
+
+	return 0;
+}
+
+static void ohmd_wake_update_workers(ohmd_context* ctx)
+{
+	if(ctx->reader_poller)
+		ohmd_poller_wake(ctx->reader_poller);
+
+	for(int i = 0; i < ctx->num_update_workers; i++){
+		if(ctx->update_workers[i].poller)
+			ohmd_poller_wake(ctx->update_workers[i].poller);
+	}
+}
+
+static void ohmd_start_update_workers(ohmd_context* ctx)
+{
+	for(int i = 0; i < ctx->update_worker_count; i++){
+		ohmd_update_worker* worker = &ctx->update_workers[i];
+
+		worker->ctx = ctx;
+		worker->index = i;
+		worker->poller = ohmd_create_poller(ctx);
+		worker->thread = ohmd_create_thread(ctx, ohmd_update_thread, worker);
+		if(worker->thread)
+			ohmd_apply_thread_settings(ctx, worker->thread, &ctx->thread_settings_in_effect);
+	}
+
+	ctx->num_update_workers = ctx->update_worker_count;
+
+	if(ctx->update_pipelined){
+		ctx->reader_poller = ohmd_create_poller(ctx);
+		ctx->reader_thread = ohmd_create_thread(ctx, ohmd_reader_thread, ctx);
+		if(ctx->reader_thread)
+			ohmd_apply_thread_settings(ctx, ctx->reader_thread, &ctx->thread_settings_in_effect);
+	}
+}
+
+static void ohmd_stop_update_workers(ohmd_context* ctx)
+{
+	ctx->update_request_quit = true;
+	ohmd_wake_update_workers(ctx);
+
+	for(int i = 0; i < ctx->num_update_workers; i++){
+		ohmd_update_worker* worker = &ctx->update_workers[i];
+
+		ohmd_destroy_thread(worker->thread);
+
+		if(worker->poller)
+			ohmd_destroy_poller(worker->poller);
+
+		free(worker->devices);
+
+		worker->thread = NULL;
+		worker->poller = NULL;
+		worker->devices = NULL;
+		worker->devices_capacity = 0;
+	}
+
+	if(ctx->reader_thread){
+		ohmd_destroy_thread(ctx->reader_thread);
+		ctx->reader_thread = NULL;
+	}
+
+	if(ctx->reader_poller){
+		ohmd_destroy_poller(ctx->reader_poller);
+		ctx->reader_poller = NULL;
+	}
+
+	ctx->num_update_workers = 0;
+	ctx->update_request_quit = false;
+}
+
+static void ohmd_set_up_update_thread(ohmd_context* ctx, ohmd_device* device)
+{
+	// devices opened in the background can get here at the same time
+	ohmd_lock_mutex(ctx->open_mutex);
+
+	if(ctx->num_update_workers == 0){
+		ohmd_start_update_workers(ctx);
+	}
+	else if(ctx->update_workers[device->update_worker].poller){
+		// wait on the new device as well
+		ohmd_poller_wake(ctx->update_workers[device->update_worker].poller);
+	}
+
+	ohmd_unlock_mutex(ctx->open_mutex);
+}
+
+// Spreads the devices over the workers, the workers must not be running and
+// the update mutex must be held, devices are added under it while opening
+static void ohmd_assign_update_workers(ohmd_context* ctx)
+{
+	ctx->next_update_worker = 0;
+
+	for(int i = 0; i < ctx->num_active_devices; i++){
+		ohmd_device* dev = ctx->active_devices[i];
+		if(dev->settings.automatic_update)
+			dev->update_worker = ctx->next_update_worker++ % ctx->update_worker_count;
+	}
+}
+
+// Spreads the devices over worker_count workers and picks up changed worker
+// settings, if the workers are running
+static void ohmd_restart_update_workers(ohmd_context* ctx, int worker_count)
+{
+	ohmd_lock_mutex(ctx->open_mutex);
+
+	bool running = ctx->num_update_workers > 0;
+
+	if(running)
+		ohmd_stop_update_workers(ctx);
+
+	// there's no update mutex until the first device is opened
+	if(ctx->update_mutex)
+		ohmd_lock_mutex(ctx->update_mutex);
+
+	ctx->update_worker_count = worker_count;
+	ohmd_assign_update_workers(ctx);
+
+	if(ctx->update_mutex)
+		ohmd_unlock_mutex(ctx->update_mutex);
+
+	if(running)
+		ohmd_start_update_workers(ctx);
+
+	ohmd_unlock_mutex(ctx->open_mutex);
+}
+
+// Waits until the driver may open a device, see ohmd_driver.open_exclusive
+static void ohmd_open_begin(ohmd_context* ctx, ohmd_driver* driver)
+{
+	ohmd_lock_mutex(ctx->open_mutex);
+
+	while(ctx->opening_exclusive || (driver->open_exclusive && ctx->num_opening > 0)){
+		ohmd_unlock_mutex(ctx->open_mutex);
+		ohmd_sleep(OPEN_WAIT_SLEEP);
+		ohmd_lock_mutex(ctx->open_mutex);
+	}
+
+	if(driver->open_exclusive)
+		ctx->opening_exclusive = true;
+	else
+		ctx->num_opening++;
+
+	ohmd_unlock_mutex(ctx->open_mutex);
+}
+
+static void ohmd_open_end(ohmd_context* ctx, ohmd_driver* driver)
+{
+	ohmd_lock_mutex(ctx->open_mutex);
+
+	if(driver->open_exclusive)
+		ctx->opening_exclusive = false;
+	else
+		ctx->num_opening--;
+
+	ctx->num_pending_opens--;
+
+	ohmd_unlock_mutex(ctx->open_mutex);
+}
+
+// Has the driver open the device, without holding the update mutex, so that
+// the update threads keep running through the feature report round trips.
+// num_pending_opens has to be counted up for it.
+static ohmd_device* ohmd_open_desc(ohmd_context* ctx, int index, ohmd_device_desc* desc, ohmd_device_settings* settings)
+{
+	ohmd_driver* driver = (ohmd_driver*)desc->driver_ptr;
+
+	ohmd_open_begin(ctx, driver);
+	ohmd_device* device = driver->open_device(driver, desc);
+	ohmd_open_end(ctx, driver);
+
+	if (device == NULL) {
+		ohmd_set_error(ctx, "Could not open device with index: %d, check device permissions?", index);
+		return NULL;
+	}
+
+	device->rotation_correction.w = 1;
+
+	device->settings = *settings;
+
+	device->ctx = ctx;
+	if(device->sensor_fusion){
+		device->sensor_fusion->clock = ctx->clock;
+
+		if(!ofusion_set_engine(device->sensor_fusion, fusion_engines[settings->fusion_engine]))
+			LOGW("could not switch to the %s fusion engine", fusion_engines[settings->fusion_engine]->name);
+
+		if(settings->use_magnetometer)
+			device->sensor_fusion->flags |= FF_USE_MAG;
+	}
+
+	device->mutex = ohmd_create_mutex(ctx);
+	device->read_mutex = ohmd_create_mutex(ctx);
+
+	ohmd_lock_mutex(ctx->update_mutex);
+
+	if(!ohmd_reserve(&ctx->active_devices, &ctx->active_devices_capacity, ctx->num_active_devices + 1, sizeof(ohmd_device*))){
+		ohmd_unlock_mutex(ctx->update_mutex);
+		ohmd_set_error(ctx, "could not allocate RAM for device");
+		ohmd_destroy_mutex(device->mutex);
+		ohmd_destroy_mutex(device->read_mutex);
+		device->close(device);
+		return NULL;
+	}
+
+	device->active_device_idx = ctx->num_active_devices;
+	ctx->active_devices[ctx->num_active_devices++] = device;
+
+	if(device->settings.automatic_update)
+		device->update_worker = ctx->next_update_worker++ % ctx->update_worker_count;
+
+	ohmd_publish_pose(device);
+
+	ohmd_unlock_mutex(ctx->update_mutex);
+
+	if(device->settings.automatic_update)
+		ohmd_set_up_update_thread(ctx, device);
+
+	return device;
+}
+
+static bool ohmd_prepare_open(ohmd_context* ctx, int index)
+{
+	if(index < 0 || index >= ctx->list.num_devices){
+		ohmd_set_error(ctx, "no device with index: %d", index);
+		return false;
+	}
+
+	// the mutex is needed from here on, any update threads need it
+	if(!ctx->update_mutex)
+		ctx->update_mutex = ohmd_create_mutex(ctx);
+
+	ohmd_lock_mutex(ctx->open_mutex);
+	ctx->num_pending_opens++;
+	ohmd_unlock_mutex(ctx->open_mutex);
+
+	return true;
+}
+
+ohmd_device* OHMD_APIENTRY ohmd_list_open_device_s(ohmd_context* ctx, int index, ohmd_device_settings* settings)
+{
+	if(!ohmd_prepare_open(ctx, index))
+		return NULL;
+
+	return ohmd_open_desc(ctx, index, &ctx->list.devices[index], settings);
+}
+
+ohmd_device* OHMD_APIENTRY ohmd_list_open_device(ohmd_context* ctx, int index)
+{
+	ohmd_device_settings settings;
+	memset(&settings, 0, sizeof(settings));
+
+	settings.automatic_update = true;
+
+	return ohmd_list_open_device_s(ctx, index, &settings);
+}
+
+static unsigned int ohmd_open_thread(void* arg)
+{
+	ohmd_open_request* request = (ohmd_open_request*)arg;
+
+	request->device = ohmd_open_desc(request->ctx, request->index, &request->desc, &request->settings);
+	ohmd_atomic_store(&request->done, 1);
+
+	if(request->callback)
+		request->callback(request->device, request->user_data);
+
+	return 0;
+}
+
+ohmd_open_request* OHMD_APIENTRY ohmd_list_open_device_async(ohmd_context* ctx, int index,
+	ohmd_device_settings* settings, ohmd_open_callback callback, void* user_data)
+{
+	ohmd_open_request* request = ohmd_alloc(ctx, sizeof(ohmd_open_request));
+	if(!request)
+		return NULL;
+
+	request->wait_mutex = ohmd_create_mutex(ctx);
+	if(!request->wait_mutex){
+		free(request);
+		return NULL;
+	}
+
+	if(!ohmd_prepare_open(ctx, index)){
+		ohmd_destroy_mutex(request->wait_mutex);
+		free(request);
+		return NULL;
+	}
+
+	// the list changes with the next probe, the thread works on a copy
+	request->ctx = ctx;
+	request->index = index;
+	request->desc = ctx->list.devices[index];
+	if(settings)
+		request->settings = *settings;
+	else
+		request->settings.automatic_update = true;
+	request->callback = callback;
+	request->user_data = user_data;
+
+	ohmd_lock_mutex(ctx->open_mutex);
+	request->next = ctx->open_requests;
+	ctx->open_requests = request;
+	ohmd_unlock_mutex(ctx->open_mutex);
+
+	request->thread = ohmd_create_thread(ctx, ohmd_open_thread, request);
+	if(!request->thread){
+		ohmd_set_error(ctx, "could not start a thread to open device with index: %d", index);
+
+		ohmd_lock_mutex(ctx->open_mutex);
+		ctx->num_pending_opens--;
+		ohmd_unlock_mutex(ctx->open_mutex);
+
+		ohmd_open_request_destroy(request);
+		return NULL;
+	}
 
-#if DRIVER_OCULUS_RIFT
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_oculus_rift_drv(ctx);
-#endif
+	return request;
+}
 
-#if DRIVER_DEEPOON
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_deepoon_drv(ctx);
-#endif
+int OHMD_APIENTRY ohmd_open_request_is_done(ohmd_open_request* request)
+{
+	return ohmd_atomic_load(&request->done) ? 1 : 0;
+}
 
-#if DRIVER_HTC_VIVE
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_htc_vive_drv(ctx);
-#endif
+ohmd_device* OHMD_APIENTRY ohmd_open_request_wait(ohmd_open_request* request)
+{
+	ohmd_lock_mutex(request->wait_mutex);
 
-#if DRIVER_WMR
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_wmr_drv(ctx);
-#endif
+	if(request->thread){
+		ohmd_destroy_thread(request->thread);
+		request->thread = NULL;
+	}
 
-#if DRIVER_PSVR
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_psvr_drv(ctx);
-#endif
+	ohmd_unlock_mutex(request->wait_mutex);
 
-#if DRIVER_NOLO
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_nolo_drv(ctx);
-#endif
+	return request->device;
+}
 
-#if DRIVER_EXTERNAL
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_external_drv(ctx);
-#endif
+void OHMD_APIENTRY ohmd_open_request_destroy(ohmd_open_request* request)
+{
+	ohmd_context* ctx = request->ctx;
 
-#if DRIVER_ANDROID
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_android_drv(ctx);
-#endif
-	// add dummy driver last to make it the lowest priority
-	ctx->drivers[ctx->num_drivers++] = ohmd_create_dummy_drv(ctx);
+	ohmd_open_request_wait(request);
 
-	ctx->update_request_quit = false;
+	ohmd_lock_mutex(ctx->open_mutex);
+	for(ohmd_open_request** cur = &ctx->open_requests; *cur; cur = &(*cur)->next){
+		if(*cur == request){
+			*cur = request->next;
+			break;
+		}
+	}
+	ohmd_unlock_mutex(ctx->open_mutex);
 
-	return ctx;
+	ohmd_destroy_mutex(request->wait_mutex);
+	free(request);
 }
 
-void OHMD_APIENTRY ohmd_ctx_destroy(ohmd_context* ctx)
+#define RECONNECT_INTERVAL 0.02
+
+static unsigned int ohmd_reconnect_thread(void* arg)
 {
-	ctx->update_request_quit = true;
+	ohmd_device* device = (ohmd_device*)arg;
 
-	for(int i = 0; i < ctx->num_active_devices; i++){
-		ctx->active_devices[i]->close(ctx->active_devices[i]);
-	}
+	while(!ohmd_atomic_load(&device->reconnect_quit)){
+		void* link = device->reopen(device);
 
-	for(int i = 0; i < ctx->num_drivers; i++){
-		ctx->drivers[i]->destroy(ctx->drivers[i]);
-	}
+		if(link){
+			// wait for the reader and the update to be done with the old link
+			ohmd_lock_mutex(device->read_mutex);
+			ohmd_lock_mutex(device->mutex);
 
-	if(ctx->update_thread){
-		ohmd_destroy_thread(ctx->update_thread);
-		ohmd_destroy_mutex(ctx->update_mutex);
+			device->resume(device, link);
+			ohmd_atomic_store(&device->lost, 0);
+
+			ohmd_unlock_mutex(device->mutex);
+			ohmd_unlock_mutex(device->read_mutex);
+
+			LOGI("device reconnected");
+			break;
+		}
+
+		ohmd_sleep(RECONNECT_INTERVAL);
 	}
 
-	free(ctx);
+	return 0;
 }
 
-void OHMD_APIENTRY ohmd_ctx_update(ohmd_context* ctx)
+void ohmd_device_lost(ohmd_device* device)
 {
-	for(int i = 0; i < ctx->num_active_devices; i++){
-		ohmd_device* dev = ctx->active_devices[i];
-		if(!dev->settings.automatic_update && dev->update)
-			dev->update(dev);
+	// not once the device is being closed, the thread would outlive it
+	if(!device->reopen || ohmd_is_lost(device) || ohmd_atomic_load(&device->reconnect_quit))
+		return;
 
-		ohmd_lock_mutex(ctx->update_mutex);
-		dev->getf(dev, OHMD_POSITION_VECTOR, (float*)&dev->position);
-		dev->getf(dev, OHMD_ROTATION_QUAT, (float*)&dev->rotation);
-		ohmd_unlock_mutex(ctx->update_mutex);
-	}
+	// the thread of a previous reconnect is done, lost is cleared last
+	if(device->reconnect_thread)
+		ohmd_destroy_thread(device->reconnect_thread);
+
+	LOGW("lost the device, reconnecting");
+
+	ohmd_atomic_store(&device->lost, 1);
+	device->reconnect_thread = ohmd_create_thread(device->ctx, ohmd_reconnect_thread, device);
+
+	if(!device->reconnect_thread)
+		LOGE("could not start reconnecting");
 }
 
-const char* OHMD_APIENTRY ohmd_ctx_get_error(ohmd_context* ctx)
+// Joins the reconnect thread, if any, and keeps another from starting. The
+// thread takes the device's mutexes to resume it, they must not be held.
+static void ohmd_stop_reconnect(ohmd_device* device)
 {
-	return ctx->error_msg;
+	ohmd_atomic_store(&device->reconnect_quit, 1);
+
+	if(!device->reconnect_thread)
+		return;
+
+	ohmd_destroy_thread(device->reconnect_thread);
+	device->reconnect_thread = NULL;
 }
 
-int OHMD_APIENTRY ohmd_ctx_probe(ohmd_context* ctx)
+int OHMD_APIENTRY ohmd_close_device(ohmd_device* device)
 {
-	memset(&ctx->list, 0, sizeof(ohmd_device_list));
-	for(int i = 0; i < ctx->num_drivers; i++){
-		ctx->drivers[i]->get_device_list(ctx->drivers[i], &ctx->list);
-	}
+	ohmd_lock_mutex(device->ctx->update_mutex);
 
-	return ctx->list.num_devices;
+	ohmd_context* ctx = device->ctx;
+	int idx = device->active_device_idx;
+
+	// the order doesn't matter, the last device takes its place
+	ohmd_device* last = ctx->active_devices[--ctx->num_active_devices];
+	ctx->active_devices[idx] = last;
+	last->active_device_idx = idx;
+
+	ohmd_unlock_mutex(ctx->update_mutex);
+
+	// no more reconnects, a read or update failing from here on doesn't
+	// start one
+	ohmd_atomic_store(&device->reconnect_quit, 1);
+
+	// Nobody can find the device anymore, wait for the threads that might
+	// still be reading or updating it. This can't be done with the update
+	// mutex held, as the update threads take it to publish the pose.
+	ohmd_mutex* read_mutex = device->read_mutex;
+	ohmd_lock_mutex(read_mutex);
+	ohmd_unlock_mutex(read_mutex);
+
+	ohmd_lock_mutex(device->mutex);
+	ohmd_unlock_mutex(device->mutex);
+
+	ohmd_stop_reconnect(device);
+
+	ohmd_destroy_mutex(read_mutex);
+
+	ohmd_mutex* mutex = device->mutex;
+	ohmd_lock_mutex(mutex);
+	device->close(device);
+	ohmd_unlock_mutex(mutex);
+	ohmd_destroy_mutex(mutex);
+
+	// stop waiting on the closed device
+	ohmd_wake_update_workers(ctx);
+
+	return OHMD_S_OK;
 }
 
-int OHMD_APIENTRY ohmd_gets(ohmd_string_description type, const char ** out)
+void ohmd_seqlock_write_begin(volatile uint32_t* seq)
 {
-	switch(type){
-	case OHMD_GLSL_DISTORTION_VERT_SRC:
-		*out = distortion_vert;
-		return OHMD_S_OK;
-	case OHMD_GLSL_DISTORTION_FRAG_SRC:
-		*out = distortion_frag;
-		return OHMD_S_OK;
-	case OHMD_GLSL_330_DISTORTION_VERT_SRC:
-		*out = distortion_vert_330;
-		return OHMD_S_OK;
-	case OHMD_GLSL_330_DISTORTION_FRAG_SRC:
-		*out = distortion_frag_330;
-		return OHMD_S_OK;
-	default:
-		return OHMD_S_UNSUPPORTED;
-	}
+	// odd sequence numbers mark a write in progress
+	ohmd_atomic_add(seq, 1);
 }
 
-const char* OHMD_APIENTRY ohmd_list_gets(ohmd_context* ctx, int index, ohmd_string_value type)
+void ohmd_seqlock_write_end(volatile uint32_t* seq)
 {
-	if(index >= ctx->list.num_devices)
-		return NULL;
-
-	switch(type){
-	case OHMD_VENDOR:
-		return ctx->list.devices[index].vendor;
-	case OHMD_PRODUCT:
-		return ctx->list.devices[index].product;
-	case OHMD_PATH:
-		return ctx->list.devices[index].path;
-	default:
-		return NULL;
-	}
+	ohmd_atomic_add(seq, 1);
 }
 
-int OHMD_APIENTRY ohmd_list_geti(ohmd_context* ctx, int index, ohmd_int_value type, int* out)
+uint32_t ohmd_seqlock_read_begin(volatile uint32_t* seq)
 {
-	if(index >= ctx->list.num_devices)
-		return OHMD_S_INVALID_PARAMETER;
+	uint32_t start;
 
-	switch(type){
-	case OHMD_DEVICE_CLASS:
-		*out = ctx->list.devices[index].device_class;
-		return OHMD_S_OK;
+	// writes are short, spin until the writer is done
+	while((start = ohmd_atomic_load(seq)) & 1);
 
-	case OHMD_DEVICE_FLAGS:
-		*out = ctx->list.devices[index].device_flags;
-		return OHMD_S_OK;
+	return start;
+}
 
-	default:
-		return OHMD_S_INVALID_PARAMETER;
-	}
+bool ohmd_seqlock_read_retry(volatile uint32_t* seq, uint32_t start)
+{
+	ohmd_memory_barrier();
+	return ohmd_atomic_load(seq) != start;
 }
 
-static unsigned int ohmd_update_thread(void* arg)
+// Must be called with the device mutex held, which serializes the writers
+void ohmd_publish_pose(ohmd_device* device)
 {
-	ohmd_context* ctx = (ohmd_context*)arg;
+	device->getf(device, OHMD_POSITION_VECTOR, (float*)&device->position);
+	device->getf(device, OHMD_ROTATION_QUAT, (float*)&device->rotation);
 
-	while(!ctx->update_request_quit)
-	{
-		ohmd_lock_mutex(ctx->update_mutex);
+	ohmd_pose* pose = &device->pose;
 
-		for(int i = 0; i < ctx->num_active_devices; i++){
-			if(ctx->active_devices[i]->settings.automatic_update && ctx->active_devices[i]->update)
-				ctx->active_devices[i]->update(ctx->active_devices[i]);
-		}
+	bool changed = pose->generation == 0 ||
+		memcmp(&pose->rotation, &device->rotation, sizeof(quatf)) != 0 ||
+		memcmp(&pose->position, &device->position, sizeof(vec3f)) != 0 ||
+		memcmp(&pose->rotation_correction, &device->rotation_correction, sizeof(quatf)) != 0 ||
+		memcmp(&pose->position_correction, &device->position_correction, sizeof(vec3f)) != 0 ||
+		pose->ipd != device->properties.ipd;
 
-		ohmd_unlock_mutex(ctx->update_mutex);
+	ohmd_seqlock_write_begin(&device->pose_seq);
+
+	device->pose.rotation = device->rotation;
+	device->pose.position = device->position;
+	device->pose.rotation_correction = device->rotation_correction;
+	device->pose.position_correction = device->position_correction;
+	device->pose.ipd = device->properties.ipd;
 
-		ohmd_sleep(AUTOMATIC_UPDATE_SLEEP);
+	if(changed)
+		device->pose.generation++;
+	device->pose.time = ohmd_ctx_get_time(device->ctx);
+
+	if(device->sensor_fusion){
+		fusion* sensor_fusion = device->sensor_fusion;
+
+		if(sensor_fusion->iterations > 0)
+			device->pose.time = ofusion_get_last_time(sensor_fusion);
+
+		device->pose.fusion_orient = sensor_fusion->orient;
+		ofusion_get_prediction_rate(sensor_fusion, &device->pose.ang_vel);
 	}
 
-	return 0;
+	ohmd_seqlock_write_end(&device->pose_seq);
 }
 
-static void ohmd_set_up_update_thread(ohmd_context* ctx)
+void ohmd_read_pose(ohmd_device* device, ohmd_pose* pose)
 {
-	if(!ctx->update_thread){
-		ctx->update_mutex = ohmd_create_mutex(ctx);
-		ctx->update_thread = ohmd_create_thread(ctx, ohmd_update_thread, ctx);
-	}
+	uint32_t start;
+
+	do {
+		start = ohmd_seqlock_read_begin(&device->pose_seq);
+		*pose = device->pose;
+	} while(ohmd_seqlock_read_retry(&device->pose_seq, start));
 }
 
-ohmd_device* OHMD_APIENTRY ohmd_list_open_device_s(ohmd_context* ctx, int index, ohmd_device_settings* settings)
+static void ohmd_get_eye_modelview(const ohmd_pose* pose, float eye_shift, mat4x4f* out)
 {
-	ohmd_lock_mutex(ctx->update_mutex);
-
-	if(index >= 0 && index < ctx->list.num_devices){
+	vec3f point = {{0, 0, 0}};
+	quatf rot = pose->rotation;
+	oquatf_mult_me(&rot, &pose->rotation_correction);
+	mat4x4f orient, world_shift, result;
+	omat4x4f_init_look_at(&orient, &rot, &point);
+	omat4x4f_init_translate(&world_shift, -pose->position.x + eye_shift, -pose->position.y, -pose->position.z);
+	omat4x4f_mult(&world_shift, &orient, &result);
+	omat4x4f_transpose(&result, out);
+}
 
-		ohmd_device_desc* desc = &ctx->list.devices[index];
-		ohmd_driver* driver = (ohmd_driver*)desc->driver_ptr;
-		ohmd_device* device = driver->open_device(driver, desc);
+// Looks up an eye matrix for the generation of pose, the matrices are only
+// rebuilt when the generation changes. Any thread may fill the cache, if two
+// of them miss at once the loser just doesn't store its result.
+static void ohmd_get_eye_matrix(ohmd_device* device, const ohmd_pose* pose, ohmd_eye_matrix matrix, float* out)
+{
+	uint32_t start, generation;
 
-		if (device == NULL) {
-			ohmd_set_error(ctx, "Could not open device with index: %d, check device permissions?", index);
-			ohmd_unlock_mutex(ctx->update_mutex);
-			return NULL;
-		}
+	do {
+		start = ohmd_seqlock_read_begin(&device->eye_cache_seq);
+		generation = device->eye_cache.generation;
+		if(generation == pose->generation)
+			*(mat4x4f*)out = device->eye_cache.matrices[matrix];
+	} while(ohmd_seqlock_read_retry(&device->eye_cache_seq, start));
 
-		device->rotation_correction.w = 1;
+	if(generation == pose->generation)
+		return;
 
-		device->settings = *settings;
+	ohmd_eye_matrices cache;
+	cache.generation = pose->generation;
 
-		device->ctx = ctx;
-		device->active_device_idx = ctx->num_active_devices;
-		ctx->active_devices[ctx->num_active_devices++] = device;
+	ohmd_get_eye_modelview(pose, pose->ipd / 2.0f, &cache.matrices[OHMD_EYE_MATRIX_LEFT_MODELVIEW]);
+	ohmd_get_eye_modelview(pose, -(pose->ipd / 2.0f), &cache.matrices[OHMD_EYE_MATRIX_RIGHT_MODELVIEW]);
 
-		ohmd_unlock_mutex(ctx->update_mutex);
+	// projections are set up when the device is opened and don't change afterwards
+	omat4x4f_transpose(&device->properties.proj_left, &cache.matrices[OHMD_EYE_MATRIX_LEFT_PROJECTION]);
+	omat4x4f_transpose(&device->properties.proj_right, &cache.matrices[OHMD_EYE_MATRIX_RIGHT_PROJECTION]);
 
-		if(device->settings.automatic_update)
-			ohmd_set_up_update_thread(ctx);
+	*(mat4x4f*)out = cache.matrices[matrix];
 
-		return device;
+	// don't replace a newer generation
+	if(ohmd_atomic_add(&device->eye_cache_lock, 1) == 1 && (int32_t)(cache.generation - device->eye_cache.generation) > 0){
+		ohmd_seqlock_write_begin(&device->eye_cache_seq);
+		device->eye_cache = cache;
+		ohmd_seqlock_write_end(&device->eye_cache_seq);
 	}
 
-	ohmd_unlock_mutex(ctx->update_mutex);
-
-	ohmd_set_error(ctx, "no device with index: %d", index);
-	return NULL;
+	ohmd_atomic_add(&device->eye_cache_lock, (uint32_t)-1);
 }
 
-ohmd_device* OHMD_APIENTRY ohmd_list_open_device(ohmd_context* ctx, int index)
+// Values derived from the published pose, these don't need the update mutex
+static int ohmd_device_getf_pose(ohmd_device* device, ohmd_float_value type, float* out)
 {
-	ohmd_device_settings settings;
+	ohmd_pose pose;
+	ohmd_read_pose(device, &pose);
 
-	settings.automatic_update = true;
+	switch(type){
+	case OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX:
+		ohmd_get_eye_matrix(device, &pose, OHMD_EYE_MATRIX_LEFT_MODELVIEW, out);
+		return OHMD_S_OK;
+	case OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX:
+		ohmd_get_eye_matrix(device, &pose, OHMD_EYE_MATRIX_RIGHT_MODELVIEW, out);
+		return OHMD_S_OK;
 
-	return ohmd_list_open_device_s(ctx, index, &settings);
+	case OHMD_LEFT_EYE_GL_PROJECTION_MATRIX:
+		ohmd_get_eye_matrix(device, &pose, OHMD_EYE_MATRIX_LEFT_PROJECTION, out);
+		return OHMD_S_OK;
+	case OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX:
+		ohmd_get_eye_matrix(device, &pose, OHMD_EYE_MATRIX_RIGHT_PROJECTION, out);
+		return OHMD_S_OK;
+
+	case OHMD_ROTATION_QUAT:
+		*(quatf*)out = pose.rotation;
+		oquatf_mult_me((quatf*)out, &pose.rotation_correction);
+		return OHMD_S_OK;
+
+	case OHMD_POSITION_VECTOR:
+		*(vec3f*)out = pose.position;
+		for(int i = 0; i < 3; i++)
+			out[i] += pose.position_correction.arr[i];
+
+		return OHMD_S_OK;
+
+	default:
+		return OHMD_S_INVALID_PARAMETER;
+	}
 }
 
-int OHMD_APIENTRY ohmd_close_device(ohmd_device* device)
+static void ohmd_predict_rotation(const ohmd_pose* pose, double time, quatf* out)
 {
-	ohmd_lock_mutex(device->ctx->update_mutex);
+	double dt = time - pose->time;
+	dt = OHMD_MAX(-OHMD_MAX_PREDICTION, OHMD_MIN(dt, OHMD_MAX_PREDICTION));
 
-	ohmd_context* ctx = device->ctx;
-	int idx = device->active_device_idx;
+	ofusion_predict(&pose->rotation, &pose->ang_vel, (float)dt, out);
+	oquatf_mult_me(out, &pose->rotation_correction);
+}
 
-	memmove(ctx->active_devices + idx, ctx->active_devices + idx + 1,
-		sizeof(ohmd_device*) * (ctx->num_active_devices - idx - 1));
+double OHMD_APIENTRY ohmd_ctx_get_time(ohmd_context* ctx)
+{
+	return ohmd_clock_get_tick(ctx->clock);
+}
 
-	device->close(device);
+void ohmd_ctx_set_clock(ohmd_context* ctx, ohmd_clock* clock)
+{
+	ctx->clock = clock;
+}
+
+void ohmd_ctx_sleep(ohmd_context* ctx, double seconds)
+{
+	ohmd_clock_sleep(ctx->clock, seconds);
+}
 
-	ctx->num_active_devices--;
+int OHMD_APIENTRY ohmd_device_get_rotation_at(ohmd_device* device, double time, float* out)
+{
+	ohmd_pose pose;
+	ohmd_read_pose(device, &pose);
+
+	quatf orient;
+	if(time < pose.time && device->sensor_fusion && ofusion_get_orient_at(device->sensor_fusion, time, &orient) == 0){
+		// apply the rotation relative to the published pose in the body frame,
+		// this keeps any fixed rotation a driver puts on top of the fusion
+		quatf inv_orient = pose.fusion_orient, delta;
+		oquatf_inverse(&inv_orient);
+		oquatf_mult(&inv_orient, &orient, &delta);
+		oquatf_mult(&pose.rotation, &delta, (quatf*)out);
+		oquatf_mult_me((quatf*)out, &pose.rotation_correction);
 
-	for(int i = idx; i < ctx->num_active_devices; i++)
-		ctx->active_devices[i]->active_device_idx--;
+		return OHMD_S_OK;
+	}
 
-	ohmd_unlock_mutex(ctx->update_mutex);
+	ohmd_predict_rotation(&pose, time, (quatf*)out);
 
 	return OHMD_S_OK;
 }
 
+int OHMD_APIENTRY ohmd_device_get_predicted_rotation(ohmd_device* device, float horizon, float* out)
+{
+	return ohmd_device_get_rotation_at(device, ohmd_ctx_get_time(device->ctx) + horizon, out);
+}
+
 static int ohmd_device_getf_unp(ohmd_device* device, ohmd_float_value type, float* out)
 {
 	switch(type){
-	case OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX: {
-			vec3f point = {{0, 0, 0}};
-			quatf rot = device->rotation;
-			oquatf_mult_me(&rot, &device->rotation_correction);
-			mat4x4f orient, world_shift, result;
-			omat4x4f_init_look_at(&orient, &rot, &point);
-			omat4x4f_init_translate(&world_shift, -device->position.x +(device->properties.ipd / 2.0f), -device->position.y, -device->position.z);
-			omat4x4f_mult(&world_shift, &orient, &result);
-			omat4x4f_transpose(&result, (mat4x4f*)out);
-			return OHMD_S_OK;
-		}
-	case OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX: {
-			vec3f point = {{0, 0, 0}};
-			quatf rot = device->rotation;
-			oquatf_mult_me(&rot, &device->rotation_correction);
-			mat4x4f orient, world_shift, result;
-			omat4x4f_init_look_at(&orient, &rot, &point);
-			omat4x4f_init_translate(&world_shift, -device->position.x + -(device->properties.ipd / 2.0f), -device->position.y, -device->position.z);
-			omat4x4f_mult(&world_shift, &orient, &result);
-			omat4x4f_transpose(&result, (mat4x4f*)out);
-			return OHMD_S_OK;
-		}
-	case OHMD_LEFT_EYE_GL_PROJECTION_MATRIX:
-		omat4x4f_transpose(&device->properties.proj_left, (mat4x4f*)out);
-		return OHMD_S_OK;
-	case OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX:
-		omat4x4f_transpose(&device->properties.proj_right, (mat4x4f*)out);
-		return OHMD_S_OK;
-
 	case OHMD_SCREEN_HORIZONTAL_SIZE:
 		*out = device->properties.hsize;
 		return OHMD_S_OK;
@@ -334,21 +1561,6 @@ static int ohmd_device_getf_unp(ohmd_device* device, ohmd_float_value type, floa
 		*out = device->properties.znear;
 		return OHMD_S_OK;
 
-	case OHMD_ROTATION_QUAT:
-	{
-		*(quatf*)out = device->rotation;
-
-		oquatf_mult_me((quatf*)out, &device->rotation_correction);
-		return OHMD_S_OK;
-	}
-	case OHMD_POSITION_VECTOR:
-	{
-		*(vec3f*)out = device->position;
-		for(int i = 0; i < 3; i++)
-			out[i] += device->position_correction.arr[i];
-		
-		return OHMD_S_OK;
-	}
 	case OHMD_UNIVERSAL_DISTORTION_K: {
 		for (int i = 0; i < 4; i++) {
 			out[i] = device->properties.universal_distortion_k[i];
@@ -368,9 +1580,21 @@ static int ohmd_device_getf_unp(ohmd_device* device, ohmd_float_value type, floa
 
 int OHMD_APIENTRY ohmd_device_getf(ohmd_device* device, ohmd_float_value type, float* out)
 {
-	ohmd_lock_mutex(device->ctx->update_mutex);
+	switch(type){
+	case OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX:
+	case OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX:
+	case OHMD_LEFT_EYE_GL_PROJECTION_MATRIX:
+	case OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX:
+	case OHMD_ROTATION_QUAT:
+	case OHMD_POSITION_VECTOR:
+		return ohmd_device_getf_pose(device, type, out);
+	default:
+		break;
+	}
+
+	ohmd_lock_mutex(device->mutex);
 	int ret = ohmd_device_getf_unp(device, type, out);
-	ohmd_unlock_mutex(device->ctx->update_mutex);
+	ohmd_unlock_mutex(device->mutex);
 
 	return ret;
 }
@@ -380,6 +1604,7 @@ int ohmd_device_setf_unp(ohmd_device* device, ohmd_float_value type, const float
 	switch(type){
 	case OHMD_EYE_IPD:
 		device->properties.ipd = *in;
+		ohmd_publish_pose(device);
 		return OHMD_S_OK;
 	case OHMD_PROJECTION_ZFAR:
 		device->properties.zfar = *in;
@@ -398,6 +1623,7 @@ int ohmd_device_setf_unp(ohmd_device* device, ohmd_float_value type, const float
 			}
 
 			oquatf_diff(&q, (quatf*)in, &device->rotation_correction);
+			ohmd_publish_pose(device);
 			return OHMD_S_OK;
 		}
 	case OHMD_POSITION_VECTOR:
@@ -413,6 +1639,7 @@ int ohmd_device_setf_unp(ohmd_device* device, ohmd_float_value type, const float
 			for(int i = 0; i < 3; i++)
 				device->position_correction.arr[i] = in[i] - v.arr[i];
 
+			ohmd_publish_pose(device);
 			return OHMD_S_OK;
 		}
 	case OHMD_EXTERNAL_SENSOR_FUSION:
@@ -420,7 +1647,11 @@ int ohmd_device_setf_unp(ohmd_device* device, ohmd_float_value type, const float
 			if(device->setf == NULL)
 				return OHMD_S_UNSUPPORTED;
 
-			return device->setf(device, type, in);
+			int ret = device->setf(device, type, in);
+			if(ret == 0)
+				ohmd_publish_pose(device);
+
+			return ret;
 		}
 	default:
 		return OHMD_S_INVALID_PARAMETER;
@@ -429,9 +1660,9 @@ int ohmd_device_setf_unp(ohmd_device* device, ohmd_float_value type, const float
 
 int OHMD_APIENTRY ohmd_device_setf(ohmd_device* device, ohmd_float_value type, const float* in)
 {
-	ohmd_lock_mutex(device->ctx->update_mutex);
+	ohmd_lock_mutex(device->mutex);
 	int ret = ohmd_device_setf_unp(device, type, in);
-	ohmd_unlock_mutex(device->ctx->update_mutex);
+	ohmd_unlock_mutex(device->mutex);
 
 	return ret;
 }
@@ -459,6 +1690,11 @@ int OHMD_APIENTRY ohmd_device_geti(ohmd_device* device, ohmd_int_value type, int
 			memcpy(out, device->properties.controls_hints, device->properties.control_count * sizeof(int));
 			return OHMD_S_OK;
 
+		case OHMD_SAMPLE_QUEUE_STATS:
+			out[0] = device->samples ? osq_get_size(device->samples) : 0;
+			out[1] = device->samples ? (int)osq_get_dropped(device->samples) : 0;
+			return OHMD_S_OK;
+
 		default:
 				return OHMD_S_INVALID_PARAMETER;
 	}
@@ -491,9 +1727,9 @@ int ohmd_device_set_data_unp(ohmd_device* device, ohmd_data_value type, const vo
 
 int OHMD_APIENTRY ohmd_device_set_data(ohmd_device* device, ohmd_data_value type, const void* in)
 {
-	ohmd_lock_mutex(device->ctx->update_mutex);
+	ohmd_lock_mutex(device->mutex);
 	int ret = ohmd_device_set_data_unp(device, type, in);
-	ohmd_unlock_mutex(device->ctx->update_mutex);
+	ohmd_unlock_mutex(device->mutex);
 
 	return ret;
 }
@@ -505,6 +1741,17 @@ ohmd_status OHMD_APIENTRY ohmd_device_settings_seti(ohmd_device_settings* settin
 		settings->automatic_update = val[0] == 0 ? false : true;
 		return OHMD_S_OK;
 
+	case OHMD_IDS_FUSION_ENGINE:
+		if(val[0] < 0 || val[0] >= NUM_FUSION_ENGINES)
+			return OHMD_S_INVALID_PARAMETER;
+
+		settings->fusion_engine = (ohmd_fusion_engine)val[0];
+		return OHMD_S_OK;
+
+	case OHMD_IDS_MAGNETOMETER:
+		settings->use_magnetometer = val[0] == 0 ? false : true;
+		return OHMD_S_OK;
+
 	default:
 		return OHMD_S_INVALID_PARAMETER;
 	}
@@ -520,6 +1767,54 @@ void OHMD_APIENTRY ohmd_device_settings_destroy(ohmd_device_settings* settings)
 	free(settings);
 }
 
+bool ohmd_reserve(void* array, int* capacity, int count, size_t size)
+{
+	if(count <= *capacity)
+		return true;
+
+	int new_capacity = OHMD_MAX(OHMD_MAX(count, *capacity + *capacity / 2), 16);
+
+	void* data;
+	memcpy(&data, array, sizeof(data));
+
+	data = realloc(data, (size_t)new_capacity * size);
+	if(!data)
+		return false;
+
+	memcpy(array, &data, sizeof(data));
+	*capacity = new_capacity;
+
+	return true;
+}
+
+bool ohmd_add_driver(ohmd_context* ctx, ohmd_driver* driver)
+{
+	if(!driver || !ohmd_reserve(&ctx->drivers, &ctx->drivers_capacity, ctx->num_drivers + 1, sizeof(ohmd_driver*)))
+		return false;
+
+	ctx->drivers[ctx->num_drivers++] = driver;
+	return true;
+}
+
+ohmd_device_desc* ohmd_device_list_add(ohmd_device_list* list)
+{
+	if(!ohmd_reserve(&list->devices, &list->capacity, list->num_devices + 1, sizeof(ohmd_device_desc))){
+		LOGE("could not allocate RAM for the device list");
+		return NULL;
+	}
+
+	ohmd_device_desc* desc = &list->devices[list->num_devices++];
+	memset(desc, 0, sizeof(ohmd_device_desc));
+
+	return desc;
+}
+
+void ohmd_device_list_free(ohmd_device_list* list)
+{
+	free(list->devices);
+	memset(list, 0, sizeof(ohmd_device_list));
+}
+
 void* ohmd_allocfn(ohmd_context* ctx, const char* e_msg, size_t size)
 {
 	void* ret = calloc(1, size);
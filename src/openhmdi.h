@@ -18,8 +18,17 @@
 #include "openhmd.h"
 #include "omath.h"
 #include "platform.h"
+#include "fusion.h"
+#include "sample_queue.h"
+#include "hid.h"
+#include "capture.h"
+#include "cache.h"
+#include "hotplug.h"
+
+#define OHMD_MAX_UPDATE_WORKERS 8
 
-#define OHMD_MAX_DEVICES 16
+// Pose prediction further ahead than this is clamped
+#define OHMD_MAX_PREDICTION (100.0 / 1000.0)
 
 #define OHMD_MAX(_a, _b) ((_a) > (_b) ? (_a) : (_b))
 #define OHMD_MIN(_a, _b) ((_a) < (_b) ? (_a) : (_b))
@@ -40,16 +49,33 @@ typedef struct {
 	ohmd_driver* driver_ptr;
 } ohmd_device_desc;
 
+// Grows as drivers add to it with ohmd_device_list_add, there is no limit
+// to the number of devices. Zero initialized when empty.
 typedef struct {
 	int num_devices;
-	ohmd_device_desc devices[OHMD_MAX_DEVICES];
+	int capacity;
+	ohmd_device_desc* devices;
 } ohmd_device_list;
 
+// a zeroed description at the end of the list, NULL if out of memory
+ohmd_device_desc* ohmd_device_list_add(ohmd_device_list* list);
+void ohmd_device_list_free(ohmd_device_list* list);
+
 struct ohmd_driver {
 	void (*get_device_list)(ohmd_driver* driver, ohmd_device_list* list);
 	ohmd_device* (*open_device)(ohmd_driver* driver, ohmd_device_desc* desc);
 	void (*destroy)(ohmd_driver* driver);
 	ohmd_context* ctx;
+
+	// The HID devices of the driver, it's only asked for its devices when
+	// the probe finds one of them. NULL for drivers that are always asked.
+	const ohmd_hid_match* hid_matches;
+
+	// Devices of different drivers are opened in parallel by
+	// ohmd_list_open_device_async. Set by drivers whose open_device changes
+	// the context (like the replay driver swapping the transport), so that
+	// nothing else is opened at the same time.
+	bool open_exclusive;
 };
 
 typedef struct {
@@ -80,9 +106,66 @@ typedef struct {
 		float universal_aberration_k[3]; //post-warp per channel scaling [r,g,b]
 } ohmd_device_properties;
 
+// Pose of a device as seen by the application, published for lock-free readers
+typedef struct {
+	quatf rotation;
+	vec3f position;
+	quatf rotation_correction;
+	vec3f position_correction;
+	vec3f ang_vel;       // body frame angular velocity for prediction
+	quatf fusion_orient; // sensor fusion orientation the rotation is based on
+	double time;         // time of the last sensor sample, see ohmd_get_tick()
+	float ipd;
+	uint32_t generation; // bumped whenever a value the eye matrices depend on changes
+} ohmd_pose;
+
+typedef enum {
+	OHMD_EYE_MATRIX_LEFT_MODELVIEW,
+	OHMD_EYE_MATRIX_RIGHT_MODELVIEW,
+	OHMD_EYE_MATRIX_LEFT_PROJECTION,
+	OHMD_EYE_MATRIX_RIGHT_PROJECTION,
+	OHMD_EYE_MATRIX_COUNT
+} ohmd_eye_matrix;
+
+// GL ready (transposed) eye matrices of one pose generation
+typedef struct {
+	uint32_t generation;
+	mat4x4f matrices[OHMD_EYE_MATRIX_COUNT];
+} ohmd_eye_matrices;
+
+// A thread that updates the devices assigned to it
+typedef struct {
+	ohmd_context* ctx;
+	int index;
+	ohmd_thread* thread;
+	ohmd_poller* poller;
+
+	// the devices picked for a round, grown by the worker itself
+	ohmd_device** devices;
+	int devices_capacity;
+} ohmd_update_worker;
+
 struct ohmd_device_settings
 {
 	bool automatic_update;
+	ohmd_fusion_engine fusion_engine;
+	bool use_magnetometer;
+};
+
+struct ohmd_open_request {
+	ohmd_context* ctx;
+	int index;
+	ohmd_device_desc desc;
+	ohmd_device_settings settings;
+	ohmd_open_callback callback;
+	void* user_data;
+
+	ohmd_thread* thread; // joined by the first wait
+	ohmd_mutex* wait_mutex;
+	volatile uint32_t done;
+	ohmd_device* device;
+
+	ohmd_open_request* next; // in ohmd_context->open_requests
 };
 
 struct ohmd_device {
@@ -99,43 +182,171 @@ struct ohmd_device {
 	void (*update)(ohmd_device* device);
 	void (*close)(ohmd_device* device);
 
+	// optional, returns a file descriptor that becomes readable when update has new data to process, or -1
+	int (*get_fd)(ohmd_device* device);
+
+	// Optional, drains the device and pushes the IMU samples to the samples
+	// queue, then update only has to consume the queue. Runs on its own thread
+	// with a pipelined update, right before update otherwise. Must not touch
+	// any state that update uses, except for the queue.
+	void (*read)(ohmd_device* device);
+	sample_queue* samples;
+
+	// Optional, for getting a device back after its link dropped, see
+	// ohmd_device_lost. reopen runs on a thread of its own with no lock held
+	// and must not touch the driver state, it returns a new link to the
+	// device (typically an ohmd_hid_device) or NULL if it's not back yet.
+	// resume then swaps it in and sets the device up again, with both
+	// read_mutex and mutex held. Everything else, the fusion state in
+	// particular, stays as it was.
+	void* (*reopen)(ohmd_device* device);
+	void (*resume)(ohmd_device* device, void* link);
+
+	volatile uint32_t lost; // set while the device is being reconnected
+	volatile uint32_t reconnect_quit;
+	ohmd_thread* reconnect_thread;
+
 	ohmd_context* ctx;
 
 	ohmd_device_settings settings;
 
-	int active_device_idx; // index into ohmd_device->active_devices[]
+	int active_device_idx; // index into ohmd_context->active_devices[]
+	int update_worker; // index into ohmd_context->update_workers[]
+
+	// held by the reader thread while read runs, see OHMD_ICS_PIPELINED_UPDATE
+	ohmd_mutex* read_mutex;
+
+	// Guards the driver state, update and the driver callbacks run with it held.
+	// The thread that updates the device takes it while holding the context's
+	// update_mutex and takes update_mutex again to publish. Nobody else holds
+	// both at once, so the two orders can't deadlock.
+	ohmd_mutex* mutex;
+
+	// set by drivers that feed ofusion_update, used for pose prediction
+	fusion* sensor_fusion;
 
 	quatf rotation;
 	vec3f position;
+
+	// last published pose, guarded by the pose_seq seqlock (see ohmd_publish_pose)
+	volatile uint32_t pose_seq;
+	ohmd_pose pose;
+
+	// eye matrices of the latest generation asked for, guarded by the
+	// eye_cache_seq seqlock, eye_cache_lock picks a single writer
+	volatile uint32_t eye_cache_seq;
+	volatile uint32_t eye_cache_lock;
+	ohmd_eye_matrices eye_cache;
 };
 
 
 struct ohmd_context {
-	ohmd_driver* drivers[16];
-	int num_drivers;
+	ohmd_driver** drivers;
+	int num_drivers, drivers_capacity;
 
 	ohmd_device_list list;
 
-	ohmd_device* active_devices[256];
-	int num_active_devices;
+	// Unordered, a closed device is replaced by the last one. It's moved
+	// when it grows, so the threads copy the devices they pick for a round
+	// to arrays of their own before unlocking the update mutex.
+	ohmd_device** active_devices;
+	int num_active_devices, active_devices_capacity;
 
-	ohmd_thread* update_thread;
+	// guards the list of active devices, poses are published with it held
 	ohmd_mutex* update_mutex;
 
+	// the devices ohmd_ctx_update picked
+	ohmd_device** manual_devices;
+	int manual_devices_capacity;
+
+	ohmd_update_worker update_workers[OHMD_MAX_UPDATE_WORKERS];
+	int num_update_workers; // running workers
+	int update_worker_count; // setting, see OHMD_ICS_UPDATE_WORKERS
+	int next_update_worker;
+
 	bool update_request_quit;
+	bool update_event_driven;
+	bool update_pipelined;
+
+	// runs the read stage of all devices with a pipelined update
+	ohmd_thread* reader_thread;
+	ohmd_poller* reader_poller;
+	ohmd_device** reader_devices;
+	uint32_t* reader_heads;
+	int reader_devices_capacity, reader_heads_capacity;
+
+	ohmd_thread_settings thread_settings; // requested, see OHMD_ICS_THREAD_*
+	ohmd_thread_settings thread_settings_in_effect; // of the last started update or reader thread
 
 	uint64_t monotonic_ticks_per_sec;
+	ohmd_clock* clock; // NULL for the system clock, see ohmd_ctx_set_clock
+
+	// what the drivers reach their HID devices through, see hid.h
+	ohmd_hid_transport* hid_transport;
+	ohmd_hid_transport* hid_default_transport; // set up for the context, see ohmd_hid_init
+	ohmd_hid_capture* hid_capture; // wraps the transport when capturing, see capture.h
+	ohmd_hid_device_info* hid_devices; // found by the last probe, see ohmd_hid_probe
+	ohmd_hid_transport* hid_devices_transport;
+
+	// Guards the list of open requests and the counts of opens in progress,
+	// and serializes starting and stopping the update threads.
+	ohmd_mutex* open_mutex;
+	ohmd_open_request* open_requests;
+	int num_pending_opens; // not through open_device yet
+	int num_opening; // in open_device
+	bool opening_exclusive;
+
+	bool probing;
+	uint32_t probe_device_classes; // see OHMD_ICS_PROBE_*
+	unsigned short probe_vendor_ids[OHMD_MAX_PROBE_VENDORS];
+
+	ohmd_device_cache_mode device_cache; // see cache.h
+
+	// The changes of the device list not returned yet. The list is only
+	// brought up to date once they are all out.
+	ohmd_hotplug_monitor* hotplug;
+	bool hotplug_pending; // look at the devices even if the monitor saw no change
+	ohmd_hotplug_event* hotplug_events;
+	int num_hotplug_events, next_hotplug_event, hotplug_events_capacity;
 
 	char error_msg[OHMD_STR_SIZE];
 };
 
 // helper functions
+
+// Makes room for count elements of size bytes in the array at *array,
+// which has room for *capacity of them, growing it by half again or more
+// so that adding one at a time is amortized O(1). False if out of memory,
+// the array is left as it was then.
+bool ohmd_reserve(void* array, int* capacity, int count, size_t size);
+
+bool ohmd_add_driver(ohmd_context* ctx, ohmd_driver* driver);
+
+void ohmd_seqlock_write_begin(volatile uint32_t* seq);
+void ohmd_seqlock_write_end(volatile uint32_t* seq);
+uint32_t ohmd_seqlock_read_begin(volatile uint32_t* seq);
+bool ohmd_seqlock_read_retry(volatile uint32_t* seq, uint32_t start);
+void ohmd_publish_pose(ohmd_device* device);
+void ohmd_read_pose(ohmd_device* device, ohmd_pose* pose);
 void ohmd_monotonic_init(ohmd_context* ctx);
 uint64_t ohmd_monotonic_get(ohmd_context* ctx);
 uint64_t ohmd_monotonic_per_sec(ohmd_context* ctx);
 uint64_t ohmd_monotonic_conv(uint64_t ticks, uint64_t srcTicksPerSecond, uint64_t dstTicksPerSecond);
+
+// Makes everything timed by the context (drivers, update threads, pose and
+// capture timestamps) use clock, e.g. a virtual clock to run tests, replays
+// and soak benchmarks faster than real time. Set it before opening devices,
+// the clock isn't owned by the context and has to outlive it.
+void ohmd_ctx_set_clock(ohmd_context* ctx, ohmd_clock* clock);
+void ohmd_ctx_sleep(ohmd_context* ctx, double seconds);
 void ohmd_set_default_device_properties(ohmd_device_properties* props);
 void ohmd_calc_default_proj_matrices(ohmd_device_properties* props);
+// Called by drivers from their read path when the device stopped
+// responding (a USB reset or unplug). The device isn't read or updated
+// until reopen brings it back, which is tried in the background. Does
+// nothing if the driver can't reopen or the device is lost already.
+void ohmd_device_lost(ohmd_device* device);
+
 void ohmd_set_universal_distortion_k(ohmd_device_properties* props, float a, float b, float c, float d);
 void ohmd_set_universal_aberration_k(ohmd_device_properties* props, float r, float g, float b);
 
@@ -147,11 +358,10 @@ ohmd_driver* ohmd_create_htc_vive_drv(ohmd_context* ctx);
 ohmd_driver* ohmd_create_wmr_drv(ohmd_context* ctx);
 ohmd_driver* ohmd_create_psvr_drv(ohmd_context* ctx);
 ohmd_driver* ohmd_create_nolo_drv(ohmd_context* ctx);
+ohmd_driver* ohmd_create_replay_drv(ohmd_context* ctx);
 ohmd_driver* ohmd_create_external_drv(ohmd_context* ctx);
 ohmd_driver* ohmd_create_android_drv(ohmd_context* ctx);
 
 #include "log.h"
-#include "omath.h"
-#include "fusion.h"
 
 #endif
@@ -15,11 +15,23 @@
 
 #define _POSIX_C_SOURCE 199309L
 
+#ifdef __linux__
+// pthread_setaffinity_np
+#define _GNU_SOURCE
+#endif
+
 #include <time.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
 
 #include "platform.h"
 #include "openhmdi.h"
@@ -52,6 +64,9 @@ void ohmd_monotonic_init(ohmd_context* ctx)
 
 uint64_t ohmd_monotonic_get(ohmd_context* ctx)
 {
+	if(ctx->clock)
+		return (uint64_t)(ohmd_clock_get_tick(ctx->clock) * ctx->monotonic_ticks_per_sec);
+
 	struct timeval now;
 	gettimeofday(&now, NULL);
 	return now.tv_sec * NUM_1_000_000 + now.tv_usec;
@@ -77,6 +92,9 @@ void ohmd_monotonic_init(ohmd_context* ctx)
 
 uint64_t ohmd_monotonic_get(ohmd_context* ctx)
 {
+	if(ctx->clock)
+		return (uint64_t)(ohmd_clock_get_tick(ctx->clock) * ctx->monotonic_ticks_per_sec);
+
 	struct timespec now;
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
@@ -113,6 +131,56 @@ static void* pthread_wrapper(void* arg)
 	return NULL;
 }
 
+void ohmd_apply_thread_settings(ohmd_context* ctx, ohmd_thread* thread, ohmd_thread_settings* in_effect)
+{
+	const ohmd_thread_settings* settings = &ctx->thread_settings;
+	*in_effect = (ohmd_thread_settings){ OHMD_SCHED_NORMAL, 0, 0, false };
+
+	if(settings->sched_policy != OHMD_SCHED_NORMAL){
+		int policy = settings->sched_policy == OHMD_SCHED_RR ? SCHED_RR : SCHED_FIFO;
+		struct sched_param param;
+
+		param.sched_priority = OHMD_MAX(sched_get_priority_min(policy),
+			OHMD_MIN(settings->sched_priority, sched_get_priority_max(policy)));
+
+		int ret = pthread_setschedparam(thread->thread, policy, &param);
+		if(ret == 0){
+			in_effect->sched_policy = settings->sched_policy;
+			in_effect->sched_priority = param.sched_priority;
+		}else{
+			LOGW("could not set real-time scheduling for thread: %s", strerror(ret));
+		}
+	}
+
+	if(settings->cpu_affinity){
+#ifdef __linux__
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+
+		for(int i = 0; i < 32; i++){
+			if(settings->cpu_affinity & (1u << i))
+				CPU_SET(i, &cpus);
+		}
+
+		int ret = pthread_setaffinity_np(thread->thread, sizeof(cpus), &cpus);
+		if(ret == 0)
+			in_effect->cpu_affinity = settings->cpu_affinity;
+		else
+			LOGW("could not set cpu affinity for thread: %s", strerror(ret));
+#else
+		LOGW("cpu affinity is not supported on this platform");
+#endif
+	}
+
+	if(settings->lock_memory){
+		// also covers the stack of the new thread
+		if(mlockall(MCL_CURRENT) == 0)
+			in_effect->lock_memory = true;
+		else
+			LOGW("could not lock memory: %s", strerror(errno));
+	}
+}
+
 ohmd_thread* ohmd_create_thread(ohmd_context* ctx, unsigned int (*routine)(void* arg), void* arg)
 {
 	ohmd_thread* thread = ohmd_alloc(ctx, sizeof(ohmd_thread));
@@ -126,7 +194,7 @@ ohmd_thread* ohmd_create_thread(ohmd_context* ctx, unsigned int (*routine)(void*
 
 	if(ret != 0){
 		free(thread);
-		thread = NULL;
+		return NULL;
 	}
 
 	return thread;
@@ -172,6 +240,147 @@ void ohmd_unlock_mutex(ohmd_mutex* mutex)
 		pthread_mutex_unlock((pthread_mutex_t*)mutex);
 }
 
+// atomics
+uint32_t ohmd_atomic_load(volatile uint32_t* value)
+{
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+void ohmd_atomic_store(volatile uint32_t* value, uint32_t new_value)
+{
+	__atomic_store_n(value, new_value, __ATOMIC_SEQ_CST);
+}
+
+uint32_t ohmd_atomic_add(volatile uint32_t* value, uint32_t add)
+{
+	return __atomic_add_fetch(value, add, __ATOMIC_SEQ_CST);
+}
+
+void ohmd_memory_barrier(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// file descriptor polling
+#define POLLER_MAX_FDS 64
+
+struct ohmd_poller
+{
+	int wake_fds[2]; // self-pipe, [0] is polled, [1] is written to on wake up
+};
+
+ohmd_poller* ohmd_create_poller(ohmd_context* ctx)
+{
+	ohmd_poller* poller = ohmd_alloc(ctx, sizeof(ohmd_poller));
+	if(poller == NULL)
+		return NULL;
+
+	if(pipe(poller->wake_fds) != 0){
+		free(poller);
+		return NULL;
+	}
+
+	for(int i = 0; i < 2; i++){
+		fcntl(poller->wake_fds[i], F_SETFL, fcntl(poller->wake_fds[i], F_GETFL) | O_NONBLOCK);
+		fcntl(poller->wake_fds[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	return poller;
+}
+
+void ohmd_destroy_poller(ohmd_poller* poller)
+{
+	close(poller->wake_fds[0]);
+	close(poller->wake_fds[1]);
+	free(poller);
+}
+
+int ohmd_poller_wait(ohmd_poller* poller, const int* fds, bool* ready, int num_fds, double timeout)
+{
+	struct pollfd pfds[POLLER_MAX_FDS + 1];
+
+	if(num_fds > POLLER_MAX_FDS)
+		return -1;
+
+	pfds[0].fd = poller->wake_fds[0];
+	pfds[0].events = POLLIN;
+
+	for(int i = 0; i < num_fds; i++){
+		pfds[i + 1].fd = fds[i];
+		pfds[i + 1].events = POLLIN;
+		ready[i] = false;
+	}
+
+	int ret = poll(pfds, num_fds + 1, timeout < 0 ? -1 : (int)(timeout * 1000.0 + 0.5));
+	if(ret <= 0)
+		return 0;
+
+	// drain pending wake ups
+	if(pfds[0].revents & POLLIN){
+		char buf[16];
+		while(read(poller->wake_fds[0], buf, sizeof(buf)) > 0);
+	}
+
+	int num_ready = 0;
+	for(int i = 0; i < num_fds; i++){
+		if(pfds[i + 1].revents & (POLLIN | POLLERR | POLLHUP)){
+			ready[i] = true;
+			num_ready++;
+		}
+	}
+
+	return num_ready;
+}
+
+void ohmd_poller_wake(ohmd_poller* poller)
+{
+	char c = 0;
+	if(write(poller->wake_fds[1], &c, 1) < 0){
+		// the pipe is full, the poller will wake up anyway
+	}
+}
+
+static bool make_dir(const char* path)
+{
+	return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+bool ohmd_get_cache_dir(char* path, size_t size)
+{
+	const char* dir = getenv("OHMD_CACHE_DIR");
+	if(dir && *dir){
+		if((size_t)snprintf(path, size, "%s", dir) >= size)
+			return false;
+
+		return make_dir(path);
+	}
+
+	// $XDG_CACHE_HOME/openhmd, falling back to ~/.cache/openhmd
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	int len;
+
+	if(xdg && *xdg)
+		len = snprintf(path, size, "%s", xdg);
+	else if(home && *home)
+		len = snprintf(path, size, "%s/.cache", home);
+	else
+		return false;
+
+	if(len < 0 || (size_t)len >= size || !make_dir(path))
+		return false;
+
+	if((size_t)snprintf(path + len, size - len, "/openhmd") >= size - len)
+		return false;
+
+	return make_dir(path);
+}
+
+bool ohmd_rename_file(const char* from, const char* to)
+{
+	return rename(from, to) == 0;
+}
+
 /// Handling ovr service
 void ohmd_toggle_ovr_service(int state) //State is 0 for Disable, 1 for Enable
 {
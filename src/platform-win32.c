@@ -39,6 +39,9 @@ void ohmd_monotonic_init(ohmd_context* ctx)
 
 uint64_t ohmd_monotonic_get(ohmd_context* ctx)
 {
+	if(ctx->clock)
+		return (uint64_t)(ohmd_clock_get_tick(ctx->clock) * ctx->monotonic_ticks_per_sec);
+
 	FILETIME filetime;
 	GetSystemTimeAsFileTime(&filetime);
 
@@ -69,6 +72,35 @@ DWORD __stdcall ohmd_thread_wrapper(void* t)
 	return thread->routine(thread->arg);
 }
 
+void ohmd_apply_thread_settings(ohmd_context* ctx, ohmd_thread* thread, ohmd_thread_settings* in_effect)
+{
+	const ohmd_thread_settings* settings = &ctx->thread_settings;
+	*in_effect = (ohmd_thread_settings){ OHMD_SCHED_NORMAL, 0, 0, false };
+
+	if(!thread->handle)
+		return;
+
+	// there are no real-time policies, the closest is the highest priority
+	if(settings->sched_policy != OHMD_SCHED_NORMAL){
+		if(SetThreadPriority(thread->handle, THREAD_PRIORITY_TIME_CRITICAL)){
+			in_effect->sched_policy = settings->sched_policy;
+			in_effect->sched_priority = settings->sched_priority;
+		}else{
+			LOGW("could not raise thread priority (%lu)", GetLastError());
+		}
+	}
+
+	if(settings->cpu_affinity){
+		if(SetThreadAffinityMask(thread->handle, settings->cpu_affinity))
+			in_effect->cpu_affinity = settings->cpu_affinity;
+		else
+			LOGW("could not set cpu affinity for thread (%lu)", GetLastError());
+	}
+
+	if(settings->lock_memory)
+		LOGW("locking memory is not supported on this platform");
+}
+
 ohmd_thread* ohmd_create_thread(ohmd_context* ctx, unsigned int (*routine)(void* arg), void* arg)
 {
 	ohmd_thread* thread = ohmd_alloc(ctx, sizeof(ohmd_thread));
@@ -120,6 +152,64 @@ void ohmd_unlock_mutex(ohmd_mutex* mutex)
 		ReleaseMutex(mutex->handle);
 }
 
+// atomics
+uint32_t ohmd_atomic_load(volatile uint32_t* value)
+{
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+}
+
+void ohmd_atomic_store(volatile uint32_t* value, uint32_t new_value)
+{
+	InterlockedExchange((volatile LONG*)value, (LONG)new_value);
+}
+
+uint32_t ohmd_atomic_add(volatile uint32_t* value, uint32_t add)
+{
+	return (uint32_t)InterlockedExchangeAdd((volatile LONG*)value, (LONG)add) + add;
+}
+
+void ohmd_memory_barrier(void)
+{
+	MemoryBarrier();
+}
+
+// there is no generic way to wait on hidapi handles on Windows, so the poller
+// only supports being woken up and returns -1 when asked to wait on fds.
+struct ohmd_poller {
+	HANDLE event;
+};
+
+ohmd_poller* ohmd_create_poller(ohmd_context* ctx)
+{
+	ohmd_poller* poller = ohmd_alloc(ctx, sizeof(ohmd_poller));
+	if(!poller)
+		return NULL;
+
+	poller->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	return poller;
+}
+
+void ohmd_destroy_poller(ohmd_poller* poller)
+{
+	CloseHandle(poller->event);
+	free(poller);
+}
+
+int ohmd_poller_wait(ohmd_poller* poller, const int* fds, bool* ready, int num_fds, double timeout)
+{
+	if(num_fds > 0)
+		return -1;
+
+	WaitForSingleObject(poller->event, timeout < 0 ? INFINITE : (DWORD)(timeout * 1000));
+	return 0;
+}
+
+void ohmd_poller_wake(ohmd_poller* poller)
+{
+	SetEvent(poller->event);
+}
+
 int findEndPoint(char* path, int endpoint)
 {
 	char comp[8];
@@ -132,6 +222,30 @@ int findEndPoint(char* path, int endpoint)
 	return 0;
 }
 
+bool ohmd_get_cache_dir(char* path, size_t size)
+{
+	const char* dir = getenv("OHMD_CACHE_DIR");
+	const char* local = getenv("LOCALAPPDATA");
+	int len;
+
+	if(dir && *dir)
+		len = snprintf(path, size, "%s", dir);
+	else if(local && *local)
+		len = snprintf(path, size, "%s\\OpenHMD", local);
+	else
+		return false;
+
+	if(len < 0 || (size_t)len >= size)
+		return false;
+
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+bool ohmd_rename_file(const char* from, const char* to)
+{
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
 /// Handling ovr service
 static int _enable_ovr_service = 0;
 
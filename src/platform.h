@@ -10,12 +10,40 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "openhmd.h"
 
 double ohmd_get_tick();
 void ohmd_sleep(double seconds);
 void ohmd_toggle_ovr_service(int state);
 
+/* Clocks */
+
+// A context reads the time from its clock, the monotonic system clock of
+// ohmd_get_tick and ohmd_sleep unless another one is set with
+// ohmd_ctx_set_clock.
+typedef struct ohmd_clock ohmd_clock;
+
+struct ohmd_clock {
+	double (*get_tick)(ohmd_clock* clock);
+	void (*sleep)(ohmd_clock* clock, double seconds);
+};
+
+// a NULL clock is the system clock
+double ohmd_clock_get_tick(ohmd_clock* clock);
+void ohmd_clock_sleep(ohmd_clock* clock, double seconds);
+
+// A clock running speed times as fast as the system clock, starting at 0.
+// With a speed of 0 it's simulated: time only passes by sleeping on it or
+// through ohmd_virtual_clock_advance, and sleeping returns right away, so a
+// run driven from one thread gives the same results every time.
+ohmd_clock* ohmd_create_virtual_clock(ohmd_context* ctx, double speed);
+void ohmd_destroy_virtual_clock(ohmd_clock* clock);
+void ohmd_virtual_clock_advance(ohmd_clock* clock, double seconds);
+
 typedef struct ohmd_thread ohmd_thread;
 typedef struct ohmd_mutex ohmd_mutex;
 
@@ -28,6 +56,49 @@ void ohmd_unlock_mutex(ohmd_mutex* mutex);
 ohmd_thread* ohmd_create_thread(ohmd_context* ctx, unsigned int (*routine)(void* arg), void* arg);
 void ohmd_destroy_thread(ohmd_thread* thread);
 
+typedef struct {
+	ohmd_sched_policy sched_policy;
+	int sched_priority;
+	uint32_t cpu_affinity; // one bit per CPU, 0 for no pinning
+	bool lock_memory;
+} ohmd_thread_settings;
+
+// Applies the context's thread settings to a thread, as far as the privileges
+// of the process allow, and stores what could be applied in in_effect. Only
+// for the threads doing the tracking, the others keep normal scheduling.
+void ohmd_apply_thread_settings(ohmd_context* ctx, ohmd_thread* thread, ohmd_thread_settings* in_effect);
+
+/* Waiting for device file descriptors */
+
+typedef struct ohmd_poller ohmd_poller;
+
+ohmd_poller* ohmd_create_poller(ohmd_context* ctx);
+void ohmd_destroy_poller(ohmd_poller* poller);
+
+// Blocks until one of fds is readable, ohmd_poller_wake is called or timeout seconds
+// have passed (a negative timeout waits forever). Sets ready[i] for every readable fd.
+// Returns the number of ready fds, 0 on timeout or wake up, and -1 if the platform
+// can't wait on file descriptors (the caller should fall back to polling).
+int ohmd_poller_wait(ohmd_poller* poller, const int* fds, bool* ready, int num_fds, double timeout);
+void ohmd_poller_wake(ohmd_poller* poller);
+
+/* Atomic operations, all of them act as full memory barriers */
+
+uint32_t ohmd_atomic_load(volatile uint32_t* value);
+void ohmd_atomic_store(volatile uint32_t* value, uint32_t new_value);
+uint32_t ohmd_atomic_add(volatile uint32_t* value, uint32_t add); // returns the new value
+void ohmd_memory_barrier(void);
+
+/* Files */
+
+// The directory the library keeps its cache files in, created if needed: the
+// OHMD_CACHE_DIR environment variable if set, the user's cache directory
+// otherwise. Returns false if there is none or it can't be created.
+bool ohmd_get_cache_dir(char* path, size_t size);
+
+// Moves from over to, replacing it
+bool ohmd_rename_file(const char* from, const char* to);
+
 /* String functions */
 
 int findEndPoint(char* path, int endpoint);
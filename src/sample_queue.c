@@ -0,0 +1,63 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* IMU Sample Queue Implementation */
+
+#include <string.h>
+#include "openhmdi.h"
+
+void osq_init(sample_queue* me)
+{
+	memset(me, 0, sizeof(sample_queue));
+}
+
+bool osq_push(sample_queue* me, const imu_sample* sample)
+{
+	uint32_t head = me->head;
+
+	if(head - ohmd_atomic_load(&me->tail) == SAMPLE_QUEUE_SIZE){
+		me->dropped_dt += sample->dt;
+		ohmd_atomic_add(&me->dropped, 1);
+		return false;
+	}
+
+	imu_sample* slot = &me->samples[head & (SAMPLE_QUEUE_SIZE - 1)];
+	*slot = *sample;
+	slot->dt += me->dropped_dt;
+	me->dropped_dt = 0;
+
+	// publish the sample after it's been written
+	ohmd_atomic_store(&me->head, head + 1);
+
+	return true;
+}
+
+bool osq_pop(sample_queue* me, imu_sample* sample)
+{
+	uint32_t tail = me->tail;
+
+	if(ohmd_atomic_load(&me->head) == tail)
+		return false;
+
+	*sample = me->samples[tail & (SAMPLE_QUEUE_SIZE - 1)];
+
+	// hand the slot back after it's been read
+	ohmd_atomic_store(&me->tail, tail + 1);
+
+	return true;
+}
+
+int osq_get_size(sample_queue* me)
+{
+	uint32_t tail = ohmd_atomic_load(&me->tail);
+	return (int)(ohmd_atomic_load(&me->head) - tail);
+}
+
+uint32_t osq_get_dropped(sample_queue* me)
+{
+	return ohmd_atomic_load(&me->dropped);
+}
@@ -0,0 +1,54 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* IMU Sample Queue */
+
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "omath.h"
+
+// Must be a power of two
+#define SAMPLE_QUEUE_SIZE 1024
+
+typedef struct {
+	double time;   // host time the sample was read, see ohmd_get_tick()
+	float dt;      // time since the previous sample on the sensor clock
+	vec3f ang_vel;
+	vec3f accel;
+	vec3f mag;
+} imu_sample;
+
+// Lock-free queue between exactly one producer and one consumer thread.
+//
+// When the queue is full new samples are dropped, the producer can't make room
+// without racing the consumer. The dt of dropped samples is added to the next
+// sample that fits, so that the integrated sensor time stays continuous.
+typedef struct {
+	imu_sample samples[SAMPLE_QUEUE_SIZE];
+	volatile uint32_t head; // next slot to write, only changed by the producer
+	volatile uint32_t tail; // next slot to read, only changed by the consumer
+
+	volatile uint32_t dropped; // number of samples dropped since osq_init
+	float dropped_dt;          // dt of the samples dropped since the last push
+} sample_queue;
+
+void osq_init(sample_queue* me);
+
+// producer side, returns false if the sample was dropped
+bool osq_push(sample_queue* me, const imu_sample* sample);
+
+// consumer side, returns false if the queue is empty
+bool osq_pop(sample_queue* me, imu_sample* sample);
+
+// safe to call from any thread
+int osq_get_size(sample_queue* me);
+uint32_t osq_get_dropped(sample_queue* me);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Benchmarks - Internal Interface */
+
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "openhmdi.h"
+#include "hid_mock.h"
+
+#define BAssert(_v) if(!(_v)){ printf("\nbenchmark failed: %s @ %s:%d\n", __func__, __FILE__, __LINE__); exit(1); }
+
+// seconds of CPU time used by the whole process
+double bench_cpu_time();
+
+// scripts a mock DK2 streaming at rate reports per second, 0 for as fast as it's read
+void bench_mock_rift_dk2(ohmd_hid_mock_device* dev, double rate);
+
+// update loop benchmarks
+void bench_update_loop_polled();
+void bench_update_loop_event_driven();
+void bench_update_loop_slow_device_one_worker();
+void bench_update_loop_slow_device_two_workers();
+void bench_update_loop_stall_inline();
+void bench_update_loop_stall_pipelined();
+
+// getter benchmarks
+void bench_getf_eye_matrices_new_pose();
+void bench_getf_eye_matrices_same_pose();
+
+// HID report reading benchmarks
+void bench_hid_read_hidapi_libusb();
+void bench_hid_read_hidapi_hidraw();
+void bench_hid_read_ohmd_hidraw();
+
+// driver update benchmarks
+void bench_driver_update_rift_dk2();
+void bench_driver_soak_rift_dk2();
+
+// probe benchmarks
+void bench_probe_busy_bus();
+void bench_open_sequential();
+void bench_open_async();
+void bench_open_cached();
+
+// sensor fusion benchmarks
+void bench_fusion_default();
+void bench_fusion_eskf();
+void bench_fusion_mahony();
+void bench_fusion_batched();
+void bench_fusion_group();
+
+#endif
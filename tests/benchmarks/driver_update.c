@@ -0,0 +1,167 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Benchmarks - Driver update throughput on the mock HID transport */
+
+#include <string.h>
+#include "benchmarks.h"
+
+#define UPDATE_REPORTS 500000
+#define SOAK_SECONDS 60.0
+#define SOAK_SPEED 100.0
+
+#define WRITE16(_buf, _val) (_buf)[0] = (_val) & 0xff; (_buf)[1] = ((_val) >> 8) & 0xff;
+#define WRITE32(_buf, _val) WRITE16(_buf, (_val) & 0xffff); WRITE16((_buf) + 2, ((_val) >> 16) & 0xffff);
+
+// Advances the DK2 timestamp (in microseconds) as a 1 kHz IMU would.
+static void advance_dk2_timestamp(unsigned char* report, size_t size, uint64_t index, void* user_data)
+{
+	uint32_t timestamp = (uint32_t)(index * 1000);
+	WRITE32(report + 8, timestamp);
+}
+
+void bench_mock_rift_dk2(ohmd_hid_mock_device* dev, double rate)
+{
+	// sensor range
+	unsigned char range[8] = { 4 };
+	range[3] = 4; // accel
+	WRITE16(range + 4, 250); // gyro
+	WRITE16(range + 6, 1000); // mag
+	ohmd_hid_mock_set_feature_report(dev, range, sizeof(range));
+
+	// display info, no distortion data
+	unsigned char display_info[56] = { 9 };
+	WRITE16(display_info + 4, 1920);
+	WRITE16(display_info + 6, 1080);
+	ohmd_hid_mock_set_feature_report(dev, display_info, sizeof(display_info));
+
+	// sensor config, 1 kHz with a 10 s keep alive
+	unsigned char config[7] = { 2 };
+	config[4] = 0;
+	WRITE16(config + 5, 10000);
+	ohmd_hid_mock_set_feature_report(dev, config, sizeof(config));
+
+	// one sample per report, slowly rotating
+	unsigned char report[64] = { 11 };
+	report[3] = 1;
+	report[12] = 0x00; report[13] = 0x40; // accel y
+	report[20] = 0x00; report[21] = 0x01; // gyro
+	ohmd_hid_mock_set_reports(dev, report, sizeof(report), 1, rate, -1);
+	ohmd_hid_mock_set_report_callback(dev, advance_dk2_timestamp, NULL);
+}
+
+static int find_rift_dk2(ohmd_context* ctx)
+{
+	// keep the mock out of the user's device cache
+	int cache = OHMD_DEVICE_CACHE_OFF;
+	ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &cache);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	for(int i = 0; i < num_devices; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PRODUCT), "Rift (DK2)") == 0)
+			return i;
+	}
+
+	printf("      rift driver not available\n");
+	return -1;
+}
+
+void bench_driver_update_rift_dk2()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+
+	ohmd_hid_mock_device* mdev = ohmd_hid_mock_add_device(mock, "mock-dk2", 0x2833, 0x0021, 0,
+		"Oculus VR, Inc.", "Rift DK2", "DK2MOCK");
+	BAssert(mdev);
+	bench_mock_rift_dk2(mdev, 0);
+
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	int idx = find_rift_dk2(ctx);
+	if(idx == -1){
+		ohmd_ctx_destroy(ctx);
+		ohmd_hid_mock_destroy(mock);
+		return;
+	}
+
+	ohmd_device_settings* settings = ohmd_device_settings_create(ctx);
+	int auto_update = 0;
+	ohmd_device_settings_seti(settings, OHMD_IDS_AUTOMATIC_UPDATE, &auto_update);
+
+	ohmd_device* device = ohmd_list_open_device_s(ctx, idx, settings);
+	ohmd_device_settings_destroy(settings);
+	BAssert(device);
+
+	ohmd_hid_mock_stats stats;
+	int updates = 0;
+	double start = ohmd_get_tick();
+	do {
+		ohmd_ctx_update(ctx);
+		ohmd_hid_mock_get_stats(mdev, &stats);
+		updates++;
+	} while(stats.reports_read < UPDATE_REPORTS);
+	double elapsed = ohmd_get_tick() - start;
+
+	float quat[4];
+	BAssert(ohmd_device_getf(device, OHMD_ROTATION_QUAT, quat) == 0);
+
+	printf("      %llu reports in %d updates, %.0f ns per report, %.0f reports/s\n",
+		(unsigned long long)stats.reports_read, updates,
+		elapsed / stats.reports_read * 1e9, stats.reports_read / elapsed);
+
+	ohmd_close_device(device);
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+// A minute of a 1 kHz DK2 on the automatic update thread, run on a clock
+// SOAK_SPEED times as fast as real time.
+void bench_driver_soak_rift_dk2()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_clock* clock = ohmd_create_virtual_clock(ctx, SOAK_SPEED);
+	BAssert(clock);
+	ohmd_ctx_set_clock(ctx, clock);
+
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_set_clock(mock, clock);
+
+	ohmd_hid_mock_device* mdev = ohmd_hid_mock_add_device(mock, "mock-dk2", 0x2833, 0x0021, 0,
+		"Oculus VR, Inc.", "Rift DK2", "DK2MOCK");
+	BAssert(mdev);
+	bench_mock_rift_dk2(mdev, 1000.0);
+
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	int idx = find_rift_dk2(ctx);
+	if(idx == -1){
+		ohmd_ctx_destroy(ctx);
+		ohmd_hid_mock_destroy(mock);
+		ohmd_destroy_virtual_clock(clock);
+		return;
+	}
+
+	double start = ohmd_get_tick();
+	ohmd_device* device = ohmd_list_open_device(ctx, idx);
+	BAssert(device);
+
+	ohmd_ctx_sleep(ctx, SOAK_SECONDS);
+
+	ohmd_hid_mock_stats stats;
+	ohmd_hid_mock_get_stats(mdev, &stats);
+
+	ohmd_close_device(device);
+	double elapsed = ohmd_get_tick() - start;
+
+	printf("      %.0f s simulated in %.2f s, %llu reports read, %llu dropped\n",
+		SOAK_SECONDS, elapsed, (unsigned long long)stats.reports_read, (unsigned long long)stats.reports_dropped);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+	ohmd_destroy_virtual_clock(clock);
+}
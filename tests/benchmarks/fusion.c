@@ -0,0 +1,228 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Benchmarks - Sensor Fusion */
+
+#include <stdlib.h>
+#include "benchmarks.h"
+#include "fusion_group.h"
+
+#define RATE 1000
+#define SAMPLES (60 * RATE)
+
+typedef struct {
+	const char* name;
+	float rate;   // peak angular velocity, rad/s
+	float motion; // peak linear acceleration, m/s^2
+	vec3f* gyro;
+	vec3f* accel;
+	quatf* truth;
+} stream;
+
+// Every engine runs over the same streams, made up once
+static stream streams[] = {
+	{ "rest", 0, 0, NULL, NULL, NULL },
+	{ "head", 1.0f, 0.5f, NULL, NULL, NULL },
+	{ "fast", 6.0f, 1.5f, NULL, NULL, NULL },
+};
+
+#define NUM_STREAMS (int)(sizeof(streams) / sizeof(streams[0]))
+
+static float noise(uint32_t* seed, float amplitude)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return ((*seed >> 8) / (float)(1 << 24) - 0.5f) * 2.0f * amplitude;
+}
+
+// A minute of a device turning and being moved around at 1 kHz, from a gyro
+// with a constant bias and a little noise on both sensors
+static void make_stream(stream* s)
+{
+	const vec3f bias = {{0.01f, -0.02f, 0.015f}};
+	const vec3f gravity = {{0, 9.81f, 0}};
+	const vec3f tilt_axis = {{1, 0, 0.5f}};
+	uint32_t seed = 1;
+	quatf orient;
+
+	if(s->gyro)
+		return;
+
+	s->gyro = malloc(SAMPLES * sizeof(vec3f));
+	s->accel = malloc(SAMPLES * sizeof(vec3f));
+	s->truth = malloc(SAMPLES * sizeof(quatf));
+	BAssert(s->gyro && s->accel && s->truth);
+
+	oquatf_init_axis(&orient, &tilt_axis, 0.3f);
+
+	for(int i = 0; i < SAMPLES; i++){
+		float t = i / (float)RATE;
+		vec3f rate = {{0.7f * s->rate * sinf(2.0f * (float)M_PI * 0.3f * t),
+		               s->rate * sinf(2.0f * (float)M_PI * 0.2f * t),
+		               0.4f * s->rate * cosf(2.0f * (float)M_PI * 0.25f * t)}};
+
+		ofusion_predict(&orient, &rate, 1.0f / RATE, &orient);
+		oquatf_normalize_me(&orient);
+		s->truth[i] = orient;
+
+		vec3f world_accel = {{s->motion * sinf(2.0f * (float)M_PI * 1.1f * t),
+		                      gravity.y + 0.5f * s->motion * sinf(2.0f * (float)M_PI * 0.7f * t),
+		                      s->motion * cosf(2.0f * (float)M_PI * 0.9f * t)}};
+
+		quatf inv_orient = orient;
+		oquatf_inverse(&inv_orient);
+		oquatf_get_rotated(&inv_orient, &world_accel, &s->accel[i]);
+
+		for(int j = 0; j < 3; j++){
+			s->gyro[i].arr[j] = rate.arr[j] + bias.arr[j] + noise(&seed, 0.005f);
+			s->accel[i].arr[j] += noise(&seed, 0.2f);
+		}
+	}
+}
+
+// angle between where the filter and the truth think up is
+static float tilt_error(const quatf* orient, const quatf* truth)
+{
+	vec3f up = {{0, 1, 0}}, body_up, est_up;
+	quatf inv_truth = *truth;
+	oquatf_inverse(&inv_truth);
+
+	oquatf_get_rotated(&inv_truth, &up, &body_up);
+	oquatf_get_rotated(orient, &body_up, &est_up);
+
+	return ovec3f_get_angle(&up, &est_up);
+}
+
+// rotation of the filter's orientation from the truth around the up axis
+static float yaw_error(const quatf* orient, const quatf* truth)
+{
+	quatf inv_truth = *truth, diff;
+	oquatf_inverse(&inv_truth);
+	oquatf_mult(orient, &inv_truth, &diff);
+
+	return fabsf(2.0f * atan2f(diff.y, diff.w));
+}
+
+// Fuses the streams sample by sample, or in batches of batch_size if it's
+// more than one
+static void run(const ofusion_engine* engine, int batch_size)
+{
+	vec3f mag = {{0, 0, 0}};
+	ofusion_sample batch[FUSION_BATCH_SIZE];
+
+	if(batch_size > 1)
+		printf("    %s, %d samples a batch\n", engine->name, batch_size);
+
+	for(int i = 0; i < NUM_STREAMS; i++){
+		stream* s = &streams[i];
+		make_stream(s);
+
+		fusion f;
+		ofusion_init(&f);
+		BAssert(ofusion_set_engine(&f, engine));
+
+		double start = bench_cpu_time();
+
+		if(batch_size == 1){
+			for(int j = 0; j < SAMPLES; j++)
+				ofusion_update(&f, 1.0f / RATE, &s->gyro[j], &s->accel[j], &mag);
+		}else{
+			for(int j = 0; j + batch_size <= SAMPLES; j += batch_size){
+				for(int k = 0; k < batch_size; k++){
+					ofusion_sample sample = { 1.0f / RATE, s->gyro[j + k], s->accel[j + k], mag };
+					batch[k] = sample;
+				}
+
+				ofusion_update_batch(&f, batch, batch_size);
+			}
+		}
+
+		double elapsed = bench_cpu_time() - start;
+
+		printf("      %s: %.1f ns per sample, tilt error %.2f deg, yaw drift %.1f deg\n", s->name,
+			elapsed / SAMPLES * 1000000000.0,
+			RAD_TO_DEG(tilt_error(&f.orient, &s->truth[SAMPLES - 1])),
+			RAD_TO_DEG(yaw_error(&f.orient, &s->truth[SAMPLES - 1])));
+	}
+}
+
+void bench_fusion_default()
+{
+	run(&ofusion_engine_default, 1);
+}
+
+void bench_fusion_eskf()
+{
+	run(&ofusion_engine_eskf, 1);
+}
+
+void bench_fusion_mahony()
+{
+	run(&ofusion_engine_mahony, 1);
+}
+
+// batches of FUSION_BATCH_SIZE, as the drivers with queued samples fuse them
+void bench_fusion_batched()
+{
+	run(&ofusion_engine_default, FUSION_BATCH_SIZE);
+	run(&ofusion_engine_eskf, FUSION_BATCH_SIZE);
+	run(&ofusion_engine_mahony, FUSION_BATCH_SIZE);
+}
+
+// Many devices on one core, each with a fusion struct of its own and all in
+// one fusion_group. Every device reads the head stream from another point.
+void bench_fusion_group()
+{
+	stream* s = &streams[1];
+	vec3f mag = {{0, 0, 0}};
+	make_stream(s);
+
+	for(int count = 1; count <= 256; count *= 2){
+		int updates = OHMD_MAX(SAMPLES / 4, (1 << 20) / count);
+
+		fusion* devices = malloc(count * sizeof(fusion));
+		BAssert(devices);
+		for(int i = 0; i < count; i++)
+			ofusion_init(&devices[i]);
+
+		double start = bench_cpu_time();
+		for(int j = 0; j < updates; j++){
+			for(int i = 0; i < count; i++){
+				int k = (j + i * 97) % SAMPLES;
+				ofusion_update(&devices[i], 1.0f / RATE, &s->gyro[k], &s->accel[k], &mag);
+			}
+		}
+		double separate = bench_cpu_time() - start;
+
+		fusion_group group;
+		BAssert(ofusion_group_init(&group, count));
+
+		start = bench_cpu_time();
+		for(int j = 0; j < updates; j++){
+			for(int i = 0; i < count; i++){
+				int k = (j + i * 97) % SAMPLES;
+				ofusion_group_set_sample(&group, i, 1.0f / RATE, &s->gyro[k], &s->accel[k]);
+			}
+
+			ofusion_group_update(&group);
+		}
+		double grouped = bench_cpu_time() - start;
+
+		// both end up in the same place
+		quatf orient, diff;
+		ofusion_group_get_orient(&group, count - 1, &orient);
+		oquatf_diff(&orient, &devices[count - 1].orient, &diff);
+		vec3f axis = {{diff.x, diff.y, diff.z}};
+		BAssert(2.0f * ovec3f_get_length(&axis) < FUSION_GROUP_TOLERANCE);
+
+		double samples = (double)updates * count;
+		printf("      %3d devices: %.1f ns per sample separately, %.1f grouped, %.1fx\n", count,
+			separate / samples * 1000000000.0, grouped / samples * 1000000000.0, separate / grouped);
+
+		ofusion_group_free(&group);
+		free(devices);
+	}
+}
@@ -0,0 +1,74 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Benchmarks - Device getters */
+
+#include "benchmarks.h"
+
+#define FRAMES 200000
+
+static const ohmd_float_value frame_values[] = {
+	OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX,
+	OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX,
+	OHMD_LEFT_EYE_GL_PROJECTION_MATRIX,
+	OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX,
+};
+
+#define NUM_FRAME_VALUES (int)(sizeof(frame_values) / sizeof(frame_values[0]))
+
+// Queries all eye matrices the way a renderer does once per frame, optionally
+// changing the pose before every frame so that nothing can be reused
+static void run(bool new_pose)
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	BAssert(ctx);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	BAssert(num_devices > 0);
+
+	ohmd_device_settings* settings = ohmd_device_settings_create(ctx);
+	int auto_update = 0;
+	ohmd_device_settings_seti(settings, OHMD_IDS_AUTOMATIC_UPDATE, &auto_update);
+
+	// the dummy device is last
+	ohmd_device* hmd = ohmd_list_open_device_s(ctx, num_devices - 1, settings);
+	BAssert(hmd);
+	ohmd_device_settings_destroy(settings);
+
+	float mat[16], sum = 0;
+	double start = bench_cpu_time();
+
+	for(int i = 0; i < FRAMES; i++){
+		if(new_pose){
+			float ipd = 0.06f + (i & 1) * 0.001f;
+			ohmd_device_setf(hmd, OHMD_EYE_IPD, &ipd);
+		}
+
+		for(int j = 0; j < NUM_FRAME_VALUES; j++){
+			ohmd_device_getf(hmd, frame_values[j], mat);
+			sum += mat[12];
+		}
+	}
+
+	double elapsed = bench_cpu_time() - start;
+
+	printf("      frames:          %d\n", FRAMES);
+	printf("      time per getf:   %.1f ns\n", elapsed / (FRAMES * NUM_FRAME_VALUES) * 1000000000.0);
+	printf("      checksum:        %f\n", sum);
+
+	ohmd_ctx_destroy(ctx);
+}
+
+void bench_getf_eye_matrices_new_pose()
+{
+	run(true);
+}
+
+void bench_getf_eye_matrices_same_pose()
+{
+	run(false);
+}
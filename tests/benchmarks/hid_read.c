@@ -0,0 +1,311 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Benchmarks - HID report reading */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "benchmarks.h"
+
+#ifdef __linux__
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "hidraw.h"
+
+// A SOCK_SEQPACKET socketpair keeps report boundaries like a hidraw node does.
+// hidapi can't open anything but real devices, so its two Linux backends are
+// modelled after what they do per report:
+//  - libusb: a reader thread puts every report in a malloc'd node on a locked
+//    list, hid_read takes the lock and pops one
+//  - hidraw: hid_read polls the descriptor and then reads it
+// Neither exposes a descriptor, so the update loop has to poll them at 1 kHz.
+
+#define REPORT_SIZE 64
+#define THROUGHPUT_REPORTS 200000
+#define BATCH_REPORTS 64
+#define LATENCY_REPORTS 1000
+#define LATENCY_PERIOD (1.1 / 1000.0) // not a multiple of the polling interval
+#define POLL_INTERVAL (1.0 / 1000.0)
+
+typedef enum {
+	BACKEND_HIDAPI_LIBUSB,
+	BACKEND_HIDAPI_HIDRAW,
+	BACKEND_OHMD_HIDRAW,
+} backend;
+
+typedef struct report_node {
+	unsigned char data[REPORT_SIZE];
+	int size;
+	struct report_node* next;
+} report_node;
+
+typedef struct {
+	backend type;
+	int fd;
+	ohmd_hidraw_device* hidraw;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	report_node* head;
+	report_node* tail;
+} fake_device;
+
+static void* libusb_reader(void* arg)
+{
+	fake_device* dev = (fake_device*)arg;
+
+	while(true){
+		report_node* node = malloc(sizeof(report_node));
+		node->size = (int)read(dev->fd, node->data, REPORT_SIZE);
+		node->next = NULL;
+
+		if(node->size <= 0){
+			free(node);
+			return NULL;
+		}
+
+		pthread_mutex_lock(&dev->lock);
+		if(dev->tail)
+			dev->tail->next = node;
+		else
+			dev->head = node;
+		dev->tail = node;
+		pthread_mutex_unlock(&dev->lock);
+	}
+}
+
+static void fake_device_open(fake_device* dev, backend type, int fd)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->type = type;
+	dev->fd = fd;
+
+	switch(type){
+	case BACKEND_HIDAPI_LIBUSB:
+		pthread_mutex_init(&dev->lock, NULL);
+		pthread_create(&dev->thread, NULL, libusb_reader, dev);
+		break;
+
+	case BACKEND_HIDAPI_HIDRAW:
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		break;
+
+	case BACKEND_OHMD_HIDRAW:
+		dev->hidraw = ohmd_hidraw_open_fd(fd);
+		BAssert(dev->hidraw);
+		BAssert(ohmd_hidraw_set_nonblocking(dev->hidraw, 1) == 0);
+		break;
+	}
+}
+
+// non-blocking, returns 0 when there's nothing to read
+static int fake_device_read(fake_device* dev, unsigned char* data)
+{
+	switch(dev->type){
+	case BACKEND_HIDAPI_LIBUSB: {
+		pthread_mutex_lock(&dev->lock);
+		report_node* node = dev->head;
+		if(node){
+			dev->head = node->next;
+			if(!dev->head)
+				dev->tail = NULL;
+		}
+		pthread_mutex_unlock(&dev->lock);
+
+		if(!node)
+			return 0;
+
+		int size = node->size;
+		memcpy(data, node->data, size);
+		free(node);
+		return size;
+	}
+
+	case BACKEND_HIDAPI_HIDRAW: {
+		struct pollfd pfd = { dev->fd, POLLIN, 0 };
+		if(poll(&pfd, 1, 0) <= 0)
+			return 0;
+
+		ssize_t size = read(dev->fd, data, REPORT_SIZE);
+		return size < 0 ? 0 : (int)size;
+	}
+
+	case BACKEND_OHMD_HIDRAW:
+		return ohmd_hidraw_read(dev->hidraw, data, REPORT_SIZE);
+	}
+
+	return 0;
+}
+
+// waits for reports the way the update loop can for this backend
+static void fake_device_wait(fake_device* dev)
+{
+	if(dev->type == BACKEND_OHMD_HIDRAW){
+		struct pollfd pfd = { ohmd_hidraw_get_fd(dev->hidraw), POLLIN, 0 };
+		poll(&pfd, 1, 10);
+	}else{
+		ohmd_sleep(POLL_INTERVAL);
+	}
+}
+
+// the producer end has to be closed first so the libusb reader sees EOF
+static void fake_device_close(fake_device* dev)
+{
+	switch(dev->type){
+	case BACKEND_HIDAPI_LIBUSB:
+		pthread_join(dev->thread, NULL);
+		while(dev->head){
+			report_node* next = dev->head->next;
+			free(dev->head);
+			dev->head = next;
+		}
+		pthread_mutex_destroy(&dev->lock);
+		close(dev->fd);
+		break;
+
+	case BACKEND_HIDAPI_HIDRAW:
+		close(dev->fd);
+		break;
+
+	case BACKEND_OHMD_HIDRAW:
+		ohmd_hidraw_close(dev->hidraw);
+		break;
+	}
+}
+
+typedef struct {
+	int fd;
+	int num_reports;
+	double period;
+} producer_args;
+
+static unsigned int producer(void* arg)
+{
+	producer_args* args = (producer_args*)arg;
+	unsigned char report[REPORT_SIZE] = {0};
+	double start = ohmd_get_tick();
+
+	for(int i = 0; i < args->num_reports; i++){
+		double wait = start + i * args->period - ohmd_get_tick();
+		if(wait > 0)
+			ohmd_sleep(wait);
+
+		double now = ohmd_get_tick();
+		memcpy(report, &now, sizeof(now));
+
+		if(write(args->fd, report, REPORT_SIZE) != REPORT_SIZE)
+			return 1;
+	}
+
+	return 0;
+}
+
+static void run(backend type)
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	BAssert(ctx);
+
+	unsigned char report[REPORT_SIZE];
+	int fds[2];
+	fake_device dev;
+
+	// throughput, drain batches of reports the size of the kernel's hidraw buffer
+	BAssert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+	fake_device_open(&dev, type, fds[1]);
+
+	double drain_time = 0;
+	memset(report, 0, sizeof(report));
+
+	for(int batch = 0; batch < THROUGHPUT_REPORTS / BATCH_REPORTS; batch++){
+		for(int i = 0; i < BATCH_REPORTS; i++)
+			BAssert(write(fds[0], report, REPORT_SIZE) == REPORT_SIZE);
+
+		double start = ohmd_get_tick();
+		for(int received = 0; received < BATCH_REPORTS; ){
+			if(fake_device_read(&dev, report) == REPORT_SIZE)
+				received++;
+		}
+		drain_time += ohmd_get_tick() - start;
+	}
+
+	close(fds[0]);
+	fake_device_close(&dev);
+
+	printf("      time per report: %.0f ns\n", drain_time / THROUGHPUT_REPORTS * 1000000000.0);
+	printf("      reports/s:       %.0f\n", THROUGHPUT_REPORTS / drain_time);
+
+	// latency, a 1 kHz-ish sensor and a consumer that waits like the update loop
+	BAssert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0);
+	fake_device_open(&dev, type, fds[1]);
+
+	producer_args args = { fds[0], LATENCY_REPORTS, LATENCY_PERIOD };
+	ohmd_thread* thread = ohmd_create_thread(ctx, producer, &args);
+
+	double latency_sum = 0, latency_max = 0;
+	for(int received = 0; received < LATENCY_REPORTS; ){
+		fake_device_wait(&dev);
+
+		while(fake_device_read(&dev, report) == REPORT_SIZE){
+			double sent;
+			memcpy(&sent, report, sizeof(sent));
+
+			double latency = ohmd_get_tick() - sent;
+			latency_sum += latency;
+			latency_max = OHMD_MAX(latency_max, latency);
+			received++;
+		}
+	}
+
+	ohmd_destroy_thread(thread);
+	close(fds[0]);
+	fake_device_close(&dev);
+
+	printf("      latency mean:    %.1f us\n", latency_sum / LATENCY_REPORTS * 1000000.0);
+	printf("      latency max:     %.1f us\n", latency_max * 1000000.0);
+
+	ohmd_ctx_destroy(ctx);
+}
+
+void bench_hid_read_hidapi_libusb()
+{
+	run(BACKEND_HIDAPI_LIBUSB);
+}
+
+void bench_hid_read_hidapi_hidraw()
+{
+	run(BACKEND_HIDAPI_HIDRAW);
+}
+
+void bench_hid_read_ohmd_hidraw()
+{
+	run(BACKEND_OHMD_HIDRAW);
+}
+
+#else
+
+void bench_hid_read_hidapi_libusb()
+{
+	printf("      not available on this platform\n");
+}
+
+void bench_hid_read_hidapi_hidraw()
+{
+	printf("      not available on this platform\n");
+}
+
+void bench_hid_read_ohmd_hidraw()
+{
+	printf("      not available on this platform\n");
+}
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Benchmarks - Main */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <string.h>
+#include <time.h>
+#include "benchmarks.h"
+
+double bench_cpu_time()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1000000000.0;
+}
+
+#define Bench(_b) printf("   "#_b"\n"); _b(); printf("\n");
+
+int main()
+{
+	printf("update loop benchmarks\n");
+	Bench(bench_update_loop_polled);
+	Bench(bench_update_loop_event_driven);
+	Bench(bench_update_loop_slow_device_one_worker);
+	Bench(bench_update_loop_slow_device_two_workers);
+	Bench(bench_update_loop_stall_inline);
+	Bench(bench_update_loop_stall_pipelined);
+
+	printf("getter benchmarks\n");
+	Bench(bench_getf_eye_matrices_new_pose);
+	Bench(bench_getf_eye_matrices_same_pose);
+
+	printf("HID report reading benchmarks\n");
+	Bench(bench_hid_read_hidapi_libusb);
+	Bench(bench_hid_read_hidapi_hidraw);
+	Bench(bench_hid_read_ohmd_hidraw);
+
+	printf("driver update benchmarks\n");
+	Bench(bench_driver_update_rift_dk2);
+	Bench(bench_driver_soak_rift_dk2);
+
+	printf("probe benchmarks\n");
+	Bench(bench_probe_busy_bus);
+	Bench(bench_open_sequential);
+	Bench(bench_open_async);
+	Bench(bench_open_cached);
+
+	printf("sensor fusion benchmarks\n");
+	Bench(bench_fusion_default);
+	Bench(bench_fusion_eskf);
+	Bench(bench_fusion_mahony);
+	Bench(bench_fusion_batched);
+	Bench(bench_fusion_group);
+
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Benchmarks - Probing and opening devices on the mock HID transport */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <stdlib.h>
+#include "benchmarks.h"
+
+#define PROBES 20
+#define BUS_DEVICES 47
+#define DEVICE_COST 0.00002 // enumerating a device, roughly what reading its attributes from sysfs takes
+
+static ohmd_hid_mock* create_busy_bus()
+{
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	char path[32];
+
+	// keyboards, mice, hubs and the like, and one DK2
+	for(int i = 0; i < BUS_DEVICES; i++){
+		snprintf(path, sizeof(path), "mock-other%d", i);
+		BAssert(ohmd_hid_mock_add_device(mock, path, 0x1000 + i, 0x0001, 0, "Other", "Device", ""));
+	}
+
+	BAssert(ohmd_hid_mock_add_device(mock, "mock-dk2", 0x2833, 0x0021, 0, "Oculus VR, Inc.", "Rift DK2", "DK2MOCK"));
+	ohmd_hid_mock_set_enumerate_cost(mock, DEVICE_COST);
+
+	return mock;
+}
+
+static void run_probes(ohmd_context* ctx, ohmd_hid_mock* mock)
+{
+	int num_devices = 0;
+	int enumerations = ohmd_hid_mock_get_num_enumerations(mock);
+
+	double start = ohmd_get_tick();
+	for(int i = 0; i < PROBES; i++)
+		num_devices = ohmd_ctx_probe(ctx);
+	double elapsed = ohmd_get_tick() - start;
+
+	enumerations = ohmd_hid_mock_get_num_enumerations(mock) - enumerations;
+
+	printf("      %d devices found, %.2f ms per probe, %.1f enumerations per probe\n",
+		num_devices, elapsed / PROBES * 1000.0, (double)enumerations / PROBES);
+}
+
+void bench_probe_busy_bus()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = create_busy_bus();
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	run_probes(ctx, mock);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+#define OPEN_DEVICES 4
+#define FEATURE_REPORT_LATENCY 0.002
+
+// An HMD and a few trackers that take a while to answer feature reports
+static ohmd_hid_mock* create_slow_devices(ohmd_context* ctx, int* indices, int cache)
+{
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	char path[32];
+
+	ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &cache);
+
+	for(int i = 0; i < OPEN_DEVICES; i++){
+		snprintf(path, sizeof(path), "mock-dk2-%d", i);
+		ohmd_hid_mock_device* dev = ohmd_hid_mock_add_device(mock, path, 0x2833, 0x0021, 0, "Oculus VR, Inc.", "Rift DK2", path);
+		BAssert(dev);
+		bench_mock_rift_dk2(dev, 1000.0);
+		ohmd_hid_mock_set_feature_report_latency(dev, FEATURE_REPORT_LATENCY);
+	}
+
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	int found = 0;
+	for(int i = 0; i < num_devices && found < OPEN_DEVICES; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PRODUCT), "Rift (DK2)") == 0)
+			indices[found++] = i;
+	}
+
+	if(found < OPEN_DEVICES){
+		printf("      rift driver not available\n");
+		ohmd_hid_mock_destroy(mock);
+		return NULL;
+	}
+
+	return mock;
+}
+
+void bench_open_sequential()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	int indices[OPEN_DEVICES];
+	ohmd_hid_mock* mock = create_slow_devices(ctx, indices, OHMD_DEVICE_CACHE_OFF);
+	if(!mock){
+		ohmd_ctx_destroy(ctx);
+		return;
+	}
+
+	double start = ohmd_get_tick();
+	for(int i = 0; i < OPEN_DEVICES; i++)
+		BAssert(ohmd_list_open_device(ctx, indices[i]));
+	double elapsed = ohmd_get_tick() - start;
+
+	printf("      %d devices opened in %.1f ms\n", OPEN_DEVICES, elapsed * 1000.0);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+void bench_open_async()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	int indices[OPEN_DEVICES];
+	ohmd_hid_mock* mock = create_slow_devices(ctx, indices, OHMD_DEVICE_CACHE_OFF);
+	if(!mock){
+		ohmd_ctx_destroy(ctx);
+		return;
+	}
+
+	ohmd_open_request* requests[OPEN_DEVICES];
+
+	double start = ohmd_get_tick();
+	for(int i = 0; i < OPEN_DEVICES; i++)
+		BAssert((requests[i] = ohmd_list_open_device_async(ctx, indices[i], NULL, NULL, NULL)));
+	double returned = ohmd_get_tick() - start;
+
+	for(int i = 0; i < OPEN_DEVICES; i++){
+		BAssert(ohmd_open_request_wait(requests[i]));
+		ohmd_open_request_destroy(requests[i]);
+	}
+	double elapsed = ohmd_get_tick() - start;
+
+	printf("      %d devices opened in %.1f ms, the calls returned after %.3f ms\n",
+		OPEN_DEVICES, elapsed * 1000.0, returned * 1000.0);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+#define CACHE_DIR "benchmarks_cache"
+
+static double open_all(ohmd_context* ctx, const int* indices)
+{
+	ohmd_device* devices[OPEN_DEVICES];
+
+	double start = ohmd_get_tick();
+	for(int i = 0; i < OPEN_DEVICES; i++)
+		BAssert((devices[i] = ohmd_list_open_device(ctx, indices[i])));
+	double elapsed = ohmd_get_tick() - start;
+
+	for(int i = 0; i < OPEN_DEVICES; i++)
+		ohmd_close_device(devices[i]);
+
+	return elapsed;
+}
+
+void bench_open_cached()
+{
+	setenv("OHMD_CACHE_DIR", CACHE_DIR, 1);
+
+	ohmd_context* ctx = ohmd_ctx_create();
+	int indices[OPEN_DEVICES];
+	ohmd_hid_mock* mock = create_slow_devices(ctx, indices, OHMD_DEVICE_CACHE_REFRESH);
+	if(!mock){
+		ohmd_ctx_destroy(ctx);
+		unsetenv("OHMD_CACHE_DIR");
+		return;
+	}
+
+	// the first open reads everything and fills the cache, the second one uses it
+	double cold = open_all(ctx, indices);
+
+	int cache = OHMD_DEVICE_CACHE_ON;
+	ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &cache);
+	double warm = open_all(ctx, indices);
+
+	printf("      %d devices opened in %.1f ms without the cache, %.1f ms with it\n",
+		OPEN_DEVICES, cold * 1000.0, warm * 1000.0);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+
+	char path[64];
+	for(int i = 0; i < OPEN_DEVICES; i++){
+		snprintf(path, sizeof(path), CACHE_DIR "/rift-mock-dk2-%d-0000.cache", i);
+		remove(path);
+	}
+	remove(CACHE_DIR);
+	unsetenv("OHMD_CACHE_DIR");
+}
@@ -0,0 +1,305 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Benchmarks - Automatic update loop */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include "benchmarks.h"
+
+#define STREAM_SECONDS 2.0
+#define IDLE_SECONDS 1.0
+#define SAMPLE_RATE 1000.0
+
+// time the slow device spends in update, like a driver draining a large backlog
+#define SLOW_UPDATE_TIME (2.0 / 1000.0)
+
+// reports a device buffers before dropping them, like the 64 of a hidraw device
+#define DEVICE_BUFFER_REPORTS 64
+
+// one stall of the fusion stage, e.g. the update thread being preempted
+#define STALL_AFTER_SAMPLES 500
+#define STALL_TIME (150.0 / 1000.0)
+
+// A device that gets "IMU samples" over a pipe, each sample being the time it was sent
+typedef struct {
+	ohmd_device base;
+	int fds[2];
+	bool slow, stall;
+	fusion sensor_fusion;
+	sample_queue samples;
+
+	int num_samples;
+	int reports_dropped;
+	double latency_sum, latency_max;
+} pipe_priv;
+
+static void read_device(ohmd_device* device)
+{
+	pipe_priv* priv = (pipe_priv*)device;
+	double sent[16];
+	ssize_t size;
+
+	while((size = read(priv->fds[0], sent, sizeof(sent))) > 0){
+		for(int i = 0; i < size / (ssize_t)sizeof(double); i++){
+			imu_sample sample = { sent[i], 1.0f / SAMPLE_RATE, {{0.1f, 0, 0}}, {{0, 9.81f, 0}}, {{0, 0, 0}} };
+			osq_push(&priv->samples, &sample);
+		}
+	}
+}
+
+static void update_device(ohmd_device* device)
+{
+	pipe_priv* priv = (pipe_priv*)device;
+	imu_sample sample;
+
+	if(priv->slow)
+		ohmd_sleep(SLOW_UPDATE_TIME);
+
+	if(priv->stall && priv->num_samples >= STALL_AFTER_SAMPLES){
+		ohmd_sleep(STALL_TIME);
+		priv->stall = false;
+	}
+
+	while(osq_pop(&priv->samples, &sample)){
+		ofusion_update(&priv->sensor_fusion, sample.dt, &sample.ang_vel, &sample.accel, &sample.mag);
+
+		double latency = ohmd_get_tick() - sample.time;
+		priv->latency_sum += latency;
+		priv->latency_max = OHMD_MAX(priv->latency_max, latency);
+		priv->num_samples++;
+	}
+}
+
+static int get_fd(ohmd_device* device)
+{
+	return ((pipe_priv*)device)->fds[0];
+}
+
+static int getf(ohmd_device* device, ohmd_float_value type, float* out)
+{
+	pipe_priv* priv = (pipe_priv*)device;
+
+	switch(type){
+	case OHMD_ROTATION_QUAT:
+		*(quatf*)out = priv->sensor_fusion.orient;
+		return OHMD_S_OK;
+
+	case OHMD_POSITION_VECTOR:
+		out[0] = out[1] = out[2] = 0;
+		return OHMD_S_OK;
+
+	default:
+		return OHMD_S_INVALID_PARAMETER;
+	}
+}
+
+static void close_device(ohmd_device* device)
+{
+	pipe_priv* priv = (pipe_priv*)device;
+	close(priv->fds[0]);
+	close(priv->fds[1]);
+	free(priv);
+}
+
+static ohmd_device* open_device(ohmd_driver* driver, ohmd_device_desc* desc)
+{
+	pipe_priv* priv = ohmd_alloc(driver->ctx, sizeof(pipe_priv));
+	if(!priv)
+		return NULL;
+
+	if(pipe(priv->fds) != 0){
+		free(priv);
+		return NULL;
+	}
+
+	fcntl(priv->fds[0], F_SETFL, O_NONBLOCK);
+
+	priv->slow = strcmp(desc->product, "Slow Pipe Device") == 0;
+
+	ohmd_set_default_device_properties(&priv->base.properties);
+	ofusion_init(&priv->sensor_fusion);
+	osq_init(&priv->samples);
+
+	priv->base.samples = &priv->samples;
+	priv->base.read = read_device;
+	priv->base.update = update_device;
+	priv->base.close = close_device;
+	priv->base.getf = getf;
+	priv->base.get_fd = get_fd;
+
+	return &priv->base;
+}
+
+static void get_device_list(ohmd_driver* driver, ohmd_device_list* list)
+{
+	const char* products[] = { "Pipe Device", "Slow Pipe Device" };
+
+	for(int i = 0; i < 2; i++){
+		ohmd_device_desc* desc = ohmd_device_list_add(list);
+		if(!desc)
+			return;
+
+		strcpy(desc->driver, "OpenHMD Benchmark Driver");
+		strcpy(desc->vendor, "OpenHMD");
+		strcpy(desc->product, products[i]);
+		strcpy(desc->path, "(none)");
+
+		desc->device_class = OHMD_DEVICE_CLASS_GENERIC_TRACKER;
+		desc->device_flags = OHMD_DEVICE_FLAGS_ROTATIONAL_TRACKING;
+		desc->driver_ptr = driver;
+	}
+}
+
+static void destroy_driver(ohmd_driver* drv)
+{
+	free(drv);
+}
+
+typedef struct {
+	pipe_priv* devices[2];
+	int num_devices;
+} producer_args;
+
+static unsigned int producer(void* arg)
+{
+	producer_args* args = (producer_args*)arg;
+	double start = ohmd_get_tick();
+
+	for(int i = 0; i < (int)(STREAM_SECONDS * SAMPLE_RATE); i++){
+		// sleep until the next sample is due
+		double wait = start + i / SAMPLE_RATE - ohmd_get_tick();
+		if(wait > 0)
+			ohmd_sleep(wait);
+
+		for(int j = 0; j < args->num_devices; j++){
+			pipe_priv* priv = args->devices[j];
+
+			// the device drops reports nobody picked up in time
+			int queued = 0;
+			ioctl(priv->fds[0], FIONREAD, &queued);
+			if(queued >= DEVICE_BUFFER_REPORTS * (int)sizeof(double)){
+				priv->reports_dropped++;
+				continue;
+			}
+
+			double now = ohmd_get_tick();
+			if(write(priv->fds[1], &now, sizeof(now)) != sizeof(now))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+static pipe_priv* open_pipe_device(ohmd_context* ctx, const char* product)
+{
+	int num_devices = ohmd_ctx_probe(ctx);
+	for(int i = 0; i < num_devices; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PRODUCT), product) == 0)
+			return (pipe_priv*)ohmd_list_open_device(ctx, i);
+	}
+
+	return NULL;
+}
+
+typedef struct {
+	bool event_driven;
+	int workers;
+	bool with_slow_device;
+	bool pipelined;
+	bool stall;
+} run_options;
+
+static void run(run_options options)
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	BAssert(ctx);
+
+	ohmd_driver* drv = ohmd_alloc(ctx, sizeof(ohmd_driver));
+	drv->get_device_list = get_device_list;
+	drv->open_device = open_device;
+	drv->destroy = destroy_driver;
+	drv->ctx = ctx;
+	ohmd_add_driver(ctx, drv);
+
+	int val = options.event_driven ? 1 : 0;
+	ohmd_ctx_seti(ctx, OHMD_ICS_EVENT_DRIVEN_UPDATE, &val);
+	BAssert(ohmd_ctx_seti(ctx, OHMD_ICS_UPDATE_WORKERS, &options.workers) == OHMD_S_OK);
+	val = options.pipelined ? 1 : 0;
+	ohmd_ctx_seti(ctx, OHMD_ICS_PIPELINED_UPDATE, &val);
+
+	producer_args args = { { NULL, NULL }, 0 };
+
+	pipe_priv* priv = open_pipe_device(ctx, "Pipe Device");
+	BAssert(priv);
+	priv->stall = options.stall;
+	args.devices[args.num_devices++] = priv;
+
+	if(options.with_slow_device){
+		pipe_priv* slow = open_pipe_device(ctx, "Slow Pipe Device");
+		BAssert(slow);
+		args.devices[args.num_devices++] = slow;
+	}
+
+	double cpu_start = bench_cpu_time();
+	ohmd_thread* thread = ohmd_create_thread(ctx, producer, &args);
+	ohmd_destroy_thread(thread);
+	ohmd_sleep(0.01); // let the last samples through
+	double cpu_stream = bench_cpu_time() - cpu_start;
+
+	cpu_start = bench_cpu_time();
+	ohmd_sleep(IDLE_SECONDS);
+	double cpu_idle = bench_cpu_time() - cpu_start;
+
+	int stats[2];
+	ohmd_device_geti(&priv->base, OHMD_SAMPLE_QUEUE_STATS, stats);
+
+	printf("      samples:         %d\n", priv->num_samples);
+	printf("      reports dropped: %d\n", priv->reports_dropped);
+	printf("      samples dropped: %d\n", stats[1]);
+	printf("      latency mean:    %.1f us\n", priv->latency_sum / OHMD_MAX(priv->num_samples, 1) * 1000000.0);
+	printf("      latency max:     %.1f us\n", priv->latency_max * 1000000.0);
+	printf("      cpu streaming:   %.2f %%\n", cpu_stream / STREAM_SECONDS * 100.0);
+	printf("      cpu idle:        %.2f %%\n", cpu_idle / IDLE_SECONDS * 100.0);
+
+	ohmd_ctx_destroy(ctx);
+}
+
+void bench_update_loop_polled()
+{
+	run((run_options){ .event_driven = false, .workers = 1 });
+}
+
+void bench_update_loop_event_driven()
+{
+	run((run_options){ .event_driven = true, .workers = 1 });
+}
+
+void bench_update_loop_slow_device_one_worker()
+{
+	run((run_options){ .event_driven = true, .workers = 1, .with_slow_device = true });
+}
+
+void bench_update_loop_slow_device_two_workers()
+{
+	run((run_options){ .event_driven = true, .workers = 2, .with_slow_device = true });
+}
+
+void bench_update_loop_stall_inline()
+{
+	run((run_options){ .event_driven = true, .workers = 1, .stall = true });
+}
+
+void bench_update_loop_stall_pipelined()
+{
+	run((run_options){ .event_driven = true, .workers = 1, .stall = true, .pipelined = true });
+}
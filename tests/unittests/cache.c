@@ -0,0 +1,171 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Unit Tests - Device Cache Tests */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include <stdlib.h>
+#include "tests.h"
+#include "hid_mock.h"
+
+#define CACHE_DIR "unittests_cache"
+#define CACHE_FILE CACHE_DIR "/test-ABC_1_2-0003.cache"
+#define RIFT_CACHE_FILE CACHE_DIR "/rift-CACHE1-0000.cache"
+
+// keeps the first size bytes of the file, or flips the last one
+static void damage(const char* path, long size)
+{
+	unsigned char data[256];
+	FILE* file = fopen(path, "rb");
+	TAssert(file);
+	long length = (long)fread(data, 1, sizeof(data), file);
+	fclose(file);
+
+	if(size < 0)
+		data[length - 1] ^= 0xff;
+	else
+		length = size;
+
+	file = fopen(path, "wb");
+	TAssert(fwrite(data, 1, length, file) == (size_t)length);
+	fclose(file);
+}
+
+void test_cache_store_load()
+{
+	setenv("OHMD_CACHE_DIR", CACHE_DIR, 1);
+	ohmd_context* ctx = ohmd_ctx_create();
+
+	ohmd_cache_key key = { "test", "ABC 1/2", 3, 1 };
+	float data[16];
+	for(int i = 0; i < 16; i++)
+		data[i] = i * 0.5f;
+
+	size_t size = 0;
+	TAssert(ohmd_cache_load(ctx, &key, &size) == NULL);
+
+	// the serial is made safe for a file name
+	TAssert(ohmd_cache_store(ctx, &key, data, sizeof(data)));
+	FILE* file = fopen(CACHE_FILE, "rb");
+	TAssert(file);
+	fclose(file);
+
+	float* loaded = ohmd_cache_load(ctx, &key, &size);
+	TAssert(loaded && size == sizeof(data));
+	TAssert(memcmp(loaded, data, sizeof(data)) == 0);
+	free(loaded);
+
+	// another layout or firmware revision doesn't match
+	ohmd_cache_key other = key;
+	other.format = 2;
+	TAssert(ohmd_cache_load(ctx, &other, &size) == NULL);
+
+	other = key;
+	other.revision = 4;
+	TAssert(ohmd_cache_load(ctx, &other, &size) == NULL);
+
+	// refreshing writes but doesn't read, off does neither
+	int mode = OHMD_DEVICE_CACHE_REFRESH;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &mode) == OHMD_S_OK);
+	TAssert(ohmd_cache_load(ctx, &key, &size) == NULL);
+	TAssert(ohmd_cache_store(ctx, &key, data, sizeof(data)));
+
+	mode = OHMD_DEVICE_CACHE_OFF;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &mode) == OHMD_S_OK);
+	TAssert(ohmd_cache_load(ctx, &key, &size) == NULL);
+	TAssert(!ohmd_cache_store(ctx, &key, data, sizeof(data)));
+
+	mode = 3;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &mode) == OHMD_S_INVALID_PARAMETER);
+
+	// a damaged file is ignored
+	mode = OHMD_DEVICE_CACHE_ON;
+	ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &mode);
+	damage(CACHE_FILE, -1);
+	TAssert(ohmd_cache_load(ctx, &key, &size) == NULL);
+
+	TAssert(ohmd_cache_store(ctx, &key, data, sizeof(data)));
+	damage(CACHE_FILE, 150);
+	TAssert(ohmd_cache_load(ctx, &key, &size) == NULL);
+
+	ohmd_ctx_destroy(ctx);
+	remove(CACHE_FILE);
+	remove(CACHE_DIR);
+	unsetenv("OHMD_CACHE_DIR");
+}
+
+static int open_rift(ohmd_context* ctx, ohmd_hid_mock_device* mdev)
+{
+	int num_devices = ohmd_ctx_probe(ctx);
+	int idx = -1;
+
+	for(int i = 0; i < num_devices; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PRODUCT), "Rift (DK2)") == 0)
+			idx = i;
+	}
+
+	if(idx == -1)
+		return -1;
+
+	ohmd_hid_mock_stats before, after;
+	ohmd_hid_mock_get_stats(mdev, &before);
+
+	ohmd_device* device = ohmd_list_open_device(ctx, idx);
+	TAssert(device);
+
+	float hsize;
+	ohmd_device_getf(device, OHMD_SCREEN_HORIZONTAL_SIZE, &hsize);
+	TAssert(float_eq(hsize, 0.125f, 1e-6f));
+	ohmd_close_device(device);
+
+	ohmd_hid_mock_get_stats(mdev, &after);
+	return after.feature_reports_read - before.feature_reports_read;
+}
+
+void test_cache_rift()
+{
+	setenv("OHMD_CACHE_DIR", CACHE_DIR, 1);
+	remove(RIFT_CACHE_FILE);
+
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_device* mdev = mock_rift_dk2(mock, "mock-dk2", "CACHE1");
+
+	unsigned char display_info[56] = { 9 };
+	uint32_t hsize = 125000; // um
+	memcpy(display_info + 8, &hsize, sizeof(hsize));
+	ohmd_hid_mock_set_feature_report(mdev, display_info, sizeof(display_info));
+
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	int cold = open_rift(ctx, mdev);
+	if(cold == -1){
+		// no rift driver to cache for
+		ohmd_ctx_destroy(ctx);
+		ohmd_hid_mock_destroy(mock);
+		unsetenv("OHMD_CACHE_DIR");
+		return;
+	}
+
+	// the second time the range and display info come from the cache
+	int warm = open_rift(ctx, mdev);
+	TAssert(warm < cold - 1);
+
+	// refreshing reads them all again
+	int mode = OHMD_DEVICE_CACHE_REFRESH;
+	ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &mode);
+	TAssert(open_rift(ctx, mdev) == cold);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+
+	remove(RIFT_CACHE_FILE);
+	remove(CACHE_DIR);
+	unsetenv("OHMD_CACHE_DIR");
+}
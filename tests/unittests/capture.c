@@ -0,0 +1,227 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Unit Tests - HID Capture Tests */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <string.h>
+#include "tests.h"
+#include "hid_mock.h"
+
+#define CAPTURE_FILE "unittests_capture.ohmdcap"
+#define TORN_FILE "unittests_capture_torn.ohmdcap"
+
+static void write_session(uint64_t start_time, int num_records)
+{
+	ohmd_capture_writer* writer = ohmd_capture_writer_open(CAPTURE_FILE);
+	TAssert(writer);
+
+	ohmd_capture_device info = { 0x1234, 0x0001 };
+	strcpy(info.path, "mock0");
+
+	uint16_t device = ohmd_capture_writer_new_device(writer);
+	TAssert(ohmd_capture_writer_add(writer, start_time, device, OHMD_CAPTURE_DEVICE, 0, &info, sizeof(info)));
+
+	for(int i = 1; i < num_records; i++){
+		unsigned char report[13] = { 11 };
+		memcpy(report + 1, &i, sizeof(i));
+		TAssert(ohmd_capture_writer_add(writer, start_time + (uint64_t)i * 1000000, device, OHMD_CAPTURE_INPUT, 0, report, sizeof(report)));
+	}
+
+	ohmd_capture_writer_close(writer);
+}
+
+void test_capture_file()
+{
+	remove(CAPTURE_FILE);
+
+	write_session(1000000000, 3000);
+
+	ohmd_capture_reader* reader = ohmd_capture_reader_open(CAPTURE_FILE);
+	TAssert(reader);
+
+	ohmd_capture_index index;
+	const ohmd_capture_index_entry* entries = ohmd_capture_reader_get_index(reader, &index);
+	TAssert(index.num_records == 3000);
+	TAssert(index.num_devices == 1);
+	TAssert(index.num_entries == 3);
+	TAssert(entries[0].offset == ohmd_capture_reader_begin(reader));
+
+	// walk it, the padded records come back intact
+	uint64_t offset = ohmd_capture_reader_begin(reader);
+	const ohmd_capture_record* record;
+	const unsigned char* payload;
+	int inputs = 0;
+
+	while((record = ohmd_capture_reader_next(reader, &offset, &payload))){
+		if(record->type == OHMD_CAPTURE_DEVICE)
+			TAssert(strcmp(((const ohmd_capture_device*)payload)->path, "mock0") == 0);
+
+		if(record->type == OHMD_CAPTURE_INPUT){
+			int i;
+			inputs++;
+			memcpy(&i, payload + 1, sizeof(i));
+			TAssert(record->size == 13 && i == inputs);
+			TAssert(record->time == 1000000000 + (uint64_t)i * 1000000);
+		}
+	}
+
+	TAssert(inputs == 2999);
+	TAssert(offset == ohmd_capture_reader_end(reader));
+
+	// seeking lands on the index entry before the time
+	offset = ohmd_capture_reader_seek(reader, 1000000000 + 1500 * (uint64_t)1000000);
+	TAssert(offset == entries[1].offset);
+	record = ohmd_capture_reader_next(reader, &offset, &payload);
+	TAssert(record->time == 1000000000 + 1024 * (uint64_t)1000000);
+
+	ohmd_capture_reader_close(reader);
+
+	// appending continues the index and the device ids
+	write_session(5000000000, 100);
+
+	reader = ohmd_capture_reader_open(CAPTURE_FILE);
+	TAssert(reader);
+	entries = ohmd_capture_reader_get_index(reader, &index);
+	TAssert(index.num_records == 3100);
+	TAssert(index.num_devices == 2);
+	TAssert(index.num_entries == 4);
+	TAssert(entries[3].time == 5000000000 + 72 * (uint64_t)1000000);
+
+	// a file cut off mid-record is indexed by walking it, but not appended to
+	uint64_t size = ohmd_capture_reader_end(reader);
+	unsigned char* data = malloc(size);
+	FILE* file = fopen(CAPTURE_FILE, "rb");
+	TAssert(fread(data, 1, size, file) == size);
+	fclose(file);
+
+	file = fopen(TORN_FILE, "wb");
+	TAssert(fwrite(data, 1, size - 12, file) == size - 12);
+	fclose(file);
+	free(data);
+	ohmd_capture_reader_close(reader);
+
+	reader = ohmd_capture_reader_open(TORN_FILE);
+	TAssert(reader);
+	ohmd_capture_reader_get_index(reader, &index);
+	TAssert(index.num_records == 3100);
+	TAssert(index.num_devices == 2);
+	TAssert(ohmd_capture_reader_end(reader) < size - 12);
+	ohmd_capture_reader_close(reader);
+
+	TAssert(ohmd_capture_writer_open(TORN_FILE) == NULL);
+
+	remove(TORN_FILE);
+	remove(CAPTURE_FILE);
+}
+
+static void advance_dk2_timestamp(unsigned char* report, size_t size, uint64_t index, void* user_data)
+{
+	uint32_t timestamp = (uint32_t)(index * 1000);
+	memcpy(report + 8, &timestamp, sizeof(timestamp));
+
+	// wobble the gyro so the orientation depends on every report
+	report[20] = (unsigned char)(index * 7);
+}
+
+static int open_rift_dk2(ohmd_context* ctx)
+{
+	int num_devices = ohmd_ctx_probe(ctx);
+
+	for(int i = 0; i < num_devices; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PRODUCT), "Rift (DK2)") == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static ohmd_device* open_manual(ohmd_context* ctx, int idx)
+{
+	// read everything from the device, so it all ends up in the capture
+	int cache = OHMD_DEVICE_CACHE_OFF;
+	ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &cache);
+
+	ohmd_device_settings* settings = ohmd_device_settings_create(ctx);
+	int auto_update = 0;
+	ohmd_device_settings_seti(settings, OHMD_IDS_AUTOMATIC_UPDATE, &auto_update);
+
+	ohmd_device* device = ohmd_list_open_device_s(ctx, idx, settings);
+	ohmd_device_settings_destroy(settings);
+
+	return device;
+}
+
+void test_capture_replay()
+{
+	remove(CAPTURE_FILE);
+
+	// capture a mock DK2
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_device* mdev = mock_rift_dk2(mock, "mock-dk2", "1");
+	ohmd_hid_mock_set_report_callback(mdev, advance_dk2_timestamp, NULL);
+
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_capture* capture = ohmd_hid_capture_create(ctx, ohmd_hid_mock_get_transport(mock), CAPTURE_FILE);
+	TAssert(capture);
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_capture_get_transport(capture));
+
+	int idx = open_rift_dk2(ctx);
+	if(idx == -1){
+		// no rift driver to capture with
+		ohmd_ctx_destroy(ctx);
+		ohmd_hid_capture_destroy(capture);
+		ohmd_hid_mock_destroy(mock);
+		remove(CAPTURE_FILE);
+		return;
+	}
+
+	ohmd_device* device = open_manual(ctx, idx);
+	TAssert(device);
+
+	for(int i = 0; i < 20; i++)
+		ohmd_ctx_update(ctx);
+
+	quatf captured;
+	ohmd_device_getf(device, OHMD_ROTATION_QUAT, (float*)&captured);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_capture_destroy(capture);
+
+	// replay it as fast as possible, with nothing but the replay to find
+	ohmd_hid_mock* empty = ohmd_hid_mock_create();
+	setenv("OHMD_REPLAY", CAPTURE_FILE, 1);
+	setenv("OHMD_REPLAY_SPEED", "0", 1);
+
+	ctx = ohmd_ctx_create();
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(empty));
+
+	idx = open_rift_dk2(ctx);
+	TAssert(idx != -1);
+
+	device = open_manual(ctx, idx);
+	TAssert(device);
+
+	for(int i = 0; i < 20; i++)
+		ohmd_ctx_update(ctx);
+
+	quatf replayed;
+	ohmd_device_getf(device, OHMD_ROTATION_QUAT, (float*)&replayed);
+
+	// the same reports in the same batches give the same orientation
+	TAssert(quatf_eq(captured, replayed, 1e-6f));
+	TAssert(fabsf(captured.w) < 0.999f);
+
+	ohmd_ctx_destroy(ctx);
+	unsetenv("OHMD_REPLAY");
+	unsetenv("OHMD_REPLAY_SPEED");
+
+	ohmd_hid_mock_destroy(empty);
+	ohmd_hid_mock_destroy(mock);
+	remove(CAPTURE_FILE);
+}
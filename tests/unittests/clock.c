@@ -0,0 +1,95 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Unit Tests - Clock Tests */
+
+#include <string.h>
+#include "tests.h"
+#include "hid_mock.h"
+
+void test_clock_virtual()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+
+	// simulated, sleeping only moves the clock
+	ohmd_clock* clock = ohmd_create_virtual_clock(ctx, 0);
+	TAssert(clock);
+	TAssert(ohmd_clock_get_tick(clock) == 0);
+
+	double start = ohmd_get_tick();
+	ohmd_clock_sleep(clock, 10.0);
+	TAssert(ohmd_get_tick() - start < 1.0);
+	TAssert(float_eq(ohmd_clock_get_tick(clock), 10.0f, 1e-6f));
+
+	ohmd_virtual_clock_advance(clock, 0.5);
+	TAssert(float_eq(ohmd_clock_get_tick(clock), 10.5f, 1e-6f));
+
+	// the context reads the time from its clock
+	ohmd_ctx_set_clock(ctx, clock);
+	TAssert(ohmd_ctx_get_time(ctx) == ohmd_clock_get_tick(clock));
+	TAssert(ohmd_monotonic_get(ctx) == 10.5 * ohmd_monotonic_per_sec(ctx));
+	ohmd_ctx_set_clock(ctx, NULL);
+	ohmd_destroy_virtual_clock(clock);
+
+	// scaled, a simulated second takes 10 ms
+	clock = ohmd_create_virtual_clock(ctx, 100.0);
+	TAssert(clock);
+
+	start = ohmd_get_tick();
+	ohmd_clock_sleep(clock, 1.0);
+	double elapsed = ohmd_get_tick() - start;
+	TAssert(elapsed >= 0.009 && elapsed < 0.5);
+	TAssert(ohmd_clock_get_tick(clock) >= 1.0);
+
+	ohmd_destroy_virtual_clock(clock);
+	ohmd_ctx_destroy(ctx);
+}
+
+void test_clock_mock_reports()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_clock* clock = ohmd_create_virtual_clock(ctx, 0);
+	ohmd_ctx_set_clock(ctx, clock);
+
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_set_clock(mock, clock);
+	ohmd_hid_mock_device* mdev = ohmd_hid_mock_add_device(mock, "mock0", 0x1234, 0x0001, 0, "Vendor", "Product", "1");
+
+	unsigned char report[16] = { 1 };
+	ohmd_hid_mock_set_reports(mdev, report, sizeof(report), 1, 1000.0, -1);
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	ohmd_hid_device* dev = ohmd_hid_open_path(ctx, "mock0");
+	TAssert(dev);
+
+	// nothing is due until the clock moves, however long it really takes
+	unsigned char buf[16];
+	TAssert(ohmd_hid_read(dev, buf, sizeof(buf)) == 0);
+
+	ohmd_virtual_clock_advance(ctx->clock, 0.0205);
+	int reads = 0;
+	while(ohmd_hid_read(dev, buf, sizeof(buf)) > 0)
+		reads++;
+	TAssert(reads == 20);
+
+	// a simulated second without reading overflows the device buffer
+	ohmd_ctx_sleep(ctx, 1.0);
+	reads = 0;
+	while(ohmd_hid_read(dev, buf, sizeof(buf)) > 0)
+		reads++;
+	TAssert(reads == OHMD_HID_MOCK_BUFFER_REPORTS);
+
+	ohmd_hid_mock_stats stats;
+	ohmd_hid_mock_get_stats(mdev, &stats);
+	TAssert(stats.reports_read == 20 + OHMD_HID_MOCK_BUFFER_REPORTS);
+	TAssert(stats.reports_dropped == 1000 - OHMD_HID_MOCK_BUFFER_REPORTS);
+
+	ohmd_hid_close(dev);
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+	ohmd_destroy_virtual_clock(clock);
+}
@@ -0,0 +1,506 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Unit Tests - Sensor Fusion Tests */
+
+#include "tests.h"
+
+static const float t = 0.001;
+
+void test_ofusion_predict()
+{
+	quatf orient, predicted, expected;
+	vec3f axis = {{0, 1, 0}};
+	vec3f ang_vel = {{0, 2.0f, 0}}; // rad/s around y
+
+	oquatf_init_axis(&orient, &axis, 0.5f);
+
+	// 50 ms at 2 rad/s adds 0.1 rad
+	ofusion_predict(&orient, &ang_vel, 0.05f, &predicted);
+	oquatf_init_axis(&expected, &axis, 0.6f);
+	TAssert(quatf_eq(predicted, expected, t));
+
+	// predicting backwards undoes the rotation
+	ofusion_predict(&predicted, &ang_vel, -0.05f, &predicted);
+	TAssert(quatf_eq(predicted, orient, t));
+
+	// no rotation without angular velocity
+	vec3f zero = {{0, 0, 0}};
+	ofusion_predict(&orient, &zero, 0.05f, &predicted);
+	TAssert(quatf_eq(predicted, orient, t));
+}
+
+void test_ofusion_get_prediction_rate()
+{
+	fusion f;
+	vec3f rate, accel = {{0, 9.81f, 0}}, mag = {{0, 0, 0}};
+
+	ofusion_init(&f);
+
+	// a resting device reports the filtered rate
+	for(int i = 0; i < 40; i++){
+		vec3f noise = {{(i & 1) ? 0.02f : -0.02f, 0, 0}};
+		ofusion_update(&f, 0.001f, &noise, &accel, &mag);
+	}
+
+	ofusion_get_prediction_rate(&f, &rate);
+	TAssert(float_eq(rate.x, 0, t));
+
+	// a moving device reports the latest rate
+	vec3f turn = {{0, 3.0f, 0}};
+	ofusion_update(&f, 0.001f, &turn, &accel, &mag);
+
+	ofusion_get_prediction_rate(&f, &rate);
+	TAssert(vec3f_eq(rate, turn, t));
+}
+
+void test_ofusion_get_orient_at()
+{
+	fusion f;
+	vec3f turn = {{0, 1.0f, 0}}, accel = {{0, 9.81f, 0}}, mag = {{0, 0, 0}};
+	quatf orient, expected;
+
+	ofusion_init(&f);
+	f.flags = 0;
+
+	TAssert(ofusion_get_orient_at(&f, 0, &orient) != 0);
+
+	// wrap the history a few times
+	for(int i = 0; i < FUSION_HISTORY_SIZE * 3; i++)
+		ofusion_update(&f, 0.001f, &turn, &accel, &mag);
+
+	TAssert(ofusion_get_last_time(&f) == f.history[(f.history_head - 1) & (FUSION_HISTORY_SIZE - 1)].time);
+
+	// exact hits and the midpoint between two entries
+	for(uint32_t i = f.history_head - 100; i < f.history_head - 1; i += 7){
+		fusion_history_entry* a = &f.history[i & (FUSION_HISTORY_SIZE - 1)];
+		fusion_history_entry* b = &f.history[(i + 1) & (FUSION_HISTORY_SIZE - 1)];
+
+		TAssert(ofusion_get_orient_at(&f, a->time, &orient) == 0);
+		TAssert(quatf_eq(orient, a->orient, t));
+
+		TAssert(ofusion_get_orient_at(&f, (a->time + b->time) / 2.0, &orient) == 0);
+		oquatf_slerp(0.5f, &a->orient, &b->orient, true, &expected);
+		TAssert(quatf_eq(orient, expected, t));
+	}
+
+	// clamped to the newest entry
+	TAssert(ofusion_get_orient_at(&f, ofusion_get_last_time(&f) + 1.0, &orient) == 0);
+	TAssert(quatf_eq(orient, f.orient, t));
+
+	// clamped to the oldest entry that is safe to read
+	TAssert(ofusion_get_orient_at(&f, 0, &orient) == 0);
+	uint32_t oldest = f.history_head - FUSION_HISTORY_SIZE + 16;
+	TAssert(quatf_eq(orient, f.history[oldest & (FUSION_HISTORY_SIZE - 1)].orient, t));
+}
+
+void test_ofusion_history_jitter()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_clock* clock = ohmd_create_virtual_clock(ctx, 0);
+	vec3f turn = {{0, 1.0f, 0}}, accel = {{0, 9.81f, 0}}, mag = {{0, 0, 0}};
+	quatf orient;
+	fusion f;
+
+	ofusion_init(&f);
+	f.clock = clock;
+
+	// samples arrive in order 1 to 5 ms after they were taken, now and then
+	// one right away, and the sensor's clock jitters against the host's
+	uint32_t seed = 1;
+	for(int i = 0; i < FUSION_HISTORY_SIZE * 2; i++){
+		seed = seed * 1103515245 + 12345;
+		double latency = (i % 100 == 99) ? 0.0001 : 0.001 + 0.004 * ((seed >> 16) & 0xff) / 255.0;
+		float dt = 0.001f + 0.0002f * (((seed >> 8) & 0xff) / 255.0f - 0.5f);
+
+		double arrival = (i + 1) * 0.001 + latency;
+		ohmd_virtual_clock_advance(clock, arrival - ohmd_clock_get_tick(clock));
+		ofusion_update(&f, dt, &turn, &accel, &mag);
+	}
+
+	// the stamps never go back in time
+	for(uint32_t i = f.history_head - FUSION_HISTORY_SIZE + 1; i < f.history_head; i++)
+		TAssert(f.history[i & (FUSION_HISTORY_SIZE - 1)].time >= f.history[(i - 1) & (FUSION_HISTORY_SIZE - 1)].time);
+
+	// so every entry is found by its stamp, the last of a run of equal ones
+	for(uint32_t i = f.history_head - 100; i < f.history_head - 1; i++){
+		fusion_history_entry* e = &f.history[i & (FUSION_HISTORY_SIZE - 1)];
+		if(e->time == f.history[(i + 1) & (FUSION_HISTORY_SIZE - 1)].time)
+			continue;
+
+		TAssert(ofusion_get_orient_at(&f, e->time, &orient) == 0);
+		TAssert(quatf_eq(orient, e->orient, t));
+	}
+
+	ohmd_destroy_virtual_clock(clock);
+	ohmd_ctx_destroy(ctx);
+}
+
+// Simulates a device with a biased gyro at 1 kHz, the readings are what a
+// device with the orientation truth would report
+static void simulate(fusion* f, quatf* truth, const vec3f* rate, const vec3f* bias, int samples)
+{
+	vec3f gravity = {{0, 9.81f, 0}}, mag = {{0, 0, 0}};
+
+	for(int i = 0; i < samples; i++){
+		ofusion_predict(truth, rate, 0.001f, truth);
+
+		quatf inv_truth = *truth;
+		oquatf_inverse(&inv_truth);
+
+		vec3f accel, gyro;
+		oquatf_get_rotated(&inv_truth, &gravity, &accel);
+
+		float noise = (i & 1) ? 0.002f : -0.002f;
+		for(int j = 0; j < 3; j++)
+			gyro.arr[j] = rate->arr[j] + bias->arr[j] + noise;
+
+		ofusion_update(f, 0.001f, &gyro, &accel, &mag);
+	}
+}
+
+// angle between where the filter and the truth think up is
+static float tilt_error(const quatf* orient, const quatf* truth)
+{
+	vec3f up = {{0, 1, 0}}, body_up, est_up;
+	quatf inv_truth = *truth;
+	oquatf_inverse(&inv_truth);
+
+	oquatf_get_rotated(&inv_truth, &up, &body_up);
+	oquatf_get_rotated(orient, &body_up, &est_up);
+
+	return ovec3f_get_angle(&up, &est_up);
+}
+
+// How far the estimated gyro bias is off, leaving out the part around the up
+// axis if only the current orientation could have shown it
+static float gyro_bias_error(const fusion* f, const vec3f* bias, const quatf* truth, bool around_up)
+{
+	vec3f up = {{0, 1, 0}}, body_up, estimate, error;
+	quatf inv_truth = *truth;
+	oquatf_inverse(&inv_truth);
+	oquatf_get_rotated(&inv_truth, &up, &body_up);
+
+	ofusion_get_gyro_bias(f, &estimate);
+	ovec3f_subtract(&estimate, bias, &error);
+
+	if(!around_up){
+		float along_up = ovec3f_get_dot(&error, &body_up);
+		for(int j = 0; j < 3; j++)
+			error.arr[j] -= along_up * body_up.arr[j];
+	}
+
+	return ovec3f_get_length(&error);
+}
+
+void test_ofusion_eskf()
+{
+	fusion f;
+	quatf truth;
+	vec3f x_axis = {{1, 0, 0}}, rest = {{0, 0, 0}}, turn = {{0, 0, 0.5f}};
+	vec3f bias = {{0.01f, -0.02f, 0.015f}};
+
+	ofusion_init(&f);
+	TAssert(ofusion_set_engine(&f, &ofusion_engine_eskf));
+	oquatf_init_axis(&truth, &x_axis, 0.5f);
+
+	// the first still reading levels the device
+	simulate(&f, &truth, &rest, &bias, 10);
+	TAssert(tilt_error(&f.orient, &truth) < 0.01f);
+
+	// at rest the bias is found for the axes gravity doesn't line up with
+	simulate(&f, &truth, &rest, &bias, 10000);
+	TAssert(tilt_error(&f.orient, &truth) < 0.005f);
+	TAssert(gyro_bias_error(&f, &bias, &truth, false) < 0.002f);
+
+	// held in another orientation, the rest of the bias is found too
+	simulate(&f, &truth, &turn, &bias, 2000);
+	simulate(&f, &truth, &rest, &bias, 15000);
+	TAssert(tilt_error(&f.orient, &truth) < 0.005f);
+	TAssert(gyro_bias_error(&f, &bias, &truth, true) < 0.002f);
+
+	// without it the bias is left in the rate
+	fusion plain;
+	ofusion_init(&plain);
+	oquatf_init_axis(&truth, &x_axis, 0.5f);
+	simulate(&plain, &truth, &rest, &bias, 1000);
+	TAssert(ovec3f_get_length(&plain.ang_vel) > 0.02f);
+}
+
+void test_ofusion_mahony()
+{
+	fusion f;
+	quatf truth;
+	vec3f x_axis = {{1, 0, 0}}, rest = {{0, 0, 0}};
+	vec3f bias = {{0.01f, -0.02f, 0.015f}};
+
+	ofusion_init(&f);
+	TAssert(ofusion_set_engine(&f, &ofusion_engine_mahony));
+	oquatf_init_axis(&truth, &x_axis, 0.5f);
+
+	simulate(&f, &truth, &rest, &bias, 1);
+	TAssert(tilt_error(&f.orient, &truth) < 0.01f);
+
+	// slower than the Kalman filter, but it gets there
+	simulate(&f, &truth, &rest, &bias, 30000);
+	TAssert(tilt_error(&f.orient, &truth) < 0.005f);
+	TAssert(gyro_bias_error(&f, &bias, &truth, false) < 0.002f);
+
+	// the corrected rate is what prediction uses
+	vec3f rate;
+	ofusion_get_prediction_rate(&f, &rate);
+	TAssert(ovec3f_get_length(&rate) < 0.03f);
+}
+
+static void bloated_init(fusion* me, void* state)
+{
+	TAssert(false);
+}
+
+void test_ofusion_engines()
+{
+	fusion single, batched;
+	ofusion_sample samples[3];
+
+	for(int j = 0; j < 3; j++){
+		ofusion_sample sample = {0.001f, {{0.3f, -0.2f * j, 0.1f}}, {{0.1f * j, 9.81f, 0.2f}}, {{0, 0, 0}}};
+		samples[j] = sample;
+	}
+
+	// engines take a whole batch, keeping the timing of each sample
+	ofusion_init(&single);
+	ofusion_init(&batched);
+	ofusion_set_engine(&single, &ofusion_engine_mahony);
+	ofusion_set_engine(&batched, &ofusion_engine_mahony);
+	for(int i = 0; i < 300; i++){
+		for(int j = 0; j < 3; j++)
+			ofusion_update(&single, samples[j].dt, &samples[j].ang_vel, &samples[j].accel, &samples[j].mag);
+
+		ofusion_update_batch(&batched, samples, 3);
+	}
+
+	TAssert(quatf_eq(single.orient, batched.orient, 0.01f));
+	TAssert(single.iterations == batched.iterations && float_eq(single.time, batched.time, 1e-6f));
+	TAssert(batched.history_head == single.history_head - 600);
+
+	// a state that doesn't fit is refused
+	ofusion_engine bloated = ofusion_engine_default;
+	bloated.state_size = FUSION_ENGINE_STATE_SIZE + 1;
+	bloated.init = bloated_init;
+	TAssert(!ofusion_set_engine(&batched, &bloated));
+	TAssert(batched.engine == &ofusion_engine_mahony);
+
+	// the engine is chosen when opening a device
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_device_settings* settings = ohmd_device_settings_create(ctx);
+	int engine = OHMD_FUSION_ENGINE_MAHONY;
+	TAssert(ohmd_device_settings_seti(settings, OHMD_IDS_FUSION_ENGINE, &engine) == OHMD_S_OK);
+	engine = 100;
+	TAssert(ohmd_device_settings_seti(settings, OHMD_IDS_FUSION_ENGINE, &engine) == OHMD_S_INVALID_PARAMETER);
+	engine = -1;
+	TAssert(ohmd_device_settings_seti(settings, OHMD_IDS_FUSION_ENGINE, &engine) == OHMD_S_INVALID_PARAMETER);
+	int use_mag = 1;
+	TAssert(ohmd_device_settings_seti(settings, OHMD_IDS_MAGNETOMETER, &use_mag) == OHMD_S_OK);
+	ohmd_device_settings_destroy(settings);
+	ohmd_ctx_destroy(ctx);
+}
+
+// The largest angle between per-sample updates and batches of size
+// samples on the stream, compared after each batch from sample from on
+static float batch_error(const ofusion_sample* stream, int count, int size, int from)
+{
+	fusion single, batched;
+	float max_error = 0;
+
+	ofusion_init(&single);
+	ofusion_init(&batched);
+
+	for(int i = 0; i + size <= count; i += size){
+		for(int j = i; j < i + size; j++)
+			ofusion_update(&single, stream[j].dt, &stream[j].ang_vel, &stream[j].accel, &stream[j].mag);
+
+		ofusion_update_batch(&batched, stream + i, size);
+
+		// twice the length of the vector part is the angle, for small ones
+		quatf diff;
+		oquatf_diff(&single.orient, &batched.orient, &diff);
+		vec3f axis = {{diff.x, diff.y, diff.z}};
+		if(i >= from)
+			max_error = OHMD_MAX(max_error, 2.0f * ovec3f_get_length(&axis));
+	}
+
+	TAssert(single.iterations == batched.iterations && float_eq(single.time, batched.time, 1e-4f));
+	TAssert(batched.history_head == single.history_head / size);
+
+	return max_error;
+}
+
+void test_ofusion_batch()
+{
+	// 1 kHz with a biased gyro: turning while tilted, at rest so that the
+	// tilt is set from gravity, turning and drifting, and at rest again past
+	// the 2000 samples from where gravity pulls the tilt in slowly
+	enum { count = 6144 };
+	static ofusion_sample stream[count];
+	vec3f gravity = {{0, 9.81f, 0}}, bias = {{0.05f, -0.03f, 0.04f}};
+	quatf truth = {{0.2f, 0, 0.1f, 1.0f}};
+	oquatf_normalize_me(&truth);
+
+	for(int i = 0; i < count; i++){
+		vec3f rate = {{0, 0, 0}};
+		if(i < 1000 || (i >= 2000 && i < 3000) || i >= 4500)
+			rate = (vec3f){{0.8f, 1.5f * sinf(i * 0.004f), -0.4f}};
+
+		ofusion_predict(&truth, &rate, 0.001f, &truth);
+
+		quatf inv_truth = truth;
+		oquatf_inverse(&inv_truth);
+
+		ofusion_sample sample = {0.001f, {{0, 0, 0}}, {{0, 0, 0}}, {{0, 0, 0}}};
+		ovec3f_subtract(&rate, &bias, &sample.ang_vel);
+		oquatf_get_rotated(&inv_truth, &gravity, &sample.accel);
+		stream[i] = sample;
+	}
+
+	// within FUSION_BATCH_TOLERANCE of updating sample by sample, once the
+	// tilt has been set in the first 2000 samples, when that can happen a
+	// batch later
+	float error_3 = batch_error(stream, count, 3, 2000);
+	float error_32 = batch_error(stream, count, FUSION_BATCH_SIZE, 2000);
+	TAssert(error_3 < FUSION_BATCH_TOLERANCE);
+	TAssert(error_32 < FUSION_BATCH_TOLERANCE);
+
+	// a batch of one is a sample
+	TAssert(batch_error(stream, count, 1, 0) < 1e-5f);
+}
+
+// The yaw of orient off from truth, signed
+static float yaw_error(const quatf* orient, const quatf* truth)
+{
+	quatf inv_truth = *truth, diff;
+	oquatf_inverse(&inv_truth);
+	oquatf_mult(orient, &inv_truth, &diff);
+
+	return 2.0f * atan2f(diff.y, diff.w);
+}
+
+#define MAG_RATE 1000
+#define MAG_SAMPLES (120 * MAG_RATE)
+
+// Two minutes of a headset with a biased gyro and a magnetometer with hard
+// and soft iron: turned every which way for 40 s, then looked around with
+// mostly yaw while the gyro bias around up grows as it warms up, which
+// gravity can't tell. A magnet is held next to it for 3 s at 100 s.
+static void make_mag_recording(ofusion_sample* samples, quatf* truth)
+{
+	const vec3f gravity = {{0, 9.81f, 0}}, field = {{0, -0.42f, 0.22f}};
+	const vec3f gyro_bias = {{0.002f, 0.01f, -0.003f}}, hard_iron = {{0.12f, -0.3f, 0.25f}};
+	const float soft_iron[3][3] = {{1.1f, 0.08f, 0.02f}, {0.08f, 0.92f, -0.05f}, {0.02f, -0.05f, 1.04f}};
+	const vec3f tilt_axis = {{1, 0, 0}};
+	uint32_t seed = 1;
+	quatf orient;
+
+	oquatf_init_axis(&orient, &tilt_axis, 0.2f);
+
+	for(int i = 0; i < MAG_SAMPLES; i++){
+		float t = i / (float)MAG_RATE;
+		vec3f rate = {{0.1f * sinf(0.9f * t), 0.8f * sinf(0.2f * t), 0.1f * cosf(0.7f * t)}};
+		if(t < 40.0f){
+			vec3f dance = {{1.2f * sinf(0.7f * t), 0.9f * sinf(0.31f * t + 1.0f), 1.1f * cosf(0.53f * t)}};
+			rate = dance;
+		}
+
+		ofusion_predict(&orient, &rate, 1.0f / MAG_RATE, &orient);
+		oquatf_normalize_me(&orient);
+		truth[i] = orient;
+
+		quatf inv_orient = orient;
+		oquatf_inverse(&inv_orient);
+
+		vec3f body_field;
+		ofusion_sample* s = &samples[i];
+		s->dt = 1.0f / MAG_RATE;
+		oquatf_get_rotated(&inv_orient, &gravity, &s->accel);
+		oquatf_get_rotated(&inv_orient, &field, &body_field);
+
+		for(int j = 0; j < 3; j++){
+			seed = seed * 1664525u + 1013904223u;
+			float noise = ((seed >> 8) / (float)(1 << 24) - 0.5f) * 0.006f;
+
+			s->ang_vel.arr[j] = rate.arr[j] + gyro_bias.arr[j];
+			if(j == 1 && t >= 40.0f)
+				s->ang_vel.y += 0.01f * OHMD_MIN((t - 40.0f) / 20.0f, 1.0f);
+			s->mag.arr[j] = hard_iron.arr[j] + noise + soft_iron[j][0] * body_field.x +
+				soft_iron[j][1] * body_field.y + soft_iron[j][2] * body_field.z;
+		}
+
+		if(t >= 100.0f && t < 103.0f)
+			s->mag.x += 0.3f;
+	}
+}
+
+void test_ofusion_mag()
+{
+	ofusion_sample* samples = malloc(MAG_SAMPLES * sizeof(ofusion_sample));
+	quatf* truth = malloc(MAG_SAMPLES * sizeof(quatf));
+	TAssert(samples && truth);
+	make_mag_recording(samples, truth);
+
+	fusion plain, corrected;
+	ofusion_init(&plain);
+	ofusion_init(&corrected);
+	ofusion_set_engine(&plain, &ofusion_engine_mahony);
+	ofusion_set_engine(&corrected, &ofusion_engine_mahony);
+	corrected.flags |= FF_USE_MAG;
+
+	// knocks the yaw off by 0.3 rad after a minute
+	vec3f up = {{0, 1, 0}};
+	quatf knock;
+	oquatf_init_axis(&knock, &up, 0.3f);
+
+	float held_yaw = 0, max_drift = 0;
+	for(int i = 0; i < MAG_SAMPLES; i++){
+		ofusion_sample* s = &samples[i];
+		bool had_reference = corrected.mag_cal.has_reference;
+
+		ofusion_update(&plain, s->dt, &s->ang_vel, &s->accel, &s->mag);
+		ofusion_update(&corrected, s->dt, &s->ang_vel, &s->accel, &s->mag);
+
+		if(i == 60 * MAG_RATE){
+			quatf orient = plain.orient;
+			oquatf_mult(&knock, &orient, &plain.orient);
+			orient = corrected.orient;
+			oquatf_mult(&knock, &orient, &corrected.orient);
+		}
+
+		// the yaw is held where it was when the correction began, also
+		// through the magnet, and back there 20 s after the knock
+		float yaw = yaw_error(&corrected.orient, &truth[i]);
+		if(!had_reference && corrected.mag_cal.has_reference)
+			held_yaw = yaw;
+		else if(had_reference && (i < 60 * MAG_RATE || i >= 80 * MAG_RATE))
+			max_drift = OHMD_MAX(max_drift, fabsf(yaw - held_yaw));
+	}
+
+	// it's calibrated within 20 s
+	TAssert(corrected.mag_cal.has_reference);
+	TAssert(max_drift < DEG_TO_RAD(1.0f));
+
+	// the yaw stays knocked off without
+	TAssert(fabsf(yaw_error(&plain.orient, &truth[MAG_SAMPLES - 1])) > 0.2f);
+
+	// the hard iron and the calibrated field are as recorded
+	vec3f hard_iron = {{0.12f, -0.3f, 0.25f}};
+	TAssert(vec3f_eq(corrected.mag_cal.hard_iron, hard_iron, 0.005f));
+	TAssert(float_eq(ovec3f_get_length(&corrected.mag), 1.0f, 0.02f));
+
+	// nothing changes with the flag off
+	TAssert(!plain.mag_cal.calibrated && plain.mag.x == samples[MAG_SAMPLES - 1].mag.x);
+
+	free(samples);
+	free(truth);
+}
@@ -0,0 +1,89 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Unit Tests - Device Group Fusion Tests */
+
+#include "tests.h"
+#include "fusion_group.h"
+
+// more devices than fit in one vector of any width, and not a multiple of one
+#define DEVICES 13
+#define SAMPLES 6000
+
+// The sample at i of a device turning while tilted, resting, turning and
+// resting again with a biased gyro, a little different for every device
+static void make_sample(int device, int i, quatf* truth, float* dt, vec3f* ang_vel, vec3f* accel)
+{
+	vec3f gravity = {{0, 9.81f, 0}};
+	vec3f bias = {{0.05f, -0.03f, 0.04f - 0.005f * device}};
+	vec3f rate = {{0, 0, 0}};
+
+	if(i < 1000 || (i >= 2000 && i < 3000) || i >= 4500){
+		rate.x = 0.8f - 0.1f * device;
+		rate.y = (1.0f + 0.2f * device) * sinf(i * 0.004f);
+		rate.z = -0.4f;
+	}
+
+	*dt = 0.001f * (1.0f + 0.05f * device);
+	ofusion_predict(truth, &rate, *dt, truth);
+
+	quatf inv_truth = *truth;
+	oquatf_inverse(&inv_truth);
+
+	ovec3f_subtract(&rate, &bias, ang_vel);
+	oquatf_get_rotated(&inv_truth, &gravity, accel);
+}
+
+void test_ofusion_group_update()
+{
+	fusion_group group;
+	fusion single[DEVICES];
+	quatf truth[DEVICES];
+
+	TAssert(ofusion_group_init(&group, DEVICES));
+	TAssert(group.count == DEVICES && group.stride >= DEVICES);
+
+	for(int i = 0; i < DEVICES; i++){
+		ofusion_init(&single[i]);
+
+		vec3f tilt_axis = {{1, 0, 0.1f * i}};
+		ovec3f_normalize_me(&tilt_axis);
+		oquatf_init_axis(&truth[i], &tilt_axis, 0.05f * i);
+	}
+
+	// every device follows what a fusion struct with the default engine does
+	float max_error = 0;
+	for(int i = 0; i < SAMPLES; i++){
+		for(int j = 0; j < DEVICES; j++){
+			float dt;
+			vec3f ang_vel, accel, mag = {{0, 0, 0}};
+			make_sample(j, i, &truth[j], &dt, &ang_vel, &accel);
+
+			ofusion_group_set_sample(&group, j, dt, &ang_vel, &accel);
+			ofusion_update(&single[j], dt, &ang_vel, &accel, &mag);
+		}
+
+		ofusion_group_update(&group);
+
+		for(int j = 0; j < DEVICES; j++){
+			quatf orient, diff;
+			ofusion_group_get_orient(&group, j, &orient);
+			oquatf_diff(&single[j].orient, &orient, &diff);
+
+			vec3f axis = {{diff.x, diff.y, diff.z}};
+			max_error = OHMD_MAX(max_error, 2.0f * ovec3f_get_length(&axis));
+		}
+	}
+
+	TAssert(max_error < FUSION_GROUP_TOLERANCE);
+
+	// and the tilt was pulled in as far
+	for(int j = 0; j < DEVICES; j++)
+		TAssert(float_eq(group.grav_error_angle[j], single[j].grav_error_angle, 1e-4f));
+
+	ofusion_group_free(&group);
+}
@@ -0,0 +1,442 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Unit Tests - HID Transport Tests */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <string.h>
+#include <wchar.h>
+#include "tests.h"
+#include "hid_mock.h"
+
+ohmd_hid_mock_device* mock_rift_dk2(ohmd_hid_mock* mock, const char* path, const char* serial)
+{
+	ohmd_hid_mock_device* dev = ohmd_hid_mock_add_device(mock, path, 0x2833, 0x0021, 0, "Oculus VR, Inc.", "Rift DK2", serial);
+	if(!dev)
+		return NULL;
+
+	unsigned char range[8] = { 4, 0, 0, 4, 250, 0, 0xe8, 0x03 };
+	unsigned char display_info[56] = { 9 };
+	unsigned char config[7] = { 2, 0, 0, 0, 0, 0x10, 0x27 };
+	ohmd_hid_mock_set_feature_report(dev, range, sizeof(range));
+	ohmd_hid_mock_set_feature_report(dev, display_info, sizeof(display_info));
+	ohmd_hid_mock_set_feature_report(dev, config, sizeof(config));
+
+	// one sample per report, turning around y
+	unsigned char report[64] = { 11 };
+	report[3] = 1;
+	report[12] = 0x00; report[13] = 0x40; // accel y
+	report[20] = 0x00; report[21] = 0x10; // gyro
+	ohmd_hid_mock_set_reports(dev, report, sizeof(report), 1, 0, -1);
+
+	return dev;
+}
+
+static void count_report(unsigned char* report, size_t size, uint64_t index, void* user_data)
+{
+	report[1] = (unsigned char)index;
+	(*(int*)user_data)++;
+}
+
+void test_hid_mock_enumerate()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+
+	ohmd_hid_mock_add_device(mock, "mock0", 0x1234, 0x0001, 0, "Vendor", "Product A", "A1");
+	ohmd_hid_mock_device* b = ohmd_hid_mock_add_device(mock, "mock1", 0x1234, 0x0002, 2, "Vendor", "Product B", "B1");
+	ohmd_hid_mock_add_device(mock, "mock2", 0x4321, 0x0002, 0, "Other", "Product C", "C1");
+
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	// filter on vendor only, then on both
+	int count = 0;
+	ohmd_hid_device_info* devs = ohmd_hid_enumerate(ctx, 0x1234, 0);
+	for(ohmd_hid_device_info* cur = devs; cur; cur = cur->next)
+		count++;
+	TAssert(count == 2);
+	ohmd_hid_free_enumeration(ctx, devs);
+
+	devs = ohmd_hid_enumerate(ctx, 0x1234, 0x0002);
+	TAssert(devs && !devs->next);
+	TAssert(strcmp(devs->path, "mock1") == 0);
+	TAssert(devs->interface_number == 2);
+	TAssert(wcscmp(devs->product_string, L"Product B") == 0);
+	TAssert(wcscmp(devs->serial_number, L"B1") == 0);
+
+	ohmd_hid_device* dev = ohmd_hid_open_path(ctx, devs->path);
+	ohmd_hid_free_enumeration(ctx, devs);
+	TAssert(dev);
+
+	wchar_t str[32];
+	TAssert(ohmd_hid_get_manufacturer_string(dev, str, 32) == 0);
+	TAssert(wcscmp(str, L"Vendor") == 0);
+	TAssert(ohmd_hid_get_serial_number_string(dev, str, 32) == 0);
+	TAssert(wcscmp(str, L"B1") == 0);
+
+	// the mock has no descriptor to wait on
+	TAssert(ohmd_hid_get_fd(dev) == -1);
+
+	ohmd_hid_mock_stats stats;
+	ohmd_hid_mock_get_stats(b, &stats);
+	TAssert(stats.open_count == 1);
+
+	ohmd_hid_close(dev);
+	ohmd_hid_mock_get_stats(b, &stats);
+	TAssert(stats.open_count == 0);
+
+	TAssert(ohmd_hid_open_path(ctx, "nonexistent") == NULL);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+void test_hid_mock_feature_reports()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_device* mdev = ohmd_hid_mock_add_device(mock, "mock0", 0x1234, 0x0001, 0, "Vendor", "Product", "1");
+
+	unsigned char config[] = { 2, 0, 0, 0x30, 1, 0x10, 0x27 };
+	ohmd_hid_mock_set_feature_report(mdev, config, sizeof(config));
+
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+	ohmd_hid_device* dev = ohmd_hid_open_path(ctx, "mock0");
+	TAssert(dev);
+
+	unsigned char buf[64] = { 2 };
+	TAssert(ohmd_hid_get_feature_report(dev, buf, sizeof(buf)) == sizeof(config));
+	TAssert(memcmp(buf, config, sizeof(config)) == 0);
+
+	// unknown report ids fail like a stalled control transfer
+	buf[0] = 9;
+	TAssert(ohmd_hid_get_feature_report(dev, buf, sizeof(buf)) == -1);
+
+	// a sent report is what's read back
+	unsigned char new_config[] = { 2, 0, 0, 0x31, 1, 0x10, 0x27 };
+	TAssert(ohmd_hid_send_feature_report(dev, new_config, sizeof(new_config)) == sizeof(new_config));
+
+	buf[0] = 2;
+	TAssert(ohmd_hid_get_feature_report(dev, buf, sizeof(buf)) == sizeof(new_config));
+	TAssert(buf[3] == 0x31);
+
+	TAssert(ohmd_hid_write(dev, config, sizeof(config)) == sizeof(config));
+
+	ohmd_hid_mock_stats stats;
+	ohmd_hid_mock_get_stats(mdev, &stats);
+	TAssert(stats.feature_reports_sent == 1);
+	TAssert(stats.writes == 1);
+
+	ohmd_hid_close(dev);
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+void test_hid_mock_reports()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_device* mdev = ohmd_hid_mock_add_device(mock, "mock0", 0x1234, 0x0001, 0, "Vendor", "Product", "1");
+
+	unsigned char reports[3][8] = { { 11 }, { 12 }, { 13 } };
+	int callbacks = 0;
+
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+	ohmd_hid_device* dev = ohmd_hid_open_path(ctx, "mock0");
+	TAssert(dev);
+	TAssert(ohmd_hid_set_nonblocking(dev, 1) == 0);
+
+	unsigned char buf[64];
+
+	// nothing scripted, nothing to read
+	TAssert(ohmd_hid_read(dev, buf, sizeof(buf)) == 0);
+
+	// the stream repeats in order, the callback sees every report
+	ohmd_hid_mock_set_reports(mdev, reports[0], 8, 3, 0, 10);
+	ohmd_hid_mock_set_report_callback(mdev, count_report, &callbacks);
+
+	for(int i = 0; i < 10; i++){
+		TAssert(ohmd_hid_read(dev, buf, sizeof(buf)) == 8);
+		TAssert(buf[0] == 11 + i % 3);
+		TAssert(buf[1] == i);
+	}
+
+	TAssert(callbacks == 10);
+
+	// and ends after total reports
+	TAssert(ohmd_hid_read(dev, buf, sizeof(buf)) == 0);
+
+	// unlimited at rate 0 comes in bursts of a device buffer, so drain loops end
+	ohmd_hid_mock_set_reports(mdev, reports[0], 8, 3, 0, -1);
+	for(int burst = 0; burst < 3; burst++){
+		int read = 0;
+		while(ohmd_hid_read(dev, buf, sizeof(buf)) > 0)
+			read++;
+		TAssert(read == OHMD_HID_MOCK_BUFFER_REPORTS);
+	}
+
+	// with a rate the reports not read in time are dropped
+	ohmd_hid_mock_stats stats;
+	ohmd_hid_mock_get_stats(mdev, &stats);
+	TAssert(stats.reports_dropped == 0);
+
+	ohmd_hid_mock_set_reports(mdev, reports[0], 8, 3, 10000.0, -1);
+	ohmd_sleep(0.05);
+
+	int read = 0;
+	while(ohmd_hid_read(dev, buf, sizeof(buf)) > 0)
+		read++;
+
+	// ~500 were due, only a buffer full plus the few due while reading are left
+	TAssert(read >= OHMD_HID_MOCK_BUFFER_REPORTS && read < 200);
+
+	ohmd_hid_mock_get_stats(mdev, &stats);
+	TAssert(stats.reports_dropped > 200);
+	TAssert(stats.reports_read == 10 + 3 * OHMD_HID_MOCK_BUFFER_REPORTS + (uint64_t)read);
+
+	ohmd_hid_close(dev);
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+static int count_class(ohmd_context* ctx, int num_devices, int device_class)
+{
+	int count = 0;
+	for(int i = 0; i < num_devices; i++){
+		int cls = -1;
+		ohmd_list_geti(ctx, i, OHMD_DEVICE_CLASS, &cls);
+		count += cls == device_class;
+	}
+
+	return count;
+}
+
+void test_hid_probe()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_add_device(mock, "mock0", 0x1234, 0x0001, 0, "Vendor", "Product A", "A1");
+	ohmd_hid_mock_add_device(mock, "mock1", 0x1234, 0x0002, 0, "Vendor", "Product B", "B1");
+	ohmd_hid_mock_add_device(mock, "mock2", 0x4321, 0x0002, 0, "Other", "Product C", "C1");
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	// all the drivers share one enumeration
+	int num_devices = ohmd_ctx_probe(ctx);
+	TAssert(ohmd_hid_mock_get_num_enumerations(mock) == 1);
+
+	ohmd_hid_device_info* dev = ohmd_hid_next_device(ctx, NULL, 0x1234, 0);
+	TAssert(dev && strcmp(dev->path, "mock0") == 0);
+	dev = ohmd_hid_next_device(ctx, dev, 0x1234, 0);
+	TAssert(dev && strcmp(dev->path, "mock1") == 0);
+	TAssert(ohmd_hid_next_device(ctx, dev, 0x1234, 0) == NULL);
+
+	dev = ohmd_hid_next_device(ctx, NULL, 0, 0x0002);
+	TAssert(dev && strcmp(dev->path, "mock1") == 0);
+	dev = ohmd_hid_next_device(ctx, dev, 0, 0x0002);
+	TAssert(dev && strcmp(dev->path, "mock2") == 0);
+
+	const ohmd_hid_match found[] = { { 0x9999, 0x0001 }, { 0x4321, 0 }, { 0, 0 } };
+	const ohmd_hid_match missing[] = { { 0x9999, 0x0001 }, { 0x1234, 0x0003 }, { 0, 0 } };
+	TAssert(ohmd_hid_probe_matches(ctx, found));
+	TAssert(!ohmd_hid_probe_matches(ctx, missing));
+
+	// only the selected classes are listed
+	int classes = 1 << OHMD_DEVICE_CLASS_CONTROLLER;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_PROBE_DEVICE_CLASSES, &classes) == OHMD_S_OK);
+	int num_controllers = ohmd_ctx_probe(ctx);
+	TAssert(num_controllers == count_class(ctx, num_controllers, OHMD_DEVICE_CLASS_CONTROLLER));
+	TAssert(num_controllers <= num_devices);
+	TAssert(ohmd_hid_mock_get_num_enumerations(mock) == 2);
+
+	classes = 0;
+	ohmd_ctx_seti(ctx, OHMD_ICS_PROBE_DEVICE_CLASSES, &classes);
+	TAssert(ohmd_ctx_probe(ctx) == num_devices);
+
+	// other vendors are hidden from the drivers while probing
+	int vendors[OHMD_MAX_PROBE_VENDORS] = { 0x4321 };
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_PROBE_VENDOR_IDS, vendors) == OHMD_S_OK);
+	ohmd_ctx_probe(ctx);
+
+	ctx->probing = true;
+	TAssert(ohmd_hid_next_device(ctx, NULL, 0x1234, 0) == NULL);
+	TAssert(!ohmd_hid_probe_matches(ctx, missing));
+	ctx->probing = false;
+	TAssert(ohmd_hid_next_device(ctx, NULL, 0x1234, 0) != NULL);
+
+	int out[OHMD_MAX_PROBE_VENDORS];
+	ohmd_ctx_geti(ctx, OHMD_ICS_PROBE_VENDOR_IDS, out);
+	TAssert(out[0] == 0x4321 && out[1] == 0);
+
+	vendors[1] = 0x10000;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_PROBE_VENDOR_IDS, vendors) == OHMD_S_INVALID_PARAMETER);
+
+	// a new transport drops the devices of the old one
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+	TAssert(ohmd_hid_next_device(ctx, NULL, 0, 0) == NULL);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+static int find_path(ohmd_context* ctx, int num_devices, const char* path)
+{
+	for(int i = 0; i < num_devices; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PATH), path) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+void test_hid_hotplug()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_device* first = ohmd_hid_mock_add_device(mock, "mock-dk2-a", 0x2833, 0x0021, 0, "Oculus VR, Inc.", "Rift DK2", "A");
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	int first_index = find_path(ctx, num_devices, "mock-dk2-a");
+	if(first_index == -1){
+		// no rift driver to list the devices
+		ohmd_ctx_destroy(ctx);
+		ohmd_hid_mock_destroy(mock);
+		return;
+	}
+
+	ohmd_hotplug_event event;
+	TAssert(ohmd_ctx_poll_hotplug(ctx, &event) == 0);
+
+	int on = 1;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_HOTPLUG_MONITOR, &on) == OHMD_S_OK);
+	int out = 0;
+	ohmd_ctx_geti(ctx, OHMD_ICS_HOTPLUG_MONITOR, &out);
+	TAssert(out == 1);
+
+	// catching up finds nothing new, and looking again without a change doesn't enumerate
+	TAssert(ohmd_ctx_poll_hotplug(ctx, &event) == 0);
+	int enumerations = ohmd_hid_mock_get_num_enumerations(mock);
+	TAssert(ohmd_ctx_poll_hotplug(ctx, &event) == 0);
+	TAssert(ohmd_hid_mock_get_num_enumerations(mock) == enumerations);
+
+	// a new device goes to the end of the list
+	ohmd_hid_mock_add_device(mock, "mock-dk2-b", 0x2833, 0x0021, 0, "Oculus VR, Inc.", "Rift DK2", "B");
+	TAssert(ohmd_ctx_poll_hotplug(ctx, &event) == 1);
+	TAssert(event.type == OHMD_HOTPLUG_ADDED && event.index == num_devices);
+	TAssert(event.device_class == OHMD_DEVICE_CLASS_HMD);
+	TAssert(strcmp(event.path, "mock-dk2-b") == 0 && strcmp(event.product, "Rift (DK2)") == 0);
+	TAssert(strcmp(ohmd_list_gets(ctx, num_devices, OHMD_PATH), "mock-dk2-b") == 0);
+	TAssert(ohmd_ctx_poll_hotplug(ctx, &event) == 0);
+
+	// a device unplugged is taken out, the ones after it move down
+	ohmd_hid_mock_set_plugged(first, false);
+	TAssert(ohmd_ctx_wait_hotplug(ctx, 1.0, &event) == 1);
+	TAssert(event.type == OHMD_HOTPLUG_REMOVED && event.index == first_index);
+	TAssert(strcmp(event.path, "mock-dk2-a") == 0);
+	TAssert(find_path(ctx, num_devices, "mock-dk2-a") == -1);
+	TAssert(find_path(ctx, num_devices, "mock-dk2-b") == num_devices - 1);
+
+	double start = ohmd_get_tick();
+	TAssert(ohmd_ctx_wait_hotplug(ctx, 0.05, &event) == 0);
+	TAssert(ohmd_get_tick() - start >= 0.04);
+
+	// and plugging it back in adds it again
+	ohmd_hid_mock_set_plugged(first, true);
+	TAssert(ohmd_ctx_wait_hotplug(ctx, 1.0, &event) == 1);
+	TAssert(event.type == OHMD_HOTPLUG_ADDED && event.index == num_devices);
+	TAssert(strcmp(event.path, "mock-dk2-a") == 0);
+
+	// a probe starts over
+	ohmd_hid_mock_set_plugged(first, false);
+	TAssert(ohmd_ctx_probe(ctx) == num_devices);
+	TAssert(ohmd_ctx_poll_hotplug(ctx, &event) == 0);
+
+	int off = 0;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_HOTPLUG_MONITOR, &off) == OHMD_S_OK);
+	ohmd_hid_mock_set_plugged(first, true);
+	TAssert(ohmd_ctx_poll_hotplug(ctx, &event) == 0);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+
+void test_hid_reconnect()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	ohmd_hid_mock_device* mdev = mock_rift_dk2(mock, "mock-dk2-a", "RECONNECT");
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	int cache = OHMD_DEVICE_CACHE_OFF;
+	ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &cache);
+
+	int idx = find_path(ctx, ohmd_ctx_probe(ctx), "mock-dk2-a");
+	if(idx == -1){
+		// no rift driver to reconnect
+		ohmd_ctx_destroy(ctx);
+		ohmd_hid_mock_destroy(mock);
+		return;
+	}
+
+	ohmd_device_settings* settings = ohmd_device_settings_create(ctx);
+	int auto_update = 0;
+	ohmd_device_settings_seti(settings, OHMD_IDS_AUTOMATIC_UPDATE, &auto_update);
+	ohmd_device* device = ohmd_list_open_device_s(ctx, idx, settings);
+	ohmd_device_settings_destroy(settings);
+	TAssert(device && device->reopen);
+
+	for(int i = 0; i < 10; i++)
+		ohmd_ctx_update(ctx);
+
+	quatf before;
+	ohmd_device_getf(device, OHMD_ROTATION_QUAT, before.arr);
+	int iterations = device->sensor_fusion->iterations;
+	TAssert(iterations > 0 && before.w < 0.9999f);
+
+	// the link drops, the device is kept as it was meanwhile
+	ohmd_hid_mock_set_plugged(mdev, false);
+	ohmd_ctx_update(ctx);
+	TAssert(device->lost);
+	ohmd_ctx_update(ctx);
+	TAssert(device->sensor_fusion->iterations == iterations);
+
+	// and comes back under another path, found by its serial number
+	ohmd_hid_mock_device* back = mock_rift_dk2(mock, "mock-dk2-b", "RECONNECT");
+
+	double start = ohmd_get_tick();
+	while(ohmd_atomic_load(&device->lost) && ohmd_get_tick() - start < 1.0)
+		ohmd_sleep(0.001);
+	TAssert(!device->lost);
+
+	// the fusion carries on from where it was, no warm-up from scratch
+	quatf after;
+	ohmd_device_getf(device, OHMD_ROTATION_QUAT, after.arr);
+	TAssert(float_eq(after.w, before.w, 1e-6f) && float_eq(after.y, before.y, 1e-6f));
+	TAssert(device->sensor_fusion->iterations == iterations);
+
+	ohmd_ctx_update(ctx);
+	TAssert(device->sensor_fusion->iterations > iterations);
+
+	ohmd_hid_mock_stats stats;
+	ohmd_hid_mock_get_stats(back, &stats);
+	TAssert(stats.reports_read > 0);
+
+	// closing it while it's being reconnected stops that, a device showing
+	// up afterwards isn't resumed into the closed one
+	ohmd_hid_mock_set_plugged(back, false);
+	ohmd_ctx_update(ctx);
+	TAssert(device->lost);
+
+	ohmd_close_device(device);
+	mock_rift_dk2(mock, "mock-dk2-c", "RECONNECT");
+	ohmd_sleep(0.05);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
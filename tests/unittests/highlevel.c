@@ -7,8 +7,10 @@
 
 /* Unit Tests - High-level functions */
 
+#include <string.h>
 #include "tests.h"
 #include "openhmd.h"
+#include "hid_mock.h"
 
 void test_highlevel_open_close_device()
 {
@@ -67,3 +69,541 @@ void test_highlevel_open_close_many_devices()
 	
 	ohmd_ctx_destroy(ctx);	
 }
+
+#define FARM_SIZE 300
+
+static bool active_devices_consistent(ohmd_context* ctx)
+{
+	for(int i = 0; i < ctx->num_active_devices; i++){
+		if(ctx->active_devices[i]->active_device_idx != i)
+			return false;
+	}
+
+	return true;
+}
+
+void test_highlevel_device_farm()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+
+	// more trackers than any fixed size list would take
+	for(int i = 0; i < FARM_SIZE; i++){
+		char path[32], serial[32];
+		snprintf(path, sizeof(path), "mock-dk2-%d", i);
+		snprintf(serial, sizeof(serial), "FARM%d", i);
+		TAssert(ohmd_hid_mock_add_device(mock, path, 0x2833, 0x0021, 0, "Oculus VR, Inc.", "Rift DK2", serial));
+	}
+
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	int num_rifts = 0;
+	for(int i = 0; i < num_devices; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PRODUCT), "Rift (DK2)") == 0)
+			num_rifts++;
+	}
+
+	// unless there's no rift driver to list them
+	TAssert(num_rifts == FARM_SIZE || num_rifts == 0);
+
+	// as many null devices, updated by the update threads
+	static ohmd_device* devices[FARM_SIZE];
+	for(int i = 0; i < FARM_SIZE; i++){
+		devices[i] = ohmd_list_open_device(ctx, num_devices - 1);
+		TAssert(devices[i]);
+	}
+
+	TAssert(ctx->num_active_devices == FARM_SIZE && active_devices_consistent(ctx));
+
+	static ohmd_device_pose poses[FARM_SIZE];
+	TAssert(ohmd_ctx_get_poses(ctx, poses, FARM_SIZE) == FARM_SIZE);
+
+	// closing takes them out from anywhere in the list
+	for(int i = 0; i < FARM_SIZE; i += 2)
+		TAssert(ohmd_close_device(devices[i]) == 0);
+
+	TAssert(ctx->num_active_devices == FARM_SIZE / 2 && active_devices_consistent(ctx));
+	TAssert(ohmd_ctx_get_poses(ctx, poses, FARM_SIZE) == FARM_SIZE / 2);
+
+	// the ones left, each of them once
+	int found = 0;
+	for(int i = 0; i < FARM_SIZE / 2; i++){
+		for(int j = 1; j < FARM_SIZE; j += 2)
+			found += poses[i].device == devices[j];
+	}
+	TAssert(found == FARM_SIZE / 2);
+
+	for(int i = FARM_SIZE - 1; i > 0; i -= 2)
+		TAssert(ohmd_close_device(devices[i]) == 0);
+
+	TAssert(ctx->num_active_devices == 0);
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+typedef struct {
+	ohmd_device* hmd;
+	volatile bool done;
+} pose_writer_args;
+
+static const quatf pose_q1 = {{0.5f, 0.5f, 0.5f, 0.5f}};
+static const quatf pose_q2 = {{0, 0.70710678f, 0, 0.70710678f}};
+
+static unsigned int pose_writer(void* arg)
+{
+	pose_writer_args* args = (pose_writer_args*)arg;
+
+	for(int i = 0; i < 20000; i++)
+		ohmd_device_setf(args->hmd, OHMD_ROTATION_QUAT, (i & 1) ? pose_q1.arr : pose_q2.arr);
+
+	args->done = true;
+	return 0;
+}
+
+static bool pose_quat_eq(const quatf* q1, const quatf* q2)
+{
+	for(int i = 0; i < 4; i++)
+		if(!float_eq(q1->arr[i], q2->arr[i], 0.001f))
+			return false;
+
+	return true;
+}
+
+void test_highlevel_pose_consistency()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	TAssert(ctx);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	TAssert(num_devices > 0);
+
+	ohmd_device* hmd = ohmd_list_open_device(ctx, num_devices - 1);
+	TAssert(hmd);
+
+	quatf q;
+	TAssert(ohmd_device_getf(hmd, OHMD_ROTATION_QUAT, q.arr) == 0);
+	TAssert(float_eq(q.w, 1.0f, 0.001f));
+
+	// readers must only ever see one of the poses written, never a mix of both
+	pose_writer_args args = { hmd, false };
+	ohmd_thread* writer = ohmd_create_thread(ctx, pose_writer, &args);
+	TAssert(writer);
+
+	while(!args.done){
+		ohmd_device_getf(hmd, OHMD_ROTATION_QUAT, q.arr);
+		TAssert(pose_quat_eq(&q, &pose_q1) || pose_quat_eq(&q, &pose_q2) || float_eq(q.w, 1.0f, 0.001f));
+	}
+
+	ohmd_destroy_thread(writer);
+
+	ohmd_device_getf(hmd, OHMD_ROTATION_QUAT, q.arr);
+	TAssert(pose_quat_eq(&q, &pose_q1));
+
+	ohmd_ctx_destroy(ctx);
+}
+
+void test_highlevel_external_sensor_fusion()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	TAssert(ctx);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	for(int i = 0; i < num_devices; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PRODUCT), "External Device") != 0)
+			continue;
+
+		ohmd_device_settings* settings = ohmd_device_settings_create(ctx);
+		ohmd_device* hmd = ohmd_list_open_device_s(ctx, i, settings);
+		ohmd_device_settings_destroy(settings);
+		TAssert(hmd);
+
+		// the pose read back is the one fused from the sample, without an update
+		float sample[10] = { 0.01f, 0, 20.0f, 0, 0, 9.81f, 0, 0, 0, 0 };
+		TAssert(ohmd_device_setf(hmd, OHMD_EXTERNAL_SENSOR_FUSION, sample) == OHMD_S_OK);
+
+		quatf q;
+		TAssert(ohmd_device_getf(hmd, OHMD_ROTATION_QUAT, q.arr) == OHMD_S_OK);
+		TAssert(q.w < 0.999f && pose_quat_eq(&q, &hmd->sensor_fusion->orient));
+	}
+
+	ohmd_ctx_destroy(ctx);
+}
+
+void test_highlevel_get_poses()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	TAssert(ctx);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	TAssert(num_devices > 0);
+
+	ohmd_device* hmds[3];
+	for(int i = 0; i < 3; i++){
+		hmds[i] = ohmd_list_open_device(ctx, num_devices - 1);
+		TAssert(hmds[i]);
+	}
+
+	ohmd_device_setf(hmds[1], OHMD_ROTATION_QUAT, pose_q1.arr);
+	ohmd_ctx_update(ctx);
+
+	ohmd_device_pose poses[4];
+	TAssert(ohmd_ctx_get_poses(ctx, poses, 2) == 2);
+	TAssert(ohmd_ctx_get_poses(ctx, poses, 4) == 3);
+
+	// the snapshot matches what the single value getters return
+	for(int i = 0; i < 3; i++){
+		float rot[4], pos[3], left[16], right[16];
+
+		TAssert(poses[i].device == hmds[i]);
+
+		ohmd_device_getf(hmds[i], OHMD_ROTATION_QUAT, rot);
+		ohmd_device_getf(hmds[i], OHMD_POSITION_VECTOR, pos);
+		ohmd_device_getf(hmds[i], OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX, left);
+		ohmd_device_getf(hmds[i], OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX, right);
+
+		TAssert(memcmp(rot, poses[i].rotation, sizeof(rot)) == 0);
+		TAssert(memcmp(pos, poses[i].position, sizeof(pos)) == 0);
+		TAssert(memcmp(left, poses[i].left_eye_modelview, sizeof(left)) == 0);
+		TAssert(memcmp(right, poses[i].right_eye_modelview, sizeof(right)) == 0);
+	}
+
+	// the devices left come in no particular order
+	ohmd_close_device(hmds[0]);
+	TAssert(ohmd_ctx_get_poses(ctx, poses, 4) == 2);
+	TAssert((poses[0].device == hmds[1] && poses[1].device == hmds[2]) ||
+	        (poses[0].device == hmds[2] && poses[1].device == hmds[1]));
+
+	ohmd_ctx_destroy(ctx);
+}
+
+void test_highlevel_eye_matrix_cache()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	TAssert(ctx);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	TAssert(num_devices > 0);
+
+	ohmd_device* hmd = ohmd_list_open_device(ctx, num_devices - 1);
+	TAssert(hmd);
+
+	float left[16], right[16], again[16], proj[16];
+
+	// repeated queries return the cached matrix
+	ohmd_device_getf(hmd, OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX, left);
+	ohmd_device_getf(hmd, OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX, again);
+	TAssert(memcmp(left, again, sizeof(left)) == 0);
+
+	// an IPD change is picked up, the eyes are shifted by half of it each way
+	float ipd = 0.1f;
+	ohmd_device_setf(hmd, OHMD_EYE_IPD, &ipd);
+	ohmd_device_getf(hmd, OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX, left);
+	ohmd_device_getf(hmd, OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX, right);
+	TAssert(float_eq(left[12] - right[12], ipd, 0.0001f));
+
+	// so is a rotation change
+	ohmd_device_setf(hmd, OHMD_ROTATION_QUAT, pose_q2.arr);
+	ohmd_device_getf(hmd, OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX, again);
+	TAssert(memcmp(left, again, sizeof(left)) != 0);
+
+	// projections are the transposed device properties
+	mat4x4f expected;
+	omat4x4f_transpose(&hmd->properties.proj_left, &expected);
+	ohmd_device_getf(hmd, OHMD_LEFT_EYE_GL_PROJECTION_MATRIX, proj);
+	TAssert(memcmp(proj, &expected, sizeof(proj)) == 0);
+
+	omat4x4f_transpose(&hmd->properties.proj_right, &expected);
+	ohmd_device_getf(hmd, OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX, proj);
+	TAssert(memcmp(proj, &expected, sizeof(proj)) == 0);
+
+	ohmd_ctx_destroy(ctx);
+}
+
+void test_highlevel_update_workers()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	TAssert(ctx);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	TAssert(num_devices > 0);
+
+	int workers = 0;
+	TAssert(ohmd_ctx_geti(ctx, OHMD_ICS_UPDATE_WORKERS, &workers) == OHMD_S_OK);
+	TAssert(workers == 1);
+
+	workers = 0;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_UPDATE_WORKERS, &workers) != OHMD_S_OK);
+	workers = OHMD_MAX_UPDATE_WORKERS + 1;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_UPDATE_WORKERS, &workers) != OHMD_S_OK);
+
+	workers = 3;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_UPDATE_WORKERS, &workers) == OHMD_S_OK);
+
+	ohmd_device* hmds[8];
+	for(int i = 0; i < 8; i++){
+		hmds[i] = ohmd_list_open_device(ctx, num_devices - 1);
+		TAssert(hmds[i]);
+		TAssert(hmds[i]->update_worker == i % 3);
+	}
+
+	// the devices keep updating while the workers are restarted
+	workers = 2;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_UPDATE_WORKERS, &workers) == OHMD_S_OK);
+	TAssert(ohmd_ctx_geti(ctx, OHMD_ICS_UPDATE_WORKERS, &workers) == OHMD_S_OK);
+	TAssert(workers == 2);
+
+	for(int i = 0; i < 8; i++)
+		TAssert(hmds[i]->update_worker == i % 2);
+
+	ohmd_sleep(0.01);
+
+	for(int i = 0; i < 8; i += 2)
+		TAssert(ohmd_close_device(hmds[i]) == 0);
+
+	float rot[4];
+	for(int i = 1; i < 8; i += 2)
+		TAssert(ohmd_device_getf(hmds[i], OHMD_ROTATION_QUAT, rot) == OHMD_S_OK);
+
+	// devices opened in the background while the workers change all end up
+	// with one of the workers
+	ohmd_open_request* requests[16];
+	for(int i = 0; i < 16; i++){
+		requests[i] = ohmd_list_open_device_async(ctx, num_devices - 1, NULL, NULL, NULL);
+		TAssert(requests[i]);
+
+		workers = 1 + i % OHMD_MAX_UPDATE_WORKERS;
+		TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_UPDATE_WORKERS, &workers) == OHMD_S_OK);
+	}
+
+	for(int i = 0; i < 16; i++){
+		ohmd_device* device = ohmd_open_request_wait(requests[i]);
+		TAssert(device && device->update_worker < workers);
+		ohmd_open_request_destroy(requests[i]);
+	}
+
+	// the remaining devices get closed with the context
+	ohmd_ctx_destroy(ctx);
+}
+
+void test_highlevel_thread_settings()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	TAssert(ctx);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	TAssert(num_devices > 0);
+
+	int in_effect[4];
+	TAssert(ohmd_ctx_geti(ctx, OHMD_ICS_THREAD_SETTINGS_IN_EFFECT, in_effect) == OHMD_S_OK);
+	TAssert(in_effect[0] == OHMD_SCHED_NORMAL && in_effect[2] == 0 && in_effect[3] == 0);
+
+	int val = 42;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_THREAD_SCHED_POLICY, &val) != OHMD_S_OK);
+
+	ohmd_device* hmd = ohmd_list_open_device(ctx, num_devices - 1);
+	TAssert(hmd);
+
+	// applied to the running update thread, real-time scheduling may be
+	// refused without privileges
+	val = OHMD_SCHED_FIFO;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_THREAD_SCHED_POLICY, &val) == OHMD_S_OK);
+	val = 10;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_THREAD_SCHED_PRIORITY, &val) == OHMD_S_OK);
+	val = 1;
+	TAssert(ohmd_ctx_seti(ctx, OHMD_ICS_THREAD_CPU_AFFINITY, &val) == OHMD_S_OK);
+
+	TAssert(ohmd_ctx_geti(ctx, OHMD_ICS_THREAD_SCHED_POLICY, &val) == OHMD_S_OK && val == OHMD_SCHED_FIFO);
+	TAssert(ohmd_ctx_geti(ctx, OHMD_ICS_THREAD_SCHED_PRIORITY, &val) == OHMD_S_OK && val == 10);
+
+	TAssert(ohmd_ctx_geti(ctx, OHMD_ICS_THREAD_SETTINGS_IN_EFFECT, in_effect) == OHMD_S_OK);
+	TAssert((in_effect[0] == OHMD_SCHED_FIFO && in_effect[1] == 10) || (in_effect[0] == OHMD_SCHED_NORMAL && in_effect[1] == 0));
+	TAssert(in_effect[2] == 0 || in_effect[2] == 1);
+
+	// the device is still updated
+	ohmd_sleep(0.01);
+	float rot[4];
+	TAssert(ohmd_device_getf(hmd, OHMD_ROTATION_QUAT, rot) == OHMD_S_OK);
+
+	ohmd_ctx_destroy(ctx);
+}
+
+static void count_opened(ohmd_device* device, void* user_data)
+{
+	if(device)
+		ohmd_atomic_add((volatile uint32_t*)user_data, 1);
+}
+
+void test_highlevel_open_device_async()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	TAssert(ctx);
+
+	int num_devices = ohmd_ctx_probe(ctx);
+	TAssert(num_devices > 0);
+
+	TAssert(ohmd_list_open_device_async(ctx, num_devices, NULL, NULL, NULL) == NULL);
+
+	// open all of them at once
+	volatile uint32_t opened = 0;
+	ohmd_open_request* requests[16];
+	for(int i = 0; i < num_devices; i++){
+		requests[i] = ohmd_list_open_device_async(ctx, i, NULL, count_opened, (void*)&opened);
+		TAssert(requests[i]);
+	}
+
+	for(int i = 0; i < num_devices; i++){
+		ohmd_device* device = ohmd_open_request_wait(requests[i]);
+		TAssert(device);
+		TAssert(ohmd_open_request_is_done(requests[i]));
+		TAssert(ohmd_open_request_wait(requests[i]) == device);
+
+		float quat[4];
+		TAssert(ohmd_device_getf(device, OHMD_ROTATION_QUAT, quat) == OHMD_S_OK);
+	}
+
+	TAssert(ohmd_atomic_load(&opened) == (uint32_t)num_devices);
+
+	for(int i = 0; i < num_devices; i++)
+		ohmd_open_request_destroy(requests[i]);
+
+	// the probe waits for the opens, requests left over go with the context
+	ohmd_device_settings* settings = ohmd_device_settings_create(ctx);
+	ohmd_open_request* request = ohmd_list_open_device_async(ctx, num_devices - 1, settings, NULL, NULL);
+	ohmd_device_settings_destroy(settings);
+	TAssert(request);
+	TAssert(ohmd_ctx_probe(ctx) == num_devices);
+	TAssert(ohmd_open_request_is_done(request));
+
+	ohmd_list_open_device_async(ctx, num_devices - 1, NULL, NULL, NULL);
+
+	ohmd_ctx_destroy(ctx);
+
+	// the device is opened with all of the settings
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+	mock_rift_dk2(mock, "mock-dk2", "ASYNC");
+
+	ctx = ohmd_ctx_create();
+	ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+	num_devices = ohmd_ctx_probe(ctx);
+	for(int i = 0; i < num_devices; i++){
+		if(strcmp(ohmd_list_gets(ctx, i, OHMD_PRODUCT), "Rift (DK2)") != 0)
+			continue;
+
+		settings = ohmd_device_settings_create(ctx);
+		int engine = OHMD_FUSION_ENGINE_ESKF;
+		ohmd_device_settings_seti(settings, OHMD_IDS_FUSION_ENGINE, &engine);
+		int use_mag = 1;
+		ohmd_device_settings_seti(settings, OHMD_IDS_MAGNETOMETER, &use_mag);
+		request = ohmd_list_open_device_async(ctx, i, settings, NULL, NULL);
+		ohmd_device_settings_destroy(settings);
+
+		ohmd_device* device = ohmd_open_request_wait(request);
+		TAssert(device && device->sensor_fusion);
+		TAssert(device->sensor_fusion->engine == &ofusion_engine_eskf);
+		TAssert(device->sensor_fusion->flags & FF_USE_MAG);
+		TAssert(!device->settings.automatic_update);
+
+		ohmd_open_request_destroy(request);
+		ohmd_close_device(device);
+	}
+
+	ohmd_ctx_destroy(ctx);
+	ohmd_hid_mock_destroy(mock);
+}
+
+#define CONCURRENT_CONTEXTS 8
+#define CONCURRENT_ROUNDS 10
+
+typedef struct {
+	int index;
+	volatile bool ok;
+} context_worker_args;
+
+// a context of its own, with devices of its own, opened and closed over and over
+static unsigned int context_worker(void* arg)
+{
+	context_worker_args* args = (context_worker_args*)arg;
+	ohmd_hid_mock* mock = ohmd_hid_mock_create();
+
+	char serial[32];
+	snprintf(serial, sizeof(serial), "CTX%d", args->index);
+	mock_rift_dk2(mock, "mock-dk2", serial);
+	ohmd_hid_mock_add_device(mock, "mock-nolo", 0x0483, 0x5750, 0, "LYRobotix", "NOLO", serial);
+
+	bool ok = true;
+
+	for(int round = 0; round < CONCURRENT_ROUNDS && ok; round++){
+		ohmd_context* ctx = ohmd_ctx_create();
+		ohmd_ctx_set_hid_transport(ctx, ohmd_hid_mock_get_transport(mock));
+
+		int cache = OHMD_DEVICE_CACHE_OFF;
+		ohmd_ctx_seti(ctx, OHMD_ICS_DEVICE_CACHE, &cache);
+
+		ohmd_device_settings* settings = ohmd_device_settings_create(ctx);
+		int auto_update = round & 1;
+		ohmd_device_settings_seti(settings, OHMD_IDS_AUTOMATIC_UPDATE, &auto_update);
+
+		ohmd_device* devices[16];
+		int num_devices = OHMD_MIN(ohmd_ctx_probe(ctx), 16);
+		for(int i = 0; i < num_devices; i++){
+			devices[i] = ohmd_list_open_device_s(ctx, i, settings);
+			ok = ok && devices[i];
+		}
+
+		ohmd_device_settings_destroy(settings);
+
+		for(int i = 0; i < 10; i++)
+			ohmd_ctx_update(ctx);
+
+		ohmd_device_pose poses[16];
+		ok = ok && ohmd_ctx_get_poses(ctx, poses, 16) == num_devices;
+
+		// the NOLO's HMD and controllers share their device, close them in any order
+		for(int i = 0; i < num_devices; i++){
+			ohmd_device* device = devices[(i + round) % num_devices];
+			if(device)
+				ohmd_close_device(device);
+		}
+
+		ohmd_ctx_destroy(ctx);
+	}
+
+	ohmd_hid_mock_destroy(mock);
+
+	args->ok = ok;
+	return 0;
+}
+
+void test_highlevel_concurrent_contexts()
+{
+	// one that stays around while the others come and go
+	ohmd_context* ctx = ohmd_ctx_create();
+	int num_devices = ohmd_ctx_probe(ctx);
+	TAssert(num_devices > 0);
+
+	context_worker_args args[CONCURRENT_CONTEXTS];
+	ohmd_thread* threads[CONCURRENT_CONTEXTS];
+
+	for(int i = 0; i < CONCURRENT_CONTEXTS; i++){
+		args[i].index = i;
+		args[i].ok = false;
+		threads[i] = ohmd_create_thread(ctx, context_worker, &args[i]);
+		TAssert(threads[i]);
+	}
+
+	for(int i = 0; i < CONCURRENT_CONTEXTS; i++){
+		ohmd_destroy_thread(threads[i]);
+		TAssert(args[i].ok);
+	}
+
+	// still working after all of them are gone
+	TAssert(ohmd_ctx_probe(ctx) == num_devices);
+	ohmd_device* hmd = ohmd_list_open_device(ctx, num_devices - 1);
+	TAssert(hmd);
+	ohmd_close_device(hmd);
+
+	ohmd_ctx_destroy(ctx);
+}
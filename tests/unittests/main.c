@@ -32,11 +32,67 @@ int main()
 	Test(test_oquatf_get_dot);
 	Test(test_oquatf_inverse);
 	Test(test_oquatf_diff);
+	Test(test_oquatf_slerp);
+	printf("\n");
+
+	printf("fusion tests\n");
+	Test(test_ofusion_predict);
+	Test(test_ofusion_get_prediction_rate);
+	Test(test_ofusion_get_orient_at);
+	Test(test_ofusion_history_jitter);
+	Test(test_ofusion_eskf);
+	Test(test_ofusion_mahony);
+	Test(test_ofusion_engines);
+	Test(test_ofusion_batch);
+	Test(test_ofusion_mag);
+	printf("\n");
+
+	printf("device group fusion tests\n");
+	Test(test_ofusion_group_update);
+	printf("\n");
+
+	printf("sample queue tests\n");
+	Test(test_osq_push_pop);
+	Test(test_osq_overflow);
+	Test(test_osq_threads);
+	printf("\n");
+
+	printf("clock tests\n");
+	Test(test_clock_virtual);
+	Test(test_clock_mock_reports);
+	printf("\n");
+
+	printf("HID transport tests\n");
+	Test(test_hid_mock_enumerate);
+	Test(test_hid_mock_feature_reports);
+	Test(test_hid_mock_reports);
+	Test(test_hid_probe);
+	Test(test_hid_hotplug);
+	Test(test_hid_reconnect);
+	printf("\n");
+
+	printf("HID capture tests\n");
+	Test(test_capture_file);
+	Test(test_capture_replay);
+	printf("\n");
+
+	printf("device cache tests\n");
+	Test(test_cache_store_load);
+	Test(test_cache_rift);
 	printf("\n");
 
 	printf("high level tests\n");
 	Test(test_highlevel_open_close_device);
 	Test(test_highlevel_open_close_many_devices);
+	Test(test_highlevel_device_farm);
+	Test(test_highlevel_open_device_async);
+	Test(test_highlevel_pose_consistency);
+	Test(test_highlevel_external_sensor_fusion);
+	Test(test_highlevel_get_poses);
+	Test(test_highlevel_eye_matrix_cache);
+	Test(test_highlevel_update_workers);
+	Test(test_highlevel_thread_settings);
+	Test(test_highlevel_concurrent_contexts);
 	printf("\n");
 
 	printf("all a-ok\n");
@@ -152,3 +152,29 @@ void test_oquatf_diff()
 		TAssert(quatf_eq(q, list[i].q3, t));
 	}
 }
+
+void test_oquatf_slerp()
+{
+	vec3f axis = {{0, 0, 1}};
+	quatf p, q, neg_q, expected, out;
+
+	oquatf_init_axis(&p, &axis, 0.2f);
+	oquatf_init_axis(&q, &axis, 1.0f);
+	oquatf_init_axis(&expected, &axis, 0.6f);
+
+	oquatf_slerp(0.5f, &p, &q, true, &out);
+	TAssert(quatf_eq(out, expected, t));
+
+	// -q is the same rotation, the shortest path must end up in the same place
+	for(int i = 0; i < 4; i++)
+		neg_q.arr[i] = -q.arr[i];
+
+	oquatf_slerp(0.5f, &p, &neg_q, true, &out);
+	TAssert(quatf_eq(out, expected, t));
+
+	oquatf_slerp(0.0f, &p, &q, true, &out);
+	TAssert(quatf_eq(out, p, t));
+
+	oquatf_slerp(1.0f, &p, &q, true, &out);
+	TAssert(quatf_eq(out, q, t));
+}
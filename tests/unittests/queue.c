@@ -0,0 +1,132 @@
+/*
+ * OpenHMD - Free and Open Source API and drivers for immersive technology.
+ * Copyright (C) 2013 Fredrik Hultin.
+ * Copyright (C) 2013 Jakob Bornecrantz.
+ * Distributed under the Boost 1.0 licence, see LICENSE for full text.
+ */
+
+/* Unit Tests - Sample Queue Tests */
+
+#include "tests.h"
+
+static const float t = 0.001;
+
+static imu_sample make_sample(int i)
+{
+	imu_sample sample = { (double)i, 0.001f, {{(float)i, 0, 0}}, {{0, 9.81f, 0}}, {{0, 0, 0}} };
+	return sample;
+}
+
+void test_osq_push_pop()
+{
+	sample_queue* queue = calloc(1, sizeof(sample_queue));
+	imu_sample sample;
+
+	osq_init(queue);
+	TAssert(!osq_pop(queue, &sample));
+
+	// wrap around a few times, checking order
+	for(int round = 0; round < 3; round++){
+		for(int i = 0; i < SAMPLE_QUEUE_SIZE; i++){
+			imu_sample in = make_sample(i);
+			TAssert(osq_push(queue, &in));
+		}
+
+		TAssert(osq_get_size(queue) == SAMPLE_QUEUE_SIZE);
+
+		for(int i = 0; i < SAMPLE_QUEUE_SIZE; i++){
+			TAssert(osq_pop(queue, &sample));
+			TAssert(sample.time == (double)i);
+			TAssert(float_eq(sample.ang_vel.x, (float)i, t));
+		}
+
+		TAssert(!osq_pop(queue, &sample));
+		TAssert(osq_get_size(queue) == 0);
+	}
+
+	TAssert(osq_get_dropped(queue) == 0);
+
+	free(queue);
+}
+
+void test_osq_overflow()
+{
+	sample_queue* queue = calloc(1, sizeof(sample_queue));
+	imu_sample sample, in;
+
+	osq_init(queue);
+
+	int pushed = 0;
+	for(int i = 0; i < SAMPLE_QUEUE_SIZE + 10; i++){
+		in = make_sample(i);
+		if(osq_push(queue, &in))
+			pushed++;
+	}
+
+	int dropped = SAMPLE_QUEUE_SIZE + 10 - pushed;
+	TAssert(dropped > 0);
+	TAssert(osq_get_dropped(queue) == (uint32_t)dropped);
+
+	// the oldest samples are kept
+	TAssert(osq_pop(queue, &sample));
+	TAssert(sample.time == 0.0);
+
+	// the next sample that fits carries the dt of the dropped ones
+	in = make_sample(SAMPLE_QUEUE_SIZE + 10);
+	TAssert(osq_push(queue, &in));
+
+	for(int i = 1; i < pushed; i++)
+		TAssert(osq_pop(queue, &sample));
+
+	TAssert(osq_pop(queue, &sample));
+	TAssert(sample.time == (double)(SAMPLE_QUEUE_SIZE + 10));
+	TAssert(float_eq(sample.dt, 0.001f * (dropped + 1), t));
+	TAssert(!osq_pop(queue, &sample));
+
+	free(queue);
+}
+
+#define SPSC_SAMPLES 200000
+
+static unsigned int spsc_producer(void* arg)
+{
+	sample_queue* queue = (sample_queue*)arg;
+
+	for(int i = 0; i < SPSC_SAMPLES; ){
+		imu_sample in = make_sample(i);
+
+		// only push when there is room, so nothing is dropped
+		if(osq_get_size(queue) < SAMPLE_QUEUE_SIZE && osq_push(queue, &in))
+			i++;
+	}
+
+	return 0;
+}
+
+void test_osq_threads()
+{
+	ohmd_context* ctx = ohmd_ctx_create();
+	TAssert(ctx);
+
+	sample_queue* queue = calloc(1, sizeof(sample_queue));
+	osq_init(queue);
+
+	ohmd_thread* thread = ohmd_create_thread(ctx, spsc_producer, queue);
+
+	imu_sample sample;
+	for(int i = 0; i < SPSC_SAMPLES; ){
+		if(osq_pop(queue, &sample)){
+			TAssert(sample.time == (double)i);
+			TAssert(float_eq(sample.ang_vel.x, (float)i, 1.0f));
+			i++;
+		}
+	}
+
+	ohmd_destroy_thread(thread);
+
+	TAssert(!osq_pop(queue, &sample));
+	TAssert(osq_get_dropped(queue) == 0);
+
+	free(queue);
+	ohmd_ctx_destroy(ctx);
+}
@@ -15,11 +15,18 @@
 #include <math.h>
 
 #include "openhmdi.h"
+#include "hid_mock.h"
 
 #define TAssert(_v) if(!(_v)){ printf("\ntest failed: %s @ %s:%d\n", __func__, __FILE__, __LINE__); exit(1); }
 
 bool float_eq(float a, float b, float t);
 bool vec3f_eq(vec3f v1, vec3f v2, float t);
+bool quatf_eq(quatf q1, quatf q2, float t);
+
+// Adds a mock Rift DK2 that answers the feature reports the driver reads when
+// opening it and streams reports of one sample each, turning around y. NULL if
+// the mock has no room for it.
+ohmd_hid_mock_device* mock_rift_dk2(ohmd_hid_mock* mock, const char* path, const char* serial);
 
 // vec3f tests
 void test_ovec3f_normalize_me();
@@ -37,11 +44,60 @@ void test_oquatf_get_length();
 void test_oquatf_get_dot();
 void test_oquatf_inverse();
 void test_oquatf_diff();
+void test_oquatf_slerp();
 
 void test_oquatf_get_mat4x4();
 
+// fusion tests
+void test_ofusion_predict();
+void test_ofusion_get_prediction_rate();
+void test_ofusion_get_orient_at();
+void test_ofusion_history_jitter();
+void test_ofusion_eskf();
+void test_ofusion_mahony();
+void test_ofusion_engines();
+void test_ofusion_batch();
+void test_ofusion_mag();
+
+// device group fusion tests
+void test_ofusion_group_update();
+
+// sample queue tests
+void test_osq_push_pop();
+void test_osq_overflow();
+void test_osq_threads();
+
+// clock tests
+void test_clock_virtual();
+void test_clock_mock_reports();
+
+// HID transport tests
+void test_hid_mock_enumerate();
+void test_hid_mock_feature_reports();
+void test_hid_mock_reports();
+void test_hid_probe();
+void test_hid_hotplug();
+void test_hid_reconnect();
+
+// HID capture tests
+void test_capture_file();
+void test_capture_replay();
+
+// device cache tests
+void test_cache_store_load();
+void test_cache_rift();
+
 // high-level tests
 void test_highlevel_open_close_device();
 void test_highlevel_open_close_many_devices();
+void test_highlevel_device_farm();
+void test_highlevel_open_device_async();
+void test_highlevel_pose_consistency();
+void test_highlevel_external_sensor_fusion();
+void test_highlevel_get_poses();
+void test_highlevel_eye_matrix_cache();
+void test_highlevel_update_workers();
+void test_highlevel_thread_settings();
+void test_highlevel_concurrent_contexts();
 
 #endif